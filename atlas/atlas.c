@@ -0,0 +1,435 @@
+/* Skyline atlas and texture array packing of baked mip chains. */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+
+#include "atlas.h"
+#include "gl_caps.h"
+
+typedef struct {
+  int x;
+  int y;
+  int width;
+} SkylineNode;
+
+static int bytes_per_pixel(GLenum format) {
+  return format == GL_RGBA ? 4 : 3;
+}
+
+static int level_dimension(int size, int level) {
+  size >>= level;
+  return size > 0 ? size : 1;
+}
+
+/* ---- Skyline packing ---- */
+
+/* The y a width x height rect would sit at on node i, or -1 */
+static int skyline_fit(const SkylineNode *nodes, int num_nodes, int i,
+		       int width, int height, int atlas_width, int atlas_height) {
+  if (nodes[i].x + width > atlas_width) {
+    return -1;
+  }
+  int y = 0;
+  for (int remaining = width; remaining > 0; i++) {
+    if (i == num_nodes) {
+      return -1;
+    }
+    if (nodes[i].y > y) {
+      y = nodes[i].y;
+    }
+    if (y + height > atlas_height) {
+      return -1;
+    }
+    remaining -= nodes[i].width;
+  }
+  return y;
+}
+
+/* Bottom-left: the lowest spot, then the narrowest node, then leftmost */
+static bool skyline_insert(SkylineNode *nodes, int *num_nodes, int width, int height,
+			   int atlas_width, int atlas_height, int *out_x, int *out_y) {
+  int best = -1;
+  int best_y = 0;
+  for (int i = 0; i < *num_nodes; i++) {
+    int y = skyline_fit(nodes, *num_nodes, i, width, height, atlas_width, atlas_height);
+    if (y >= 0 && (best < 0 || y < best_y
+		   || (y == best_y && nodes[i].width < nodes[best].width))) {
+      best = i;
+      best_y = y;
+    }
+  }
+  if (best < 0) {
+    return false;
+  }
+
+  SkylineNode node = { nodes[best].x, best_y + height, width };
+  memmove(&nodes[best + 1], &nodes[best], (*num_nodes - best) * sizeof(SkylineNode));
+  nodes[best] = node;
+  *num_nodes += 1;
+
+  /* Cut back whatever the new node now covers */
+  for (int i = best + 1; i < *num_nodes; ) {
+    int overlap = node.x + node.width - nodes[i].x;
+    if (overlap <= 0) {
+      break;
+    }
+    nodes[i].x += overlap;
+    nodes[i].width -= overlap;
+    if (nodes[i].width > 0) {
+      break;
+    }
+    memmove(&nodes[i], &nodes[i + 1], (*num_nodes - i - 1) * sizeof(SkylineNode));
+    *num_nodes -= 1;
+  }
+  for (int i = 0; i + 1 < *num_nodes; ) {
+    if (nodes[i].y == nodes[i + 1].y) {
+      nodes[i].width += nodes[i + 1].width;
+      memmove(&nodes[i + 1], &nodes[i + 2], (*num_nodes - i - 2) * sizeof(SkylineNode));
+      *num_nodes -= 1;
+    } else {
+      i++;
+    }
+  }
+
+  *out_x = node.x;
+  *out_y = best_y;
+  return true;
+}
+
+/* Sizes are with the gutter; order is tallest first */
+static bool skyline_pack(const int *widths, const int *heights, const int *order,
+			 int count, int atlas_width, int atlas_height, AtlasRect *out) {
+  SkylineNode nodes[2 * ATLAS_MAX_IMAGES + 1];
+  int num_nodes = 1;
+  nodes[0].x = 0;
+  nodes[0].y = 0;
+  nodes[0].width = atlas_width;
+  for (int i = 0; i < count; i++) {
+    int image = order[i];
+    if (!skyline_insert(nodes, &num_nodes, widths[image], heights[image],
+			atlas_width, atlas_height, &out[image].x, &out[image].y)) {
+      return false;
+    }
+    out[image].width = widths[image];
+    out[image].height = heights[image];
+  }
+  return true;
+}
+
+/* ---- Levels ---- */
+
+static void allocate_levels(Atlas *atlas) {
+  int bpp = bytes_per_pixel(atlas->format);
+  for (int level = 0; level < atlas->num_levels; level++) {
+    AtlasLevel *data = &atlas->levels[level];
+    data->width = level_dimension(atlas->width, level);
+    data->height = level_dimension(atlas->height, level);
+    data->layer_size = (((size_t) data->width * bpp + 3) & ~(size_t) 3) * data->height;
+    data->data = calloc(atlas->num_layers, data->layer_size);
+  }
+}
+
+/* Fill region (in level texels) of one layer from an image level whose
+   top left corner is at (x, y), repeating the image's edge texels
+   outside it. */
+static void fill_region(const Atlas *atlas, int level, int layer, AtlasRect region,
+			int x, int y, const KtxTexture *image, int image_level) {
+  const AtlasLevel *dst = &atlas->levels[level];
+  const KtxLevel *src = &image->levels[image_level];
+  int dst_bpp = bytes_per_pixel(atlas->format);
+  int src_bpp = bytes_per_pixel(image->internal_format);
+  size_t dst_row = dst->layer_size / dst->height;
+  size_t src_row = src->size / src->height;
+
+  for (int row = region.y; row < region.y + region.height; row++) {
+    int sy = row - y;
+    sy = sy < 0 ? 0 : (sy >= src->height ? src->height - 1 : sy);
+    const unsigned char *in = src->data + sy * src_row;
+    unsigned char *out = dst->data + layer * dst->layer_size + row * dst_row;
+    for (int column = region.x; column < region.x + region.width; column++) {
+      int sx = column - x;
+      sx = sx < 0 ? 0 : (sx >= src->width ? src->width - 1 : sx);
+      unsigned char *texel = out + column * dst_bpp;
+      memcpy(texel, in + sx * src_bpp, 3);
+      if (dst_bpp == 4) {
+	texel[3] = src_bpp == 4 ? in[sx * src_bpp + 3] : 255;
+      }
+    }
+  }
+}
+
+/* Past the clean levels the atlas is just averaged down, as those are
+   only a texel or two per image anyway */
+static void box_level(Atlas *atlas, int level) {
+  const AtlasLevel *src = &atlas->levels[level - 1];
+  AtlasLevel *dst = &atlas->levels[level];
+  int bpp = bytes_per_pixel(atlas->format);
+  size_t src_row = src->layer_size / src->height;
+  size_t dst_row = dst->layer_size / dst->height;
+
+  for (int y = 0; y < dst->height; y++) {
+    int y0 = 2 * y < src->height ? 2 * y : src->height - 1;
+    int y1 = 2 * y + 1 < src->height ? 2 * y + 1 : src->height - 1;
+    for (int x = 0; x < dst->width; x++) {
+      int x0 = 2 * x < src->width ? 2 * x : src->width - 1;
+      int x1 = 2 * x + 1 < src->width ? 2 * x + 1 : src->width - 1;
+      for (int c = 0; c < bpp; c++) {
+	int sum = src->data[y0 * src_row + x0 * bpp + c] + src->data[y0 * src_row + x1 * bpp + c]
+	  + src->data[y1 * src_row + x0 * bpp + c] + src->data[y1 * src_row + x1 * bpp + c];
+	dst->data[y * dst_row + x * bpp + c] = (unsigned char) ((sum + 2) / 4);
+      }
+    }
+  }
+}
+
+static int full_chain(int width, int height) {
+  int levels = 1;
+  while (level_dimension(width, levels - 1) > 1 || level_dimension(height, levels - 1) > 1) {
+    levels += 1;
+  }
+  return levels < KTX_MAX_LEVELS ? levels : KTX_MAX_LEVELS;
+}
+
+static bool build_2d(Atlas *atlas, const KtxTexture *images, int num_images, int max_size) {
+
+  /* Every clean level has to halve every image exactly */
+  int clean = ATLAS_CLEAN_LEVELS;
+  for (int i = 0; i < num_images; i++) {
+    while (clean > 1 && (images[i].width % (1 << (clean - 1)) != 0
+			 || images[i].height % (1 << (clean - 1)) != 0
+			 || images[i].num_levels < clean)) {
+      clean -= 1;
+    }
+  }
+  int gutter = 1 << (clean - 1);
+
+  int widths[ATLAS_MAX_IMAGES];
+  int heights[ATLAS_MAX_IMAGES];
+  int order[ATLAS_MAX_IMAGES];
+  size_t area = 0;
+  for (int i = 0; i < num_images; i++) {
+    widths[i] = images[i].width + 2 * gutter;
+    heights[i] = images[i].height + 2 * gutter;
+    area += (size_t) widths[i] * heights[i];
+
+    /* Insertion sort, tallest then widest first */
+    int j = i;
+    for (; j > 0; j--) {
+      int other = order[j - 1];
+      if (heights[other] > heights[i]
+	  || (heights[other] == heights[i] && widths[other] >= widths[i])) {
+	break;
+      }
+      order[j] = other;
+    }
+    order[j] = i;
+  }
+
+  /* The smallest power of two that could hold them, growing until the
+     packer agrees */
+  int width = 1;
+  int height = 1;
+  while ((size_t) width * height < area) {
+    if (width <= height) {
+      width *= 2;
+    } else {
+      height *= 2;
+    }
+  }
+  if (width > max_size || height > max_size) {
+    printf("ERROR: %d images do not fit in a %d by %d atlas\n",
+	   num_images, max_size, max_size);
+    return false;
+  }
+  AtlasRect placed[ATLAS_MAX_IMAGES];
+  while (!skyline_pack(widths, heights, order, num_images, width, height, placed)) {
+    if (width <= height) {
+      width *= 2;
+    } else {
+      height *= 2;
+    }
+    if (width > max_size || height > max_size) {
+      printf("ERROR: %d images do not fit in a %d by %d atlas\n",
+	     num_images, max_size, max_size);
+      return false;
+    }
+  }
+
+  atlas->width = width;
+  atlas->height = height;
+  atlas->num_layers = 1;
+  atlas->num_levels = full_chain(width, height);
+  atlas->clean_levels = clean < atlas->num_levels ? clean : atlas->num_levels;
+  allocate_levels(atlas);
+
+  for (int i = 0; i < num_images; i++) {
+    AtlasRect *rect = &atlas->rects[i];
+    rect->x = placed[i].x + gutter;
+    rect->y = placed[i].y + gutter;
+    rect->width = images[i].width;
+    rect->height = images[i].height;
+
+    AtlasUV *uv = &atlas->uvs[i];
+    uv->scale[0] = (float) rect->width / width;
+    uv->scale[1] = (float) rect->height / height;
+    uv->offset[0] = (float) rect->x / width;
+    uv->offset[1] = (float) rect->y / height;
+    uv->layer = 0;
+
+    for (int level = 0; level < atlas->clean_levels; level++) {
+      AtlasRect region = {
+	placed[i].x >> level, placed[i].y >> level,
+	placed[i].width >> level, placed[i].height >> level
+      };
+      fill_region(atlas, level, 0, region, rect->x >> level, rect->y >> level,
+		  &images[i], level);
+    }
+  }
+  for (int level = atlas->clean_levels; level < atlas->num_levels; level++) {
+    box_level(atlas, level);
+  }
+  return true;
+}
+
+static bool build_array(Atlas *atlas, const KtxTexture *images, int num_images) {
+  int width = 0;
+  int height = 0;
+  for (int i = 0; i < num_images; i++) {
+    width = images[i].width > width ? images[i].width : width;
+    height = images[i].height > height ? images[i].height : height;
+  }
+
+  atlas->width = width;
+  atlas->height = height;
+  atlas->num_layers = num_images;
+  atlas->num_levels = full_chain(width, height);
+  atlas->clean_levels = atlas->num_levels;
+  allocate_levels(atlas);
+
+  for (int i = 0; i < num_images; i++) {
+    AtlasRect *rect = &atlas->rects[i];
+    rect->x = 0;
+    rect->y = 0;
+    rect->width = images[i].width;
+    rect->height = images[i].height;
+
+    AtlasUV *uv = &atlas->uvs[i];
+    uv->scale[0] = (float) rect->width / width;
+    uv->scale[1] = (float) rect->height / height;
+    uv->offset[0] = 0.0f;
+    uv->offset[1] = 0.0f;
+    uv->layer = i;
+
+    /* A smaller image runs out of levels first; its 1x1 then covers
+       the rest of the layer's chain */
+    for (int level = 0; level < atlas->num_levels; level++) {
+      AtlasRect region = { 0, 0, atlas->levels[level].width, atlas->levels[level].height };
+      int image_level = level < images[i].num_levels ? level : images[i].num_levels - 1;
+      fill_region(atlas, level, i, region, 0, 0, &images[i], image_level);
+    }
+  }
+  return true;
+}
+
+bool atlas_build(Atlas *atlas, AtlasKind kind, const KtxTexture *images,
+		 int num_images, int max_size) {
+  Uint64 start = SDL_GetPerformanceCounter();
+  memset(atlas, 0, sizeof(*atlas));
+  atlas->kind = kind;
+
+  if (num_images < 1 || num_images > ATLAS_MAX_IMAGES) {
+    printf("ERROR: an atlas takes 1 to %d images, not %d\n", ATLAS_MAX_IMAGES, num_images);
+    return false;
+  }
+  atlas->format = GL_RGB;
+  for (int i = 0; i < num_images; i++) {
+    if (images[i].type != GL_UNSIGNED_BYTE || images[i].num_levels < 1) {
+      printf("ERROR: atlas image %d is not a baked RGB8 or RGBA8 texture\n", i);
+      return false;
+    }
+    if (images[i].internal_format == GL_RGBA) {
+      atlas->format = GL_RGBA;
+    }
+  }
+
+  bool ok = kind == ATLAS_ARRAY ? build_array(atlas, images, num_images)
+    : build_2d(atlas, images, num_images, max_size);
+  if (!ok) {
+    atlas_destroy(atlas);
+    return false;
+  }
+
+  atlas->num_images = num_images;
+  for (int i = 0; i < num_images; i++) {
+    atlas->image_texels += (size_t) images[i].width * images[i].height;
+  }
+  atlas->total_texels = (size_t) atlas->width * atlas->height * atlas->num_layers;
+  atlas->build_ms = (double) (SDL_GetPerformanceCounter() - start) * 1000.0
+    / (double) SDL_GetPerformanceFrequency();
+  return true;
+}
+
+void atlas_destroy(Atlas *atlas) {
+  for (int level = 0; level < atlas->num_levels; level++) {
+    free(atlas->levels[level].data);
+  }
+  memset(atlas, 0, sizeof(*atlas));
+}
+
+GLuint atlas_upload(const Atlas *atlas) {
+  GLenum target = atlas->kind == ATLAS_ARRAY ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+  if (atlas->kind == ATLAS_ARRAY && gl_caps.TexImage3D == NULL) {
+    printf("ERROR: texture arrays need an ES3 context\n");
+    return 0;
+  }
+
+  GLuint id;
+  glGenTextures(1, &id);
+  glBindTexture(target, id);
+  for (int level = 0; level < atlas->num_levels; level++) {
+    const AtlasLevel *data = &atlas->levels[level];
+    if (atlas->kind == ATLAS_ARRAY) {
+      gl_caps.TexImage3D(target, level, atlas->format, data->width, data->height,
+			 atlas->num_layers, 0, atlas->format, GL_UNSIGNED_BYTE, data->data);
+    } else {
+      glTexImage2D(target, level, atlas->format, data->width, data->height, 0,
+		   atlas->format, GL_UNSIGNED_BYTE, data->data);
+    }
+  }
+  glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  if (gl_caps.es3) {
+    glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, atlas->clean_levels - 1);
+  }
+  return id;
+}
+
+void atlas_transform_uv(const Atlas *atlas, int image, const float uv[2], float out[2]) {
+  const AtlasUV *transform = &atlas->uvs[image];
+  out[0] = uv[0] * transform->scale[0] + transform->offset[0];
+  out[1] = uv[1] * transform->scale[1] + transform->offset[1];
+}
+
+void atlas_report(const Atlas *atlas, int draws_before, int draws_after) {
+  size_t bytes = 0;
+  for (int level = 0; level < atlas->num_levels; level++) {
+    bytes += atlas->levels[level].layer_size * atlas->num_layers;
+  }
+  if (atlas->kind == ATLAS_ARRAY) {
+    printf("Texture array: %d layers of %d by %d, ", atlas->num_layers,
+	   atlas->width, atlas->height);
+  } else {
+    printf("Texture atlas: %d images in %d by %d, ", atlas->num_images,
+	   atlas->width, atlas->height);
+  }
+  printf("%.0f%% occupied, %d of %d levels clean, %.1f KB, built in %.2f ms\n",
+	 100.0 * atlas->image_texels / atlas->total_texels, atlas->clean_levels,
+	 atlas->num_levels, bytes / 1024.0, atlas->build_ms);
+  printf("\t%d draw calls and texture binds a frame instead of %d, %d saved\n",
+	 draws_after, draws_before, draws_before - draws_after);
+}
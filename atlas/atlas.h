@@ -0,0 +1,104 @@
+#ifndef ATLAS_H_
+#define ATLAS_H_
+
+/* Packing several textures into one, so objects that differ only by
+   their image can share a bind and a draw call.
+
+   Two layouts:
+
+   atlas  one big GL_TEXTURE_2D. Images are placed with a skyline
+          bottom-left packer, tallest first, in the smallest power of
+          two square (or 2:1) that holds them. Each image sits in a
+          gutter of its own edge texels, and positions are aligned so
+          that every mip level maps the image onto whole texels: with
+          clean_levels levels the gutter and alignment are
+          1 << (clean_levels - 1) texels, one texel wide at the last
+          clean level. Each clean level is copied from the image's own
+          baked chain rather than filtered from the atlas, so images
+          never bleed into each other. Below that the atlas is box
+          filtered down to 1x1 (ES2 wants the whole chain) and, on ES3,
+          GL_TEXTURE_MAX_LEVEL stops sampling before it.
+   array  a GL_TEXTURE_2D_ARRAY, ES3 only, one image per layer. Layers
+          are as big as the biggest image; smaller ones sit in the
+          corner with their edges repeated over the rest of the layer.
+
+   Either way an image's texture coordinates become
+   uv * scale + offset, in layer `layer`. atlas_transform_uv rewrites
+   them for geometry that is merged ahead of time, or the AtlasUV can
+   be passed per instance.
+
+   Images are uncompressed, baked KtxTextures (texture_prep), all RGB8
+   or RGBA8; the result is RGBA8 if any of them is.
+*/
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <GLES2/gl2.h>
+
+#include "ktx.h"
+
+#define ATLAS_MAX_IMAGES 64
+#define ATLAS_CLEAN_LEVELS 4
+
+typedef enum {
+  ATLAS_2D,
+  ATLAS_ARRAY
+} AtlasKind;
+
+typedef struct {
+  int x;
+  int y;
+  int width;
+  int height;
+} AtlasRect;
+
+typedef struct {
+  float scale[2];
+  float offset[2];
+  int layer;
+} AtlasUV;
+
+typedef struct {
+  int width;
+  int height;
+  size_t layer_size;     /* bytes per layer, rows padded to 4 */
+  unsigned char *data;   /* num_layers layers */
+} AtlasLevel;
+
+typedef struct {
+  AtlasKind kind;
+  GLenum format;         /* GL_RGB or GL_RGBA */
+  int width;             /* of the atlas, or of one layer */
+  int height;
+  int num_layers;
+  int num_levels;
+  int clean_levels;      /* levels with no bleeding between images */
+  AtlasLevel levels[KTX_MAX_LEVELS];
+
+  int num_images;
+  AtlasRect rects[ATLAS_MAX_IMAGES];  /* level 0, without the gutter */
+  AtlasUV uvs[ATLAS_MAX_IMAGES];
+
+  size_t image_texels;   /* level 0 texels that are some image's */
+  size_t total_texels;   /* level 0 texels in all layers */
+  double build_ms;
+} Atlas;
+
+/* kind ATLAS_2D packs into at most max_size square; ATLAS_ARRAY
+   ignores it. False if the images do not fit or are not baked. */
+bool atlas_build(Atlas *atlas, AtlasKind kind, const KtxTexture *images,
+		 int num_images, int max_size);
+void atlas_destroy(Atlas *atlas);
+
+/* Needs a current context, and gl_caps for arrays. Leaves the texture
+   bound to GL_TEXTURE_2D or GL_TEXTURE_2D_ARRAY. */
+GLuint atlas_upload(const Atlas *atlas);
+
+/* One image's texture coordinate into the atlas. */
+void atlas_transform_uv(const Atlas *atlas, int image, const float uv[2], float out[2]);
+
+/* Occupancy, and the draw calls the caller saved by using it. */
+void atlas_report(const Atlas *atlas, int draws_before, int draws_after);
+
+#endif // ATLAS_H_
@@ -0,0 +1,241 @@
+/* Deferred GL command lists: recording on any thread, replay on the GL
+   thread. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "command_list.h"
+
+void command_list_init(CommandList *list) {
+  memset(list, 0, sizeof(*list));
+  list->capacity = COMMAND_LIST_INITIAL_SIZE;
+  list->data = (unsigned char *) malloc(list->capacity);
+}
+
+void command_list_reset(CommandList *list) {
+  list->size = 0;
+  list->num_commands = 0;
+  list->record_ticks = 0;
+}
+
+void command_list_destroy(CommandList *list) {
+  free(list->data);
+  list->data = NULL;
+  list->size = 0;
+  list->capacity = 0;
+}
+
+/* Bump allocate one command. Commands hold no pointers, so the arena
+   can simply be reallocated when it fills up. */
+static void *command_alloc(CommandList *list, CommandType type, size_t size) {
+
+  if (list->size + size > list->capacity) {
+    size_t capacity = list->capacity * 2;
+    while (list->size + size > capacity) {
+      capacity *= 2;
+    }
+    unsigned char *data = (unsigned char *) realloc(list->data, capacity);
+    if (data == NULL) {
+      printf("ERROR: could not grow command list to %zu bytes\n", capacity);
+      return NULL;
+    }
+    list->data = data;
+    list->capacity = capacity;
+  }
+
+  CommandHeader *header = (CommandHeader *) (list->data + list->size);
+  header->type = type;
+  header->size = size;
+  list->size += size;
+  list->num_commands += 1;
+  return header;
+}
+
+void cmd_use_program(CommandList *list, GLuint program) {
+  CmdUseProgram *cmd = command_alloc(list, CMD_USE_PROGRAM, sizeof(*cmd));
+  if (cmd != NULL) {
+    cmd->program = program;
+  }
+}
+
+void cmd_uniform_matrix4(CommandList *list, GLint location, const GLfloat *value) {
+  CmdUniformMatrix4 *cmd = command_alloc(list, CMD_UNIFORM_MATRIX4, sizeof(*cmd));
+  if (cmd != NULL) {
+    cmd->location = location;
+    memcpy(cmd->value, value, sizeof(cmd->value));
+  }
+}
+
+void cmd_uniform3f(CommandList *list, GLint location, const GLfloat *value) {
+  CmdUniform3f *cmd = command_alloc(list, CMD_UNIFORM3F, sizeof(*cmd));
+  if (cmd != NULL) {
+    cmd->location = location;
+    memcpy(cmd->value, value, sizeof(cmd->value));
+  }
+}
+
+void cmd_uniform1f(CommandList *list, GLint location, GLfloat value) {
+  CmdUniform1f *cmd = command_alloc(list, CMD_UNIFORM1F, sizeof(*cmd));
+  if (cmd != NULL) {
+    cmd->location = location;
+    cmd->value = value;
+  }
+}
+
+void cmd_bind_buffer(CommandList *list, GLenum target, GLuint buffer) {
+  CmdBindBuffer *cmd = command_alloc(list, CMD_BIND_BUFFER, sizeof(*cmd));
+  if (cmd != NULL) {
+    cmd->target = target;
+    cmd->buffer = buffer;
+  }
+}
+
+void cmd_enable_attrib(CommandList *list, GLuint index) {
+  CmdAttrib *cmd = command_alloc(list, CMD_ENABLE_ATTRIB, sizeof(*cmd));
+  if (cmd != NULL) {
+    cmd->index = index;
+  }
+}
+
+void cmd_disable_attrib(CommandList *list, GLuint index) {
+  CmdAttrib *cmd = command_alloc(list, CMD_DISABLE_ATTRIB, sizeof(*cmd));
+  if (cmd != NULL) {
+    cmd->index = index;
+  }
+}
+
+void cmd_vertex_attrib(CommandList *list, GLuint index, GLint size,
+		       GLsizei stride, size_t offset) {
+  CmdVertexAttrib *cmd = command_alloc(list, CMD_VERTEX_ATTRIB, sizeof(*cmd));
+  if (cmd != NULL) {
+    cmd->index = index;
+    cmd->size = size;
+    cmd->stride = stride;
+    cmd->offset = (uint32_t) offset;
+  }
+}
+
+void cmd_draw_arrays(CommandList *list, GLenum mode, GLint first, GLsizei count) {
+  CmdDrawArrays *cmd = command_alloc(list, CMD_DRAW_ARRAYS, sizeof(*cmd));
+  if (cmd != NULL) {
+    cmd->mode = mode;
+    cmd->first = first;
+    cmd->count = count;
+  }
+}
+
+void cmd_draw_elements(CommandList *list, GLenum mode, GLsizei count,
+		       GLenum type, size_t offset) {
+  CmdDrawElements *cmd = command_alloc(list, CMD_DRAW_ELEMENTS, sizeof(*cmd));
+  if (cmd != NULL) {
+    cmd->mode = mode;
+    cmd->count = count;
+    cmd->type = type;
+    cmd->offset = (uint32_t) offset;
+  }
+}
+
+void command_list_replay(const CommandList *lists, int num_lists,
+			 CommandStats *stats) {
+
+  Uint64 start = SDL_GetPerformanceCounter();
+
+  /* Lists are recorded independently, so each one binds everything it
+     needs. Drop the binds that repeat what the previous list left. */
+  GLuint current_program = 0;
+  GLuint current_array_buffer = 0;
+  long commands = 0;
+  long skipped = 0;
+
+  for (int l = 0; l < num_lists; l++) {
+    const unsigned char *at = lists[l].data;
+    const unsigned char *end = at + lists[l].size;
+
+    while (at < end) {
+      const CommandHeader *header = (const CommandHeader *) at;
+
+      switch (header->type) {
+      case CMD_USE_PROGRAM: {
+	const CmdUseProgram *cmd = (const CmdUseProgram *) at;
+	if (cmd->program != current_program) {
+	  glUseProgram(cmd->program);
+	  current_program = cmd->program;
+	} else {
+	  skipped += 1;
+	}
+	break;
+      }
+      case CMD_UNIFORM_MATRIX4: {
+	const CmdUniformMatrix4 *cmd = (const CmdUniformMatrix4 *) at;
+	glUniformMatrix4fv(cmd->location, 1, GL_FALSE, cmd->value);
+	break;
+      }
+      case CMD_UNIFORM3F: {
+	const CmdUniform3f *cmd = (const CmdUniform3f *) at;
+	glUniform3fv(cmd->location, 1, cmd->value);
+	break;
+      }
+      case CMD_UNIFORM1F: {
+	const CmdUniform1f *cmd = (const CmdUniform1f *) at;
+	glUniform1f(cmd->location, cmd->value);
+	break;
+      }
+      case CMD_BIND_BUFFER: {
+	const CmdBindBuffer *cmd = (const CmdBindBuffer *) at;
+	if (cmd->target != GL_ARRAY_BUFFER) {
+	  glBindBuffer(cmd->target, cmd->buffer);
+	} else if (cmd->buffer != current_array_buffer) {
+	  glBindBuffer(cmd->target, cmd->buffer);
+	  current_array_buffer = cmd->buffer;
+	} else {
+	  skipped += 1;
+	}
+	break;
+      }
+      case CMD_ENABLE_ATTRIB: {
+	const CmdAttrib *cmd = (const CmdAttrib *) at;
+	glEnableVertexAttribArray(cmd->index);
+	break;
+      }
+      case CMD_DISABLE_ATTRIB: {
+	const CmdAttrib *cmd = (const CmdAttrib *) at;
+	glDisableVertexAttribArray(cmd->index);
+	break;
+      }
+      case CMD_VERTEX_ATTRIB: {
+	const CmdVertexAttrib *cmd = (const CmdVertexAttrib *) at;
+	glVertexAttribPointer(cmd->index, cmd->size, GL_FLOAT, GL_FALSE,
+			      cmd->stride, (void *) (uintptr_t) cmd->offset);
+	break;
+      }
+      case CMD_DRAW_ARRAYS: {
+	const CmdDrawArrays *cmd = (const CmdDrawArrays *) at;
+	glDrawArrays(cmd->mode, cmd->first, cmd->count);
+	break;
+      }
+      case CMD_DRAW_ELEMENTS: {
+	const CmdDrawElements *cmd = (const CmdDrawElements *) at;
+	glDrawElements(cmd->mode, cmd->count, cmd->type,
+		       (void *) (uintptr_t) cmd->offset);
+	break;
+      }
+      default:
+	/* Its size cannot be trusted either, so drop the rest of this list */
+	printf("ERROR: unknown command %d in command list\n", header->type);
+	at = end;
+	continue;
+      }
+
+      at += header->size;
+      commands += 1;
+    }
+  }
+
+  if (stats != NULL) {
+    stats->frames += 1;
+    stats->commands += commands;
+    stats->skipped += skipped;
+    stats->replay_ms += (double) (SDL_GetPerformanceCounter() - start) * 1000.0
+      / (double) SDL_GetPerformanceFrequency();
+  }
+}
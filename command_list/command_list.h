@@ -0,0 +1,141 @@
+#ifndef COMMAND_LIST_H_
+#define COMMAND_LIST_H_
+
+/* Deferred GL command lists.
+
+   A GL context can only be used from the thread it is current on, but
+   working out what to draw does not need GL at all. Worker threads
+   record draws into CommandLists - flat byte arenas of small POD
+   commands, no pointers - and the GL thread replays them in order in a
+   single loop. Lists are reset rather than freed each frame, so after
+   the first few frames recording does not allocate.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <GLES2/gl2.h>
+#include <SDL2/SDL.h>
+
+#define COMMAND_LIST_INITIAL_SIZE 4096
+
+typedef enum {
+  CMD_USE_PROGRAM,
+  CMD_UNIFORM_MATRIX4,
+  CMD_UNIFORM3F,
+  CMD_UNIFORM1F,
+  CMD_BIND_BUFFER,
+  CMD_ENABLE_ATTRIB,
+  CMD_DISABLE_ATTRIB,
+  CMD_VERTEX_ATTRIB,
+  CMD_DRAW_ARRAYS,
+  CMD_DRAW_ELEMENTS
+} CommandType;
+
+/* Every command starts with this; size includes the header and is a
+   multiple of four. */
+typedef struct {
+  uint16_t type;
+  uint16_t size;
+} CommandHeader;
+
+typedef struct {
+  CommandHeader header;
+  GLuint program;
+} CmdUseProgram;
+
+typedef struct {
+  CommandHeader header;
+  GLint location;
+  GLfloat value[16];
+} CmdUniformMatrix4;
+
+typedef struct {
+  CommandHeader header;
+  GLint location;
+  GLfloat value[3];
+} CmdUniform3f;
+
+typedef struct {
+  CommandHeader header;
+  GLint location;
+  GLfloat value;
+} CmdUniform1f;
+
+typedef struct {
+  CommandHeader header;
+  GLenum target;
+  GLuint buffer;
+} CmdBindBuffer;
+
+typedef struct {
+  CommandHeader header;
+  GLuint index;
+} CmdAttrib;
+
+typedef struct {
+  CommandHeader header;
+  GLuint index;
+  GLint size;
+  GLsizei stride;
+  uint32_t offset;
+} CmdVertexAttrib;
+
+typedef struct {
+  CommandHeader header;
+  GLenum mode;
+  GLint first;
+  GLsizei count;
+} CmdDrawArrays;
+
+typedef struct {
+  CommandHeader header;
+  GLenum mode;
+  GLsizei count;
+  GLenum type;
+  uint32_t offset;  /* bytes into the bound element array buffer */
+} CmdDrawElements;
+
+typedef struct {
+  unsigned char *data;
+  size_t size;
+  size_t capacity;
+  int num_commands;
+
+  /* Time spent recording into this list since the last reset, filled in
+     by whoever recorded it */
+  Uint64 record_ticks;
+} CommandList;
+
+typedef struct {
+  /* Accumulated by command_list_replay */
+  int frames;
+  long commands;
+  long skipped;  /* redundant program/buffer binds not sent to GL */
+  double replay_ms;
+} CommandStats;
+
+void command_list_init(CommandList *list);
+void command_list_reset(CommandList *list);
+void command_list_destroy(CommandList *list);
+
+/* Recording. None of these touch GL, so any thread may call them, as
+   long as each list is only recorded by one thread at a time. */
+void cmd_use_program(CommandList *list, GLuint program);
+void cmd_uniform_matrix4(CommandList *list, GLint location, const GLfloat *value);
+void cmd_uniform3f(CommandList *list, GLint location, const GLfloat *value);
+void cmd_uniform1f(CommandList *list, GLint location, GLfloat value);
+void cmd_bind_buffer(CommandList *list, GLenum target, GLuint buffer);
+void cmd_enable_attrib(CommandList *list, GLuint index);
+void cmd_disable_attrib(CommandList *list, GLuint index);
+void cmd_vertex_attrib(CommandList *list, GLuint index, GLint size,
+		       GLsizei stride, size_t offset);
+void cmd_draw_arrays(CommandList *list, GLenum mode, GLint first, GLsizei count);
+void cmd_draw_elements(CommandList *list, GLenum mode, GLsizei count,
+		       GLenum type, size_t offset);
+
+/* Replay num_lists lists, in order, on the GL thread. */
+void command_list_replay(const CommandList *lists, int num_lists,
+			 CommandStats *stats);
+
+#endif // COMMAND_LIST_H_
@@ -0,0 +1,315 @@
+/* Dynamic resolution scaling against a GPU frame time budget. */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+
+#include "dynamic_resolution.h"
+#include "shader_loader.h"
+
+/* How quickly the smoothed GPU time follows new samples */
+#define GPU_TIME_SMOOTHING 0.2f
+
+static const GLfloat fullscreen_triangle[] = {
+  -1.0f, -1.0f,
+   3.0f, -1.0f,
+  -1.0f,  3.0f,
+};
+
+void dynres_default_config(DynResConfig *config) {
+  config->target_ms = 14.0f;
+  config->min_scale = 0.5f;
+  config->max_scale = 1.0f;
+  config->step = 0.05f;
+  config->headroom = 0.75f;
+  config->settle_frames = 10;
+  config->report_frames = 5 * 60;
+  config->upscale_vertex_path = "shaders/upscale.vert";
+  config->upscale_fragment_path = "shaders/upscale.frag";
+}
+
+void dynres_parse_args(DynResConfig *config, int argc, char *argv[]) {
+
+  for (int i = 1; i < argc - 1; i++) {
+    if (strcmp(argv[i], "--dynres-target") == 0) {
+      config->target_ms = atof(argv[i + 1]);
+    } else if (strcmp(argv[i], "--dynres-min-scale") == 0) {
+      config->min_scale = atof(argv[i + 1]);
+    }
+  }
+
+  if (config->min_scale < 0.1f) {
+    config->min_scale = 0.1f;
+  }
+  if (config->min_scale > config->max_scale) {
+    config->min_scale = config->max_scale;
+  }
+}
+
+static void set_scale(DynamicResolution *dynres, float scale) {
+
+  if (scale < dynres->config.min_scale) {
+    scale = dynres->config.min_scale;
+  } else if (scale > dynres->config.max_scale) {
+    scale = dynres->config.max_scale;
+  }
+
+  dynres->scale = scale;
+  dynres->render_w = (int) (dynres->display_w * scale);
+  dynres->render_h = (int) (dynres->display_h * scale);
+  if (dynres->render_w < 1) {
+    dynres->render_w = 1;
+  }
+  if (dynres->render_h < 1) {
+    dynres->render_h = 1;
+  }
+}
+
+bool dynres_init(DynamicResolution *dynres, const DynResConfig *config,
+		 int display_w, int display_h) {
+
+  memset(dynres, 0, sizeof(*dynres));
+  dynres->config = *config;
+  dynres->display_w = display_w;
+  dynres->display_h = display_h;
+  set_scale(dynres, config->max_scale);
+
+  /* The colour target is allocated once at full size, lower scales
+     only use part of it so changing scale never reallocates. */
+  glGenTextures(1, &dynres->colour_texture);
+  glBindTexture(GL_TEXTURE_2D, dynres->colour_texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, display_w, display_h,
+	       0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  glGenRenderbuffers(1, &dynres->depth_renderbuffer);
+  glBindRenderbuffer(GL_RENDERBUFFER, dynres->depth_renderbuffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16,
+			display_w, display_h);
+
+  glGenFramebuffers(1, &dynres->framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, dynres->framebuffer);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			 GL_TEXTURE_2D, dynres->colour_texture, 0);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+			    GL_RENDERBUFFER, dynres->depth_renderbuffer);
+
+  GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  if (status != GL_FRAMEBUFFER_COMPLETE) {
+    printf("ERROR: dynamic resolution framebuffer incomplete: 0x%x\n", status);
+    return false;
+  }
+
+  /* Upscale pass: one triangle covering the screen */
+  dynres->upscale_program = load_shaders(config->upscale_vertex_path,
+					 config->upscale_fragment_path);
+  dynres->position_attr = glGetAttribLocation(dynres->upscale_program, "aPos");
+  dynres->texture_uniform = glGetUniformLocation(dynres->upscale_program,
+						 "u_texture");
+  dynres->uv_scale_uniform = glGetUniformLocation(dynres->upscale_program,
+						  "u_uvScale");
+  dynres->uv_max_uniform = glGetUniformLocation(dynres->upscale_program,
+						"u_uvMax");
+
+  glGenBuffers(1, &dynres->quad_vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, dynres->quad_vbo);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(fullscreen_triangle),
+	       fullscreen_triangle, GL_STATIC_DRAW);
+
+  if (gl_caps.timer_query) {
+    gl_caps.GenQueriesEXT(DYNRES_QUERY_COUNT, dynres->queries);
+  } else {
+    printf("Dynamic resolution: no timer queries, using frame intervals\n");
+  }
+  dynres->last_frame_counter = SDL_GetPerformanceCounter();
+
+  printf("Dynamic resolution: display %dx%d, budget %.1f ms, min scale %.2f\n",
+	 display_w, display_h, config->target_ms, config->min_scale);
+  return true;
+}
+
+void dynres_begin_scene(DynamicResolution *dynres) {
+
+  glBindFramebuffer(GL_FRAMEBUFFER, dynres->framebuffer);
+  glViewport(0, 0, dynres->render_w, dynres->render_h);
+
+  /* Only start a query in a slot whose last result has been read */
+  if (gl_caps.timer_query && !dynres->query_pending[dynres->query_ix]) {
+    gl_caps.BeginQueryEXT(GL_TIME_ELAPSED_EXT, dynres->queries[dynres->query_ix]);
+  }
+}
+
+void dynres_upscale(DynamicResolution *dynres) {
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(0, 0, dynres->display_w, dynres->display_h);
+
+  /* The upscale fully covers the screen, no clear or depth needed */
+  glDisable(GL_DEPTH_TEST);
+
+  glUseProgram(dynres->upscale_program);
+
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, dynres->colour_texture);
+  glUniform1i(dynres->texture_uniform, 0);
+
+  float uv_scale_x = (float) dynres->render_w / (float) dynres->display_w;
+  float uv_scale_y = (float) dynres->render_h / (float) dynres->display_h;
+  glUniform2f(dynres->uv_scale_uniform, uv_scale_x, uv_scale_y);
+  glUniform2f(dynres->uv_max_uniform,
+	      uv_scale_x - 0.5f / (float) dynres->display_w,
+	      uv_scale_y - 0.5f / (float) dynres->display_h);
+
+  glBindBuffer(GL_ARRAY_BUFFER, dynres->quad_vbo);
+  glVertexAttribPointer(dynres->position_attr, 2,
+			GL_FLOAT, GL_FALSE,
+			2*sizeof(GLfloat),
+			(void*) (0*sizeof(GLfloat)));
+  glEnableVertexAttribArray(dynres->position_attr);
+
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+
+  glDisableVertexAttribArray(dynres->position_attr);
+  glEnable(GL_DEPTH_TEST);
+
+  if (gl_caps.timer_query && !dynres->query_pending[dynres->query_ix]) {
+    gl_caps.EndQueryEXT(GL_TIME_ELAPSED_EXT);
+    dynres->query_pending[dynres->query_ix] = true;
+  }
+  dynres->query_ix = (dynres->query_ix + 1) % DYNRES_QUERY_COUNT;
+}
+
+/* Returns the newest GPU time available this frame, or a negative
+   value when there is nothing new. */
+static float collect_gpu_time(DynamicResolution *dynres) {
+
+  if (!gl_caps.timer_query) {
+    unsigned long long now = SDL_GetPerformanceCounter();
+    float interval = (float) (now - dynres->last_frame_counter) * 1000.0f
+      / (float) SDL_GetPerformanceFrequency();
+    dynres->last_frame_counter = now;
+    return interval;
+  }
+
+  /* A disjoint event (e.g. a clock change) invalidates all results in
+     flight, so drop them. */
+  GLint disjoint = 0;
+  glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+
+  float newest = -1.0f;
+  for (int i = 1; i <= DYNRES_QUERY_COUNT; i++) {
+    int slot = (dynres->query_ix + i) % DYNRES_QUERY_COUNT;
+    if (!dynres->query_pending[slot]) {
+      continue;
+    }
+
+    GLuint available = 0;
+    gl_caps.GetQueryObjectuivEXT(dynres->queries[slot],
+				 GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+    if (!available) {
+      continue;
+    }
+
+    GLuint64 elapsed_ns = 0;
+    gl_caps.GetQueryObjectui64vEXT(dynres->queries[slot],
+				   GL_QUERY_RESULT_EXT, &elapsed_ns);
+    dynres->query_pending[slot] = false;
+    if (!disjoint) {
+      newest = (float) elapsed_ns / 1.0e6f;
+    }
+  }
+  return newest;
+}
+
+void dynres_update(DynamicResolution *dynres) {
+
+  float sample = collect_gpu_time(dynres);
+  if (sample >= 0.0f) {
+    if (dynres->gpu_ms == 0.0f) {
+      dynres->gpu_ms = sample;
+    } else {
+      dynres->gpu_ms += GPU_TIME_SMOOTHING * (sample - dynres->gpu_ms);
+    }
+  }
+
+  const DynResConfig *config = &dynres->config;
+
+  /* Frame intervals are quantised to the refresh rate by vsync, so
+     being on budget is the best "under" signal we get from them. */
+  float under_threshold = gl_caps.timer_query
+    ? config->target_ms * config->headroom
+    : config->target_ms * 1.05f;
+  int up_settle_frames = gl_caps.timer_query
+    ? config->settle_frames
+    : config->settle_frames * 4;
+
+  /* After a reset (or before the first query comes back) there is no
+     time to judge the scale by yet. */
+  if (dynres->gpu_ms > 0.0f) {
+    dynres->gpu_ms_sum += dynres->gpu_ms;
+    dynres->sampled_frames += 1;
+
+    if (dynres->gpu_ms > config->target_ms) {
+      dynres->over_frames += 1;
+      dynres->under_frames = 0;
+    } else if (dynres->gpu_ms < under_threshold) {
+      dynres->under_frames += 1;
+      dynres->over_frames = 0;
+    } else {
+      dynres->over_frames = 0;
+      dynres->under_frames = 0;
+    }
+
+    if (dynres->over_frames >= config->settle_frames
+	&& dynres->scale > config->min_scale) {
+      /* Pixel count goes with scale squared, so aim straight for the
+	 budget but always move at least one step. */
+      float target_scale = dynres->scale
+	* sqrtf(config->target_ms / dynres->gpu_ms);
+      if (target_scale > dynres->scale - config->step) {
+	target_scale = dynres->scale - config->step;
+      }
+      set_scale(dynres, target_scale);
+      dynres->scale_changes += 1;
+      dynres->over_frames = 0;
+      dynres->gpu_ms = 0.0f;
+    } else if (dynres->under_frames >= up_settle_frames
+	       && dynres->scale < config->max_scale) {
+      set_scale(dynres, dynres->scale + config->step);
+      dynres->scale_changes += 1;
+      dynres->under_frames = 0;
+      dynres->gpu_ms = 0.0f;
+    }
+  }
+
+  dynres->frames += 1;
+  if (dynres->frames == config->report_frames) {
+    printf("dynamic resolution: scale %.2f (%dx%d), %s %.2f ms, "
+	   "budget %.1f ms, %d changes\n",
+	   dynres->scale, dynres->render_w, dynres->render_h,
+	   gl_caps.timer_query ? "gpu" : "frame",
+	   dynres->sampled_frames > 0 ? dynres->gpu_ms_sum / dynres->sampled_frames : 0.0f,
+	   config->target_ms, dynres->scale_changes);
+    dynres->frames = 0;
+    dynres->scale_changes = 0;
+    dynres->gpu_ms_sum = 0.0f;
+    dynres->sampled_frames = 0;
+  }
+}
+
+void dynres_destroy(DynamicResolution *dynres) {
+  if (gl_caps.timer_query) {
+    gl_caps.DeleteQueriesEXT(DYNRES_QUERY_COUNT, dynres->queries);
+  }
+  glDeleteBuffers(1, &dynres->quad_vbo);
+  glDeleteProgram(dynres->upscale_program);
+  glDeleteFramebuffers(1, &dynres->framebuffer);
+  glDeleteRenderbuffers(1, &dynres->depth_renderbuffer);
+  glDeleteTextures(1, &dynres->colour_texture);
+}
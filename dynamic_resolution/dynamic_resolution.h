@@ -0,0 +1,101 @@
+#ifndef DYNAMIC_RESOLUTION_H_
+#define DYNAMIC_RESOLUTION_H_
+
+/* Dynamic resolution scaling.
+
+   The scene is drawn into an offscreen framebuffer sized for the full
+   display, but only a scale * display sized corner of it is used. After
+   the scene, a single full-screen pass stretches that corner onto the
+   window. Every frame the GPU time (from EXT_disjoint_timer_query, or
+   the frame interval when that is missing) is compared with a budget
+   and the scale is stepped down or up.
+
+   Hysteresis: the time has to stay above the budget, or below
+   budget * headroom, for settle_frames frames in a row before the
+   scale moves, and the scale never drops below min_scale.
+*/
+
+#include <stdbool.h>
+
+#include "gl_caps.h"
+
+#define DYNRES_QUERY_COUNT 4
+
+typedef struct {
+  float target_ms;    /* GPU time budget per frame */
+  float min_scale;    /* floor for the render scale */
+  float max_scale;
+  float step;         /* how much the scale moves per adjustment */
+  float headroom;     /* only scale up below target_ms * headroom */
+  int settle_frames;  /* frames outside the band before adjusting */
+  int report_frames;  /* print stats every this many frames */
+  const char *upscale_vertex_path;
+  const char *upscale_fragment_path;
+} DynResConfig;
+
+typedef struct {
+  DynResConfig config;
+
+  /* Full display size and the current render size */
+  int display_w;
+  int display_h;
+  int render_w;
+  int render_h;
+  float scale;
+
+  /* Offscreen target */
+  GLuint framebuffer;
+  GLuint colour_texture;
+  GLuint depth_renderbuffer;
+
+  /* Upscale pass */
+  GLuint upscale_program;
+  GLuint quad_vbo;
+  GLint position_attr;
+  GLint texture_uniform;
+  GLint uv_scale_uniform;
+  GLint uv_max_uniform;
+
+  /* Ring of timer queries, results are read a few frames late */
+  GLuint queries[DYNRES_QUERY_COUNT];
+  bool query_pending[DYNRES_QUERY_COUNT];
+  int query_ix;
+
+  /* Fallback timing from frame intervals */
+  unsigned long long last_frame_counter;
+
+  /* Smoothed GPU time and hysteresis counters */
+  float gpu_ms;
+  int over_frames;
+  int under_frames;
+
+  /* Stats for the report window */
+  int frames;
+  int scale_changes;
+  float gpu_ms_sum;
+  int sampled_frames;  /* frames with a time in gpu_ms_sum */
+} DynamicResolution;
+
+void dynres_default_config(DynResConfig *config);
+
+/* Parse --dynres-target, --dynres-min-scale from argv. */
+void dynres_parse_args(DynResConfig *config, int argc, char *argv[]);
+
+/* Create the offscreen target and upscale pass for the given display
+   size. Needs a current context and load_gl_caps(). */
+bool dynres_init(DynamicResolution *dynres, const DynResConfig *config,
+		 int display_w, int display_h);
+
+/* Bind the offscreen target at the current render size. */
+void dynres_begin_scene(DynamicResolution *dynres);
+
+/* Stretch the scene onto the default framebuffer. */
+void dynres_upscale(DynamicResolution *dynres);
+
+/* Collect the GPU time for earlier frames and adjust the scale. Call
+   once per frame after the swap. */
+void dynres_update(DynamicResolution *dynres);
+
+void dynres_destroy(DynamicResolution *dynres);
+
+#endif // DYNAMIC_RESOLUTION_H_
@@ -0,0 +1,388 @@
+/* ETC1 block encoder and ETC1/ETC2 RGB block decoder. */
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "etc.h"
+
+/* Brightness offsets per table: a pixel adds +a, +b, -a or -b */
+static const int modifier_table[8][2] = {
+  { 2, 8 }, { 5, 17 }, { 9, 29 }, { 13, 42 },
+  { 18, 60 }, { 24, 80 }, { 33, 106 }, { 47, 183 }
+};
+
+/* T and H mode distances */
+static const int distance_table[8] = { 3, 6, 11, 16, 23, 32, 41, 64 };
+
+static inline int clamp255(int value) {
+  return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+/* Selector 0..3 to offset: +a, +b, -a, -b */
+static inline int modifier(int table, int selector) {
+  int offset = modifier_table[table][selector & 1];
+  return (selector & 2) ? -offset : offset;
+}
+
+static inline int expand4(int value) { return (value << 4) | value; }
+static inline int expand5(int value) { return (value << 3) | (value >> 2); }
+static inline int expand6(int value) { return (value << 2) | (value >> 4); }
+static inline int expand7(int value) { return (value << 1) | (value >> 6); }
+
+static inline int bits(uint64_t block, int high, int low) {
+  return (int) ((block >> low) & ((1u << (high - low + 1)) - 1));
+}
+
+size_t etc_image_size(int width, int height) {
+  return (size_t) ((width + 3) / 4) * (size_t) ((height + 3) / 4) * ETC_BLOCK_BYTES;
+}
+
+/* ---- Decoding ---- */
+
+/* out is [y][x][rgb] */
+static void decode_block(const unsigned char *in, bool etc2, unsigned char out[4][4][3]) {
+
+  uint64_t block = 0;
+  for (int i = 0; i < 8; i++) {
+    block = (block << 8) | in[i];
+  }
+
+  /* Pixel (x, y) is index x * 4 + y: MSB at bit 16 + index, LSB at index */
+  int selectors[16];
+  for (int i = 0; i < 16; i++) {
+    selectors[i] = (bits(block, 16 + i, 16 + i) << 1) | bits(block, i, i);
+  }
+
+  bool differential = bits(block, 33, 33);
+  int base[2][3];
+
+  if (differential) {
+    int r = bits(block, 63, 59), g = bits(block, 55, 51), b = bits(block, 47, 43);
+    /* Signed 3 bit deltas */
+    int dr = (bits(block, 58, 56) ^ 4) - 4;
+    int dg = (bits(block, 50, 48) ^ 4) - 4;
+    int db = (bits(block, 42, 40) ^ 4) - 4;
+
+    if (etc2 && (r + dr < 0 || r + dr > 31)) {
+      /* T mode: one colour on its own, three around the other */
+      int c0[3] = {
+	expand4((bits(block, 60, 59) << 2) | bits(block, 57, 56)),
+	expand4(bits(block, 55, 52)), expand4(bits(block, 51, 48))
+      };
+      int c1[3] = {
+	expand4(bits(block, 47, 44)), expand4(bits(block, 43, 40)),
+	expand4(bits(block, 39, 36))
+      };
+      int distance = distance_table[(bits(block, 35, 34) << 1) | bits(block, 32, 32)];
+      for (int i = 0; i < 16; i++) {
+	int x = i / 4, y = i % 4;
+	for (int c = 0; c < 3; c++) {
+	  int paint[4] = { c0[c], c1[c] + distance, c1[c], c1[c] - distance };
+	  out[y][x][c] = (unsigned char) clamp255(paint[selectors[i]]);
+	}
+      }
+      return;
+    }
+
+    if (etc2 && (g + dg < 0 || g + dg > 31)) {
+      /* H mode: two colours, each split into two */
+      int r0 = bits(block, 62, 59);
+      int g0 = (bits(block, 58, 56) << 1) | bits(block, 52, 52);
+      int b0 = (bits(block, 51, 51) << 3) | bits(block, 49, 47);
+      int r1 = bits(block, 46, 43), g1 = bits(block, 42, 39), b1 = bits(block, 38, 35);
+      int order = ((r0 << 8) | (g0 << 4) | b0) >= ((r1 << 8) | (g1 << 4) | b1);
+      int distance = distance_table[(bits(block, 34, 34) << 2)
+				    | (bits(block, 32, 32) << 1) | order];
+      int c0[3] = { expand4(r0), expand4(g0), expand4(b0) };
+      int c1[3] = { expand4(r1), expand4(g1), expand4(b1) };
+      for (int i = 0; i < 16; i++) {
+	int x = i / 4, y = i % 4;
+	for (int c = 0; c < 3; c++) {
+	  int paint[4] = {
+	    c0[c] + distance, c0[c] - distance, c1[c] + distance, c1[c] - distance
+	  };
+	  out[y][x][c] = (unsigned char) clamp255(paint[selectors[i]]);
+	}
+      }
+      return;
+    }
+
+    if (etc2 && (b + db < 0 || b + db > 31)) {
+      /* Planar: a colour at the origin and at the right and bottom edges */
+      int origin[3] = {
+	expand6(bits(block, 62, 57)),
+	expand7((bits(block, 56, 56) << 6) | bits(block, 54, 49)),
+	expand6((bits(block, 48, 48) << 5) | (bits(block, 44, 43) << 3)
+		| bits(block, 41, 39))
+      };
+      int horizontal[3] = {
+	expand6((bits(block, 38, 34) << 1) | bits(block, 32, 32)),
+	expand7(bits(block, 31, 25)), expand6(bits(block, 24, 19))
+      };
+      int vertical[3] = {
+	expand6(bits(block, 18, 13)), expand7(bits(block, 12, 6)),
+	expand6(bits(block, 5, 0))
+      };
+      for (int y = 0; y < 4; y++) {
+	for (int x = 0; x < 4; x++) {
+	  for (int c = 0; c < 3; c++) {
+	    int value = (x * (horizontal[c] - origin[c]) + y * (vertical[c] - origin[c])
+			 + 4 * origin[c] + 2) >> 2;
+	    out[y][x][c] = (unsigned char) clamp255(value);
+	  }
+	}
+      }
+      return;
+    }
+
+    base[0][0] = expand5(r);
+    base[0][1] = expand5(g);
+    base[0][2] = expand5(b);
+    base[1][0] = expand5((r + dr) & 31);
+    base[1][1] = expand5((g + dg) & 31);
+    base[1][2] = expand5((b + db) & 31);
+  } else {
+    base[0][0] = expand4(bits(block, 63, 60));
+    base[1][0] = expand4(bits(block, 59, 56));
+    base[0][1] = expand4(bits(block, 55, 52));
+    base[1][1] = expand4(bits(block, 51, 48));
+    base[0][2] = expand4(bits(block, 47, 44));
+    base[1][2] = expand4(bits(block, 43, 40));
+  }
+
+  int tables[2] = { bits(block, 39, 37), bits(block, 36, 34) };
+  bool flip = bits(block, 32, 32);
+  for (int i = 0; i < 16; i++) {
+    int x = i / 4, y = i % 4;
+    int half = flip ? (y >= 2) : (x >= 2);
+    int offset = modifier(tables[half], selectors[i]);
+    for (int c = 0; c < 3; c++) {
+      out[y][x][c] = (unsigned char) clamp255(base[half][c] + offset);
+    }
+  }
+}
+
+void etc_decode_image(const unsigned char *blocks, int width, int height,
+		      bool etc2, unsigned char *rgb) {
+  int blocks_x = (width + 3) / 4;
+  int blocks_y = (height + 3) / 4;
+  for (int by = 0; by < blocks_y; by++) {
+    for (int bx = 0; bx < blocks_x; bx++) {
+      unsigned char pixels[4][4][3];
+      decode_block(blocks + (by * blocks_x + bx) * ETC_BLOCK_BYTES, etc2, pixels);
+      for (int y = 0; y < 4 && by * 4 + y < height; y++) {
+	for (int x = 0; x < 4 && bx * 4 + x < width; x++) {
+	  memcpy(rgb + 3 * ((size_t) (by * 4 + y) * width + bx * 4 + x), pixels[y][x], 3);
+	}
+      }
+    }
+  }
+}
+
+bool etc_blocks_are_etc1(const unsigned char *blocks, size_t size) {
+  for (size_t i = 0; i + ETC_BLOCK_BYTES <= size; i += ETC_BLOCK_BYTES) {
+    const unsigned char *block = blocks + i;
+    if ((block[3] & 2) == 0) {
+      continue;
+    }
+    /* Differential: the second colour must not overflow 5 bits */
+    for (int c = 0; c < 3; c++) {
+      int base = block[c] >> 3;
+      int delta = ((block[c] & 7) ^ 4) - 4;
+      if (base + delta < 0 || base + delta > 31) {
+	return false;
+      }
+    }
+  }
+  return true;
+}
+
+/* ---- Encoding ---- */
+
+/* The best table for eight pixels around one base colour. Returns the
+   squared error and fills in the selector for each pixel. */
+static int encode_half(const int pixels[8][3], const int base[3],
+		       int *best_table, int best_selectors[8]) {
+  int best_error = INT_MAX;
+  for (int table = 0; table < 8; table++) {
+    int error = 0;
+    int selectors[8];
+    for (int p = 0; p < 8 && error < best_error; p++) {
+      int pixel_error = INT_MAX;
+      for (int s = 0; s < 4; s++) {
+	int offset = modifier(table, s);
+	int e = 0;
+	for (int c = 0; c < 3; c++) {
+	  int d = clamp255(base[c] + offset) - pixels[p][c];
+	  e += d * d;
+	}
+	if (e < pixel_error) {
+	  pixel_error = e;
+	  selectors[p] = s;
+	}
+      }
+      error += pixel_error;
+    }
+    if (error < best_error) {
+      best_error = error;
+      *best_table = table;
+      memcpy(best_selectors, selectors, sizeof(selectors));
+    }
+  }
+  return best_error;
+}
+
+/* Block pixel index (x * 4 + y) of the p'th pixel of each half */
+static void half_indices(bool flip, int indices[2][8]) {
+  for (int p = 0; p < 8; p++) {
+    if (flip) {
+      /* 4x2 halves, top and bottom */
+      int x = p / 2, y = p % 2;
+      indices[0][p] = x * 4 + y;
+      indices[1][p] = x * 4 + y + 2;
+    } else {
+      /* 2x4 halves, left and right */
+      int x = p / 4, y = p % 4;
+      indices[0][p] = x * 4 + y;
+      indices[1][p] = (x + 2) * 4 + y;
+    }
+  }
+}
+
+/* pixels is [index][rgb] with index x * 4 + y */
+static void encode_block(const int pixels[16][3], unsigned char *out) {
+
+  int best_error = INT_MAX;
+  uint32_t best_high = 0;
+  uint32_t best_low = 0;
+
+  for (int flip = 0; flip < 2; flip++) {
+    int indices[2][8];
+    half_indices(flip, indices);
+
+    int half_pixels[2][8][3];
+    int average[2][3] = { { 0 } };
+    for (int h = 0; h < 2; h++) {
+      for (int p = 0; p < 8; p++) {
+	for (int c = 0; c < 3; c++) {
+	  half_pixels[h][p][c] = pixels[indices[h][p]][c];
+	  average[h][c] += pixels[indices[h][p]][c];
+	}
+      }
+      for (int c = 0; c < 3; c++) {
+	average[h][c] = (average[h][c] + 4) / 8;
+      }
+    }
+
+    for (int differential = 0; differential < 2; differential++) {
+      int quantized[2][3];
+      int base[2][3];
+      for (int h = 0; h < 2; h++) {
+	for (int c = 0; c < 3; c++) {
+	  if (differential) {
+	    quantized[h][c] = (average[h][c] * 31 + 127) / 255;
+	    base[h][c] = expand5(quantized[h][c]);
+	  } else {
+	    quantized[h][c] = (average[h][c] * 15 + 127) / 255;
+	    base[h][c] = expand4(quantized[h][c]);
+	  }
+	}
+      }
+      if (differential) {
+	bool fits = true;
+	for (int c = 0; c < 3; c++) {
+	  int delta = quantized[1][c] - quantized[0][c];
+	  fits = fits && delta >= -4 && delta <= 3;
+	}
+	if (!fits) {
+	  continue;
+	}
+      }
+
+      int tables[2];
+      int selectors[2][8];
+      int error = encode_half(half_pixels[0], base[0], &tables[0], selectors[0]);
+      if (error >= best_error) {
+	continue;
+      }
+      error += encode_half(half_pixels[1], base[1], &tables[1], selectors[1]);
+      if (error >= best_error) {
+	continue;
+      }
+
+      uint32_t high;
+      if (differential) {
+	high = (uint32_t) quantized[0][0] << 27
+	  | (uint32_t) ((quantized[1][0] - quantized[0][0]) & 7) << 24
+	  | (uint32_t) quantized[0][1] << 19
+	  | (uint32_t) ((quantized[1][1] - quantized[0][1]) & 7) << 16
+	  | (uint32_t) quantized[0][2] << 11
+	  | (uint32_t) ((quantized[1][2] - quantized[0][2]) & 7) << 8;
+      } else {
+	high = (uint32_t) quantized[0][0] << 28 | (uint32_t) quantized[1][0] << 24
+	  | (uint32_t) quantized[0][1] << 20 | (uint32_t) quantized[1][1] << 16
+	  | (uint32_t) quantized[0][2] << 12 | (uint32_t) quantized[1][2] << 8;
+      }
+      high |= (uint32_t) tables[0] << 5 | (uint32_t) tables[1] << 2
+	| (uint32_t) differential << 1 | (uint32_t) flip;
+
+      uint32_t low = 0;
+      for (int h = 0; h < 2; h++) {
+	for (int p = 0; p < 8; p++) {
+	  int index = indices[h][p];
+	  low |= (uint32_t) (selectors[h][p] >> 1) << (16 + index);
+	  low |= (uint32_t) (selectors[h][p] & 1) << index;
+	}
+      }
+
+      best_error = error;
+      best_high = high;
+      best_low = low;
+    }
+  }
+
+  for (int i = 0; i < 4; i++) {
+    out[i] = (unsigned char) (best_high >> (24 - 8 * i));
+    out[4 + i] = (unsigned char) (best_low >> (24 - 8 * i));
+  }
+}
+
+double etc_encode_image(const unsigned char *rgb, int width, int height,
+			unsigned char *blocks) {
+  int blocks_x = (width + 3) / 4;
+  int blocks_y = (height + 3) / 4;
+  double error = 0.0;
+
+  for (int by = 0; by < blocks_y; by++) {
+    for (int bx = 0; bx < blocks_x; bx++) {
+      /* Blocks hanging off the edge repeat the last row and column */
+      int pixels[16][3];
+      for (int x = 0; x < 4; x++) {
+	for (int y = 0; y < 4; y++) {
+	  int ix = bx * 4 + x < width ? bx * 4 + x : width - 1;
+	  int iy = by * 4 + y < height ? by * 4 + y : height - 1;
+	  const unsigned char *pixel = rgb + 3 * ((size_t) iy * width + ix);
+	  for (int c = 0; c < 3; c++) {
+	    pixels[x * 4 + y][c] = pixel[c];
+	  }
+	}
+      }
+
+      unsigned char *block = blocks + (by * blocks_x + bx) * ETC_BLOCK_BYTES;
+      encode_block(pixels, block);
+
+      /* Measure what actually comes back out, inside the image only */
+      unsigned char decoded[4][4][3];
+      decode_block(block, false, decoded);
+      for (int y = 0; y < 4 && by * 4 + y < height; y++) {
+	for (int x = 0; x < 4 && bx * 4 + x < width; x++) {
+	  for (int c = 0; c < 3; c++) {
+	    int d = decoded[y][x][c] - pixels[x * 4 + y][c];
+	    error += d * d;
+	  }
+	}
+      }
+    }
+  }
+  return error;
+}
@@ -0,0 +1,41 @@
+#ifndef ETC_H_
+#define ETC_H_
+
+/* ETC1 and ETC2 RGB texture compression.
+
+   Both store a 4x4 block of pixels in 8 bytes, a sixth of GL_RGB. ETC1
+   splits the block into two 2x4 or 4x2 halves, each with a base colour
+   and a table of brightness offsets; every pixel picks one of four
+   offsets. ETC2 RGB is ETC1 plus three extra modes (T, H and planar),
+   flagged by base colour combinations ETC1 never uses, so any ETC1
+   data is also valid ETC2.
+
+   The encoder only writes ETC1 blocks, trying both split directions and
+   both ways of storing the base colours and keeping the least error.
+   That makes its output loadable as either format. The decoder handles
+   all of ETC2 RGB, for drivers that can do neither.
+*/
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define ETC_BLOCK_BYTES 8
+
+/* Bytes for a width x height image, rounded up to whole blocks. */
+size_t etc_image_size(int width, int height);
+
+/* Tightly packed RGB8 in, etc_image_size bytes out. Returns the sum
+   of squared errors over all channels, for reporting PSNR. */
+double etc_encode_image(const unsigned char *rgb, int width, int height,
+			unsigned char *blocks);
+
+/* etc_image_size bytes in, tightly packed RGB8 out. With etc2 false
+   the extra modes are read as plain ETC1 differential blocks. */
+void etc_decode_image(const unsigned char *blocks, int width, int height,
+		      bool etc2, unsigned char *rgb);
+
+/* True if no block uses the ETC2-only modes, so the data can go to
+   an ES2 driver that only has ETC1. */
+bool etc_blocks_are_etc1(const unsigned char *blocks, size_t size);
+
+#endif // ETC_H_
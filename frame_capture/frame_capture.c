@@ -0,0 +1,434 @@
+/* Asynchronous framebuffer capture with a background writer thread. */
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame_capture.h"
+
+/* How long to wait for a fence when draining at shutdown */
+#define DRAIN_TIMEOUT_NS 1000000000ull
+
+static double ms_since(Uint64 start) {
+  return (double) (SDL_GetPerformanceCounter() - start) * 1000.0
+    / (double) SDL_GetPerformanceFrequency();
+}
+
+void capture_default_config(CaptureConfig *config) {
+  config->path = NULL;
+  config->fps = 60;
+  config->report_frames = 5 * 60;
+}
+
+void capture_parse_args(CaptureConfig *config, int argc, char *argv[]) {
+  for (int i = 1; i < argc - 1; i++) {
+    if (strcmp(argv[i], "--capture") == 0) {
+      config->path = argv[i + 1];
+    } else if (strcmp(argv[i], "--capture-fps") == 0) {
+      config->fps = atoi(argv[i + 1]);
+    }
+  }
+  if (config->fps < 1) {
+    config->fps = 60;
+  }
+}
+
+/* The PPM path is used as a printf format, so it may only hold %% and
+   one %d, optionally zero padded and with a width */
+static bool ppm_pattern_valid(const char *path) {
+  int conversions = 0;
+  for (const char *c = path; *c != 0; c++) {
+    if (*c != '%') {
+      continue;
+    }
+    c++;
+    if (*c == '%') {
+      continue;
+    }
+    if (*c == '0') {
+      c++;
+    }
+    while (*c >= '0' && *c <= '9') {
+      c++;
+    }
+    if (*c != 'd') {
+      return false;
+    }
+    conversions++;
+  }
+  return conversions == 1;
+}
+
+/* ---- Writer thread ---- */
+
+static void write_ppm(FrameCapture *capture, CaptureBuffer *buffer,
+		      unsigned char *row) {
+
+  char filename[512];
+  snprintf(filename, sizeof(filename), capture->config.path,
+	   buffer->frame_number);
+
+  FILE *fp = fopen(filename, "wb");
+  if (fp == NULL) {
+    printf("ERROR: could not open capture file %s\n", filename);
+    return;
+  }
+
+  int w = capture->width;
+  int h = capture->height;
+  fprintf(fp, "P6\n%d %d\n255\n", w, h);
+
+  /* GL rows are bottom first, PPM rows are top first */
+  for (int y = h - 1; y >= 0; y--) {
+    const unsigned char *src = buffer->pixels + (size_t) y * w * 4;
+    for (int x = 0; x < w; x++) {
+      row[3*x] = src[4*x];
+      row[3*x + 1] = src[4*x + 1];
+      row[3*x + 2] = src[4*x + 2];
+    }
+    fwrite(row, 3, w, fp);
+  }
+  fclose(fp);
+}
+
+static void write_y4m(FrameCapture *capture, CaptureBuffer *buffer,
+		      unsigned char *planes) {
+
+  int w = capture->width;
+  int h = capture->height;
+  int cw = (w + 1) / 2;
+  int ch = (h + 1) / 2;
+
+  unsigned char *y_plane = planes;
+  unsigned char *u_plane = y_plane + (size_t) w * h;
+  unsigned char *v_plane = u_plane + (size_t) cw * ch;
+
+  /* Full range BT.601 (C420jpeg), in 8.8 fixed point. Chroma is taken
+     from the top-left pixel of each 2x2 block. */
+  for (int y = 0; y < h; y++) {
+    const unsigned char *src = buffer->pixels + (size_t) (h - 1 - y) * w * 4;
+    unsigned char *dst_y = y_plane + (size_t) y * w;
+    for (int x = 0; x < w; x++) {
+      int r = src[4*x];
+      int g = src[4*x + 1];
+      int b = src[4*x + 2];
+      dst_y[x] = (unsigned char) ((77*r + 150*g + 29*b) >> 8);
+
+      if (((x | y) & 1) == 0) {
+	int u = ((-43*r - 85*g + 128*b) >> 8) + 128;
+	int v = ((128*r - 107*g - 21*b) >> 8) + 128;
+	u_plane[(y/2) * cw + x/2] = (unsigned char) (u < 0 ? 0 : (u > 255 ? 255 : u));
+	v_plane[(y/2) * cw + x/2] = (unsigned char) (v < 0 ? 0 : (v > 255 ? 255 : v));
+      }
+    }
+  }
+
+  fputs("FRAME\n", capture->y4m_file);
+  fwrite(planes, 1, (size_t) w * h + 2 * (size_t) cw * ch, capture->y4m_file);
+}
+
+static int writer_thread(void *data) {
+
+  FrameCapture *capture = (FrameCapture *) data;
+
+  /* Scratch space owned by this thread */
+  size_t scratch_size = (size_t) capture->width * 3;
+  if (capture->format == CAPTURE_Y4M) {
+    size_t chroma = (size_t) ((capture->width + 1) / 2) * ((capture->height + 1) / 2);
+    scratch_size = (size_t) capture->width * capture->height + 2 * chroma;
+  }
+  unsigned char *scratch = malloc(scratch_size);
+
+  SDL_LockMutex(capture->mutex);
+  while (1) {
+    while (capture->queue_count == 0 && !capture->stopping) {
+      SDL_CondWait(capture->work_ready, capture->mutex);
+    }
+    if (capture->queue_count == 0) {
+      /* Stopping and nothing left to write */
+      break;
+    }
+
+    int index = capture->queue[capture->queue_head];
+    capture->queue_head = (capture->queue_head + 1) % CAPTURE_WRITE_BUFFERS;
+    capture->queue_count -= 1;
+    SDL_UnlockMutex(capture->mutex);
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    if (capture->format == CAPTURE_Y4M) {
+      write_y4m(capture, &capture->buffers[index], scratch);
+    } else {
+      write_ppm(capture, &capture->buffers[index], scratch);
+    }
+    double elapsed = ms_since(start);
+
+    SDL_LockMutex(capture->mutex);
+    capture->free_list[capture->free_count] = index;
+    capture->free_count += 1;
+    capture->written += 1;
+    capture->write_ms += elapsed;
+  }
+  SDL_UnlockMutex(capture->mutex);
+
+  free(scratch);
+  return 0;
+}
+
+/* ---- Readback ring ---- */
+
+/* Take a free writer buffer, or -1 if the writer has fallen behind. */
+static int acquire_buffer(FrameCapture *capture) {
+  int index = -1;
+  SDL_LockMutex(capture->mutex);
+  if (capture->free_count > 0) {
+    capture->free_count -= 1;
+    index = capture->free_list[capture->free_count];
+  }
+  SDL_UnlockMutex(capture->mutex);
+  return index;
+}
+
+static void submit_buffer(FrameCapture *capture, int index) {
+  SDL_LockMutex(capture->mutex);
+  int tail = (capture->queue_head + capture->queue_count) % CAPTURE_WRITE_BUFFERS;
+  capture->queue[tail] = index;
+  capture->queue_count += 1;
+  if (capture->queue_count > capture->max_queue_depth) {
+    capture->max_queue_depth = capture->queue_count;
+  }
+  SDL_CondSignal(capture->work_ready);
+  SDL_UnlockMutex(capture->mutex);
+}
+
+/* Copy a finished slot into a writer buffer and free the slot. */
+static void complete_slot(FrameCapture *capture, int slot) {
+
+  int index = acquire_buffer(capture);
+  size_t frame_size = (size_t) capture->width * capture->height * 4;
+
+  if (capture->use_pbo) {
+    gl_caps.DeleteSync(capture->fences[slot]);
+    capture->fences[slot] = NULL;
+
+    if (index >= 0) {
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, capture->pbos[slot]);
+      void *mapped = gl_caps.MapBufferRange(GL_PIXEL_PACK_BUFFER, 0, frame_size,
+					    GL_MAP_READ_BIT);
+      if (mapped != NULL) {
+	memcpy(capture->buffers[index].pixels, mapped, frame_size);
+	gl_caps.UnmapBuffer(GL_PIXEL_PACK_BUFFER);
+      }
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+  } else if (index >= 0) {
+    GLint previous_framebuffer;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous_framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, capture->framebuffers[slot]);
+    glReadPixels(0, 0, capture->width, capture->height,
+		 GL_RGBA, GL_UNSIGNED_BYTE, capture->buffers[index].pixels);
+    glBindFramebuffer(GL_FRAMEBUFFER, previous_framebuffer);
+  }
+
+  if (index >= 0) {
+    capture->buffers[index].frame_number = capture->slot_frame[slot];
+    submit_buffer(capture, index);
+    capture->captured += 1;
+  } else {
+    capture->dropped_writer += 1;
+  }
+  capture->slot_frame[slot] = -1;
+}
+
+/* Complete slots oldest first, stopping at the first one that is not
+   ready yet. With block set, wait for everything. */
+static void collect_readbacks(FrameCapture *capture, bool block) {
+
+  for (int i = 0; i < CAPTURE_READBACK_SLOTS; i++) {
+    int slot = (capture->next_slot + i) % CAPTURE_READBACK_SLOTS;
+    if (capture->slot_frame[slot] < 0) {
+      continue;
+    }
+
+    bool ready;
+    if (capture->use_pbo) {
+      GLenum result = gl_caps.ClientWaitSync(capture->fences[slot], 0,
+					     block ? DRAIN_TIMEOUT_NS : 0);
+      ready = (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED);
+    } else {
+      /* No fences on ES2, so trust that a copy issued this many frames
+	 ago is done. */
+      ready = block || (capture->frame_number - capture->slot_frame[slot]
+			>= CAPTURE_READBACK_SLOTS - 1);
+    }
+
+    if (!ready) {
+      break;
+    }
+    complete_slot(capture, slot);
+  }
+}
+
+static void issue_readback(FrameCapture *capture) {
+
+  int slot = capture->next_slot;
+  if (capture->slot_frame[slot] >= 0) {
+    /* The GPU is more than the whole ring behind */
+    capture->dropped_readback += 1;
+    return;
+  }
+
+  if (capture->use_pbo) {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, capture->pbos[slot]);
+    glReadPixels(0, 0, capture->width, capture->height,
+		 GL_RGBA, GL_UNSIGNED_BYTE, (void*) 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    capture->fences[slot] = gl_caps.FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  } else {
+    glBindTexture(GL_TEXTURE_2D, capture->textures[slot]);
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0,
+			capture->width, capture->height);
+  }
+
+  capture->slot_frame[slot] = capture->frame_number;
+  capture->next_slot = (slot + 1) % CAPTURE_READBACK_SLOTS;
+}
+
+bool capture_init(FrameCapture *capture, const CaptureConfig *config,
+		  int width, int height) {
+
+  memset(capture, 0, sizeof(*capture));
+  capture->config = *config;
+  capture->width = width;
+  capture->height = height;
+  capture->use_pbo = gl_caps.MapBufferRange != NULL && gl_caps.FenceSync != NULL;
+
+  const char *extension = strrchr(config->path, '.');
+  capture->format = (extension != NULL && strcmp(extension, ".ppm") == 0)
+    ? CAPTURE_PPM : CAPTURE_Y4M;
+
+  if (capture->format == CAPTURE_PPM && !ppm_pattern_valid(config->path)) {
+    printf("ERROR: capture pattern %s needs exactly one %%d\n", config->path);
+    return false;
+  }
+  if (capture->format == CAPTURE_Y4M) {
+    capture->y4m_file = fopen(config->path, "wb");
+    if (capture->y4m_file == NULL) {
+      printf("ERROR: could not open capture file %s\n", config->path);
+      return false;
+    }
+    fprintf(capture->y4m_file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n",
+	    width, height, config->fps);
+  }
+
+  size_t frame_size = (size_t) width * height * 4;
+  for (int i = 0; i < CAPTURE_READBACK_SLOTS; i++) {
+    capture->slot_frame[i] = -1;
+  }
+
+  if (capture->use_pbo) {
+    glGenBuffers(CAPTURE_READBACK_SLOTS, capture->pbos);
+    for (int i = 0; i < CAPTURE_READBACK_SLOTS; i++) {
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, capture->pbos[i]);
+      glBufferData(GL_PIXEL_PACK_BUFFER, frame_size, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  } else {
+    /* RGB so the copy is legal from a backbuffer without alpha */
+    glGenTextures(CAPTURE_READBACK_SLOTS, capture->textures);
+    glGenFramebuffers(CAPTURE_READBACK_SLOTS, capture->framebuffers);
+    GLint previous_framebuffer;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous_framebuffer);
+    for (int i = 0; i < CAPTURE_READBACK_SLOTS; i++) {
+      glBindTexture(GL_TEXTURE_2D, capture->textures[i]);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height,
+		   0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+      glBindFramebuffer(GL_FRAMEBUFFER, capture->framebuffers[i]);
+      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			     GL_TEXTURE_2D, capture->textures[i], 0);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, previous_framebuffer);
+  }
+
+  for (int i = 0; i < CAPTURE_WRITE_BUFFERS; i++) {
+    capture->buffers[i].pixels = malloc(frame_size);
+    capture->free_list[i] = i;
+  }
+  capture->free_count = CAPTURE_WRITE_BUFFERS;
+
+  capture->mutex = SDL_CreateMutex();
+  capture->work_ready = SDL_CreateCond();
+  capture->writer = SDL_CreateThread(writer_thread, "capture writer", capture);
+
+  printf("Capturing %dx%d to %s as %s using %s readback\n",
+	 width, height, config->path,
+	 capture->format == CAPTURE_Y4M ? "Y4M" : "PPM",
+	 capture->use_pbo ? "pixel pack buffer" : "deferred texture");
+  return true;
+}
+
+static void print_report(FrameCapture *capture, const char *label) {
+  SDL_LockMutex(capture->mutex);
+  int queue_depth = capture->queue_count;
+  int written = capture->written;
+  double write_ms = capture->write_ms;
+  SDL_UnlockMutex(capture->mutex);
+
+  printf("capture %s: %d captured, %d written (%.2f ms/frame), "
+	 "dropped %d readback + %d writer, queue %d (max %d of %d)\n",
+	 label, capture->captured, written,
+	 written > 0 ? write_ms / written : 0.0,
+	 capture->dropped_readback, capture->dropped_writer,
+	 queue_depth, capture->max_queue_depth, CAPTURE_WRITE_BUFFERS);
+}
+
+void capture_frame(FrameCapture *capture) {
+
+  if (capture->mutex == NULL) {
+    return;
+  }
+
+  collect_readbacks(capture, false);
+  issue_readback(capture);
+  capture->frame_number += 1;
+
+  if (capture->frame_number % capture->config.report_frames == 0) {
+    print_report(capture, "status");
+  }
+}
+
+void capture_destroy(FrameCapture *capture) {
+
+  if (capture->mutex == NULL) {
+    return;
+  }
+
+  collect_readbacks(capture, true);
+
+  SDL_LockMutex(capture->mutex);
+  capture->stopping = true;
+  SDL_CondSignal(capture->work_ready);
+  SDL_UnlockMutex(capture->mutex);
+  SDL_WaitThread(capture->writer, NULL);
+
+  print_report(capture, "finished");
+
+  if (capture->use_pbo) {
+    glDeleteBuffers(CAPTURE_READBACK_SLOTS, capture->pbos);
+  } else {
+    glDeleteFramebuffers(CAPTURE_READBACK_SLOTS, capture->framebuffers);
+    glDeleteTextures(CAPTURE_READBACK_SLOTS, capture->textures);
+  }
+  for (int i = 0; i < CAPTURE_WRITE_BUFFERS; i++) {
+    free(capture->buffers[i].pixels);
+  }
+  if (capture->y4m_file != NULL) {
+    fclose(capture->y4m_file);
+  }
+
+  SDL_DestroyCond(capture->work_ready);
+  SDL_DestroyMutex(capture->mutex);
+  capture->mutex = NULL;
+}
@@ -0,0 +1,106 @@
+#ifndef FRAME_CAPTURE_H_
+#define FRAME_CAPTURE_H_
+
+/* Asynchronous capture of the rendered frames to disk.
+
+   A plain glReadPixels at the end of the frame waits for the GPU to
+   finish that frame, which throws away all CPU/GPU overlap. Instead
+   each frame is copied somewhere on the GPU and read back a couple of
+   frames later:
+   - ES3: glReadPixels into a ring of pixel pack buffers, with a fence
+     per buffer. A buffer is only mapped once its fence has signalled.
+   - ES2: glCopyTexSubImage2D into a ring of textures, and glReadPixels
+     from the oldest one, which the GPU has had time to finish.
+
+   Finished frames are handed to a writer thread that converts them and
+   writes a Y4M stream or a numbered PPM sequence. If the readback ring
+   or the writer queue is full the frame is dropped rather than stalling
+   the render loop, and counted.
+*/
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <SDL2/SDL.h>
+
+#include "gl_caps.h"
+
+#define CAPTURE_READBACK_SLOTS 3
+#define CAPTURE_WRITE_BUFFERS 8
+
+typedef enum {
+  CAPTURE_Y4M,
+  CAPTURE_PPM
+} CaptureFormat;
+
+typedef struct {
+  /* For Y4M a file name, for PPM a printf pattern such as
+     "capture/frame_%05d.ppm", with exactly one %d and nothing else but
+     %%. Format is picked from the extension. */
+  const char *path;
+  int fps;            /* frame rate written to the Y4M header */
+  int report_frames;  /* print stats every this many frames */
+} CaptureConfig;
+
+typedef struct {
+  unsigned char *pixels;  /* RGBA, bottom row first as GL returns it */
+  int frame_number;
+} CaptureBuffer;
+
+typedef struct {
+  CaptureConfig config;
+  CaptureFormat format;
+  int width;
+  int height;
+  bool use_pbo;
+
+  /* GPU side readback ring */
+  GLuint pbos[CAPTURE_READBACK_SLOTS];
+  GLsync fences[CAPTURE_READBACK_SLOTS];
+  GLuint textures[CAPTURE_READBACK_SLOTS];
+  GLuint framebuffers[CAPTURE_READBACK_SLOTS];
+  int slot_frame[CAPTURE_READBACK_SLOTS];  /* -1 when empty */
+  int next_slot;
+
+  /* Writer thread and its queue */
+  CaptureBuffer buffers[CAPTURE_WRITE_BUFFERS];
+  int free_list[CAPTURE_WRITE_BUFFERS];
+  int free_count;
+  int queue[CAPTURE_WRITE_BUFFERS];
+  int queue_head;
+  int queue_count;
+  bool stopping;
+  SDL_mutex *mutex;
+  SDL_cond *work_ready;
+  SDL_Thread *writer;
+  FILE *y4m_file;
+
+  /* Counters */
+  int frame_number;
+  int captured;
+  int dropped_readback;  /* GPU ring still busy */
+  int dropped_writer;    /* writer queue full */
+  int max_queue_depth;
+  int written;           /* updated by the writer thread */
+  double write_ms;       /* ditto */
+} FrameCapture;
+
+void capture_default_config(CaptureConfig *config);
+
+/* Parse --capture <path> and --capture-fps <n>. Capture stays off when
+   no path is given. */
+void capture_parse_args(CaptureConfig *config, int argc, char *argv[]);
+
+/* Set up the readback ring and start the writer thread. Needs a current
+   context and load_gl_caps(). */
+bool capture_init(FrameCapture *capture, const CaptureConfig *config,
+		  int width, int height);
+
+/* Queue a copy of the currently bound framebuffer and hand any finished
+   readbacks to the writer. Call after drawing and before the swap. */
+void capture_frame(FrameCapture *capture);
+
+/* Finish the outstanding readbacks, drain the writer and close files. */
+void capture_destroy(FrameCapture *capture);
+
+#endif // FRAME_CAPTURE_H_
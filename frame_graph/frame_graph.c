@@ -0,0 +1,747 @@
+/* Render passes declared as a graph: culled, merged, aliased and
+   invalidated once, then run every frame. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame_graph.h"
+#include "shader_loader.h"
+
+/* One triangle covering the screen */
+static const GLfloat fullscreen_triangle[] = {
+  -1.0f, -1.0f,
+  3.0f, -1.0f,
+  -1.0f, 3.0f
+};
+
+static const char *fullscreen_vertex_source =
+  "#version 100\n"
+  "attribute vec2 vPosition;\n"
+  "varying vec2 uv;\n"
+  "void main() {\n"
+  "  uv = vPosition * 0.5 + 0.5;\n"
+  "  gl_Position = vec4(vPosition, 0.0, 1.0);\n"
+  "}\n";
+
+static const char *kind_name(FrameGraphPassKind kind) {
+  switch (kind) {
+  case FRAME_GRAPH_PIXEL: return "pixel";
+  case FRAME_GRAPH_SAMPLE: return "sample";
+  default: return "callback";
+  }
+}
+
+static size_t resource_bytes(const FrameGraphResource *resource) {
+  size_t texel = (resource->format == FRAME_GRAPH_DEPTH && !gl_caps.es3) ? 2 : 4;
+  return (size_t) resource->width * resource->height * texel;
+}
+
+void frame_graph_init(FrameGraph *graph) {
+  memset(graph, 0, sizeof(*graph));
+  graph->cull = true;
+  graph->merge = true;
+  graph->alias = true;
+  graph->invalidate = true;
+  graph->open_pass = -1;
+}
+
+void frame_graph_destroy(FrameGraph *graph) {
+  for (int p = 0; p < graph->num_passes; p++) {
+    if (graph->passes[p].program != 0) {
+      glDeleteProgram(graph->passes[p].program);
+    }
+    free(graph->passes[p].source);
+  }
+  for (int t = 0; t < graph->num_targets; t++) {
+    if (graph->targets[t].texture != 0) {
+      glDeleteTextures(1, &graph->targets[t].texture);
+    }
+    if (graph->targets[t].renderbuffer != 0) {
+      glDeleteRenderbuffers(1, &graph->targets[t].renderbuffer);
+    }
+  }
+  if (graph->num_framebuffers > 0) {
+    glDeleteFramebuffers(graph->num_framebuffers, graph->framebuffers);
+  }
+  if (graph->triangle_buffer != 0) {
+    glDeleteBuffers(1, &graph->triangle_buffer);
+  }
+  memset(graph, 0, sizeof(*graph));
+}
+
+static int add_resource(FrameGraph *graph, const char *name, FrameGraphFormat format,
+			int width, int height) {
+  if (graph->num_resources == FRAME_GRAPH_MAX_RESOURCES) {
+    printf("ERROR: frame graph has no room for target %s\n", name);
+    return -1;
+  }
+  FrameGraphResource *resource = &graph->resources[graph->num_resources];
+  memset(resource, 0, sizeof(*resource));
+  resource->name = name;
+  resource->format = format;
+  resource->width = width;
+  resource->height = height;
+  resource->target = -1;
+  return graph->num_resources++;
+}
+
+int frame_graph_create(FrameGraph *graph, const char *name, FrameGraphFormat format,
+		       int width, int height) {
+  return add_resource(graph, name, format, width, height);
+}
+
+int frame_graph_import(FrameGraph *graph, const char *name, GLuint framebuffer,
+		       int width, int height) {
+  int index = add_resource(graph, name, FRAME_GRAPH_RGBA8, width, height);
+  if (index >= 0) {
+    graph->resources[index].imported = true;
+    graph->resources[index].framebuffer = framebuffer;
+  }
+  return index;
+}
+
+static int add_pass(FrameGraph *graph, const char *name, FrameGraphPassKind kind) {
+  if (graph->num_passes == FRAME_GRAPH_MAX_PASSES) {
+    printf("ERROR: frame graph has no room for pass %s\n", name);
+    return -1;
+  }
+  int index = graph->num_passes++;
+  FrameGraphPass *pass = &graph->passes[index];
+  memset(pass, 0, sizeof(*pass));
+  pass->name = name;
+  pass->kind = kind;
+  pass->input = -1;
+  pass->colour = -1;
+  pass->depth = -1;
+  pass->head = index;
+  pass->next = -1;
+  pass->order = -1;
+  return index;
+}
+
+int frame_graph_add_pass(FrameGraph *graph, const char *name,
+			 FrameGraphExecute execute, void *user) {
+  int index = add_pass(graph, name, FRAME_GRAPH_CALLBACK);
+  if (index >= 0) {
+    graph->passes[index].execute = execute;
+    graph->passes[index].user = user;
+  }
+  return index;
+}
+
+int frame_graph_add_fullscreen(FrameGraph *graph, const char *name,
+			       FrameGraphPassKind kind, const char *source, int input,
+			       FrameGraphSetup setup, void *user) {
+  int index = add_pass(graph, name, kind);
+  if (index >= 0) {
+    FrameGraphPass *pass = &graph->passes[index];
+    pass->source = strdup(source);
+    pass->input = input;
+    pass->setup = setup;
+    pass->user = user;
+  }
+  return index;
+}
+
+void frame_graph_read(FrameGraph *graph, int pass, int resource, const char *sampler) {
+  if (pass < 0 || resource < 0) {
+    printf("ERROR: frame graph read of %s without a pass or target\n", sampler);
+    return;
+  }
+  FrameGraphPass *p = &graph->passes[pass];
+  if (p->num_samplers == FRAME_GRAPH_MAX_SAMPLERS) {
+    printf("ERROR: frame graph pass %s reads too many targets\n", p->name);
+    return;
+  }
+  p->samplers[p->num_samplers] = resource;
+  p->sampler_names[p->num_samplers] = sampler;
+  p->num_samplers += 1;
+}
+
+void frame_graph_write(FrameGraph *graph, int pass, int resource, FrameGraphLoad load) {
+  if (pass < 0 || resource < 0) {
+    printf("ERROR: frame graph write without a pass or target\n");
+    return;
+  }
+  FrameGraphPass *p = &graph->passes[pass];
+  if (graph->resources[resource].format == FRAME_GRAPH_DEPTH) {
+    if (p->kind != FRAME_GRAPH_CALLBACK) {
+      printf("ERROR: full-screen pass %s cannot write depth\n", p->name);
+      return;
+    }
+    p->depth = resource;
+    p->depth_load = load;
+  } else {
+    p->colour = resource;
+    p->colour_load = load;
+  }
+}
+
+GLuint frame_graph_texture(const FrameGraph *graph, int resource) {
+  int target = graph->resources[resource].target;
+  return target >= 0 ? graph->targets[target].texture : 0;
+}
+
+static bool writes(const FrameGraphPass *pass, int resource) {
+  return pass->colour == resource || pass->depth == resource;
+}
+
+/* The one pass left writing resource, or -1 if there are none or
+   several */
+static int single_writer(const FrameGraph *graph, int resource) {
+  int writer = -1;
+  for (int p = 0; p < graph->num_passes; p++) {
+    if (!graph->passes[p].culled && writes(&graph->passes[p], resource)) {
+      if (writer >= 0) {
+	return -1;
+      }
+      writer = p;
+    }
+  }
+  return writer;
+}
+
+static void release_reads(FrameGraph *graph, const FrameGraphPass *pass,
+			  int *stack, int *stack_size) {
+  for (int s = -1; s < pass->num_samplers; s++) {
+    int r = s < 0 ? pass->input : pass->samplers[s];
+    if (r < 0) {
+      continue;
+    }
+    graph->resources[r].readers -= 1;
+    if (graph->resources[r].readers == 0 && !graph->resources[r].imported) {
+      stack[(*stack_size)++] = r;
+    }
+  }
+}
+
+/* Drop what never reaches an imported target: counting readers per
+   target and written targets per pass, then unwinding from the targets
+   nobody reads */
+static void cull_passes(FrameGraph *graph) {
+  int refs[FRAME_GRAPH_MAX_PASSES];
+  int stack[FRAME_GRAPH_MAX_RESOURCES * FRAME_GRAPH_MAX_PASSES];
+  int stack_size = 0;
+
+  for (int r = 0; r < graph->num_resources; r++) {
+    if (graph->resources[r].readers == 0 && !graph->resources[r].imported) {
+      stack[stack_size++] = r;
+    }
+  }
+  for (int p = 0; p < graph->num_passes; p++) {
+    FrameGraphPass *pass = &graph->passes[p];
+    refs[p] = (pass->colour >= 0) + (pass->depth >= 0);
+    if (refs[p] == 0) {
+      pass->culled = true;
+      release_reads(graph, pass, stack, &stack_size);
+    }
+  }
+
+  while (stack_size > 0) {
+    int r = stack[--stack_size];
+    for (int p = 0; p < graph->num_passes; p++) {
+      FrameGraphPass *pass = &graph->passes[p];
+      if (pass->culled || !writes(pass, r)) {
+	continue;
+      }
+      refs[p] -= 1;
+      if (refs[p] == 0) {
+	pass->culled = true;
+	release_reads(graph, pass, stack, &stack_size);
+      }
+    }
+  }
+}
+
+/* Fold pixel passes into the full-screen pass whose output they read,
+   when that output is theirs alone */
+static void merge_passes(FrameGraph *graph) {
+  for (int b = 0; b < graph->num_passes; b++) {
+    FrameGraphPass *pass = &graph->passes[b];
+    if (pass->culled || pass->kind != FRAME_GRAPH_PIXEL || pass->input < 0
+	|| pass->colour < 0) {
+      continue;
+    }
+    FrameGraphResource *between = &graph->resources[pass->input];
+    const FrameGraphResource *output = &graph->resources[pass->colour];
+    int a = single_writer(graph, pass->input);
+    if (between->imported || between->readers != 1 || a < 0 || a >= b
+	|| graph->passes[a].kind == FRAME_GRAPH_CALLBACK
+	|| single_writer(graph, pass->colour) != b
+	|| output->width != between->width || output->height != between->height) {
+      continue;
+    }
+
+    /* It will run where the chain's head does, so whatever else it
+       samples has to be drawn by then */
+    int head = graph->passes[a].head;
+    int num_samplers = pass->num_samplers;
+    for (int p = head; p >= 0; p = graph->passes[p].next) {
+      num_samplers += graph->passes[p].num_samplers;
+    }
+    bool ready = num_samplers <= FRAME_GRAPH_MAX_SAMPLERS * 2;
+    for (int s = 0; s < pass->num_samplers && ready; s++) {
+      for (int p = head; p < graph->num_passes; p++) {
+	if (!graph->passes[p].culled && writes(&graph->passes[p], pass->samplers[s])) {
+	  ready = false;
+	}
+      }
+    }
+    if (!ready) {
+      continue;
+    }
+
+    pass->head = head;
+    graph->passes[a].next = b;
+    between->elided = true;
+    graph->merged_passes += 1;
+    graph->merged_traffic += 2 * resource_bytes(between);
+  }
+}
+
+static void touch(FrameGraph *graph, int resource, int order) {
+  if (resource < 0) {
+    return;
+  }
+  FrameGraphResource *r = &graph->resources[resource];
+  if (r->first_use < 0) {
+    r->first_use = order;
+  }
+  r->last_use = order;
+}
+
+/* Transient targets in order of first use, each taking a free texture
+   of its kind if there is one */
+static void allocate_targets(FrameGraph *graph, int num_orders) {
+  for (int o = 0; o < num_orders; o++) {
+    for (int r = 0; r < graph->num_resources; r++) {
+      FrameGraphResource *resource = &graph->resources[r];
+      if (resource->imported || resource->elided || resource->first_use != o) {
+	continue;
+      }
+      graph->declared_bytes += resource_bytes(resource);
+
+      int t = -1;
+      for (int i = 0; i < graph->num_targets && graph->alias; i++) {
+	FrameGraphTarget *target = &graph->targets[i];
+	if (target->format == resource->format && target->width == resource->width
+	    && target->height == resource->height && target->busy_until < o) {
+	  t = i;
+	  graph->aliased_resources += 1;
+	  break;
+	}
+      }
+      if (t < 0) {
+	t = graph->num_targets++;
+	FrameGraphTarget *target = &graph->targets[t];
+	target->format = resource->format;
+	target->width = resource->width;
+	target->height = resource->height;
+	graph->allocated_bytes += resource_bytes(resource);
+
+	if (resource->format == FRAME_GRAPH_DEPTH) {
+	  glGenRenderbuffers(1, &target->renderbuffer);
+	  glBindRenderbuffer(GL_RENDERBUFFER, target->renderbuffer);
+	  glRenderbufferStorage(GL_RENDERBUFFER,
+				gl_caps.es3 ? GL_DEPTH24_STENCIL8 : GL_DEPTH_COMPONENT16,
+				target->width, target->height);
+	  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	} else {
+	  glGenTextures(1, &target->texture);
+	  glBindTexture(GL_TEXTURE_2D, target->texture);
+	  glTexImage2D(GL_TEXTURE_2D, 0, gl_caps.es3 ? GL_RGBA8 : GL_RGBA,
+		       target->width, target->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	  glBindTexture(GL_TEXTURE_2D, 0);
+	}
+      }
+      graph->targets[t].busy_until = resource->last_use;
+      resource->target = t;
+    }
+  }
+}
+
+/* The chain's generated shader: every snippet with apply renamed, then
+   a main calling them in order */
+static bool build_program(FrameGraph *graph, FrameGraphPass *head) {
+  size_t length = 1024;
+  for (int p = head - graph->passes; p >= 0; p = graph->passes[p].next) {
+    length += strlen(graph->passes[p].source) + 128;
+  }
+  char *source = (char *) malloc(length);
+  size_t used = snprintf(source, length,
+			 "#version 100\n"
+			 "precision mediump float;\n"
+			 "varying vec2 uv;\n"
+			 "uniform sampler2D source;\n"
+			 "uniform vec2 sourceTexel;\n");
+  for (int p = head - graph->passes; p >= 0; p = graph->passes[p].next) {
+    used += snprintf(source + used, length - used, "#define apply frame_graph_pass%d\n%s\n"
+		     "#undef apply\n", p, graph->passes[p].source);
+  }
+  used += snprintf(source + used, length - used, "void main() {\n");
+  int first = head - graph->passes;
+  if (head->kind == FRAME_GRAPH_SAMPLE) {
+    used += snprintf(source + used, length - used,
+		     "  vec4 colour = frame_graph_pass%d(uv);\n", first);
+  } else {
+    used += snprintf(source + used, length - used,
+		     "  vec4 colour = frame_graph_pass%d(texture2D(source, uv), uv);\n", first);
+  }
+  for (int p = head->next; p >= 0; p = graph->passes[p].next) {
+    used += snprintf(source + used, length - used,
+		     "  colour = frame_graph_pass%d(colour, uv);\n", p);
+  }
+  snprintf(source + used, length - used, "  gl_FragColor = colour;\n}\n");
+
+  head->program = load_shaders_source(fullscreen_vertex_source, source);
+  free(source);
+  if (head->program == 0) {
+    printf("ERROR: frame graph pass %s did not compile\n", head->name);
+    return false;
+  }
+
+  glUseProgram(head->program);
+  head->position_attr = glGetAttribLocation(head->program, "vPosition");
+  head->source_uniform = glGetUniformLocation(head->program, "source");
+  head->texel_uniform = glGetUniformLocation(head->program, "sourceTexel");
+  glUniform1i(head->source_uniform, 0);
+  if (head->input >= 0) {
+    const FrameGraphResource *input = &graph->resources[head->input];
+    glUniform2f(head->texel_uniform, 1.0f / input->width, 1.0f / input->height);
+  }
+  head->num_bound = 0;
+  for (int p = first; p >= 0; p = graph->passes[p].next) {
+    const FrameGraphPass *pass = &graph->passes[p];
+    for (int s = 0; s < pass->num_samplers; s++) {
+      int unit = head->num_bound + 1;
+      head->bound[head->num_bound] = pass->samplers[s];
+      head->bound_uniforms[head->num_bound] =
+	glGetUniformLocation(head->program, pass->sampler_names[s]);
+      glUniform1i(head->bound_uniforms[head->num_bound], unit);
+      head->num_bound += 1;
+    }
+  }
+  glUseProgram(0);
+  return true;
+}
+
+/* Framebuffer, clears and invalidation for a chain's targets */
+static bool set_up_pass(FrameGraph *graph, FrameGraphPass *head,
+			const FrameGraphPass *last) {
+  int colour = last->colour;
+  int depth = head->depth;
+  FrameGraphLoad colour_load = last->colour_load;
+
+  bool imported = colour >= 0 && graph->resources[colour].imported;
+  bool window = imported && graph->resources[colour].framebuffer == 0;
+  GLenum colour_attachment = window ? GL_COLOR : GL_COLOR_ATTACHMENT0;
+  GLenum depth_attachment = window ? GL_DEPTH
+    : (gl_caps.es3 ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT);
+  const FrameGraphResource *sized = &graph->resources[colour >= 0 ? colour : depth];
+  head->width = sized->width;
+  head->height = sized->height;
+
+  if (imported) {
+    if (depth >= 0) {
+      printf("ERROR: frame graph pass %s draws into %s with a depth target of its own\n",
+	     head->name, graph->resources[colour].name);
+      return false;
+    }
+    head->framebuffer = graph->resources[colour].framebuffer;
+  } else {
+    glGenFramebuffers(1, &head->framebuffer);
+    graph->framebuffers[graph->num_framebuffers++] = head->framebuffer;
+    glBindFramebuffer(GL_FRAMEBUFFER, head->framebuffer);
+    if (colour >= 0) {
+      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+			     frame_graph_texture(graph, colour), 0);
+    }
+    if (depth >= 0) {
+      glFramebufferRenderbuffer(GL_FRAMEBUFFER, depth_attachment, GL_RENDERBUFFER,
+				graph->targets[graph->resources[depth].target].renderbuffer);
+    }
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+      printf("ERROR: frame graph pass %s framebuffer incomplete: 0x%x\n", head->name,
+	     status);
+      return false;
+    }
+  }
+
+  head->clear_bits = 0;
+  if (colour >= 0 && colour_load == FRAME_GRAPH_CLEAR) {
+    head->clear_bits |= GL_COLOR_BUFFER_BIT;
+  }
+  if (depth >= 0 && head->depth_load == FRAME_GRAPH_CLEAR) {
+    head->clear_bits |= GL_DEPTH_BUFFER_BIT | (gl_caps.es3 ? GL_STENCIL_BUFFER_BIT : 0);
+  }
+
+  /* Nothing to load what is overwritten or cleared anyway, and nothing
+     to store what nobody reads again. The window's depth is never used
+     by the graph either. */
+  if (!graph->invalidate || gl_caps.InvalidateFramebuffer == NULL) {
+    return true;
+  }
+  int order = head->order;
+  if (colour >= 0 && colour_load == FRAME_GRAPH_DISCARD) {
+    head->invalidate_before[head->num_before++] = colour_attachment;
+    graph->invalidated_traffic += resource_bytes(&graph->resources[colour]);
+  }
+  if (depth >= 0 && head->depth_load == FRAME_GRAPH_DISCARD) {
+    head->invalidate_before[head->num_before++] = depth_attachment;
+    graph->invalidated_traffic += resource_bytes(&graph->resources[depth]);
+  }
+  if (colour >= 0 && !imported && graph->resources[colour].last_use == order) {
+    head->invalidate_after[head->num_after++] = colour_attachment;
+    graph->invalidated_traffic += resource_bytes(&graph->resources[colour]);
+  }
+  if (depth >= 0 && graph->resources[depth].last_use == order) {
+    head->invalidate_after[head->num_after++] = depth_attachment;
+    graph->invalidated_traffic += resource_bytes(&graph->resources[depth]);
+  }
+  if (window) {
+    head->invalidate_after[head->num_after++] = GL_DEPTH;
+    head->invalidate_after[head->num_after++] = GL_STENCIL;
+    graph->invalidated_traffic += (size_t) head->width * head->height * 4;
+  }
+  return true;
+}
+
+bool frame_graph_compile(FrameGraph *graph) {
+
+  if (graph->compiled) {
+    printf("ERROR: frame graph compiled twice\n");
+    return false;
+  }
+  graph->compiled = true;
+
+  for (int p = 0; p < graph->num_passes; p++) {
+    const FrameGraphPass *pass = &graph->passes[p];
+    if (pass->input >= 0) {
+      graph->resources[pass->input].readers += 1;
+    }
+    for (int s = 0; s < pass->num_samplers; s++) {
+      graph->resources[pass->samplers[s]].readers += 1;
+    }
+  }
+
+  if (graph->cull) {
+    cull_passes(graph);
+    for (int p = 0; p < graph->num_passes; p++) {
+      const FrameGraphPass *pass = &graph->passes[p];
+      if (!pass->culled) {
+	continue;
+      }
+      graph->culled_passes += 1;
+      for (int s = -1; s < pass->num_samplers; s++) {
+	int r = s < 0 ? pass->input : pass->samplers[s];
+	if (r >= 0) {
+	  graph->culled_traffic += resource_bytes(&graph->resources[r]);
+	}
+      }
+      for (int w = 0; w < 2; w++) {
+	int r = w == 0 ? pass->colour : pass->depth;
+	if (r >= 0) {
+	  graph->culled_traffic += resource_bytes(&graph->resources[r]);
+	}
+      }
+    }
+  }
+  if (graph->merge) {
+    merge_passes(graph);
+  }
+
+  /* Execution order, chains running where their head is, and when each
+     target is first and last used */
+  int num_orders = 0;
+  for (int p = 0; p < graph->num_passes; p++) {
+    FrameGraphPass *pass = &graph->passes[p];
+    if (!pass->culled && pass->head == p) {
+      pass->order = num_orders++;
+    }
+  }
+  for (int r = 0; r < graph->num_resources; r++) {
+    graph->resources[r].first_use = -1;
+    graph->resources[r].last_use = -1;
+  }
+  for (int p = 0; p < graph->num_passes; p++) {
+    FrameGraphPass *pass = &graph->passes[p];
+    if (pass->culled) {
+      continue;
+    }
+    pass->order = graph->passes[pass->head].order;
+    int reads[FRAME_GRAPH_MAX_SAMPLERS + 1];
+    reads[0] = pass->input;
+    memcpy(reads + 1, pass->samplers, pass->num_samplers * sizeof(int));
+    for (int i = 0; i <= pass->num_samplers; i++) {
+      if (reads[i] < 0 || !graph->resources[reads[i]].elided) {
+	touch(graph, reads[i], pass->order);
+      }
+    }
+    if (pass->colour < 0 || !graph->resources[pass->colour].elided) {
+      touch(graph, pass->colour, pass->order);
+    }
+    touch(graph, pass->depth, pass->order);
+  }
+  allocate_targets(graph, num_orders);
+
+  glGenBuffers(1, &graph->triangle_buffer);
+  glBindBuffer(GL_ARRAY_BUFFER, graph->triangle_buffer);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(fullscreen_triangle), fullscreen_triangle,
+	       GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  bool ok = true;
+  for (int p = 0; p < graph->num_passes; p++) {
+    FrameGraphPass *pass = &graph->passes[p];
+    if (pass->culled || pass->head != p) {
+      continue;
+    }
+    int last = p;
+    while (graph->passes[last].next >= 0) {
+      last = graph->passes[last].next;
+    }
+    ok = set_up_pass(graph, pass, &graph->passes[last]) && ok;
+    if (pass->kind != FRAME_GRAPH_CALLBACK) {
+      ok = build_program(graph, pass) && ok;
+    }
+  }
+  return ok;
+}
+
+static void invalidate(GLsizei count, const GLenum *attachments) {
+  if (count > 0) {
+    gl_caps.InvalidateFramebuffer(GL_FRAMEBUFFER, count, attachments);
+  }
+}
+
+static void draw_chain(FrameGraph *graph, const FrameGraphPass *head) {
+  GLboolean depth_test = glIsEnabled(GL_DEPTH_TEST);
+  glDisable(GL_DEPTH_TEST);
+  glUseProgram(head->program);
+
+  if (head->input >= 0) {
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, frame_graph_texture(graph, head->input));
+  }
+  for (int b = 0; b < head->num_bound; b++) {
+    glActiveTexture(GL_TEXTURE1 + b);
+    glBindTexture(GL_TEXTURE_2D, frame_graph_texture(graph, head->bound[b]));
+  }
+  for (int p = head - graph->passes; p >= 0; p = graph->passes[p].next) {
+    if (graph->passes[p].setup != NULL) {
+      graph->passes[p].setup(graph->passes[p].user, head->program);
+    }
+  }
+
+  glBindBuffer(GL_ARRAY_BUFFER, graph->triangle_buffer);
+  glEnableVertexAttribArray(head->position_attr);
+  glVertexAttribPointer(head->position_attr, 2, GL_FLOAT, GL_FALSE, 0, NULL);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  glDisableVertexAttribArray(head->position_attr);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  for (int b = head->num_bound - 1; b >= 0; b--) {
+    glActiveTexture(GL_TEXTURE1 + b);
+    glBindTexture(GL_TEXTURE_2D, 0);
+  }
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  if (depth_test) {
+    glEnable(GL_DEPTH_TEST);
+  }
+}
+
+int frame_graph_execute(FrameGraph *graph) {
+
+  if (graph->open_pass >= 0) {
+    const FrameGraphPass *open = &graph->passes[graph->open_pass];
+    invalidate(open->num_after, open->invalidate_after);
+    graph->open_pass = -1;
+  }
+
+  while (graph->cursor < graph->num_passes) {
+    int index = graph->cursor++;
+    FrameGraphPass *pass = &graph->passes[index];
+    if (pass->culled || pass->head != index) {
+      continue;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, pass->framebuffer);
+    glViewport(0, 0, pass->width, pass->height);
+    invalidate(pass->num_before, pass->invalidate_before);
+    if (pass->clear_bits != 0) {
+      glClear(pass->clear_bits);
+    }
+
+    if (pass->kind == FRAME_GRAPH_CALLBACK) {
+      if (pass->execute == NULL) {
+	graph->open_pass = index;
+	return index;
+      }
+      pass->execute(pass->user);
+    } else {
+      draw_chain(graph, pass);
+    }
+    invalidate(pass->num_after, pass->invalidate_after);
+  }
+
+  graph->cursor = 0;
+  return -1;
+}
+
+void frame_graph_print(const FrameGraph *graph) {
+
+  int runs = 0;
+  for (int p = 0; p < graph->num_passes; p++) {
+    runs += !graph->passes[p].culled && graph->passes[p].head == p;
+  }
+  printf("Frame graph: %d passes, %d culled, %d merged, %d run; invalidate %s\n",
+	 graph->num_passes, graph->culled_passes, graph->merged_passes, runs,
+	 !graph->invalidate ? "off"
+	 : gl_caps.InvalidateFramebuffer != NULL ? "on" : "unsupported");
+
+  for (int p = 0; p < graph->num_passes; p++) {
+    const FrameGraphPass *pass = &graph->passes[p];
+    char target[96] = "-";
+    if (pass->colour >= 0) {
+      const FrameGraphResource *colour = &graph->resources[pass->colour];
+      if (colour->elided) {
+	snprintf(target, sizeof(target), "%s (merged away)", colour->name);
+      } else if (colour->imported || colour->target < 0) {
+	snprintf(target, sizeof(target), "%s", colour->name);
+      } else {
+	snprintf(target, sizeof(target), "%s %dx%d in #%d", colour->name,
+		 colour->width, colour->height, colour->target);
+      }
+    }
+    printf("\t%-12s %-8s -> %-34s", pass->name, kind_name(pass->kind), target);
+    if (pass->culled) {
+      printf(" culled");
+    } else if (pass->head != p) {
+      printf(" merged into %s", graph->passes[pass->head].name);
+    } else {
+      printf(" run %d", pass->order);
+      if (pass->num_before + pass->num_after > 0) {
+	printf(", %d invalidated", pass->num_before + pass->num_after);
+      }
+    }
+    printf("\n");
+  }
+
+  double mb = 1024.0 * 1024.0;
+  size_t saved = graph->culled_traffic + graph->merged_traffic + graph->invalidated_traffic;
+  printf("\ttargets: %.1f MB drawn into, %.1f MB allocated in %d textures and "
+	 "renderbuffers (%d aliased, %.1f MB saved)\n",
+	 graph->declared_bytes / mb, graph->allocated_bytes / mb, graph->num_targets,
+	 graph->aliased_resources, (graph->declared_bytes - graph->allocated_bytes) / mb);
+  printf("\ttraffic saved per frame: %.1f MB culled, %.1f MB merged, %.1f MB not "
+	 "loaded or stored; %.2f GB/s at 60 fps\n",
+	 graph->culled_traffic / mb, graph->merged_traffic / mb,
+	 graph->invalidated_traffic / mb, saved * 60.0 / (mb * 1024.0));
+}
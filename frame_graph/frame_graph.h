@@ -0,0 +1,215 @@
+#ifndef FRAME_GRAPH_H_
+#define FRAME_GRAPH_H_
+
+/* A frame graph for render passes and the targets between them.
+
+   Instead of each pass owning its framebuffers, passes declare what they
+   read and write: transient targets the graph creates, or imported ones
+   such as the window's framebuffer. frame_graph_compile then works out
+   the frame once:
+
+   - Culling: passes whose results never reach an imported target are
+     dropped, and so are the targets only they used.
+   - Merging: a full-screen pass that only reads its input at its own
+     pixel is folded into the full-screen pass that produced that input,
+     when nothing else reads it. Their snippets are chained in one
+     generated shader and the target between them is never allocated,
+     written or read.
+   - Aliasing: transient targets whose lifetimes do not overlap share a
+     texture when their format and size match. GL has no memory
+     aliasing between formats, so that is as far as sharing can go.
+   - Load and store: targets a pass overwrites entirely are invalidated
+     before it and targets nothing reads afterwards are invalidated
+     after it, with glInvalidateFramebuffer on ES3 or
+     EXT_discard_framebuffer, so a tile-based GPU neither loads them into
+     tile memory nor writes them back out.
+
+   Full-screen passes are GLSL snippets defining one function, apply:
+
+     FRAME_GRAPH_PIXEL   vec4 apply(vec4 colour, vec2 uv), colour being
+                         the input at this pixel
+     FRAME_GRAPH_SAMPLE  vec4 apply(vec2 uv), sampling the input as it
+                         likes through sampler2D source, with
+                         vec2 sourceTexel one texel
+
+   Any other targets they read are sampler2D uniforms named when they
+   are declared. Snippets are GLSL ES 1.00, and uniforms must not clash
+   with the other snippets they may be merged with.
+
+   The graph is built and compiled once and then run every frame with
+   frame_graph_execute. Targets are RGBA8 colour textures or depth
+   renderbuffers.
+*/
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <GLES2/gl2.h>
+
+#include "gl_caps.h"
+
+#define FRAME_GRAPH_MAX_RESOURCES 32
+#define FRAME_GRAPH_MAX_PASSES 32
+#define FRAME_GRAPH_MAX_SAMPLERS 4  /* besides a full-screen pass's input */
+
+typedef enum {
+  FRAME_GRAPH_RGBA8,
+  FRAME_GRAPH_DEPTH    /* 24 bit with stencil on ES3, 16 bit on ES2 */
+} FrameGraphFormat;
+
+typedef enum {
+  FRAME_GRAPH_LOAD,    /* keep what is there */
+  FRAME_GRAPH_CLEAR,   /* to the current clear colour and depth */
+  FRAME_GRAPH_DISCARD  /* every pixel gets overwritten */
+} FrameGraphLoad;
+
+typedef enum {
+  FRAME_GRAPH_CALLBACK,
+  FRAME_GRAPH_PIXEL,
+  FRAME_GRAPH_SAMPLE
+} FrameGraphPassKind;
+
+typedef void (*FrameGraphExecute)(void *user);
+/* Set a full-screen pass's own uniforms; program is already in use */
+typedef void (*FrameGraphSetup)(void *user, GLuint program);
+
+typedef struct {
+  const char *name;
+  FrameGraphFormat format;
+  int width;
+  int height;
+  bool imported;
+  GLuint framebuffer;  /* imported: the framebuffer it is the colour of */
+
+  /* From compile */
+  int readers;
+  int first_use;       /* execution order, -1 when unused */
+  int last_use;
+  bool elided;         /* merged away, never allocated */
+  int target;          /* into targets, -1 for imported or unused */
+} FrameGraphResource;
+
+typedef struct {
+  const char *name;
+  FrameGraphPassKind kind;
+  FrameGraphExecute execute;  /* NULL: drawn by the caller, see execute */
+  FrameGraphSetup setup;
+  void *user;
+  char *source;        /* full-screen snippet, owned */
+
+  int input;           /* full-screen input, -1 for none */
+  int num_samplers;
+  int samplers[FRAME_GRAPH_MAX_SAMPLERS];
+  const char *sampler_names[FRAME_GRAPH_MAX_SAMPLERS];
+  int colour;          /* written targets, -1 for none */
+  int depth;
+  FrameGraphLoad colour_load;
+  FrameGraphLoad depth_load;
+
+  /* From compile */
+  bool culled;
+  int head;            /* the pass it runs in: itself unless merged */
+  int next;            /* next pass merged into this chain, -1 at the end */
+  int order;           /* position in execution, -1 when not run */
+  GLuint framebuffer;
+  int width;
+  int height;
+  GLuint program;      /* chain heads only */
+  GLint position_attr;
+  GLint source_uniform;
+  GLint texel_uniform;
+  int num_bound;       /* samplers of the whole chain */
+  int bound[FRAME_GRAPH_MAX_SAMPLERS * 2];
+  GLint bound_uniforms[FRAME_GRAPH_MAX_SAMPLERS * 2];
+  GLbitfield clear_bits;
+  int num_before;
+  GLenum invalidate_before[3];
+  int num_after;
+  GLenum invalidate_after[3];
+} FrameGraphPass;
+
+typedef struct {
+  FrameGraphFormat format;
+  int width;
+  int height;
+  GLuint texture;      /* RGBA8 */
+  GLuint renderbuffer; /* DEPTH */
+  int busy_until;      /* last use of whatever holds it */
+} FrameGraphTarget;
+
+typedef struct {
+  /* Set before compiling to compare with and without */
+  bool cull;
+  bool merge;
+  bool alias;
+  bool invalidate;
+
+  int num_resources;
+  FrameGraphResource resources[FRAME_GRAPH_MAX_RESOURCES];
+  int num_passes;
+  FrameGraphPass passes[FRAME_GRAPH_MAX_PASSES];
+
+  int num_targets;
+  FrameGraphTarget targets[FRAME_GRAPH_MAX_RESOURCES];
+  int num_framebuffers;
+  GLuint framebuffers[FRAME_GRAPH_MAX_PASSES];
+  GLuint triangle_buffer;
+  bool compiled;
+
+  /* Where frame_graph_execute is up to, and the caller-drawn pass it
+     returned, if any */
+  int cursor;
+  int open_pass;
+
+  /* From compile: what it saved, bandwidth per frame */
+  int culled_passes;
+  int merged_passes;
+  int aliased_resources;
+  size_t declared_bytes;  /* every target that is drawn, separately */
+  size_t allocated_bytes;
+  size_t culled_traffic;
+  size_t merged_traffic;
+  size_t invalidated_traffic;
+} FrameGraph;
+
+void frame_graph_init(FrameGraph *graph);
+
+/* Frees everything compile made */
+void frame_graph_destroy(FrameGraph *graph);
+
+/* Targets; the returned index is their handle */
+int frame_graph_create(FrameGraph *graph, const char *name, FrameGraphFormat format,
+		       int width, int height);
+int frame_graph_import(FrameGraph *graph, const char *name, GLuint framebuffer,
+		       int width, int height);
+
+/* Passes run in the order they are added. execute NULL makes a pass the
+   caller draws between frame_graph_execute calls. */
+int frame_graph_add_pass(FrameGraph *graph, const char *name,
+			 FrameGraphExecute execute, void *user);
+int frame_graph_add_fullscreen(FrameGraph *graph, const char *name,
+			       FrameGraphPassKind kind, const char *source, int input,
+			       FrameGraphSetup setup, void *user);
+
+/* A target a pass samples, bound to the snippet's sampler uniform, or
+   for a callback pass to fetch with frame_graph_texture */
+void frame_graph_read(FrameGraph *graph, int pass, int resource, const char *sampler);
+/* A target a pass draws into, one colour and one depth at most */
+void frame_graph_write(FrameGraph *graph, int pass, int resource, FrameGraphLoad load);
+
+/* Cull, merge, alias and create everything. Needs a current context. */
+bool frame_graph_compile(FrameGraph *graph);
+
+/* What a transient target ended up as, after compiling */
+GLuint frame_graph_texture(const FrameGraph *graph, int resource);
+
+/* Run the frame's passes in order. A pass the caller draws stops it:
+   its targets are bound and cleared and its index returned, and the
+   next call finishes it and carries on. Returns -1 once the frame is
+   done. */
+int frame_graph_execute(FrameGraph *graph);
+
+/* The compiled passes, their targets and what was saved */
+void frame_graph_print(const FrameGraph *graph);
+
+#endif // FRAME_GRAPH_H_
@@ -0,0 +1,204 @@
+/* Frame pacing and input-to-present latency measurement. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame_pacing.h"
+
+/* Give up waiting on a fence after a second rather than hang forever */
+#define FENCE_TIMEOUT_NS 1000000000ull
+
+static const char *swap_mode_name(SwapMode mode) {
+  switch (mode) {
+  case SWAP_IMMEDIATE: return "immediate";
+  case SWAP_ADAPTIVE: return "adaptive";
+  default: return "vsync";
+  }
+}
+
+static const char *throttle_name(ThrottleMode mode) {
+  switch (mode) {
+  case THROTTLE_FINISH: return "finish";
+  case THROTTLE_FENCE: return "fence";
+  default: return "none";
+  }
+}
+
+static double ms_since(Uint64 start) {
+  return (double) (SDL_GetPerformanceCounter() - start) * 1000.0
+    / (double) SDL_GetPerformanceFrequency();
+}
+
+static void reset_stats(FramePacer *pacer) {
+  pacer->frames = 0;
+  pacer->samples = 0;
+  pacer->latency_sum_ms = 0.0;
+  pacer->latency_min_ms = 1e9;
+  pacer->latency_max_ms = 0.0;
+  pacer->throttle_wait_ms = 0.0;
+}
+
+void latency_default_config(LatencyConfig *config) {
+  config->swap_mode = SWAP_VSYNC;
+  config->frame_delay_ms = 0;
+  config->throttle = THROTTLE_NONE;
+  config->max_queued_frames = 1;
+  config->report_frames = 5 * 60;
+}
+
+void latency_parse_args(LatencyConfig *config, int argc, char *argv[]) {
+
+  for (int i = 1; i < argc - 1; i++) {
+    const char *value = argv[i + 1];
+
+    if (strcmp(argv[i], "--swap") == 0) {
+      if (strcmp(value, "adaptive") == 0) {
+	config->swap_mode = SWAP_ADAPTIVE;
+      } else if (strcmp(value, "immediate") == 0) {
+	config->swap_mode = SWAP_IMMEDIATE;
+      } else {
+	config->swap_mode = SWAP_VSYNC;
+      }
+    } else if (strcmp(argv[i], "--frame-delay") == 0) {
+      config->frame_delay_ms = atoi(value);
+    } else if (strcmp(argv[i], "--throttle") == 0) {
+      if (strcmp(value, "finish") == 0) {
+	config->throttle = THROTTLE_FINISH;
+      } else if (strcmp(value, "fence") == 0) {
+	config->throttle = THROTTLE_FENCE;
+      } else {
+	config->throttle = THROTTLE_NONE;
+      }
+    } else if (strcmp(argv[i], "--max-queued") == 0) {
+      config->max_queued_frames = atoi(value);
+    }
+  }
+
+  if (config->frame_delay_ms < 0) {
+    config->frame_delay_ms = 0;
+  }
+  if (config->max_queued_frames < 1) {
+    config->max_queued_frames = 1;
+  } else if (config->max_queued_frames > PACING_MAX_QUEUED_FRAMES) {
+    config->max_queued_frames = PACING_MAX_QUEUED_FRAMES;
+  }
+}
+
+void latency_init(FramePacer *pacer, const LatencyConfig *config) {
+
+  memset(pacer, 0, sizeof(*pacer));
+  pacer->config = *config;
+  reset_stats(pacer);
+
+  /* Adaptive vsync needs EXT_swap_control_tear, which SDL reports by
+     failing the call. */
+  pacer->active_swap_mode = config->swap_mode;
+  if (SDL_GL_SetSwapInterval(config->swap_mode) != 0) {
+    printf("Swap interval %s refused (%s), using vsync\n",
+	   swap_mode_name(config->swap_mode), SDL_GetError());
+    pacer->active_swap_mode = SWAP_VSYNC;
+    SDL_GL_SetSwapInterval(SWAP_VSYNC);
+  }
+
+  /* Fences are ES3 only, glFinish is the ES2 fallback */
+  if (pacer->config.throttle == THROTTLE_FENCE && gl_caps.FenceSync == NULL) {
+    printf("No fence support, throttling with glFinish instead\n");
+    pacer->config.throttle = THROTTLE_FINISH;
+  }
+
+  printf("Frame pacing: swap %s, frame delay %d ms, throttle %s",
+	 swap_mode_name(pacer->active_swap_mode),
+	 pacer->config.frame_delay_ms,
+	 throttle_name(pacer->config.throttle));
+  if (pacer->config.throttle == THROTTLE_FENCE) {
+    printf(" (%d frames queued)", pacer->config.max_queued_frames);
+  }
+  printf("\n");
+}
+
+void latency_begin_frame(FramePacer *pacer) {
+
+  /* Wait until the frame max_queued_frames ago has finished on the GPU.
+     Its fence is the one we are about to overwrite. */
+  if (pacer->config.throttle == THROTTLE_FENCE) {
+    GLsync oldest = pacer->fences[pacer->fence_ix];
+    if (oldest != NULL) {
+      Uint64 wait_start = SDL_GetPerformanceCounter();
+      gl_caps.ClientWaitSync(oldest, GL_SYNC_FLUSH_COMMANDS_BIT,
+			     FENCE_TIMEOUT_NS);
+      gl_caps.DeleteSync(oldest);
+      pacer->fences[pacer->fence_ix] = NULL;
+      pacer->throttle_wait_ms += ms_since(wait_start);
+    }
+  }
+
+  /* Push the input sampling point towards the next vsync */
+  if (pacer->config.frame_delay_ms > 0) {
+    SDL_Delay(pacer->config.frame_delay_ms);
+  }
+}
+
+void latency_mark_input(FramePacer *pacer, const SDL_Event *event) {
+  if (!pacer->input_pending) {
+    pacer->input_pending = true;
+    pacer->input_timestamp = event->common.timestamp;
+  }
+}
+
+void latency_end_frame(FramePacer *pacer, SDL_Window *window) {
+
+  SDL_GL_SwapWindow(window);
+
+  if (pacer->config.throttle == THROTTLE_FINISH) {
+    Uint64 wait_start = SDL_GetPerformanceCounter();
+    glFinish();
+    pacer->throttle_wait_ms += ms_since(wait_start);
+  } else if (pacer->config.throttle == THROTTLE_FENCE) {
+    pacer->fences[pacer->fence_ix] =
+      gl_caps.FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    pacer->fence_ix = (pacer->fence_ix + 1) % pacer->config.max_queued_frames;
+  }
+
+  /* Input that was consumed this frame has now been handed over for
+     presentation. */
+  if (pacer->input_pending) {
+    double latency = (double) (SDL_GetTicks() - pacer->input_timestamp);
+    pacer->latency_sum_ms += latency;
+    if (latency < pacer->latency_min_ms) {
+      pacer->latency_min_ms = latency;
+    }
+    if (latency > pacer->latency_max_ms) {
+      pacer->latency_max_ms = latency;
+    }
+    pacer->samples += 1;
+    pacer->input_pending = false;
+  }
+
+  pacer->frames += 1;
+  if (pacer->frames == pacer->config.report_frames) {
+    if (pacer->samples > 0) {
+      printf("input-to-present latency (%s/%dms/%s): "
+	     "avg %.2f ms, min %.0f ms, max %.0f ms over %d inputs, "
+	     "throttle wait %.2f ms/frame\n",
+	     swap_mode_name(pacer->active_swap_mode),
+	     pacer->config.frame_delay_ms,
+	     throttle_name(pacer->config.throttle),
+	     pacer->latency_sum_ms / pacer->samples,
+	     pacer->latency_min_ms, pacer->latency_max_ms, pacer->samples,
+	     pacer->throttle_wait_ms / pacer->frames);
+    } else {
+      printf("input-to-present latency: no input in the last %d frames\n",
+	     pacer->frames);
+    }
+    reset_stats(pacer);
+  }
+}
+
+void latency_destroy(FramePacer *pacer) {
+  for (int i = 0; i < PACING_MAX_QUEUED_FRAMES; i++) {
+    if (pacer->fences[i] != NULL) {
+      gl_caps.DeleteSync(pacer->fences[i]);
+      pacer->fences[i] = NULL;
+    }
+  }
+}
@@ -0,0 +1,91 @@
+#ifndef FRAME_PACING_H_
+#define FRAME_PACING_H_
+
+/* Low-latency presentation helpers.
+
+   The usual loop is poll -> update -> draw -> swap with vsync on, so an
+   input event that arrives just after the poll is only seen a frame
+   later, and the driver is free to queue up a couple of frames on top.
+   The frame pacer lets a program:
+   - pick the swap interval (vsync, adaptive vsync or immediate),
+   - sleep for a while after the swap returns so that input and
+     transforms are sampled as late as possible before the next swap,
+   - cap how many frames the GPU may queue, with glFinish or fences,
+   - measure the time from an input event's timestamp to the swap
+     returning for the frame that first used it.
+*/
+
+#include <stdbool.h>
+
+#include <SDL2/SDL.h>
+
+#include "gl_caps.h"
+
+#define PACING_MAX_QUEUED_FRAMES 4
+
+typedef enum {
+  SWAP_IMMEDIATE = 0,
+  SWAP_VSYNC = 1,
+  SWAP_ADAPTIVE = -1
+} SwapMode;
+
+typedef enum {
+  THROTTLE_NONE,
+  THROTTLE_FINISH,
+  THROTTLE_FENCE
+} ThrottleMode;
+
+typedef struct {
+  SwapMode swap_mode;
+  int frame_delay_ms;     /* sleep after each swap before sampling input */
+  ThrottleMode throttle;
+  int max_queued_frames;  /* used by THROTTLE_FENCE, 1..PACING_MAX_QUEUED_FRAMES */
+  int report_frames;      /* print latency stats every this many frames */
+} LatencyConfig;
+
+typedef struct {
+  LatencyConfig config;
+  SwapMode active_swap_mode;
+
+  /* Ring of fences, one per frame in flight */
+  GLsync fences[PACING_MAX_QUEUED_FRAMES];
+  int fence_ix;
+
+  /* Oldest input event not yet presented (SDL ticks) */
+  bool input_pending;
+  Uint32 input_timestamp;
+
+  /* Stats for the current report window */
+  int frames;
+  int samples;
+  double latency_sum_ms;
+  double latency_min_ms;
+  double latency_max_ms;
+  double throttle_wait_ms;
+} FramePacer;
+
+/* Sensible defaults: plain vsync, no delay, no throttling. */
+void latency_default_config(LatencyConfig *config);
+
+/* Parse --swap, --frame-delay, --throttle and --max-queued from argv.
+   Unknown arguments are left alone for the caller. */
+void latency_parse_args(LatencyConfig *config, int argc, char *argv[]);
+
+/* Apply the swap interval. Must be called with a current context and
+   after load_gl_caps(). Falls back to vsync if adaptive is refused. */
+void latency_init(FramePacer *pacer, const LatencyConfig *config);
+
+/* Call at the top of the frame, before polling events. Waits for the
+   queued frame cap and then sleeps for the configured frame delay. */
+void latency_begin_frame(FramePacer *pacer);
+
+/* Call for every event that should count as input. */
+void latency_mark_input(FramePacer *pacer, const SDL_Event *event);
+
+/* Swap, record the latency of any input used this frame and apply
+   glFinish or insert a fence for throttling. */
+void latency_end_frame(FramePacer *pacer, SDL_Window *window);
+
+void latency_destroy(FramePacer *pacer);
+
+#endif // FRAME_PACING_H_
@@ -0,0 +1,305 @@
+/* View frustum culling of bounding volumes, four at a time. */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+
+#include "frustum_cull.h"
+#include "simd.h"
+
+void bounds_from_vertices(Bounds *bounds, const float *vertices, int num_vertices) {
+
+  memset(bounds, 0, sizeof(*bounds));
+  if (num_vertices <= 0) {
+    return;
+  }
+
+  for (int axis = 0; axis < 3; axis++) {
+    bounds->min[axis] = vertices[axis];
+    bounds->max[axis] = vertices[axis];
+  }
+  for (int i = 1; i < num_vertices; i++) {
+    for (int axis = 0; axis < 3; axis++) {
+      float value = vertices[3 * i + axis];
+      if (value < bounds->min[axis]) {
+	bounds->min[axis] = value;
+      }
+      if (value > bounds->max[axis]) {
+	bounds->max[axis] = value;
+      }
+    }
+  }
+
+  /* Sphere about the box centre, so both volumes share a centre and the
+     cull test can pick the tighter one per plane */
+  for (int axis = 0; axis < 3; axis++) {
+    bounds->center[axis] = 0.5f * (bounds->min[axis] + bounds->max[axis]);
+  }
+  float radius_squared = 0.0f;
+  for (int i = 0; i < num_vertices; i++) {
+    float dx = vertices[3 * i] - bounds->center[0];
+    float dy = vertices[3 * i + 1] - bounds->center[1];
+    float dz = vertices[3 * i + 2] - bounds->center[2];
+    float distance_squared = dx * dx + dy * dy + dz * dz;
+    if (distance_squared > radius_squared) {
+      radius_squared = distance_squared;
+    }
+  }
+  bounds->radius = sqrtf(radius_squared);
+}
+
+void frustum_from_matrix(Frustum *frustum, const float *m) {
+
+  /* Gribb/Hartmann: the planes are sums and differences of the rows of
+     the clip matrix. Row i is m[i], m[4 + i], m[8 + i], m[12 + i]. */
+  for (int p = 0; p < 6; p++) {
+    int row = p / 2;
+    float sign = (p % 2 == 0) ? 1.0f : -1.0f;
+    for (int col = 0; col < 4; col++) {
+      frustum->planes[p][col] = m[4 * col + 3] + sign * m[4 * col + row];
+    }
+
+    float length = sqrtf(frustum->planes[p][0] * frustum->planes[p][0]
+			 + frustum->planes[p][1] * frustum->planes[p][1]
+			 + frustum->planes[p][2] * frustum->planes[p][2]);
+    if (length > 0.0f) {
+      for (int col = 0; col < 4; col++) {
+	frustum->planes[p][col] /= length;
+      }
+    }
+  }
+}
+
+void cull_set_init(CullSet *set, int capacity) {
+  capacity = (capacity + 3) & ~3;
+  memset(set, 0, sizeof(*set));
+  set->capacity = capacity;
+  for (int axis = 0; axis < 3; axis++) {
+    set->center[axis] = (float *) calloc(capacity, sizeof(float));
+    set->extent[axis] = (float *) calloc(capacity, sizeof(float));
+  }
+  set->radius = (float *) calloc(capacity, sizeof(float));
+  set->visible = (unsigned char *) calloc(capacity, 1);
+}
+
+void cull_set_destroy(CullSet *set) {
+  for (int axis = 0; axis < 3; axis++) {
+    free(set->center[axis]);
+    free(set->extent[axis]);
+  }
+  free(set->radius);
+  free(set->visible);
+}
+
+void cull_set_update(CullSet *set, int index, const Bounds *local,
+		     const float *m) {
+
+  if (index >= set->capacity) {
+    printf("ERROR: cull set index %d out of range (%d)\n", index, set->capacity);
+    return;
+  }
+  if (index >= set->count) {
+    set->count = index + 1;
+  }
+
+  float half[3];
+  for (int axis = 0; axis < 3; axis++) {
+    half[axis] = 0.5f * (local->max[axis] - local->min[axis]);
+  }
+
+  float max_scale_squared = 0.0f;
+  for (int row = 0; row < 3; row++) {
+    set->center[row][index] = m[row] * local->center[0]
+      + m[4 + row] * local->center[1]
+      + m[8 + row] * local->center[2]
+      + m[12 + row];
+
+    /* Box half extents in the world are |M| times the local ones */
+    set->extent[row][index] = fabsf(m[row]) * half[0]
+      + fabsf(m[4 + row]) * half[1]
+      + fabsf(m[8 + row]) * half[2];
+
+    float scale_squared = m[4 * row] * m[4 * row]
+      + m[4 * row + 1] * m[4 * row + 1]
+      + m[4 * row + 2] * m[4 * row + 2];
+    if (scale_squared > max_scale_squared) {
+      max_scale_squared = scale_squared;
+    }
+  }
+  set->radius[index] = local->radius * sqrtf(max_scale_squared);
+}
+
+int frustum_cull(const Frustum *frustum, CullSet *set, CullStats *stats) {
+
+  Uint64 start = SDL_GetPerformanceCounter();
+
+  /* Plane coefficients and their absolute values, broadcast once */
+  f32x4 plane[6][4];
+  f32x4 plane_abs[6][3];
+  for (int p = 0; p < 6; p++) {
+    for (int i = 0; i < 4; i++) {
+      plane[p][i] = f32x4_set1(frustum->planes[p][i]);
+    }
+    for (int i = 0; i < 3; i++) {
+      plane_abs[p][i] = f32x4_set1(fabsf(frustum->planes[p][i]));
+    }
+  }
+
+  int visible = 0;
+  for (int i = 0; i < set->count; i += 4) {
+    f32x4 cx = f32x4_load(&set->center[0][i]);
+    f32x4 cy = f32x4_load(&set->center[1][i]);
+    f32x4 cz = f32x4_load(&set->center[2][i]);
+    f32x4 radius = f32x4_load(&set->radius[i]);
+    f32x4 ex = f32x4_load(&set->extent[0][i]);
+    f32x4 ey = f32x4_load(&set->extent[1][i]);
+    f32x4 ez = f32x4_load(&set->extent[2][i]);
+
+    f32x4 outside = f32x4_zero();  /* no lanes set */
+    for (int p = 0; p < 6; p++) {
+      f32x4 distance = f32x4_madd(plane[p][0], cx, plane[p][3]);
+      distance = f32x4_madd(plane[p][1], cy, distance);
+      distance = f32x4_madd(plane[p][2], cz, distance);
+
+      /* The box's reach towards the plane, or the sphere's if smaller */
+      f32x4 reach = f32x4_mul(plane_abs[p][0], ex);
+      reach = f32x4_madd(plane_abs[p][1], ey, reach);
+      reach = f32x4_madd(plane_abs[p][2], ez, reach);
+      reach = f32x4_min(reach, radius);
+
+      outside = f32x4_or(outside, f32x4_cmplt(f32x4_add(distance, reach),
+					      f32x4_zero()));
+    }
+
+    int mask = f32x4_movemask(outside);
+    int lanes = set->count - i < 4 ? set->count - i : 4;
+    for (int lane = 0; lane < lanes; lane++) {
+      set->visible[i + lane] = !(mask & (1 << lane));
+      visible += set->visible[i + lane];
+    }
+  }
+
+  if (stats != NULL) {
+    stats->frames += 1;
+    stats->objects += set->count;
+    stats->visible += visible;
+    stats->cull_ms += (double) (SDL_GetPerformanceCounter() - start) * 1000.0
+      / (double) SDL_GetPerformanceFrequency();
+  }
+  return visible;
+}
+
+int frustum_cull_scalar(const Frustum *frustum, CullSet *set) {
+
+  int visible = 0;
+  for (int i = 0; i < set->count; i++) {
+    bool outside = false;
+    for (int p = 0; p < 6 && !outside; p++) {
+      const float *plane = frustum->planes[p];
+      float distance = plane[0] * set->center[0][i] + plane[1] * set->center[1][i]
+	+ plane[2] * set->center[2][i] + plane[3];
+      float reach = fabsf(plane[0]) * set->extent[0][i]
+	+ fabsf(plane[1]) * set->extent[1][i]
+	+ fabsf(plane[2]) * set->extent[2][i];
+      if (set->radius[i] < reach) {
+	reach = set->radius[i];
+      }
+      outside = distance + reach < 0.0f;
+    }
+    set->visible[i] = !outside;
+    visible += !outside;
+  }
+  return visible;
+}
+
+void cull_stats_init(CullStats *stats) {
+  memset(stats, 0, sizeof(*stats));
+  stats->report_frames = 5 * 60;
+}
+
+void cull_stats_report(CullStats *stats, const char *name) {
+
+  if (stats->frames < stats->report_frames) {
+    return;
+  }
+
+  double per_10k = stats->objects > 0
+    ? stats->cull_ms * 10000.0 / (double) stats->objects : 0.0;
+  printf("%s culling: %.1f visible, %.1f culled of %.1f objects/frame, "
+	 "%.3f ms/frame, %.4f ms per 10K objects\n",
+	 name,
+	 (double) stats->visible / stats->frames,
+	 (double) (stats->objects - stats->visible) / stats->frames,
+	 (double) stats->objects / stats->frames,
+	 stats->cull_ms / stats->frames, per_10k);
+
+  int report_frames = stats->report_frames;
+  memset(stats, 0, sizeof(*stats));
+  stats->report_frames = report_frames;
+}
+
+void frustum_cull_benchmark(int num_objects) {
+
+  const int num_frames = 100;
+
+  /* 45 degree camera at the origin looking down -z, like the demos */
+  float f = 1.0f / tanf(0.5f * 45.0f * (float) M_PI / 180.0f);
+  float aspect = 16.0f / 9.0f;
+  float near = 0.1f;
+  float far = 100.0f;
+  float projection[16] = {
+    f / aspect, 0.0f, 0.0f, 0.0f,
+    0.0f, f, 0.0f, 0.0f,
+    0.0f, 0.0f, (far + near) / (near - far), -1.0f,
+    0.0f, 0.0f, 2.0f * far * near / (near - far), 0.0f
+  };
+  Frustum frustum;
+  frustum_from_matrix(&frustum, projection);
+
+  /* Unit cubes scattered around the camera, so roughly 1 in 8 land
+     inside the frustum */
+  Bounds cube = { { -1.0f, -1.0f, -1.0f }, { 1.0f, 1.0f, 1.0f },
+		  { 0.0f, 0.0f, 0.0f }, 1.7320508f };
+  CullSet set;
+  cull_set_init(&set, num_objects);
+  srand(1);
+  for (int i = 0; i < num_objects; i++) {
+    float world[16] = {
+      1.0f, 0.0f, 0.0f, 0.0f,
+      0.0f, 1.0f, 0.0f, 0.0f,
+      0.0f, 0.0f, 1.0f, 0.0f,
+      0.0f, 0.0f, 0.0f, 1.0f
+    };
+    for (int axis = 0; axis < 3; axis++) {
+      world[12 + axis] = ((float) rand() / (float) RAND_MAX - 0.5f) * 2.0f * far;
+    }
+    cull_set_update(&set, i, &cube, world);
+  }
+
+  CullStats stats;
+  cull_stats_init(&stats);
+  int visible = 0;
+  for (int frame = 0; frame < num_frames; frame++) {
+    visible = frustum_cull(&frustum, &set, &stats);
+  }
+  double simd_ms = stats.cull_ms / num_frames;
+
+  Uint64 start = SDL_GetPerformanceCounter();
+  int scalar_visible = 0;
+  for (int frame = 0; frame < num_frames; frame++) {
+    scalar_visible = frustum_cull_scalar(&frustum, &set);
+  }
+  double scalar_ms = (double) (SDL_GetPerformanceCounter() - start) * 1000.0
+    / (double) SDL_GetPerformanceFrequency() / num_frames;
+
+  printf("Frustum cull benchmark: %d objects, %d visible (%d scalar)\n"
+	 "\tSIMD   %.4f ms/frame, %.4f ms per 10K objects\n"
+	 "\tscalar %.4f ms/frame, %.4f ms per 10K objects\n",
+	 num_objects, visible, scalar_visible,
+	 simd_ms, simd_ms * 10000.0 / num_objects,
+	 scalar_ms, scalar_ms * 10000.0 / num_objects);
+
+  cull_set_destroy(&set);
+}
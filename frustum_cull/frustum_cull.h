@@ -0,0 +1,78 @@
+#ifndef FRUSTUM_CULL_H_
+#define FRUSTUM_CULL_H_
+
+/* View frustum culling.
+
+   Meshes get a Bounds (AABB plus a bounding sphere about the AABB
+   centre) when they are loaded. Each frame the world-space bounds of
+   every object are kept in a CullSet, one array per component, and
+   tested against the six frustum planes four objects at a time. An
+   object is culled when it lies wholly behind any plane, using
+   whichever of its sphere or box is tighter against that plane.
+
+   Matrices are column-major float[16], as both cglm and glm store them.
+*/
+
+#include <stdbool.h>
+
+typedef struct {
+  float min[3];
+  float max[3];
+  float center[3];
+  float radius;
+} Bounds;
+
+typedef struct {
+  /* a x + b y + c z + d >= 0 inside, normalised */
+  float planes[6][4];
+} Frustum;
+
+typedef struct {
+  int count;
+  int capacity;  /* multiple of four */
+
+  /* World-space sphere centre and radius and AABB half extents */
+  float *center[3];
+  float *radius;
+  float *extent[3];
+
+  /* One flag per object, written by frustum_cull */
+  unsigned char *visible;
+} CullSet;
+
+typedef struct {
+  int frames;
+  long objects;
+  long visible;
+  double cull_ms;
+  int report_frames;
+} CullStats;
+
+/* num_vertices xyz triples, stride three floats */
+void bounds_from_vertices(Bounds *bounds, const float *vertices, int num_vertices);
+
+void frustum_from_matrix(Frustum *frustum, const float *view_projection);
+
+void cull_set_init(CullSet *set, int capacity);
+void cull_set_destroy(CullSet *set);
+
+/* Place object index's local bounds in the world with world_matrix. */
+void cull_set_update(CullSet *set, int index, const Bounds *local,
+		     const float *world_matrix);
+
+/* Test objects [0, set->count) and fill in set->visible. Returns the
+   number visible. stats may be NULL. */
+int frustum_cull(const Frustum *frustum, CullSet *set, CullStats *stats);
+
+/* Plain C version of frustum_cull, for comparison */
+int frustum_cull_scalar(const Frustum *frustum, CullSet *set);
+
+void cull_stats_init(CullStats *stats);
+
+/* Prints every stats->report_frames frames and resets. */
+void cull_stats_report(CullStats *stats, const char *name);
+
+/* Time the SIMD and scalar tests over num_objects random objects. */
+void frustum_cull_benchmark(int num_objects);
+
+#endif // FRUSTUM_CULL_H_
@@ -0,0 +1,91 @@
+/* Runtime detection of the GLES version and the ES3 entry points. */
+#include <stdio.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+
+#include "gl_caps.h"
+
+GLCaps gl_caps;
+
+void load_gl_caps(void) {
+
+  memset(&gl_caps, 0, sizeof(gl_caps));
+
+  /* GL_VERSION looks like "OpenGL ES 3.1 Mesa 20.3.5" */
+  const char *version = (const char *) glGetString(GL_VERSION);
+  if (version == NULL ||
+      sscanf(version, "OpenGL ES %d.%d", &gl_caps.major, &gl_caps.minor) != 2) {
+    gl_caps.major = 2;
+    gl_caps.minor = 0;
+  }
+  gl_caps.es3 = gl_caps.major >= 3;
+
+  if (gl_caps.es3) {
+    gl_caps.FenceSync = SDL_GL_GetProcAddress("glFenceSync");
+    gl_caps.ClientWaitSync = SDL_GL_GetProcAddress("glClientWaitSync");
+    gl_caps.DeleteSync = SDL_GL_GetProcAddress("glDeleteSync");
+    gl_caps.MapBufferRange = SDL_GL_GetProcAddress("glMapBufferRange");
+    gl_caps.UnmapBuffer = SDL_GL_GetProcAddress("glUnmapBuffer");
+    gl_caps.TexImage3D = SDL_GL_GetProcAddress("glTexImage3D");
+    gl_caps.TexSubImage3D = SDL_GL_GetProcAddress("glTexSubImage3D");
+    gl_caps.BindBufferBase = SDL_GL_GetProcAddress("glBindBufferBase");
+    gl_caps.GetUniformBlockIndex = SDL_GL_GetProcAddress("glGetUniformBlockIndex");
+    gl_caps.UniformBlockBinding = SDL_GL_GetProcAddress("glUniformBlockBinding");
+    gl_caps.DrawBuffers = SDL_GL_GetProcAddress("glDrawBuffers");
+    gl_caps.ClearBufferfv = SDL_GL_GetProcAddress("glClearBufferfv");
+    gl_caps.ClearBufferuiv = SDL_GL_GetProcAddress("glClearBufferuiv");
+    gl_caps.BlitFramebuffer = SDL_GL_GetProcAddress("glBlitFramebuffer");
+    gl_caps.VertexAttribDivisor = SDL_GL_GetProcAddress("glVertexAttribDivisor");
+    gl_caps.DrawArraysInstanced = SDL_GL_GetProcAddress("glDrawArraysInstanced");
+    gl_caps.InvalidateFramebuffer = SDL_GL_GetProcAddress("glInvalidateFramebuffer");
+  } else if (has_gl_extension("GL_EXT_discard_framebuffer")) {
+    gl_caps.InvalidateFramebuffer = SDL_GL_GetProcAddress("glDiscardFramebufferEXT");
+  }
+
+  gl_caps.etc1 = has_gl_extension("GL_OES_compressed_ETC1_RGB8_texture");
+  gl_caps.etc2 = gl_caps.es3;
+  gl_caps.depth_texture = gl_caps.es3 || has_gl_extension("GL_OES_depth_texture");
+
+  if (has_gl_extension("GL_EXT_disjoint_timer_query")) {
+    gl_caps.GenQueriesEXT = SDL_GL_GetProcAddress("glGenQueriesEXT");
+    gl_caps.DeleteQueriesEXT = SDL_GL_GetProcAddress("glDeleteQueriesEXT");
+    gl_caps.BeginQueryEXT = SDL_GL_GetProcAddress("glBeginQueryEXT");
+    gl_caps.EndQueryEXT = SDL_GL_GetProcAddress("glEndQueryEXT");
+    gl_caps.GetQueryObjectuivEXT = SDL_GL_GetProcAddress("glGetQueryObjectuivEXT");
+    gl_caps.GetQueryObjectui64vEXT = SDL_GL_GetProcAddress("glGetQueryObjectui64vEXT");
+    gl_caps.timer_query = gl_caps.GenQueriesEXT != NULL
+      && gl_caps.GetQueryObjectui64vEXT != NULL;
+  }
+
+  printf("GL caps: ES %d.%d, fences %s, timer queries %s, invalidate %s, ETC1 %s, ETC2 %s, "
+	 "depth textures %s\n",
+	 gl_caps.major, gl_caps.minor,
+	 gl_caps.FenceSync ? "yes" : "no",
+	 gl_caps.timer_query ? "yes" : "no",
+	 gl_caps.InvalidateFramebuffer ? "yes" : "no",
+	 gl_caps.etc1 ? "yes" : "no",
+	 gl_caps.etc2 ? "yes" : "no",
+	 gl_caps.depth_texture ? "yes" : "no");
+}
+
+bool has_gl_extension(const char *name) {
+
+  const char *extensions = (const char *) glGetString(GL_EXTENSIONS);
+  if (extensions == NULL) {
+    return false;
+  }
+
+  /* Need a whole-word match, as some names are prefixes of others */
+  size_t name_length = strlen(name);
+  const char *start = extensions;
+  while ((start = strstr(start, name)) != NULL) {
+    bool starts_word = (start == extensions) || (start[-1] == ' ');
+    bool ends_word = (start[name_length] == ' ') || (start[name_length] == 0);
+    if (starts_word && ends_word) {
+      return true;
+    }
+    start += name_length;
+  }
+  return false;
+}
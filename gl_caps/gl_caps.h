@@ -0,0 +1,218 @@
+#ifndef GL_CAPS_H_
+#define GL_CAPS_H_
+
+/* The pi's GLESv2 headers only know about ES2, but the contexts we ask
+   for can be ES3.x on newer boards and mesa. Rather than linking
+   against ES3 entry points directly (which would not link on the pi),
+   we look them up at runtime once the context is current and keep them
+   in the gl_caps struct. */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <GLES2/gl2.h>
+
+#ifndef GL_ES_VERSION_3_0
+typedef struct __GLsync *GLsync;
+typedef uint64_t GLuint64;
+#endif
+
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#endif
+#ifndef GL_SYNC_FLUSH_COMMANDS_BIT
+#define GL_SYNC_FLUSH_COMMANDS_BIT 0x00000001
+#endif
+#ifndef GL_ALREADY_SIGNALED
+#define GL_ALREADY_SIGNALED 0x911A
+#endif
+#ifndef GL_TIMEOUT_EXPIRED
+#define GL_TIMEOUT_EXPIRED 0x911B
+#endif
+#ifndef GL_CONDITION_SATISFIED
+#define GL_CONDITION_SATISFIED 0x911C
+#endif
+#ifndef GL_WAIT_FAILED
+#define GL_WAIT_FAILED 0x911D
+#endif
+#ifndef GL_TIMEOUT_IGNORED
+#define GL_TIMEOUT_IGNORED 0xFFFFFFFFFFFFFFFFull
+#endif
+
+/* Pixel pack buffers */
+#ifndef GL_PIXEL_PACK_BUFFER
+#define GL_PIXEL_PACK_BUFFER 0x88EB
+#endif
+#ifndef GL_STREAM_READ
+#define GL_STREAM_READ 0x88E1
+#endif
+#ifndef GL_MAP_READ_BIT
+#define GL_MAP_READ_BIT 0x0001
+#endif
+
+/* Streaming vertex buffers */
+#ifndef GL_MAP_WRITE_BIT
+#define GL_MAP_WRITE_BIT 0x0002
+#endif
+#ifndef GL_MAP_INVALIDATE_RANGE_BIT
+#define GL_MAP_INVALIDATE_RANGE_BIT 0x0004
+#endif
+#ifndef GL_MAP_UNSYNCHRONIZED_BIT
+#define GL_MAP_UNSYNCHRONIZED_BIT 0x0020
+#endif
+
+/* EXT_disjoint_timer_query */
+#ifndef GL_QUERY_RESULT_EXT
+#define GL_QUERY_RESULT_EXT 0x8866
+#endif
+#ifndef GL_QUERY_RESULT_AVAILABLE_EXT
+#define GL_QUERY_RESULT_AVAILABLE_EXT 0x8867
+#endif
+#ifndef GL_TIME_ELAPSED_EXT
+#define GL_TIME_ELAPSED_EXT 0x88BF
+#endif
+#ifndef GL_GPU_DISJOINT_EXT
+#define GL_GPU_DISJOINT_EXT 0x8FBB
+#endif
+
+/* Compressed texture formats */
+#ifndef GL_ETC1_RGB8_OES
+#define GL_ETC1_RGB8_OES 0x8D64
+#endif
+#ifndef GL_COMPRESSED_RGB8_ETC2
+#define GL_COMPRESSED_RGB8_ETC2 0x9274
+#endif
+
+/* Texture arrays and mip clamping */
+#ifndef GL_TEXTURE_2D_ARRAY
+#define GL_TEXTURE_2D_ARRAY 0x8C1A
+#endif
+#ifndef GL_TEXTURE_BASE_LEVEL
+#define GL_TEXTURE_BASE_LEVEL 0x813C
+#endif
+#ifndef GL_TEXTURE_MAX_LEVEL
+#define GL_TEXTURE_MAX_LEVEL 0x813D
+#endif
+
+/* Uniform buffers */
+#ifndef GL_UNIFORM_BUFFER
+#define GL_UNIFORM_BUFFER 0x8A11
+#endif
+#ifndef GL_INVALID_INDEX
+#define GL_INVALID_INDEX 0xFFFFFFFFu
+#endif
+
+/* Multiple render targets */
+#ifndef GL_READ_FRAMEBUFFER
+#define GL_READ_FRAMEBUFFER 0x8CA8
+#endif
+#ifndef GL_DRAW_FRAMEBUFFER
+#define GL_DRAW_FRAMEBUFFER 0x8CA9
+#endif
+#ifndef GL_MAX_DRAW_BUFFERS
+#define GL_MAX_DRAW_BUFFERS 0x8824
+#endif
+#ifndef GL_COLOR_ATTACHMENT1
+#define GL_COLOR_ATTACHMENT1 0x8CE1
+#endif
+#ifndef GL_COLOR_ATTACHMENT2
+#define GL_COLOR_ATTACHMENT2 0x8CE2
+#endif
+#ifndef GL_DEPTH_STENCIL_ATTACHMENT
+#define GL_DEPTH_STENCIL_ATTACHMENT 0x821A
+#endif
+#ifndef GL_DEPTH24_STENCIL8
+#define GL_DEPTH24_STENCIL8 0x88F0
+#endif
+#ifndef GL_RGB10_A2
+#define GL_RGB10_A2 0x8059
+#endif
+#ifndef GL_RGBA8
+#define GL_RGBA8 0x8058
+#endif
+#ifndef GL_RGBA16UI
+#define GL_RGBA16UI 0x8D76
+#endif
+#ifndef GL_RGBA_INTEGER
+#define GL_RGBA_INTEGER 0x8D99
+#endif
+
+/* Depth textures */
+#ifndef GL_DEPTH_COMPONENT24
+#define GL_DEPTH_COMPONENT24 0x81A6
+#endif
+
+/* Invalidating the default framebuffer's attachments */
+#ifndef GL_COLOR
+#define GL_COLOR 0x1800
+#endif
+#ifndef GL_DEPTH
+#define GL_DEPTH 0x1801
+#endif
+#ifndef GL_STENCIL
+#define GL_STENCIL 0x1802
+#endif
+
+typedef struct {
+  /* Context version as parsed from GL_VERSION */
+  int major;
+  int minor;
+  bool es3;
+
+  /* OES_compressed_ETC1_RGB8_texture, and ETC2 which ES3 always has */
+  bool etc1;
+  bool etc2;
+
+  /* OES_depth_texture, which ES3 always has */
+  bool depth_texture;
+
+  /* ES3 entry points - NULL on an ES2 context */
+  GLsync (*FenceSync)(GLenum condition, GLbitfield flags);
+  GLenum (*ClientWaitSync)(GLsync sync, GLbitfield flags, GLuint64 timeout);
+  void (*DeleteSync)(GLsync sync);
+  void *(*MapBufferRange)(GLenum target, GLintptr offset, GLsizeiptr length,
+			  GLbitfield access);
+  GLboolean (*UnmapBuffer)(GLenum target);
+  void (*TexImage3D)(GLenum target, GLint level, GLint internal_format,
+		     GLsizei width, GLsizei height, GLsizei depth, GLint border,
+		     GLenum format, GLenum type, const void *pixels);
+  void (*TexSubImage3D)(GLenum target, GLint level, GLint x, GLint y, GLint z,
+			GLsizei width, GLsizei height, GLsizei depth,
+			GLenum format, GLenum type, const void *pixels);
+  void (*BindBufferBase)(GLenum target, GLuint index, GLuint buffer);
+  GLuint (*GetUniformBlockIndex)(GLuint program, const GLchar *name);
+  void (*UniformBlockBinding)(GLuint program, GLuint block, GLuint binding);
+  void (*DrawBuffers)(GLsizei n, const GLenum *buffers);
+  void (*ClearBufferfv)(GLenum buffer, GLint draw_buffer, const GLfloat *value);
+  void (*ClearBufferuiv)(GLenum buffer, GLint draw_buffer, const GLuint *value);
+  void (*BlitFramebuffer)(GLint src_x0, GLint src_y0, GLint src_x1, GLint src_y1,
+			  GLint dst_x0, GLint dst_y0, GLint dst_x1, GLint dst_y1,
+			  GLbitfield mask, GLenum filter);
+  void (*VertexAttribDivisor)(GLuint index, GLuint divisor);
+  void (*DrawArraysInstanced)(GLenum mode, GLint first, GLsizei count,
+			      GLsizei instances);
+
+  /* glInvalidateFramebuffer on ES3, else EXT_discard_framebuffer's
+     glDiscardFramebufferEXT, which takes the same arguments - NULL
+     when there is neither */
+  void (*InvalidateFramebuffer)(GLenum target, GLsizei count, const GLenum *attachments);
+
+  /* EXT_disjoint_timer_query - NULL when the extension is missing */
+  bool timer_query;
+  void (*GenQueriesEXT)(GLsizei n, GLuint *ids);
+  void (*DeleteQueriesEXT)(GLsizei n, const GLuint *ids);
+  void (*BeginQueryEXT)(GLenum target, GLuint id);
+  void (*EndQueryEXT)(GLenum target);
+  void (*GetQueryObjectuivEXT)(GLuint id, GLenum pname, GLuint *params);
+  void (*GetQueryObjectui64vEXT)(GLuint id, GLenum pname, GLuint64 *params);
+} GLCaps;
+
+extern GLCaps gl_caps;
+
+/* Fill in gl_caps. Must be called with a current context. */
+void load_gl_caps(void);
+
+/* Check the GL_EXTENSIONS string for an exact extension name. */
+bool has_gl_extension(const char *name);
+
+#endif // GL_CAPS_H_
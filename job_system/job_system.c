@@ -0,0 +1,287 @@
+/* Work-stealing job system on top of SDL threads and C11 atomics. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "job_system.h"
+
+#define DEQUE_MASK (JOB_DEQUE_SIZE - 1)
+
+/* Spin this many times looking for work before sleeping */
+#define IDLE_SPINS 256
+
+/* Index of the current thread in its job system; 0 is the main thread. */
+static _Thread_local int thread_index = 0;
+static _Thread_local unsigned int steal_seed = 1;
+
+/* ---- Chase-Lev deque ---- */
+
+static bool deque_push(JobDeque *deque, const Job *job) {
+  int bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+  int top = atomic_load_explicit(&deque->top, memory_order_acquire);
+  if (bottom - top >= JOB_DEQUE_SIZE) {
+    return false;
+  }
+  deque->jobs[bottom & DEQUE_MASK] = *job;
+  atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_release);
+  return true;
+}
+
+static bool deque_pop(JobDeque *deque, Job *job) {
+  int bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+  atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  int top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+  if (top > bottom) {
+    /* Empty */
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    return false;
+  }
+
+  *job = deque->jobs[bottom & DEQUE_MASK];
+  if (top == bottom) {
+    /* Last job - race any thieves for it */
+    bool won = atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+						       memory_order_seq_cst,
+						       memory_order_relaxed);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    return won;
+  }
+  return true;
+}
+
+static bool deque_steal(JobDeque *deque, Job *job) {
+  int top = atomic_load_explicit(&deque->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  int bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+  if (top >= bottom) {
+    return false;
+  }
+  *job = deque->jobs[top & DEQUE_MASK];
+  return atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+						 memory_order_seq_cst,
+						 memory_order_relaxed);
+}
+
+/* ---- Running jobs ---- */
+
+static void push_job(JobSystem *system, const Job *job);
+
+static void finish_job(JobSystem *system, JobCounter *counter) {
+
+  if (counter == NULL) {
+    return;
+  }
+
+  /* The decrement happens under the lock so that a waiter, which takes
+     the lock once it sees zero, knows we are finished with the counter
+     and can let it go out of scope. */
+  Job continuations[JOB_MAX_CONTINUATIONS];
+  int num_continuations = 0;
+  SDL_AtomicLock(&counter->lock);
+  if (atomic_fetch_sub(&counter->pending, 1) == 1) {
+    /* Counter hit zero: release anything that was waiting on it */
+    num_continuations = counter->num_continuations;
+    memcpy(continuations, counter->continuations, num_continuations * sizeof(Job));
+    counter->num_continuations = 0;
+  }
+  SDL_AtomicUnlock(&counter->lock);
+
+  for (int i = 0; i < num_continuations; i++) {
+    push_job(system, &continuations[i]);
+  }
+}
+
+static void run_job(JobSystem *system, const Job *job) {
+  job->function(job->data, job->begin, job->end);
+  atomic_fetch_add_explicit(&system->jobs_run, 1, memory_order_relaxed);
+  finish_job(system, job->counter);
+}
+
+static bool find_job(JobSystem *system, Job *job) {
+
+  if (deque_pop(&system->deques[thread_index], job)) {
+    return true;
+  }
+
+  /* Start at a random victim so thieves spread out */
+  steal_seed ^= steal_seed << 13;
+  steal_seed ^= steal_seed >> 17;
+  steal_seed ^= steal_seed << 5;
+  int start = steal_seed % system->num_threads;
+
+  for (int i = 0; i < system->num_threads; i++) {
+    int victim = (start + i) % system->num_threads;
+    if (victim != thread_index && deque_steal(&system->deques[victim], job)) {
+      atomic_fetch_add_explicit(&system->jobs_stolen, 1, memory_order_relaxed);
+      return true;
+    }
+  }
+  return false;
+}
+
+static void push_job(JobSystem *system, const Job *job) {
+  if (!deque_push(&system->deques[thread_index], job)) {
+    /* Deque full, no point queueing */
+    run_job(system, job);
+    return;
+  }
+  if (atomic_load_explicit(&system->sleeping, memory_order_relaxed) > 0) {
+    SDL_CondSignal(system->sleep_cond);
+  }
+}
+
+static int worker_thread(void *data) {
+
+  JobWorker *worker = (JobWorker *) data;
+  JobSystem *system = worker->system;
+  thread_index = worker->index;
+  steal_seed = 2654435761u * (worker->index + 1);
+
+  int idle = 0;
+  Job job;
+  while (atomic_load(&system->running)) {
+    if (find_job(system, &job)) {
+      run_job(system, &job);
+      idle = 0;
+      continue;
+    }
+
+    idle += 1;
+    if (idle > IDLE_SPINS) {
+      /* Timed wait, so a missed signal only costs a millisecond */
+      SDL_LockMutex(system->sleep_mutex);
+      atomic_fetch_add(&system->sleeping, 1);
+      SDL_CondWaitTimeout(system->sleep_cond, system->sleep_mutex, 1);
+      atomic_fetch_sub(&system->sleeping, 1);
+      SDL_UnlockMutex(system->sleep_mutex);
+      idle = 0;
+    }
+  }
+  return 0;
+}
+
+/* ---- Public interface ---- */
+
+void job_system_init(JobSystem *system, int num_threads) {
+
+  if (num_threads <= 0) {
+    num_threads = SDL_GetCPUCount();
+  }
+  if (num_threads > JOB_MAX_THREADS) {
+    num_threads = JOB_MAX_THREADS;
+  }
+
+  memset(system, 0, sizeof(*system));
+  system->num_threads = num_threads;
+  system->deques = calloc(num_threads, sizeof(JobDeque));
+  system->sleep_mutex = SDL_CreateMutex();
+  system->sleep_cond = SDL_CreateCond();
+  atomic_store(&system->running, true);
+
+  thread_index = 0;
+  for (int i = 1; i < num_threads; i++) {
+    system->workers[i].system = system;
+    system->workers[i].index = i;
+    system->threads[i] = SDL_CreateThread(worker_thread, "job worker",
+					  &system->workers[i]);
+  }
+}
+
+void job_system_destroy(JobSystem *system) {
+
+  atomic_store(&system->running, false);
+  SDL_CondBroadcast(system->sleep_cond);
+  for (int i = 1; i < system->num_threads; i++) {
+    SDL_WaitThread(system->threads[i], NULL);
+  }
+
+  SDL_DestroyCond(system->sleep_cond);
+  SDL_DestroyMutex(system->sleep_mutex);
+  free(system->deques);
+  system->deques = NULL;
+}
+
+void job_counter_init(JobCounter *counter) {
+  atomic_store(&counter->pending, 0);
+  counter->lock = 0;
+  counter->num_continuations = 0;
+}
+
+void job_submit(JobSystem *system, const Job *jobs, int count) {
+  for (int i = 0; i < count; i++) {
+    if (jobs[i].counter != NULL) {
+      atomic_fetch_add(&jobs[i].counter->pending, 1);
+    }
+  }
+  for (int i = 0; i < count; i++) {
+    push_job(system, &jobs[i]);
+  }
+}
+
+void job_submit_after(JobSystem *system, JobCounter *counter, const Job *job) {
+
+  if (job->counter != NULL) {
+    atomic_fetch_add(&job->counter->pending, 1);
+  }
+
+  SDL_AtomicLock(&counter->lock);
+  if (atomic_load(&counter->pending) > 0
+      && counter->num_continuations < JOB_MAX_CONTINUATIONS) {
+    counter->continuations[counter->num_continuations] = *job;
+    counter->num_continuations += 1;
+    SDL_AtomicUnlock(&counter->lock);
+    return;
+  }
+  SDL_AtomicUnlock(&counter->lock);
+
+  /* Already done, or no room to park it - make sure the dependency has
+     finished and queue the job ourselves. */
+  job_wait(system, counter);
+  push_job(system, job);
+}
+
+void job_wait(JobSystem *system, JobCounter *counter) {
+  Job job;
+  while (atomic_load(&counter->pending) > 0) {
+    if (find_job(system, &job)) {
+      run_job(system, &job);
+    }
+  }
+
+  /* Wait for the last finisher to let go of the counter */
+  SDL_AtomicLock(&counter->lock);
+  SDL_AtomicUnlock(&counter->lock);
+}
+
+void parallel_for(JobSystem *system, int count, int grain,
+		  JobFunction function, void *data) {
+
+  if (grain < 1) {
+    grain = 1;
+  }
+  if (system == NULL || system->num_threads == 1 || count <= grain) {
+    function(data, 0, count);
+    return;
+  }
+
+  /* Keep the number of jobs well inside one deque */
+  int max_jobs = JOB_DEQUE_SIZE / 2;
+  if ((count + grain - 1) / grain > max_jobs) {
+    grain = (count + max_jobs - 1) / max_jobs;
+  }
+
+  /* Count every job up front so the counter cannot touch zero early */
+  JobCounter counter;
+  job_counter_init(&counter);
+  atomic_store(&counter.pending, (count + grain - 1) / grain);
+
+  for (int begin = 0; begin < count; begin += grain) {
+    int end = begin + grain < count ? begin + grain : count;
+    Job job = { function, data, begin, end, &counter };
+    push_job(system, &job);
+  }
+
+  job_wait(system, &counter);
+}
@@ -0,0 +1,100 @@
+#ifndef JOB_SYSTEM_H_
+#define JOB_SYSTEM_H_
+
+/* A small work-stealing job system.
+
+   Every thread (the main thread is thread 0) owns a fixed size deque.
+   A thread pushes and pops jobs at the bottom of its own deque and,
+   when it runs dry, steals from the top of somebody else's. Jobs report
+   completion through a JobCounter, and a counter can carry a few
+   continuation jobs that are pushed once it reaches zero, which is how
+   dependencies between batches of work are expressed.
+
+   Waiting on a counter never just blocks: the waiting thread keeps
+   running jobs until the counter is done.
+*/
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include <SDL2/SDL.h>
+
+#define JOB_MAX_THREADS 16
+#define JOB_DEQUE_SIZE 1024  /* must be a power of two */
+#define JOB_MAX_CONTINUATIONS 8
+
+typedef void (*JobFunction)(void *data, int begin, int end);
+
+typedef struct JobCounter JobCounter;
+
+typedef struct {
+  JobFunction function;
+  void *data;
+  int begin;
+  int end;
+  JobCounter *counter;  /* decremented when the job finishes, may be NULL */
+} Job;
+
+struct JobCounter {
+  atomic_int pending;
+  SDL_SpinLock lock;
+  int num_continuations;
+  Job continuations[JOB_MAX_CONTINUATIONS];
+};
+
+typedef struct {
+  atomic_int top;
+  atomic_int bottom;
+  Job jobs[JOB_DEQUE_SIZE];
+} JobDeque;
+
+struct JobSystem;
+
+typedef struct {
+  struct JobSystem *system;
+  int index;
+} JobWorker;
+
+typedef struct JobSystem {
+  int num_threads;
+  JobDeque *deques;  /* one per thread, allocated by job_system_init */
+  SDL_Thread *threads[JOB_MAX_THREADS];
+  JobWorker workers[JOB_MAX_THREADS];
+  atomic_bool running;
+
+  /* Idle workers sleep here instead of spinning */
+  SDL_mutex *sleep_mutex;
+  SDL_cond *sleep_cond;
+  atomic_int sleeping;
+
+  /* Stats */
+  atomic_int jobs_run;
+  atomic_int jobs_stolen;
+} JobSystem;
+
+/* Start num_threads - 1 workers; the calling thread is thread 0.
+   num_threads <= 0 means one per CPU. */
+void job_system_init(JobSystem *system, int num_threads);
+void job_system_destroy(JobSystem *system);
+
+void job_counter_init(JobCounter *counter);
+
+/* Queue count jobs on the calling thread's deque. Each job's counter
+   (if any) is incremented before the job is pushed. Only thread 0 and
+   code running inside jobs may submit. */
+void job_submit(JobSystem *system, const Job *jobs, int count);
+
+/* Queue job once counter reaches zero (straight away if it already
+   has). */
+void job_submit_after(JobSystem *system, JobCounter *counter, const Job *job);
+
+/* Run jobs until counter reaches zero. */
+void job_wait(JobSystem *system, JobCounter *counter);
+
+/* Split [0, count) into ranges of at most grain items and run
+   function over them on all threads. Returns once all are done.
+   Small ranges run inline on the calling thread. */
+void parallel_for(JobSystem *system, int count, int grain,
+		  JobFunction function, void *data);
+
+#endif // JOB_SYSTEM_H_
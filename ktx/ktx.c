@@ -0,0 +1,614 @@
+/* KTX and KTX2 loading, writing and upload of ETC textures. */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+
+#include "ktx.h"
+#include "etc.h"
+
+static const unsigned char ktx1_identifier[12] = {
+  0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n'
+};
+static const unsigned char ktx2_identifier[12] = {
+  0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'
+};
+
+#define KTX1_HEADER_SIZE 64
+#define KTX2_HEADER_SIZE 80
+#define KTX2_LEVEL_SIZE 24
+#define KTX_ENDIANNESS 0x04030201u
+
+/* As big as KTX_MAX_LEVELS levels can reach, and keeps width * height
+   * 4 well inside a size_t */
+#define KTX_MAX_SIZE (1 << (KTX_MAX_LEVELS - 1))
+
+/* VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK */
+#define VK_FORMAT_ETC2_RGB8 147
+
+/* Data format descriptor for VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK */
+#define DFD_SIZE 44
+#define DFD_MODEL_ETC2 161
+#define DFD_PRIMARIES_BT709 1
+#define DFD_TRANSFER_LINEAR 1
+#define DFD_CHANNEL_ETC2_COLOR 2
+
+static uint32_t read32(const unsigned char *p) {
+  return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16
+    | (uint32_t) p[3] << 24;
+}
+
+static uint64_t read64(const unsigned char *p) {
+  return (uint64_t) read32(p) | (uint64_t) read32(p + 4) << 32;
+}
+
+static void write32(FILE *file, uint32_t value) {
+  unsigned char bytes[4] = {
+    (unsigned char) value, (unsigned char) (value >> 8),
+    (unsigned char) (value >> 16), (unsigned char) (value >> 24)
+  };
+  fwrite(bytes, 4, 1, file);
+}
+
+static void write64(FILE *file, uint64_t value) {
+  write32(file, (uint32_t) value);
+  write32(file, (uint32_t) (value >> 32));
+}
+
+const char *ktx_format_name(GLenum internal_format) {
+  switch (internal_format) {
+  case GL_ETC1_RGB8_OES: return "ETC1";
+  case GL_COMPRESSED_RGB8_ETC2: return "ETC2";
+  case GL_RGB: return "RGB8";
+  case GL_RGBA: return "RGBA8";
+  default: return "unknown";
+  }
+}
+
+size_t ktx_level_size(GLenum format, int width, int height) {
+  size_t row = (size_t) width * (format == GL_RGBA ? 4 : 3);
+  return ((row + 3) & ~(size_t) 3) * height;
+}
+
+const char *ktx_value(const KtxTexture *texture, const char *key) {
+  size_t offset = 0;
+  size_t key_length = strlen(key);
+  while (offset + 4 <= texture->key_values_size) {
+    size_t size = read32(texture->key_values + offset);
+    const char *pair = (const char *) texture->key_values + offset + 4;
+    if (offset + 4 + size > texture->key_values_size) {
+      break;
+    }
+    /* The key is NUL terminated; only trust a value that is too */
+    if (size > key_length + 1 && memcmp(pair, key, key_length + 1) == 0
+	&& pair[size - 1] == 0) {
+      return pair + key_length + 1;
+    }
+    offset += 4 + ((size + 3) & ~(size_t) 3);
+  }
+  return NULL;
+}
+
+static int level_size(int size, int level) {
+  size >>= level;
+  return size > 0 ? size : 1;
+}
+
+/* The sizes are unsigned in the file but kept as ints */
+static bool read_size(KtxTexture *texture, const unsigned char *header, const char *path) {
+  uint32_t width = read32(header);
+  uint32_t height = read32(header + 4);
+  if (width == 0 || height == 0 || width > KTX_MAX_SIZE || height > KTX_MAX_SIZE) {
+    printf("ERROR: %s is %ux%u, which is not supported\n", path, width, height);
+    return false;
+  }
+  texture->width = (int) width;
+  texture->height = (int) height;
+  return true;
+}
+
+/* Checks a level's size and fills it in; file is NULL when only the
+   header has been read */
+static bool set_level(KtxTexture *texture, int level, const unsigned char *file,
+		      size_t offset, size_t size, const char *path) {
+  KtxLevel *out = &texture->levels[level];
+  out->width = level_size(texture->width, level);
+  out->height = level_size(texture->height, level);
+  out->size = size;
+  out->offset = offset;
+  out->data = file != NULL ? file + offset : NULL;
+  size_t expected = texture->type == 0
+    ? etc_image_size(out->width, out->height)
+    : ktx_level_size(texture->internal_format, out->width, out->height);
+  if (size != expected) {
+    printf("ERROR: %s level %d is %zu bytes, expected %zu\n", path, level,
+	   size, expected);
+    return false;
+  }
+  return true;
+}
+
+/* The parsers read either a whole file in memory or, for ktx_open,
+   just the parts they need from the open file */
+typedef struct {
+  const unsigned char *memory;
+  FILE *file;
+  size_t size;
+} KtxSource;
+
+static bool source_read(const KtxSource *source, size_t offset, void *out, size_t length) {
+  if (offset > source->size || length > source->size - offset) {
+    return false;
+  }
+  if (source->memory != NULL) {
+    memcpy(out, source->memory + offset, length);
+    return true;
+  }
+  return fseek(source->file, (long) offset, SEEK_SET) == 0
+    && fread(out, length, 1, source->file) == 1;
+}
+
+static bool parse_ktx1(KtxTexture *texture, const KtxSource *source, const char *path) {
+  unsigned char header_bytes[KTX1_HEADER_SIZE];
+  if (!source_read(source, 0, header_bytes, KTX1_HEADER_SIZE)) {
+    printf("ERROR: %s is too short for a KTX header\n", path);
+    return false;
+  }
+  const unsigned char *header = header_bytes + 12;
+  if (read32(header) != KTX_ENDIANNESS) {
+    printf("ERROR: %s is big endian, which is not supported\n", path);
+    return false;
+  }
+  uint32_t gl_type = read32(header + 4);
+  uint32_t gl_format = read32(header + 12);
+  uint32_t internal_format = read32(header + 16);
+  uint32_t depth = read32(header + 32);
+  uint32_t array_elements = read32(header + 36);
+  uint32_t faces = read32(header + 40);
+  uint32_t levels = read32(header + 44);
+  uint32_t key_value_bytes = read32(header + 48);
+
+  bool etc = gl_type == 0 && (internal_format == GL_ETC1_RGB8_OES
+			      || internal_format == GL_COMPRESSED_RGB8_ETC2);
+  bool rgb = gl_type == GL_UNSIGNED_BYTE && (gl_format == GL_RGB || gl_format == GL_RGBA);
+  if (!etc && !rgb) {
+    printf("ERROR: %s is not ETC1, ETC2, RGB8 or RGBA8 (format 0x%x)\n",
+	   path, internal_format);
+    return false;
+  }
+  if (depth > 1 || array_elements != 0 || faces != 1) {
+    printf("ERROR: %s is not a plain 2D texture\n", path);
+    return false;
+  }
+
+  /* ES2 wants the internal format to match the format, not be sized */
+  texture->internal_format = etc ? internal_format : gl_format;
+  texture->type = gl_type;
+  if (!read_size(texture, header + 24, path)) {
+    return false;
+  }
+  /* Checked before it becomes an int, where 2^31 and up go negative */
+  if (levels > KTX_MAX_LEVELS) {
+    printf("ERROR: %s has %u levels\n", path, levels);
+    return false;
+  }
+  texture->num_levels = levels > 0 ? (int) levels : 1;
+
+  if (KTX1_HEADER_SIZE + (size_t) key_value_bytes > source->size) {
+    printf("ERROR: %s is truncated\n", path);
+    return false;
+  }
+  if (source->memory != NULL) {
+    texture->key_values = source->memory + KTX1_HEADER_SIZE;
+  } else if (key_value_bytes > 0) {
+    /* Only the key/values are kept from an opened file */
+    texture->file = malloc(key_value_bytes);
+    texture->key_values = texture->file;
+    if (!source_read(source, KTX1_HEADER_SIZE, texture->file, key_value_bytes)) {
+      printf("ERROR: could not read %s\n", path);
+      return false;
+    }
+  }
+  texture->key_values_size = key_value_bytes;
+
+  size_t offset = KTX1_HEADER_SIZE + key_value_bytes;
+  for (int level = 0; level < texture->num_levels; level++) {
+    unsigned char size_bytes[4];
+    if (!source_read(source, offset, size_bytes, 4)) {
+      printf("ERROR: %s is truncated\n", path);
+      return false;
+    }
+    size_t image_size = read32(size_bytes);
+    offset += 4;
+    if (offset > source->size || image_size > source->size - offset) {
+      printf("ERROR: %s is truncated\n", path);
+      return false;
+    }
+    if (!set_level(texture, level, source->memory, offset, image_size, path)) {
+      return false;
+    }
+    offset += (image_size + 3) & ~(size_t) 3;
+  }
+  return true;
+}
+
+static bool parse_ktx2(KtxTexture *texture, const KtxSource *source, const char *path) {
+  unsigned char header_bytes[KTX2_HEADER_SIZE];
+  if (!source_read(source, 0, header_bytes, KTX2_HEADER_SIZE)) {
+    printf("ERROR: %s is too short for a KTX2 header\n", path);
+    return false;
+  }
+  const unsigned char *header = header_bytes + 12;
+  uint32_t vk_format = read32(header);
+  uint32_t depth = read32(header + 16);
+  uint32_t layers = read32(header + 20);
+  uint32_t faces = read32(header + 24);
+  uint32_t levels = read32(header + 28);
+  uint32_t supercompression = read32(header + 32);
+
+  if (vk_format != VK_FORMAT_ETC2_RGB8) {
+    printf("ERROR: %s is not ETC2 RGB (VkFormat %u)\n", path, vk_format);
+    return false;
+  }
+  if (depth > 1 || layers > 1 || faces != 1) {
+    printf("ERROR: %s is not a plain 2D texture\n", path);
+    return false;
+  }
+  if (supercompression != 0) {
+    printf("ERROR: %s is supercompressed, which is not supported\n", path);
+    return false;
+  }
+
+  texture->internal_format = GL_COMPRESSED_RGB8_ETC2;
+  if (!read_size(texture, header + 8, path)) {
+    return false;
+  }
+  if (levels > KTX_MAX_LEVELS) {
+    printf("ERROR: %s has %u levels\n", path, levels);
+    return false;
+  }
+  texture->num_levels = levels > 0 ? (int) levels : 1;
+
+  for (int level = 0; level < texture->num_levels; level++) {
+    unsigned char index[KTX2_LEVEL_SIZE];
+    if (!source_read(source, KTX2_HEADER_SIZE + level * KTX2_LEVEL_SIZE,
+		     index, KTX2_LEVEL_SIZE)) {
+      printf("ERROR: %s has a bad level index\n", path);
+      return false;
+    }
+    uint64_t offset = read64(index);
+    uint64_t length = read64(index + 8);
+    if (offset > source->size || length > source->size - offset) {
+      printf("ERROR: %s is truncated\n", path);
+      return false;
+    }
+    if (!set_level(texture, level, source->memory, (size_t) offset, (size_t) length, path)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool parse(KtxTexture *texture, const KtxSource *source, const char *path) {
+  unsigned char identifier[12];
+  if (!source_read(source, 0, identifier, 12)) {
+    printf("ERROR: could not read %s\n", path);
+    return false;
+  }
+  if (memcmp(identifier, ktx1_identifier, 12) == 0) {
+    return parse_ktx1(texture, source, path);
+  }
+  if (memcmp(identifier, ktx2_identifier, 12) == 0) {
+    return parse_ktx2(texture, source, path);
+  }
+  printf("ERROR: %s is not a KTX file\n", path);
+  return false;
+}
+
+static FILE *open_file(const char *path, size_t *size) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    printf("ERROR: could not open %s\n", path);
+    return NULL;
+  }
+  fseek(file, 0, SEEK_END);
+  long length = ftell(file);
+  rewind(file);
+  *size = length > 0 ? (size_t) length : 0;
+  return file;
+}
+
+bool ktx_load(KtxTexture *texture, const char *path) {
+  memset(texture, 0, sizeof(*texture));
+
+  size_t size;
+  FILE *file = open_file(path, &size);
+  if (file == NULL) {
+    return false;
+  }
+  texture->file = malloc(size > 0 ? size : 1);
+  bool read = size >= 12 && fread(texture->file, size, 1, file) == 1;
+  fclose(file);
+  if (!read) {
+    printf("ERROR: could not read %s\n", path);
+    ktx_free(texture);
+    return false;
+  }
+
+  KtxSource source = { texture->file, NULL, size };
+  bool ok = parse(texture, &source, path);
+  if (!ok) {
+    ktx_free(texture);
+  }
+  return ok;
+}
+
+bool ktx_open(KtxTexture *texture, const char *path) {
+  memset(texture, 0, sizeof(*texture));
+
+  size_t size;
+  FILE *file = open_file(path, &size);
+  if (file == NULL) {
+    return false;
+  }
+  KtxSource source = { NULL, file, size };
+  bool ok = parse(texture, &source, path);
+  fclose(file);
+  if (!ok) {
+    ktx_free(texture);
+  }
+  return ok;
+}
+
+bool ktx_read_level(const KtxTexture *texture, const char *path, int level,
+		    unsigned char *out) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    printf("ERROR: could not open %s\n", path);
+    return false;
+  }
+  const KtxLevel *data = &texture->levels[level];
+  bool ok = fseek(file, (long) data->offset, SEEK_SET) == 0
+    && fread(out, data->size, 1, file) == 1;
+  fclose(file);
+  if (!ok) {
+    printf("ERROR: could not read level %d of %s\n", level, path);
+  }
+  return ok;
+}
+
+void ktx_free(KtxTexture *texture) {
+  free(texture->file);
+  memset(texture, 0, sizeof(*texture));
+}
+
+static bool write_ktx1(const KtxTexture *texture, FILE *file) {
+  bool compressed = texture->type == 0;
+  GLenum base_format = compressed ? GL_RGB : texture->internal_format;
+
+  size_t pair_size = 0;
+  if (texture->key != NULL) {
+    pair_size = strlen(texture->key) + 1 + strlen(texture->value) + 1;
+  }
+  size_t pair_padding = (4 - pair_size % 4) % 4;
+
+  fwrite(ktx1_identifier, 12, 1, file);
+  write32(file, KTX_ENDIANNESS);
+  write32(file, texture->type);
+  write32(file, 1);        /* glTypeSize */
+  write32(file, compressed ? 0 : base_format);
+  write32(file, texture->internal_format);
+  write32(file, base_format);
+  write32(file, texture->width);
+  write32(file, texture->height);
+  write32(file, 0);        /* pixelDepth */
+  write32(file, 0);        /* numberOfArrayElements */
+  write32(file, 1);        /* numberOfFaces */
+  write32(file, texture->num_levels);
+  write32(file, pair_size > 0 ? (uint32_t) (4 + pair_size + pair_padding) : 0);
+
+  if (pair_size > 0) {
+    const unsigned char zeros[4] = { 0 };
+    write32(file, (uint32_t) pair_size);
+    fwrite(texture->key, strlen(texture->key) + 1, 1, file);
+    fwrite(texture->value, strlen(texture->value) + 1, 1, file);
+    fwrite(zeros, pair_padding, 1, file);
+  }
+
+  /* ETC levels are whole 8 byte blocks and uncompressed rows are
+     already padded, so levels never need padding */
+  for (int level = 0; level < texture->num_levels; level++) {
+    write32(file, (uint32_t) texture->levels[level].size);
+    fwrite(texture->levels[level].data, texture->levels[level].size, 1, file);
+  }
+  return !ferror(file);
+}
+
+static bool write_ktx2(const KtxTexture *texture, FILE *file) {
+  int levels = texture->num_levels;
+  uint32_t dfd_offset = KTX2_HEADER_SIZE + levels * KTX2_LEVEL_SIZE;
+
+  fwrite(ktx2_identifier, 12, 1, file);
+  write32(file, VK_FORMAT_ETC2_RGB8);
+  write32(file, 1);        /* typeSize */
+  write32(file, texture->width);
+  write32(file, texture->height);
+  write32(file, 0);        /* pixelDepth */
+  write32(file, 0);        /* layerCount */
+  write32(file, 1);        /* faceCount */
+  write32(file, levels);
+  write32(file, 0);        /* supercompressionScheme */
+  write32(file, dfd_offset);
+  write32(file, DFD_SIZE);
+  write32(file, 0);        /* no key/value data */
+  write32(file, 0);
+  write64(file, 0);        /* no supercompression global data */
+  write64(file, 0);
+
+  /* Level data is stored smallest first, each aligned to a block */
+  uint64_t offsets[KTX_MAX_LEVELS];
+  uint64_t offset = (dfd_offset + DFD_SIZE + 7) & ~(uint64_t) 7;
+  for (int level = levels - 1; level >= 0; level--) {
+    offsets[level] = offset;
+    offset += texture->levels[level].size;
+  }
+  for (int level = 0; level < levels; level++) {
+    write64(file, offsets[level]);
+    write64(file, texture->levels[level].size);
+    write64(file, texture->levels[level].size);
+  }
+
+  /* Basic descriptor block with one ETC2 colour sample */
+  write32(file, DFD_SIZE);
+  write32(file, 0);                       /* vendor and descriptor type */
+  write32(file, 2 | (DFD_SIZE - 4) << 16);  /* version 2 and block size */
+  write32(file, DFD_MODEL_ETC2 | DFD_PRIMARIES_BT709 << 8
+	  | DFD_TRANSFER_LINEAR << 16);
+  write32(file, 3 | 3 << 8);              /* 4x4 texel blocks */
+  write32(file, ETC_BLOCK_BYTES);         /* bytes per plane */
+  write32(file, 0);
+  write32(file, 0 | 63 << 16 | (uint32_t) DFD_CHANNEL_ETC2_COLOR << 24);
+  write32(file, 0);                       /* sample position */
+  write32(file, 0);                       /* sample lower */
+  write32(file, 0xFFFFFFFFu);             /* sample upper */
+
+  long position = ftell(file);
+  while ((uint64_t) position < offsets[levels - 1]) {
+    fputc(0, file);
+    position += 1;
+  }
+  for (int level = levels - 1; level >= 0; level--) {
+    fwrite(texture->levels[level].data, texture->levels[level].size, 1, file);
+  }
+  return !ferror(file);
+}
+
+bool ktx_write(const KtxTexture *texture, const char *path, bool ktx2) {
+  if (ktx2 && texture->type != 0) {
+    printf("ERROR: %s: only ETC textures can be written as KTX2\n", path);
+    return false;
+  }
+  FILE *file = fopen(path, "wb");
+  if (file == NULL) {
+    printf("ERROR: could not write %s\n", path);
+    return false;
+  }
+  bool ok = ktx2 ? write_ktx2(texture, file) : write_ktx1(texture, file);
+  if (fclose(file) != 0 || !ok) {
+    printf("ERROR: could not write %s\n", path);
+    return false;
+  }
+  return true;
+}
+
+/* What to hand the driver, or 0 to decode */
+static GLenum upload_format(const KtxTexture *texture) {
+  if (texture->type != 0) {
+    return 0;
+  }
+  if (texture->internal_format == GL_ETC1_RGB8_OES) {
+    if (gl_caps.etc1) {
+      return GL_ETC1_RGB8_OES;
+    }
+    return gl_caps.etc2 ? GL_COMPRESSED_RGB8_ETC2 : 0;
+  }
+  if (gl_caps.etc2) {
+    return GL_COMPRESSED_RGB8_ETC2;
+  }
+  if (gl_caps.etc1) {
+    for (int level = 0; level < texture->num_levels; level++) {
+      if (!etc_blocks_are_etc1(texture->levels[level].data, texture->levels[level].size)) {
+	return 0;
+      }
+    }
+    return GL_ETC1_RGB8_OES;
+  }
+  return 0;
+}
+
+/* One level into the bound texture: format 0 decodes ETC, and rgb is
+   scratch space for that. Returns the GPU bytes. */
+static size_t upload_level(const KtxTexture *texture, const KtxLevel *data, int gl_level,
+			   const unsigned char *pixels, GLenum format, unsigned char *rgb) {
+  if (texture->type != 0) {
+    /* Already in GL's layout, so a straight copy */
+    int bytes_per_pixel = texture->internal_format == GL_RGBA ? 4 : 3;
+    glTexImage2D(GL_TEXTURE_2D, gl_level, texture->internal_format, data->width,
+		 data->height, 0, texture->internal_format, texture->type, pixels);
+    return (size_t) data->width * data->height * bytes_per_pixel;
+  }
+  if (format != 0) {
+    glCompressedTexImage2D(GL_TEXTURE_2D, gl_level, format, data->width, data->height,
+			   0, (GLsizei) data->size, pixels);
+    return data->size;
+  }
+  etc_decode_image(pixels, data->width, data->height,
+		   texture->internal_format == GL_COMPRESSED_RGB8_ETC2, rgb);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage2D(GL_TEXTURE_2D, gl_level, GL_RGB, data->width, data->height, 0,
+	       GL_RGB, GL_UNSIGNED_BYTE, rgb);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  return (size_t) data->width * data->height * 3;
+}
+
+size_t ktx_upload_level(const KtxTexture *texture, int level, int gl_level,
+			const unsigned char *data, bool allow_compressed) {
+  const KtxLevel *info = &texture->levels[level];
+  GLenum format = 0;
+  if (allow_compressed && texture->type == 0) {
+    /* Without the other levels there is no checking for ETC1-only
+       blocks, so an ETC2 file needs real ETC2 */
+    if (texture->internal_format == GL_ETC1_RGB8_OES && gl_caps.etc1) {
+      format = GL_ETC1_RGB8_OES;
+    } else if (gl_caps.etc2) {
+      format = GL_COMPRESSED_RGB8_ETC2;
+    }
+  }
+  unsigned char *rgb = NULL;
+  if (texture->type == 0 && format == 0) {
+    rgb = malloc((size_t) info->width * info->height * 3);
+  }
+  size_t bytes = upload_level(texture, info, gl_level, data, format, rgb);
+  free(rgb);
+  return bytes;
+}
+
+GLuint ktx_upload(const KtxTexture *texture, bool allow_compressed,
+		  KtxUploadStats *stats) {
+  Uint64 start = SDL_GetPerformanceCounter();
+  memset(stats, 0, sizeof(*stats));
+
+  GLenum format = allow_compressed ? upload_format(texture) : 0;
+
+  GLuint id;
+  glGenTextures(1, &id);
+  glBindTexture(GL_TEXTURE_2D, id);
+
+  unsigned char *rgb = NULL;
+  if (texture->type == 0 && format == 0) {
+    rgb = malloc((size_t) texture->width * texture->height * 3);
+  }
+  for (int level = 0; level < texture->num_levels; level++) {
+    const KtxLevel *data = &texture->levels[level];
+    stats->gpu_bytes += upload_level(texture, data, level, data->data, format, rgb);
+    stats->rgb_bytes += (size_t) data->width * data->height * 3;
+  }
+  stats->compressed = texture->type == 0 && format != 0;
+  free(rgb);
+
+  /* Mipmapped sampling needs the chain all the way down to 1x1 */
+  int full_levels = 1;
+  while (level_size(texture->width, full_levels - 1) > 1
+	 || level_size(texture->height, full_levels - 1) > 1) {
+    full_levels += 1;
+  }
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+		  texture->num_levels >= full_levels ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+
+  stats->upload_ms = (double) (SDL_GetPerformanceCounter() - start) * 1000.0
+    / (double) SDL_GetPerformanceFrequency();
+  return id;
+}
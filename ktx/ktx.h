@@ -0,0 +1,98 @@
+#ifndef KTX_H_
+#define KTX_H_
+
+/* ETC1/ETC2 and plain RGB(A)8 textures in KTX and KTX2 files.
+
+   Loading only reads and checks the file, so it can run on a startup
+   thread. Uploading needs the context and load_gl_caps(): the levels
+   go straight to glCompressedTexImage2D when the driver takes the
+   format, and are decoded to GL_RGB when it does not.
+
+   ETC1 data is also valid ETC2, so an ETC1 file uploads as ETC2 on an
+   ES3 driver without the ETC1 extension. The other way round works
+   when the ETC2 file happens to use only ETC1 blocks, which is checked.
+   KTX2 has no ETC1 format at all, so this is how ETC1 gets through it.
+
+   Uncompressed levels (mip chains baked by texture_prep) go to
+   glTexImage2D as they are: KTX pads rows to 4 bytes, which is GL's
+   default unpack alignment. These are KTX only, not KTX2.
+
+   Only 2D textures are handled: no arrays, cube maps or
+   supercompression.
+*/
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "gl_caps.h"
+
+#define KTX_MAX_LEVELS 16
+
+typedef struct {
+  int width;
+  int height;
+  size_t size;
+  size_t offset;              /* of the data in the file */
+  const unsigned char *data;  /* NULL after ktx_open */
+} KtxLevel;
+
+typedef struct {
+  /* GL_ETC1_RGB8_OES or GL_COMPRESSED_RGB8_ETC2 with type 0, or GL_RGB
+     or GL_RGBA with type GL_UNSIGNED_BYTE */
+  GLenum internal_format;
+  GLenum type;
+  int width;
+  int height;
+  int num_levels;
+  KtxLevel levels[KTX_MAX_LEVELS];
+  unsigned char *file;  /* what the levels point into, if loaded */
+
+  /* One key/value pair to write; see ktx_value for reading */
+  const char *key;
+  const char *value;
+  const unsigned char *key_values;
+  size_t key_values_size;
+} KtxTexture;
+
+typedef struct {
+  bool compressed;    /* false if it had to be decoded */
+  size_t gpu_bytes;
+  size_t rgb_bytes;   /* the same levels as GL_RGB */
+  double upload_ms;   /* including any decoding */
+} KtxUploadStats;
+
+const char *ktx_format_name(GLenum internal_format);
+
+/* Reads a KTX or KTX2 file. No GL calls, so any thread can do it. */
+bool ktx_load(KtxTexture *texture, const char *path);
+void ktx_free(KtxTexture *texture);
+
+/* Reads only the header and where each level is, for reading levels
+   one at a time later with ktx_read_level (which any thread may call).
+   out needs texture->levels[level].size bytes. */
+bool ktx_open(KtxTexture *texture, const char *path);
+bool ktx_read_level(const KtxTexture *texture, const char *path, int level,
+		    unsigned char *out);
+
+/* The value for key in a loaded file's key/value data, or NULL. */
+const char *ktx_value(const KtxTexture *texture, const char *key);
+
+/* Bytes for an uncompressed level, with KTX's row padding. */
+size_t ktx_level_size(GLenum format, int width, int height);
+
+/* Writes texture's levels as KTX, or KTX2 if ktx2 is set. */
+bool ktx_write(const KtxTexture *texture, const char *path, bool ktx2);
+
+/* Creates and fills a GL texture, decoding to GL_RGB if the driver
+   cannot take the format or allow_compressed is false. */
+GLuint ktx_upload(const KtxTexture *texture, bool allow_compressed,
+		  KtxUploadStats *stats);
+
+/* One level's data into the bound GL_TEXTURE_2D as gl_level, for
+   textures uploaded a level at a time. An ETC2 file is decoded unless
+   the driver has ETC2, as its other levels cannot be checked for
+   ETC1-only blocks. Returns the bytes it takes on the GPU. */
+size_t ktx_upload_level(const KtxTexture *texture, int level, int gl_level,
+			const unsigned char *data, bool allow_compressed);
+
+#endif // KTX_H_
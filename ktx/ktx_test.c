@@ -0,0 +1,112 @@
+/* Hostile headers that ktx_load and ktx_open must turn down. Run from
+   texture_tool/ with make test. */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ktx.h"
+
+#define TEST_PATH "ktx_test.tmp"
+
+static const unsigned char ktx1_identifier[12] = {
+  0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n'
+};
+static const unsigned char ktx2_identifier[12] = {
+  0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'
+};
+
+static void put32(unsigned char *p, uint32_t value) {
+  p[0] = (unsigned char) value;
+  p[1] = (unsigned char) (value >> 8);
+  p[2] = (unsigned char) (value >> 16);
+  p[3] = (unsigned char) (value >> 24);
+}
+
+static void put64(unsigned char *p, uint64_t value) {
+  put32(p, (uint32_t) value);
+  put32(p + 4, (uint32_t) (value >> 32));
+}
+
+/* A 4x4 ETC2 texture with one 8 byte level, as each format lays it out */
+static size_t ktx1_file(unsigned char *file) {
+  memset(file, 0, 128);
+  memcpy(file, ktx1_identifier, 12);
+  put32(file + 12, 0x04030201u);   /* endianness */
+  put32(file + 28, 0x9274);        /* GL_COMPRESSED_RGB8_ETC2 */
+  put32(file + 32, 0x1907);        /* GL_RGB */
+  put32(file + 36, 4);
+  put32(file + 40, 4);
+  put32(file + 52, 1);             /* faces */
+  put32(file + 56, 1);             /* levels */
+  put32(file + 64, 8);             /* level size */
+  return 64 + 4 + 8;
+}
+
+static size_t ktx2_file(unsigned char *file) {
+  memset(file, 0, 128);
+  memcpy(file, ktx2_identifier, 12);
+  put32(file + 12, 147);           /* VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK */
+  put32(file + 20, 4);
+  put32(file + 24, 4);
+  put32(file + 36, 1);             /* faces */
+  put32(file + 40, 1);             /* levels */
+  put64(file + 80, 104);           /* level offset */
+  put64(file + 88, 8);             /* level length */
+  return 104 + 8;
+}
+
+/* Both loaders should agree with expect */
+static int check(const char *name, const unsigned char *file, size_t size, bool expect) {
+  FILE *out = fopen(TEST_PATH, "wb");
+  if (out == NULL) {
+    printf("ERROR: could not write %s\n", TEST_PATH);
+    return 1;
+  }
+  fwrite(file, size, 1, out);
+  fclose(out);
+
+  int failures = 0;
+  KtxTexture texture;
+  for (int open = 0; open < 2; open++) {
+    bool ok = open ? ktx_open(&texture, TEST_PATH) : ktx_load(&texture, TEST_PATH);
+    if (ok != expect) {
+      printf("FAIL: %s: %s %s\n", name, open ? "ktx_open" : "ktx_load",
+	     ok ? "accepted it" : "turned it down");
+      failures++;
+    } else if (ok && (texture.num_levels < 1 || texture.num_levels > KTX_MAX_LEVELS)) {
+      printf("FAIL: %s: %d levels\n", name, texture.num_levels);
+      failures++;
+    }
+    if (ok) {
+      ktx_free(&texture);
+    }
+  }
+  remove(TEST_PATH);
+  return failures;
+}
+
+int main(void) {
+  unsigned char file[128];
+  int failures = 0;
+
+  size_t size = ktx1_file(file);
+  failures += check("KTX1", file, size, true);
+  put32(file + 56, 0x80000000u);
+  failures += check("KTX1 with 2^31 levels", file, size, false);
+  put32(file + 56, 0xFFFFFFFFu);
+  failures += check("KTX1 with 2^32 - 1 levels", file, size, false);
+  ktx1_file(file);
+  put32(file + 36, 0x80000000u);
+  failures += check("KTX1 2^31 wide", file, size, false);
+
+  size = ktx2_file(file);
+  failures += check("KTX2", file, size, true);
+  put32(file + 40, 0x80000000u);
+  failures += check("KTX2 with 2^31 levels", file, size, false);
+  ktx2_file(file);
+  put64(file + 80, (uint64_t) -4);
+  failures += check("KTX2 level wrapping past the end", file, size, false);
+
+  printf("ktx_test: %s\n", failures == 0 ? "all passed" : "FAILED");
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,289 @@
+/* Point lights binned into view-space clusters, a slice per job. */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+
+#include "light_clusters.h"
+#include "simd.h"
+
+#define TILES (LIGHT_CLUSTERS_X * LIGHT_CLUSTERS_Y)
+
+void light_clusters_init(LightClusters *clusters, const float *projection,
+			 float near, float far) {
+
+  memset(clusters, 0, sizeof(*clusters));
+  clusters->near = near;
+  clusters->far = far;
+  clusters->slice_scale = LIGHT_CLUSTERS_Z / logf(far / near);
+  clusters->slice_bias = -logf(near) * clusters->slice_scale;
+  clusters->slice_indices = (uint8_t *) malloc((size_t) LIGHT_CLUSTERS_COUNT
+					       * LIGHT_CLUSTERS_MAX_LIGHTS);
+  clusters->report_frames = 5 * 60;
+
+  /* At depth d a view-space point is at ndc x * d / P00, so a tile's
+     box spans its ndc range scaled by both ends of the slice */
+  float scale[2] = { 1.0f / projection[0], 1.0f / projection[5] };
+  int tiles[2] = { LIGHT_CLUSTERS_X, LIGHT_CLUSTERS_Y };
+  for (int slice = 0; slice < LIGHT_CLUSTERS_Z; slice++) {
+    float d0 = slice == 0 ? 0.0f
+      : near * powf(far / near, (float) slice / LIGHT_CLUSTERS_Z);
+    float d1 = near * powf(far / near, (float) (slice + 1) / LIGHT_CLUSTERS_Z);
+    for (int y = 0; y < LIGHT_CLUSTERS_Y; y++) {
+      for (int x = 0; x < LIGHT_CLUSTERS_X; x++) {
+	int cluster = slice * TILES + y * LIGHT_CLUSTERS_X + x;
+	int tile[2] = { x, y };
+	for (int axis = 0; axis < 2; axis++) {
+	  float ndc0 = -1.0f + 2.0f * tile[axis] / tiles[axis];
+	  float ndc1 = -1.0f + 2.0f * (tile[axis] + 1) / tiles[axis];
+	  clusters->box_min[axis][cluster] = fminf(ndc0 * d0, ndc0 * d1) * scale[axis];
+	  clusters->box_max[axis][cluster] = fmaxf(ndc1 * d0, ndc1 * d1) * scale[axis];
+	}
+	clusters->box_min[2][cluster] = d0;
+	clusters->box_max[2][cluster] = d1;
+      }
+    }
+  }
+}
+
+void light_clusters_destroy(LightClusters *clusters) {
+  free(clusters->slice_indices);
+  clusters->slice_indices = NULL;
+}
+
+static uint16_t quantize(float value, float min, float size) {
+  float unit = (value - min) / size;
+  unit = unit < 0.0f ? 0.0f : (unit > 1.0f ? 1.0f : unit);
+  return (uint16_t) (unit * 65535.0f + 0.5f);
+}
+
+void light_clusters_prepare(LightClusters *clusters, const float *m) {
+
+  int num_lights = clusters->num_lights;
+  for (int i = 0; i < num_lights; i += 4) {
+    f32x4 p[3];
+    for (int axis = 0; axis < 3; axis++) {
+      float lane[4];
+      for (int k = 0; k < 4; k++) {
+	lane[k] = i + k < num_lights ? clusters->lights[i + k].position[axis] : 0.0f;
+      }
+      p[axis] = f32x4_load(lane);
+    }
+
+    float out[3][4];
+    for (int row = 0; row < 3; row++) {
+      f32x4 v = f32x4_madd(p[0], f32x4_set1(m[row]), f32x4_set1(m[12 + row]));
+      v = f32x4_madd(p[1], f32x4_set1(m[4 + row]), v);
+      v = f32x4_madd(p[2], f32x4_set1(m[8 + row]), v);
+      f32x4_store(out[row], v);
+    }
+    for (int k = 0; k < 4 && i + k < num_lights; k++) {
+      clusters->view[0][i + k] = out[0][k];
+      clusters->view[1][i + k] = out[1][k];
+      clusters->view[2][i + k] = -out[2][k];
+      clusters->radius[i + k] = clusters->lights[i + k].radius;
+    }
+  }
+
+  float bounds_max[3];
+  clusters->max_radius = 0.0f;
+  for (int axis = 0; axis < 3; axis++) {
+    clusters->bounds_min[axis] = num_lights > 0 ? clusters->lights[0].position[axis] : 0.0f;
+    bounds_max[axis] = clusters->bounds_min[axis];
+  }
+  for (int i = 0; i < num_lights; i++) {
+    const PointLight *light = &clusters->lights[i];
+    for (int axis = 0; axis < 3; axis++) {
+      clusters->bounds_min[axis] = fminf(clusters->bounds_min[axis], light->position[axis]);
+      bounds_max[axis] = fmaxf(bounds_max[axis], light->position[axis]);
+    }
+    clusters->max_radius = fmaxf(clusters->max_radius, light->radius);
+  }
+  for (int axis = 0; axis < 3; axis++) {
+    clusters->bounds_size[axis] = fmaxf(bounds_max[axis] - clusters->bounds_min[axis], 1e-3f);
+  }
+
+  for (int i = 0; i < num_lights; i++) {
+    const PointLight *light = &clusters->lights[i];
+    uint16_t q[4];
+    for (int axis = 0; axis < 3; axis++) {
+      q[axis] = quantize(light->position[axis], clusters->bounds_min[axis],
+			 clusters->bounds_size[axis]);
+    }
+    q[3] = quantize(light->radius, 0.0f, fmaxf(clusters->max_radius, 1e-3f));
+    for (int t = 0; t < 2; t++) {
+      clusters->texels[t][i][0] = q[2 * t] >> 8;
+      clusters->texels[t][i][1] = q[2 * t] & 0xff;
+      clusters->texels[t][i][2] = q[2 * t + 1] >> 8;
+      clusters->texels[t][i][3] = q[2 * t + 1] & 0xff;
+    }
+    for (int c = 0; c < 3; c++) {
+      clusters->texels[2][i][c] = (uint8_t) (light->colour[c] * 255.0f + 0.5f);
+      clusters->data[i][c] = light->position[c];
+      clusters->data[i][4 + c] = light->colour[c];
+    }
+    clusters->texels[2][i][3] = 255;
+    clusters->data[i][3] = light->radius;
+    clusters->data[i][7] = 0.0f;
+  }
+}
+
+static void bin_slice(LightClusters *clusters, int slice) {
+
+  /* Only the lights reaching into the slice are tested against its
+     boxes. The padding's negative radius squared never passes. */
+  float x[LIGHT_CLUSTERS_MAX_LIGHTS + 3];
+  float y[LIGHT_CLUSTERS_MAX_LIGHTS + 3];
+  float depth[LIGHT_CLUSTERS_MAX_LIGHTS + 3];
+  float radius2[LIGHT_CLUSTERS_MAX_LIGHTS + 3];
+  uint8_t index[LIGHT_CLUSTERS_MAX_LIGHTS + 3];
+  int first = slice * TILES;
+  float d0 = clusters->box_min[2][first];
+  float d1 = clusters->box_max[2][first];
+  int n = 0;
+  for (int i = 0; i < clusters->num_lights; i++) {
+    float d = clusters->view[2][i];
+    float r = clusters->radius[i];
+    if (d + r > d0 && d - r < d1) {
+      x[n] = clusters->view[0][i];
+      y[n] = clusters->view[1][i];
+      depth[n] = d;
+      radius2[n] = r * r;
+      index[n] = (uint8_t) i;
+      n += 1;
+    }
+  }
+  for (int pad = n; pad < ((n + 3) & ~3); pad++) {
+    x[pad] = y[pad] = depth[pad] = 0.0f;
+    radius2[pad] = -1.0f;
+    index[pad] = 0;
+  }
+
+  f32x4 zero = f32x4_zero();
+  for (int tile = 0; tile < TILES; tile++) {
+    int cluster = first + tile;
+    f32x4 min_x = f32x4_set1(clusters->box_min[0][cluster]);
+    f32x4 max_x = f32x4_set1(clusters->box_max[0][cluster]);
+    f32x4 min_y = f32x4_set1(clusters->box_min[1][cluster]);
+    f32x4 max_y = f32x4_set1(clusters->box_max[1][cluster]);
+    f32x4 min_d = f32x4_set1(d0);
+    f32x4 max_d = f32x4_set1(d1);
+    uint8_t *list = clusters->slice_indices + (size_t) cluster * LIGHT_CLUSTERS_MAX_LIGHTS;
+    int count = 0;
+
+    for (int j = 0; j < n; j += 4) {
+      /* Distance from the centre to the box, per axis */
+      f32x4 lx = f32x4_load(x + j);
+      f32x4 ly = f32x4_load(y + j);
+      f32x4 ld = f32x4_load(depth + j);
+      f32x4 dx = f32x4_add(f32x4_max(f32x4_sub(min_x, lx), zero),
+			   f32x4_max(f32x4_sub(lx, max_x), zero));
+      f32x4 dy = f32x4_add(f32x4_max(f32x4_sub(min_y, ly), zero),
+			   f32x4_max(f32x4_sub(ly, max_y), zero));
+      f32x4 dd = f32x4_add(f32x4_max(f32x4_sub(min_d, ld), zero),
+			   f32x4_max(f32x4_sub(ld, max_d), zero));
+      f32x4 d2 = f32x4_madd(dx, dx, f32x4_madd(dy, dy, f32x4_mul(dd, dd)));
+      int mask = f32x4_movemask(f32x4_cmplt(d2, f32x4_load(radius2 + j)));
+      while (mask != 0) {
+	int lane = __builtin_ctz(mask);
+	list[count] = index[j + lane];
+	count += 1;
+	mask &= mask - 1;
+      }
+    }
+    clusters->slice_counts[cluster] = (uint16_t) count;
+  }
+}
+
+static void bin_slices(void *data, int begin, int end) {
+  LightClusters *clusters = (LightClusters *) data;
+  for (int slice = begin; slice < end; slice++) {
+    bin_slice(clusters, slice);
+  }
+}
+
+/* The per-cluster lists end to end, as many as fit */
+static void pack_clusters(LightClusters *clusters) {
+
+  int offset = 0;
+  for (int cluster = 0; cluster < LIGHT_CLUSTERS_COUNT; cluster++) {
+    int count = clusters->slice_counts[cluster];
+    int fit = count;
+    if (fit > LIGHT_CLUSTERS_MAX_INDICES - offset) {
+      fit = LIGHT_CLUSTERS_MAX_INDICES - offset;
+    }
+    memcpy(clusters->indices + offset,
+	   clusters->slice_indices + (size_t) cluster * LIGHT_CLUSTERS_MAX_LIGHTS, fit);
+    clusters->clusters[cluster] = (uint32_t) offset | ((uint32_t) fit << 16);
+    offset += fit;
+
+    clusters->cluster_lights += count;
+    clusters->dropped += count - fit;
+    if (count > clusters->max_cluster_lights) {
+      clusters->max_cluster_lights = count;
+    }
+  }
+  clusters->num_indices = offset;
+}
+
+void light_clusters_update(LightClusters *clusters, JobSystem *jobs, const float *view) {
+
+  Uint64 start = SDL_GetPerformanceCounter();
+  light_clusters_prepare(clusters, view);
+  parallel_for(jobs, LIGHT_CLUSTERS_Z, 1, bin_slices, clusters);
+  pack_clusters(clusters);
+  clusters->bin_ms += (double) (SDL_GetPerformanceCounter() - start) * 1000.0
+    / (double) SDL_GetPerformanceFrequency();
+  clusters->frames += 1;
+}
+
+void light_clusters_update_scalar(LightClusters *clusters, const float *view) {
+
+  Uint64 start = SDL_GetPerformanceCounter();
+  light_clusters_prepare(clusters, view);
+  for (int cluster = 0; cluster < LIGHT_CLUSTERS_COUNT; cluster++) {
+    uint8_t *list = clusters->slice_indices + (size_t) cluster * LIGHT_CLUSTERS_MAX_LIGHTS;
+    int count = 0;
+    for (int i = 0; i < clusters->num_lights; i++) {
+      float distance2 = 0.0f;
+      for (int axis = 0; axis < 3; axis++) {
+	float value = clusters->view[axis][i];
+	float outside = fmaxf(clusters->box_min[axis][cluster] - value, 0.0f)
+	  + fmaxf(value - clusters->box_max[axis][cluster], 0.0f);
+	distance2 += outside * outside;
+      }
+      if (distance2 < clusters->radius[i] * clusters->radius[i]) {
+	list[count] = (uint8_t) i;
+	count += 1;
+      }
+    }
+    clusters->slice_counts[cluster] = (uint16_t) count;
+  }
+  pack_clusters(clusters);
+  clusters->bin_ms += (double) (SDL_GetPerformanceCounter() - start) * 1000.0
+    / (double) SDL_GetPerformanceFrequency();
+  clusters->frames += 1;
+}
+
+void light_clusters_report(LightClusters *clusters) {
+
+  if (clusters->frames < clusters->report_frames) {
+    return;
+  }
+
+  int frames = clusters->frames;
+  printf("light clusters: %d lights in %dx%dx%d clusters, bin %.3f ms/frame, "
+	 "%.2f lights per cluster (max %d), %ld dropped\n",
+	 clusters->num_lights, LIGHT_CLUSTERS_X, LIGHT_CLUSTERS_Y, LIGHT_CLUSTERS_Z,
+	 clusters->bin_ms / frames,
+	 (double) clusters->cluster_lights / frames / LIGHT_CLUSTERS_COUNT,
+	 clusters->max_cluster_lights, clusters->dropped);
+
+  clusters->frames = 0;
+  clusters->bin_ms = 0.0;
+  clusters->cluster_lights = 0;
+  clusters->max_cluster_lights = 0;
+  clusters->dropped = 0;
+}
@@ -0,0 +1,117 @@
+#ifndef LIGHT_CLUSTERS_H_
+#define LIGHT_CLUSTERS_H_
+
+/* Binning point lights into view-space clusters for clustered forward
+   shading.
+
+   The view frustum is cut into LIGHT_CLUSTERS_X by LIGHT_CLUSTERS_Y
+   screen tiles and LIGHT_CLUSTERS_Z depth slices, the slices spaced
+   exponentially between near and far so near and far clusters are
+   roughly the same shape. Each cluster gets a view-space box when the
+   projection is set. Every frame the lights are moved into view space
+   and, one slice per job, the lights touching a slice are tested four
+   at a time against each of its boxes (sphere against box). The
+   per-cluster lists are then packed end to end.
+
+   A fragment works out its cluster from gl_FragCoord and its view
+   depth, and only loops over that cluster's lights.
+
+   The packed results are laid out to be uploaded as they are:
+
+   clusters  a uint32 per cluster, index (y * X + x) + slice * X * Y:
+             offset into indices in the low 16 bits, count in the
+             high 16. On a little-endian CPU that is an RGBA8 texel
+             with the offset in R, G and the count in B, A.
+   indices   a byte per light index, so at most 256 lights.
+   texels    LIGHT_CLUSTERS_MAX_LIGHTS by 3 RGBA8 texels per light:
+             x, y, z and radius as 16 bit fractions of the light
+             bounds (for ES2, which has no float textures to rely on)
+             and the colour.
+   data      the same as two vec4s per light, position and radius then
+             colour, for a std140 uniform block.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "job_system.h"
+
+#define LIGHT_CLUSTERS_X 16
+#define LIGHT_CLUSTERS_Y 9
+#define LIGHT_CLUSTERS_Z 24
+#define LIGHT_CLUSTERS_COUNT (LIGHT_CLUSTERS_X * LIGHT_CLUSTERS_Y * LIGHT_CLUSTERS_Z)
+#define LIGHT_CLUSTERS_MAX_LIGHTS 256
+/* 16 KB, the smallest uniform block ES3 has to allow */
+#define LIGHT_CLUSTERS_MAX_INDICES 16384
+#define LIGHT_CLUSTERS_INDEX_WIDTH 1024  /* index texture width */
+
+typedef struct {
+  float position[3];  /* world space */
+  float radius;       /* no light beyond it */
+  float colour[3];    /* 0 to 1 */
+} PointLight;
+
+typedef struct {
+  int num_lights;
+  PointLight lights[LIGHT_CLUSTERS_MAX_LIGHTS];
+
+  /* Slicing: slice = log(depth) * slice_scale + slice_bias */
+  float near;
+  float far;
+  float slice_scale;
+  float slice_bias;
+
+  /* Cluster boxes in view space, with depth = -z */
+  float box_min[3][LIGHT_CLUSTERS_COUNT];
+  float box_max[3][LIGHT_CLUSTERS_COUNT];
+
+  /* This frame's lights in view space, x, y and depth */
+  float view[3][LIGHT_CLUSTERS_MAX_LIGHTS];
+  float radius[LIGHT_CLUSTERS_MAX_LIGHTS];
+
+  /* Per slice lists, before packing */
+  uint8_t *slice_indices;  /* X * Y * MAX_LIGHTS per slice */
+  uint16_t slice_counts[LIGHT_CLUSTERS_COUNT];
+
+  /* Packed for the GPU */
+  uint32_t clusters[LIGHT_CLUSTERS_COUNT];
+  uint8_t indices[LIGHT_CLUSTERS_MAX_INDICES];
+  int num_indices;
+  uint8_t texels[3][LIGHT_CLUSTERS_MAX_LIGHTS][4];
+  float data[LIGHT_CLUSTERS_MAX_LIGHTS][8];
+  float bounds_min[3];    /* what the texel positions are fractions of */
+  float bounds_size[3];
+  float max_radius;
+
+  /* Since the last report */
+  int frames;
+  double bin_ms;
+  long cluster_lights;  /* summed over clusters and frames */
+  int max_cluster_lights;
+  long dropped;         /* did not fit in indices */
+  int report_frames;
+} LightClusters;
+
+/* projection is column-major float[16], symmetric perspective. Slices
+   run from near to far, far being the projection's; the first also
+   takes anything closer. */
+void light_clusters_init(LightClusters *clusters, const float *projection,
+			 float near, float far);
+void light_clusters_destroy(LightClusters *clusters);
+
+/* Just the lights in view space and packed as texels and data, for
+   shading that loops over every light. */
+void light_clusters_prepare(LightClusters *clusters, const float *view);
+
+/* Bin the first num_lights lights for this view matrix and pack the
+   results. jobs may be NULL. */
+void light_clusters_update(LightClusters *clusters, JobSystem *jobs,
+			   const float *view);
+
+/* Same binning, one light and one cluster at a time, for comparison. */
+void light_clusters_update_scalar(LightClusters *clusters, const float *view);
+
+/* Prints every clusters->report_frames frames and resets. */
+void light_clusters_report(LightClusters *clusters);
+
+#endif // LIGHT_CLUSTERS_H_
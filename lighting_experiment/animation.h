@@ -0,0 +1,138 @@
+#ifndef ANIMATION_HEADER
+#define ANIMATION_HEADER
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <cglm/cglm.h>
+#include <SDL2/SDL.h>
+
+#include "job_system.h"
+#include "transform_store.h"
+
+// C header-only library for the per-frame cube updates, written so the
+// job system can split them across threads. Cubes only move their
+// entry in the transform store; the matrices are built from it in bulk.
+
+/* How many cubes one job updates */
+#define ANIMATION_GRAIN 256
+
+typedef struct {
+  /* C struct holding how a cube moves each frame:
+     - The cube's slot in the transform store
+     - A spin about spin_axis, in radians per frame (0 for none)
+     - Whether it orbits the origin about the z axis
+   */
+  int transform;
+  float spin_speed;
+  vec3 spin_axis;
+  bool orbits;
+} CubeAnimation;
+
+typedef struct {
+  TransformStore *store;
+  CubeAnimation *animations;
+} AnimationBatch;
+
+void animate_cube(TransformStore *store, CubeAnimation *animation) {
+
+  int index = animation->transform;
+
+  if (animation->spin_speed != 0.0f) {
+    versor spin;
+    glm_quatv(spin, animation->spin_speed, animation->spin_axis);
+    transform_store_rotate(store, index, spin);
+  }
+
+  /* Orbit: step along the tangent, which is position x z */
+  if (animation->orbits) {
+    vec3 z_axis = GLM_VEC3_ZERO_INIT;
+    z_axis[2] = 1.0f;
+
+    vec3 position;
+    vec3 translation_vector;
+    transform_store_get_position(store, index, position);
+    glm_vec3_cross(position, z_axis, translation_vector);
+    glm_vec3_scale(translation_vector, 0.01, translation_vector);
+    glm_vec3_add(position, translation_vector, position);
+    transform_store_set_position(store, index, position);
+  }
+}
+
+void animate_cubes_job(void *data, int begin, int end) {
+  AnimationBatch *batch = (AnimationBatch *) data;
+  for (int i = begin; i < end; i++) {
+    animate_cube(batch->store, &batch->animations[i]);
+  }
+}
+
+/* Move every cube, spread over the job system's threads. The matrices
+   are rebuilt afterwards by transform_store_update. */
+void animate_cubes(JobSystem *jobs, TransformStore *store,
+		   CubeAnimation *animations, int num_cubes) {
+  AnimationBatch batch = { store, animations };
+  parallel_for(jobs, num_cubes, ANIMATION_GRAIN, animate_cubes_job, &batch);
+}
+
+void benchmark_animation(int num_objects, int num_frames) {
+  /* Time the cube updates for num_objects cubes with 1..N threads.
+     No GL is involved, only the animation and the matrix rebuild. */
+
+  TransformStore store;
+  CubeAnimation *animations = (CubeAnimation *) calloc(num_objects,
+						       sizeof(CubeAnimation));
+
+  mat4 view_projection;
+  glm_perspective(glm_rad(45.0f), 16.0f / 9.0f, 0.1f, 100.0f, view_projection);
+
+  int max_threads = SDL_GetCPUCount();
+  if (max_threads > JOB_MAX_THREADS) {
+    max_threads = JOB_MAX_THREADS;
+  }
+
+  printf("Animation benchmark: %d objects, %d frames\n", num_objects, num_frames);
+
+  double single_thread_ms = 0.0;
+  for (int threads = 1; threads <= max_threads; threads++) {
+
+    /* Same starting state for every run */
+    transform_store_init(&store, num_objects);
+    for (int i = 0; i < num_objects; i++) {
+      animations[i].transform = transform_store_add(&store);
+      animations[i].spin_speed = 0.025f;
+      animations[i].spin_axis[0] = 0.2f;
+      animations[i].spin_axis[1] = 1.0f;
+      animations[i].spin_axis[2] = 0.0f;
+      animations[i].orbits = (i % 2) == 1;
+
+      vec3 position = { 3.0f + (float) (i % 100) * 0.1f, 0.0f, 0.0f };
+      transform_store_set_position(&store, animations[i].transform, position);
+    }
+
+    JobSystem *jobs = (JobSystem *) malloc(sizeof(JobSystem));
+    job_system_init(jobs, threads);
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int frame = 0; frame < num_frames; frame++) {
+      animate_cubes(jobs, &store, animations, num_objects);
+      transform_store_update(&store, jobs, view_projection);
+    }
+    double frame_ms = (double) (SDL_GetPerformanceCounter() - start) * 1000.0
+      / (double) SDL_GetPerformanceFrequency() / num_frames;
+
+    if (threads == 1) {
+      single_thread_ms = frame_ms;
+    }
+    printf("\t%2d threads: %8.3f ms/frame, speedup %.2fx, %d jobs stolen\n",
+	   threads, frame_ms, single_thread_ms / frame_ms,
+	   atomic_load(&jobs->jobs_stolen));
+
+    job_system_destroy(jobs);
+    free(jobs);
+    transform_store_destroy(&store);
+  }
+
+  free(animations);
+}
+
+#endif
@@ -0,0 +1,422 @@
+#ifndef CLUSTERED_LIGHTING_HEADER
+#define CLUSTERED_LIGHTING_HEADER
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <cglm/cglm.h>
+#include <GLES2/gl2.h>
+#include <SDL2/SDL.h>
+
+#include "command_list.h"
+#include "cube.h"
+#include "cube_draw.h"
+#include "gl_caps.h"
+#include "job_system.h"
+#include "light_clusters.h"
+#include "shader_loader.h"
+
+// C header-only library that lights the cubes with hundreds of moving
+// point lights through clustered forward shading. The lights are
+// binned on the CPU by light_clusters and uploaded every frame: as
+// data textures on ES2, as uniform blocks on ES3. The program keeps
+// the lighting shader's uniform names, so the cube draws and their
+// command lists work with it unchanged; only the per-frame cluster
+// uniforms are set here.
+//
+// The naive version (every fragment loops over every light) is the
+// same shader built with NAIVE_LIGHTS, for comparison.
+
+/* Texture units 1 to 3 hold the ES2 data textures */
+#define CLUSTER_TEXTURE_UNIT 1
+
+typedef struct {
+  /* Where a light circles */
+  vec3 centre;
+  float orbit;
+  float speed;   /* radians per second */
+  float phase;
+} LightOrbit;
+
+typedef struct {
+  LightClusters *clusters;
+  LightOrbit orbits[LIGHT_CLUSTERS_MAX_LIGHTS];
+  bool naive;
+  bool blocks;   /* uniform blocks, or data textures */
+  int width;
+  int height;
+
+  GLuint program;
+  LightingShader shader;
+  GLint view;
+  GLint tile_scale;
+  GLint slice_scale;
+  GLint slice_bias;
+  GLint num_lights;
+  GLint cluster_texture;
+  GLint index_texture;
+  GLint light_texture;
+  GLint bounds_min;
+  GLint bounds_size;
+  GLint max_radius;
+
+  GLuint textures[3];  /* clusters, indices, lights */
+  GLuint buffers[3];   /* lights, clusters, indices */
+
+  /* Since the last report */
+  int frames;
+  double upload_ms;
+} ClusteredLighting;
+
+float light_random(unsigned int *seed) {
+  *seed = *seed * 1664525u + 1013904223u;
+  return (float) (*seed >> 8) / 16777216.0f;
+}
+
+/* num_lights lights circling at random inside the box min to max.
+   The same seed every time, so every way of shading gets the same
+   lights. */
+void place_lights(PointLight *lights, LightOrbit *orbits, int num_lights,
+		  const float *min, const float *max) {
+
+  unsigned int seed = 12345;
+  for (int i = 0; i < num_lights; i++) {
+    LightOrbit *orbit = &orbits[i];
+    for (int axis = 0; axis < 3; axis++) {
+      orbit->centre[axis] = min[axis] + (max[axis] - min[axis]) * light_random(&seed);
+    }
+    orbit->orbit = 0.5f + 1.5f * light_random(&seed);
+    orbit->speed = 0.3f + light_random(&seed);
+    orbit->phase = 6.2831853f * light_random(&seed);
+
+    /* Bright, saturated colours */
+    PointLight *light = &lights[i];
+    float hue = light_random(&seed);
+    for (int c = 0; c < 3; c++) {
+      light->colour[c] = 0.5f + 0.5f * cosf(6.2831853f * (hue - c / 3.0f));
+    }
+    light->radius = 2.0f + 2.0f * light_random(&seed);
+  }
+}
+
+/* Move the lights to where they are at time seconds */
+void animate_lights(PointLight *lights, const LightOrbit *orbits, int num_lights,
+		    float time) {
+  for (int i = 0; i < num_lights; i++) {
+    const LightOrbit *orbit = &orbits[i];
+    float angle = orbit->phase + orbit->speed * time;
+    lights[i].position[0] = orbit->centre[0] + orbit->orbit * cosf(angle);
+    lights[i].position[1] = orbit->centre[1];
+    lights[i].position[2] = orbit->centre[2] + orbit->orbit * sinf(angle);
+  }
+}
+
+/* Where the lights go in the lighting_experiment scene */
+void place_scene_lights(PointLight *lights, LightOrbit *orbits, int num_lights) {
+  vec3 min = { -12.0f, -4.0f, -12.0f };
+  vec3 max = { 12.0f, 3.0f, 6.0f };
+  place_lights(lights, orbits, num_lights, min, max);
+}
+
+void clustered_lighting_place(ClusteredLighting *lighting, int num_lights,
+			      const float *min, const float *max) {
+  lighting->clusters->num_lights = num_lights;
+  place_lights(lighting->clusters->lights, lighting->orbits, num_lights, min, max);
+}
+
+void clustered_lighting_init(ClusteredLighting *lighting, int num_lights, bool naive,
+			     mat4 projection, int width, int height) {
+
+  memset(lighting, 0, sizeof(*lighting));
+  lighting->clusters = (LightClusters *) malloc(sizeof(LightClusters));
+  light_clusters_init(lighting->clusters, projection[0], 1.0f, 100.0f);
+  lighting->naive = naive;
+  lighting->blocks = gl_caps.es3 && gl_caps.BindBufferBase != NULL
+    && gl_caps.GetUniformBlockIndex != NULL && gl_caps.UniformBlockBinding != NULL;
+  lighting->width = width;
+  lighting->height = height;
+
+  if (num_lights > LIGHT_CLUSTERS_MAX_LIGHTS) {
+    num_lights = LIGHT_CLUSTERS_MAX_LIGHTS;
+  }
+  lighting->clusters->num_lights = num_lights;
+  place_scene_lights(lighting->clusters->lights, lighting->orbits, num_lights);
+
+  /* The grid sizes are compiled in */
+  char defines[512];
+  snprintf(defines, sizeof(defines),
+	   "#define CLUSTERS_X %d\n#define CLUSTERS_Y %d\n#define CLUSTERS_Z %d\n"
+	   "#define MAX_LIGHTS %d\n#define MAX_INDICES %d\n#define INDEX_WIDTH %d\n%s",
+	   LIGHT_CLUSTERS_X, LIGHT_CLUSTERS_Y, LIGHT_CLUSTERS_Z,
+	   LIGHT_CLUSTERS_MAX_LIGHTS, LIGHT_CLUSTERS_MAX_INDICES,
+	   LIGHT_CLUSTERS_INDEX_WIDTH, naive ? "#define NAIVE_LIGHTS 1\n" : "");
+  if (lighting->blocks) {
+    lighting->program = load_shaders_defines("shaders/clustered_es3.vert",
+					     "shaders/clustered_es3.frag", defines);
+  } else {
+    lighting->program = load_shaders_defines("shaders/clustered.vert",
+					     "shaders/clustered.frag", defines);
+  }
+
+  GLuint program = lighting->program;
+  lighting_shader_locations(program, &lighting->shader);
+  lighting->view = glGetUniformLocation(program, "view");
+  lighting->tile_scale = glGetUniformLocation(program, "tileScale");
+  lighting->slice_scale = glGetUniformLocation(program, "sliceScale");
+  lighting->slice_bias = glGetUniformLocation(program, "sliceBias");
+  lighting->num_lights = glGetUniformLocation(program, "numLights");
+  lighting->cluster_texture = glGetUniformLocation(program, "clusterTexture");
+  lighting->index_texture = glGetUniformLocation(program, "indexTexture");
+  lighting->light_texture = glGetUniformLocation(program, "lightTexture");
+  lighting->bounds_min = glGetUniformLocation(program, "lightBoundsMin");
+  lighting->bounds_size = glGetUniformLocation(program, "lightBoundsSize");
+  lighting->max_radius = glGetUniformLocation(program, "maxRadius");
+
+  if (lighting->blocks) {
+    const char *names[3] = { "ClusterLights", "ClusterTable", "ClusterIndices" };
+    glGenBuffers(3, lighting->buffers);
+    for (int b = 0; b < 3; b++) {
+      GLuint block = gl_caps.GetUniformBlockIndex(program, names[b]);
+      if (block != GL_INVALID_INDEX) {
+	gl_caps.UniformBlockBinding(program, block, b);
+      }
+    }
+  } else {
+    /* Sizes as in light_clusters.h, all sampled texel for texel */
+    int sizes[3][2] = {
+      { LIGHT_CLUSTERS_X * LIGHT_CLUSTERS_Y, LIGHT_CLUSTERS_Z },
+      { LIGHT_CLUSTERS_INDEX_WIDTH, LIGHT_CLUSTERS_MAX_INDICES / LIGHT_CLUSTERS_INDEX_WIDTH },
+      { LIGHT_CLUSTERS_MAX_LIGHTS, 3 }
+    };
+    GLenum formats[3] = { GL_RGBA, GL_LUMINANCE, GL_RGBA };
+    glGenTextures(3, lighting->textures);
+    for (int t = 0; t < 3; t++) {
+      glBindTexture(GL_TEXTURE_2D, lighting->textures[t]);
+      glTexImage2D(GL_TEXTURE_2D, 0, formats[t], sizes[t][0], sizes[t][1], 0,
+		   formats[t], GL_UNSIGNED_BYTE, NULL);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+  }
+
+  printf("Clustered lighting: %d lights, %s, %s\n", num_lights,
+	 naive ? "naive (every light per fragment)" : "clustered",
+	 lighting->blocks ? "uniform blocks" : "data textures");
+}
+
+void clustered_lighting_destroy(ClusteredLighting *lighting) {
+  glDeleteProgram(lighting->program);
+  if (lighting->blocks) {
+    glDeleteBuffers(3, lighting->buffers);
+  } else {
+    glDeleteTextures(3, lighting->textures);
+  }
+  light_clusters_destroy(lighting->clusters);
+  free(lighting->clusters);
+}
+
+/* Move the lights to where they are at time seconds, bin them for this
+   view, upload the results and set the per-frame uniforms. */
+void clustered_lighting_update(ClusteredLighting *lighting, JobSystem *jobs,
+			       mat4 view, float time) {
+
+  LightClusters *clusters = lighting->clusters;
+  animate_lights(clusters->lights, lighting->orbits, clusters->num_lights, time);
+
+  if (lighting->naive) {
+    light_clusters_prepare(clusters, view[0]);
+  } else {
+    light_clusters_update(clusters, jobs, view[0]);
+  }
+
+  Uint64 start = SDL_GetPerformanceCounter();
+  if (lighting->blocks) {
+    const void *data[3] = { clusters->data, clusters->clusters, clusters->indices };
+    GLsizeiptr sizes[3] = { sizeof(clusters->data), sizeof(clusters->clusters),
+			    sizeof(clusters->indices) };
+    for (int b = 0; b < 3; b++) {
+      glBindBuffer(GL_UNIFORM_BUFFER, lighting->buffers[b]);
+      glBufferData(GL_UNIFORM_BUFFER, sizes[b], data[b], GL_DYNAMIC_DRAW);
+      gl_caps.BindBufferBase(GL_UNIFORM_BUFFER, b, lighting->buffers[b]);
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  } else {
+    /* Only the index rows in use */
+    int rows = (clusters->num_indices + LIGHT_CLUSTERS_INDEX_WIDTH - 1)
+      / LIGHT_CLUSTERS_INDEX_WIDTH;
+    glActiveTexture(GL_TEXTURE0 + CLUSTER_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_2D, lighting->textures[0]);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, LIGHT_CLUSTERS_X * LIGHT_CLUSTERS_Y,
+		    LIGHT_CLUSTERS_Z, GL_RGBA, GL_UNSIGNED_BYTE, clusters->clusters);
+    glActiveTexture(GL_TEXTURE0 + CLUSTER_TEXTURE_UNIT + 1);
+    glBindTexture(GL_TEXTURE_2D, lighting->textures[1]);
+    if (rows > 0) {
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, LIGHT_CLUSTERS_INDEX_WIDTH, rows,
+		      GL_LUMINANCE, GL_UNSIGNED_BYTE, clusters->indices);
+    }
+    glActiveTexture(GL_TEXTURE0 + CLUSTER_TEXTURE_UNIT + 2);
+    glBindTexture(GL_TEXTURE_2D, lighting->textures[2]);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, LIGHT_CLUSTERS_MAX_LIGHTS, 3,
+		    GL_RGBA, GL_UNSIGNED_BYTE, clusters->texels);
+    glActiveTexture(GL_TEXTURE0);
+  }
+  lighting->upload_ms += (double) (SDL_GetPerformanceCounter() - start) * 1000.0
+    / (double) SDL_GetPerformanceFrequency();
+  lighting->frames += 1;
+
+  /* Uniforms stay with the program, so the cube draws pick them up */
+  glUseProgram(lighting->program);
+  glUniformMatrix4fv(lighting->view, 1, GL_FALSE, view[0]);
+  glUniform2f(lighting->tile_scale, (float) LIGHT_CLUSTERS_X / lighting->width,
+	      (float) LIGHT_CLUSTERS_Y / lighting->height);
+  glUniform1f(lighting->slice_scale, clusters->slice_scale);
+  glUniform1f(lighting->slice_bias, clusters->slice_bias);
+  if (lighting->blocks) {
+    glUniform1i(lighting->num_lights, clusters->num_lights);
+  } else {
+    glUniform1f(lighting->num_lights, (float) clusters->num_lights);
+    glUniform1i(lighting->cluster_texture, CLUSTER_TEXTURE_UNIT);
+    glUniform1i(lighting->index_texture, CLUSTER_TEXTURE_UNIT + 1);
+    glUniform1i(lighting->light_texture, CLUSTER_TEXTURE_UNIT + 2);
+    glUniform3fv(lighting->bounds_min, 1, clusters->bounds_min);
+    glUniform3fv(lighting->bounds_size, 1, clusters->bounds_size);
+    glUniform1f(lighting->max_radius, clusters->max_radius);
+  }
+}
+
+/* Prints every clusters->report_frames frames and resets. */
+void clustered_lighting_report(ClusteredLighting *lighting) {
+
+  LightClusters *clusters = lighting->clusters;
+  if (lighting->frames < clusters->report_frames) {
+    return;
+  }
+  printf("clustered lighting: upload %.3f ms/frame\n",
+	 lighting->upload_ms / lighting->frames);
+  lighting->frames = 0;
+  lighting->upload_ms = 0.0;
+  if (lighting->naive) {
+    clusters->frames = 0;
+  } else {
+    light_clusters_report(clusters);
+  }
+}
+
+/* A wall of columns by rows flattened cubes facing the camera, for the
+   lighting benchmarks. Each extra layer is another wall 1.5 units
+   further back, drawn before the one in front of it so every layer
+   gets shaded. */
+#define LIGHT_WALL_COLUMNS 9
+#define LIGHT_WALL_ROWS 5
+
+/* Cube i of a layer of the wall */
+void light_wall_model(int layer, int i, mat4 model) {
+  vec3 position = { 2.6f * (i % LIGHT_WALL_COLUMNS - LIGHT_WALL_COLUMNS / 2),
+		    2.6f * (i / LIGHT_WALL_COLUMNS - LIGHT_WALL_ROWS / 2),
+		    -1.5f * layer };
+  vec3 scale = { 1.25f, 1.25f, 0.2f };
+  glm_mat4_identity(model);
+  glm_translate(model, position);
+  glm_scale(model, scale);
+}
+
+void record_light_wall(CommandList *list, GLuint program, const LightingShader *shader,
+		       const Cube *cube, mat4 view_projection, float *view_position,
+		       int layers) {
+
+  vec3 white = GLM_VEC3_ONE_INIT;
+  cmd_use_program(list, program);
+  cmd_uniform3f(list, shader->object_colour, white);
+  cmd_uniform3f(list, shader->view_pos, view_position);
+  cmd_uniform1f(list, shader->ambient_strength, 0.05f);
+  cmd_uniform1f(list, shader->specular_strength, 0.5f);
+  cmd_enable_attrib(list, shader->position_attr);
+  cmd_enable_attrib(list, shader->normal_attr);
+  record_vertex_layout(list, &cube->mesh->layout, shader);
+  for (int layer = layers - 1; layer >= 0; layer--) {
+    for (int i = 0; i < LIGHT_WALL_COLUMNS * LIGHT_WALL_ROWS; i++) {
+      mat4 model;
+      mat4 mvp;
+      light_wall_model(layer, i, model);
+      glm_mat4_mul(view_projection, model, mvp);
+      mat4 normal;
+      glm_mat4_inv(model, normal);
+      glm_mat4_transpose(normal);
+      cmd_uniform_matrix4(list, shader->model, model[0]);
+      cmd_uniform_matrix4(list, shader->mvp, mvp[0]);
+      cmd_uniform_matrix4(list, shader->mat_normal, normal[0]);
+      cmd_draw_arrays(list, GL_TRIANGLES, 0, 3 * cube->mesh->num_triangles);
+    }
+  }
+  cmd_disable_attrib(list, shader->position_attr);
+  cmd_disable_attrib(list, shader->normal_attr);
+}
+
+/* --bench-lights: a wall of cubes filling the screen, lit by more and
+   more lights, drawn naive and clustered. Each frame is finished, so
+   the times are the whole frame's, CPU binning and upload included. */
+void benchmark_clustered_lighting(JobSystem *jobs, const Cube *cube, mat4 view,
+				  mat4 projection, float *view_position,
+				  int width, int height) {
+
+  const int counts[] = { 16, 32, 64, 128, 256 };
+  const int num_frames = 60;
+
+  mat4 view_projection;
+  glm_mat4_mul(projection, view, view_projection);
+
+  printf("Clustered lighting, %dx%d cube wall, %d frames each:\n",
+	 LIGHT_WALL_COLUMNS, LIGHT_WALL_ROWS, num_frames);
+  printf("\t%8s %12s %12s %12s %16s\n",
+	 "lights", "naive ms", "clustered ms", "bin ms", "lights/cluster");
+  for (int c = 0; c < (int) (sizeof(counts) / sizeof(counts[0])); c++) {
+    double ms[2];
+    double bin_ms = 0.0;
+    double per_cluster = 0.0;
+    for (int naive = 1; naive >= 0; naive--) {
+      ClusteredLighting lighting;
+      clustered_lighting_init(&lighting, counts[c], naive, projection, width, height);
+      vec3 min = { -12.0f, -6.0f, 0.5f };
+      vec3 max = { 12.0f, 6.0f, 4.0f };
+      clustered_lighting_place(&lighting, counts[c], min, max);
+
+      /* The wall is recorded once and replayed every frame */
+      CommandList list;
+      command_list_init(&list);
+      record_light_wall(&list, lighting.program, &lighting.shader, cube, view_projection,
+			view_position, 1);
+
+      /* One frame to warm up, then time the rest */
+      clustered_lighting_update(&lighting, jobs, view, 0.0f);
+      command_list_replay(&list, 1, NULL);
+      glFinish();
+      lighting.clusters->frames = 0;
+      lighting.clusters->bin_ms = 0.0;
+      lighting.clusters->cluster_lights = 0;
+      Uint64 start = SDL_GetPerformanceCounter();
+      for (int f = 0; f < num_frames; f++) {
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	clustered_lighting_update(&lighting, jobs, view, f / 60.0f);
+	command_list_replay(&list, 1, NULL);
+	glFinish();
+      }
+      ms[naive] = (double) (SDL_GetPerformanceCounter() - start) * 1000.0
+	/ (double) SDL_GetPerformanceFrequency() / num_frames;
+      if (!naive) {
+	bin_ms = lighting.clusters->bin_ms / num_frames;
+	per_cluster = (double) lighting.clusters->cluster_lights / num_frames
+	  / LIGHT_CLUSTERS_COUNT;
+      }
+
+      command_list_destroy(&list);
+      clustered_lighting_destroy(&lighting);
+    }
+    printf("\t%8d %12.3f %12.3f %12.3f %16.2f\n", counts[c], ms[1], ms[0], bin_ms,
+	   per_cluster);
+  }
+}
+
+#endif
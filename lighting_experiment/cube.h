@@ -1,31 +1,46 @@
 #ifndef CUBE_HEADER
 #define CUBE_HEADER
 
+#include <stdbool.h>
+
 #include <cglm/cglm.h>
 #include <GLES2/gl2.h>
 
+#include "frustum_cull.h"
+#include "resource_manager.h"
+#include "vertex_layout.h"
+
 typedef struct {
-  /* C struct to hold the information about our cubes:
-     - The address of the relevant shader program
-     - The ID of the relevant VBOs for data.
-     - The number of triangles in the cube
-     - Pointer to an array of vertices
-     - Pointer to an array of normals
-     - Pointer to an array of uvs
-     - A model matrix
+  /* C struct holding a loaded mesh, shared by every cube drawing it:
+     - Its vertex buffers and how the attributes sit in them
+     - The number of triangles
+     - Pointers to the arrays of vertices, normals and uvs
+     - Its bounding box and sphere in model space
    */
-
-  GLuint shaderProgramAddress;
-  GLuint vertexVBO;
-  GLuint normalVBO;
-  GLuint uvVBO;
+  VertexLayout layout;
   uint num_triangles;
-  
+
   /* These pointers in the struct will be aligned next to each other */
   GLfloat *vertices;
   GLfloat *normals;
   GLfloat *uvs;
-  mat4 model_matrix;  
+  Bounds bounds;
+} Mesh;
+
+typedef struct {
+  /* C struct to hold the information about our cubes:
+     - Handles to its mesh and shader program in the resource manager
+     - The mesh and program they resolve to, borrowed from the manager
+     - Its slot in the transform store, which holds its matrices
+     - Whether it is drawn into the software occlusion buffer
+   */
+
+  MeshHandle mesh_handle;
+  ProgramHandle program_handle;
+  const Mesh *mesh;
+  GLuint shaderProgramAddress;
+  int transform;
+  bool occluder;
 } Cube;
 
 #endif
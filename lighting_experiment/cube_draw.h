@@ -0,0 +1,307 @@
+#ifndef CUBE_DRAW_HEADER
+#define CUBE_DRAW_HEADER
+
+#include <stdio.h>
+
+#include <cglm/cglm.h>
+#include <GLES2/gl2.h>
+#include <SDL2/SDL.h>
+
+#include "command_list.h"
+#include "cube.h"
+#include "job_system.h"
+#include "static_batch.h"
+#include "transform_store.h"
+
+// C header-only library that turns the cubes into command lists. The
+// recording runs on the job system; only the replay needs the GL thread.
+
+typedef struct {
+  /* C struct holding the locations in one lighting shader program */
+  GLint position_attr;
+  GLint normal_attr;
+
+  GLint model;
+  GLint mvp;
+  GLint mat_normal;
+
+  GLint object_colour;
+  GLint light_colour;
+  GLint ambient_strength;
+  GLint specular_strength;
+  GLint light_pos;
+  GLint view_pos;
+} LightingShader;
+
+typedef struct {
+  /* C struct holding one cube draw:
+     - The cube and the shader locations to use with it
+     - Its material: colour, light colour and ambient/specular strength
+   */
+  Cube *cube;
+  LightingShader *shader;
+  vec3 object_colour;
+  vec3 light_colour;
+  float ambient_strength;
+  float specular_strength;
+} CubeDraw;
+
+typedef struct {
+  /* The per-frame values every draw shares */
+  TransformStore *transforms;
+  float *light_position;
+  float *view_position;
+} DrawFrame;
+
+void lighting_shader_locations(GLuint program, LightingShader *shader) {
+  shader->position_attr = glGetAttribLocation(program, "vPosition");
+  shader->normal_attr = glGetAttribLocation(program, "vNormal");
+
+  shader->model = glGetUniformLocation(program, "model");
+  shader->mvp = glGetUniformLocation(program, "mvp");
+  shader->mat_normal = glGetUniformLocation(program, "mat_normal");
+
+  shader->object_colour = glGetUniformLocation(program, "objectColour");
+  shader->light_colour = glGetUniformLocation(program, "lightColour");
+  shader->ambient_strength = glGetUniformLocation(program, "ambientStrength");
+  shader->specular_strength = glGetUniformLocation(program, "specularStrength");
+  shader->light_pos = glGetUniformLocation(program, "lightPos");
+  shader->view_pos = glGetUniformLocation(program, "viewPos");
+}
+
+/* Point the position and normal attributes at the mesh's streams. An
+   interleaved mesh binds its one buffer once. */
+void record_vertex_layout(CommandList *list, const VertexLayout *layout,
+			  const LightingShader *shader) {
+  cmd_bind_buffer(list, GL_ARRAY_BUFFER, layout->position.buffer);
+  cmd_vertex_attrib(list, shader->position_attr, layout->position.size,
+		    layout->position.stride, layout->position.offset);
+
+  if (layout->normal.buffer != layout->position.buffer) {
+    cmd_bind_buffer(list, GL_ARRAY_BUFFER, layout->normal.buffer);
+  }
+  cmd_vertex_attrib(list, shader->normal_attr, layout->normal.size,
+		    layout->normal.stride, layout->normal.offset);
+}
+
+void record_cube_draw(CommandList *list, const CubeDraw *draw,
+		      const DrawFrame *frame) {
+
+  const Cube *cube = draw->cube;
+  const LightingShader *shader = draw->shader;
+  TransformStore *transforms = frame->transforms;
+
+  cmd_use_program(list, cube->shaderProgramAddress);
+
+  /* Apply the model, mvp and normal matrices */
+  cmd_uniform_matrix4(list, shader->model, transforms->world[cube->transform][0]);
+  cmd_uniform_matrix4(list, shader->mvp, transforms->mvp[cube->transform][0]);
+  cmd_uniform_matrix4(list, shader->mat_normal,
+		      transforms->normal[cube->transform][0]);
+
+  cmd_uniform3f(list, shader->object_colour, draw->object_colour);
+  cmd_uniform3f(list, shader->light_colour, draw->light_colour);
+  cmd_uniform3f(list, shader->light_pos, frame->light_position);
+  cmd_uniform3f(list, shader->view_pos, frame->view_position);
+  cmd_uniform1f(list, shader->ambient_strength, draw->ambient_strength);
+  cmd_uniform1f(list, shader->specular_strength, draw->specular_strength);
+
+  cmd_enable_attrib(list, shader->position_attr);
+  cmd_enable_attrib(list, shader->normal_attr);
+
+  /* Vertices */
+  record_vertex_layout(list, &cube->mesh->layout, shader);
+
+  cmd_draw_arrays(list, GL_TRIANGLES, 0, 3 * cube->mesh->num_triangles);
+
+  cmd_disable_attrib(list, shader->position_attr);
+  cmd_disable_attrib(list, shader->normal_attr);
+}
+
+/* Record the static batch, one draw per chunk. Chunk material k takes
+   its shader and colours from materials[k]; the batch is already in
+   world space, so model and the normal matrix are the identity. */
+void record_static_batch(CommandList *list, const StaticBatch *batch,
+			 const CubeDraw *materials, mat4 view_projection,
+			 const DrawFrame *frame) {
+
+  mat4 identity = GLM_MAT4_IDENTITY_INIT;
+  int material = -1;
+  const LightingShader *shader = NULL;
+
+  cmd_bind_buffer(list, GL_ARRAY_BUFFER, batch->vertex_buffer);
+  cmd_bind_buffer(list, GL_ELEMENT_ARRAY_BUFFER, batch->index_buffer);
+
+  for (int c = 0; c < batch->num_chunks; c++) {
+    const StaticChunk *chunk = &batch->chunks[c];
+
+    if (chunk->material != material) {
+      const CubeDraw *draw = &materials[chunk->material];
+      if (shader != NULL) {
+	cmd_disable_attrib(list, shader->position_attr);
+	cmd_disable_attrib(list, shader->normal_attr);
+      }
+      material = chunk->material;
+      shader = draw->shader;
+
+      cmd_use_program(list, draw->cube->shaderProgramAddress);
+      cmd_uniform_matrix4(list, shader->model, identity[0]);
+      cmd_uniform_matrix4(list, shader->mvp, view_projection[0]);
+      cmd_uniform_matrix4(list, shader->mat_normal, identity[0]);
+
+      cmd_uniform3f(list, shader->object_colour, draw->object_colour);
+      cmd_uniform3f(list, shader->light_colour, draw->light_colour);
+      cmd_uniform3f(list, shader->light_pos, frame->light_position);
+      cmd_uniform3f(list, shader->view_pos, frame->view_position);
+      cmd_uniform1f(list, shader->ambient_strength, draw->ambient_strength);
+      cmd_uniform1f(list, shader->specular_strength, draw->specular_strength);
+
+      cmd_enable_attrib(list, shader->position_attr);
+      cmd_enable_attrib(list, shader->normal_attr);
+    }
+
+    /* Indices are relative to the chunk, so point the attributes at it */
+    cmd_vertex_attrib(list, shader->position_attr, 3, STATIC_BATCH_STRIDE,
+		      chunk->vertex_offset);
+    cmd_vertex_attrib(list, shader->normal_attr, 3, STATIC_BATCH_STRIDE,
+		      chunk->vertex_offset + 3 * sizeof(GLfloat));
+    cmd_draw_elements(list, GL_TRIANGLES, chunk->num_indices, GL_UNSIGNED_SHORT,
+		      chunk->index_offset);
+  }
+
+  if (shader != NULL) {
+    cmd_disable_attrib(list, shader->position_attr);
+    cmd_disable_attrib(list, shader->normal_attr);
+  }
+  cmd_bind_buffer(list, GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+typedef struct {
+  CommandList *lists;
+  int draws_per_list;
+  const CubeDraw *draws;
+  int num_draws;
+  const DrawFrame *frame;
+} RecordBatch;
+
+void record_cube_draws_job(void *data, int begin, int end) {
+  RecordBatch *batch = (RecordBatch *) data;
+
+  for (int l = begin; l < end; l++) {
+    CommandList *list = &batch->lists[l];
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    command_list_reset(list);
+    int first = l * batch->draws_per_list;
+    int last = first + batch->draws_per_list;
+    if (last > batch->num_draws) {
+      last = batch->num_draws;
+    }
+    for (int i = first; i < last; i++) {
+      record_cube_draw(list, &batch->draws[i], batch->frame);
+    }
+
+    list->record_ticks = SDL_GetPerformanceCounter() - start;
+  }
+}
+
+/* Record every draw, split over num_lists lists on the job system.
+   Replaying the lists in order draws the cubes in the order given. */
+void record_cube_draws(JobSystem *jobs, CommandList *lists, int num_lists,
+		       const CubeDraw *draws, int num_draws,
+		       const DrawFrame *frame) {
+  RecordBatch batch = {
+    lists, (num_draws + num_lists - 1) / num_lists, draws, num_draws, frame
+  };
+  parallel_for(jobs, num_lists, 1, record_cube_draws_job, &batch);
+}
+
+/* --bench-layout N: N copies of the cube merged into one mesh, drawn
+   into a tiny viewport so the frame is bound by vertex fetch rather
+   than fill, once per layout. */
+void benchmark_vertex_layouts(const Cube *cube, const LightingShader *shader,
+			      mat4 view_projection, int num_cubes) {
+
+  const int num_frames = 100;
+  const Mesh *mesh = cube->mesh;
+  int cube_vertices = 3 * mesh->num_triangles;
+  int num_vertices = num_cubes * cube_vertices;
+  GLfloat *positions = (GLfloat *) malloc(num_vertices * 3 * sizeof(GLfloat));
+  GLfloat *normals = (GLfloat *) malloc(num_vertices * 3 * sizeof(GLfloat));
+  GLfloat *uvs = (GLfloat *) malloc(num_vertices * 2 * sizeof(GLfloat));
+
+  int per_row = (int) ceilf(cbrtf((float) num_cubes));
+  for (int c = 0; c < num_cubes; c++) {
+    float offset[3] = { (float) (c % per_row), (float) ((c / per_row) % per_row),
+			(float) (c / (per_row * per_row)) };
+    for (int v = 0; v < cube_vertices; v++) {
+      int at = c * cube_vertices + v;
+      for (int k = 0; k < 3; k++) {
+	positions[3 * at + k] = (mesh->vertices[3 * v + k] * 0.4f + offset[k])
+	  * 8.0f / per_row - 4.0f;
+	normals[3 * at + k] = mesh->normals[3 * v + k];
+      }
+      uvs[2 * at] = mesh->uvs[2 * v];
+      uvs[2 * at + 1] = mesh->uvs[2 * v + 1];
+    }
+  }
+
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  glViewport(0, 0, 8, 8);
+
+  mat4 identity = GLM_MAT4_IDENTITY_INIT;
+  vec3 colour = GLM_VEC3_ONE_INIT;
+  glUseProgram(cube->shaderProgramAddress);
+  glUniformMatrix4fv(shader->model, 1, GL_FALSE, identity[0]);
+  glUniformMatrix4fv(shader->mvp, 1, GL_FALSE, view_projection[0]);
+  glUniformMatrix4fv(shader->mat_normal, 1, GL_FALSE, identity[0]);
+  glUniform3fv(shader->object_colour, 1, colour);
+  glUniform3fv(shader->light_colour, 1, colour);
+  glUniform3fv(shader->light_pos, 1, colour);
+  glUniform3fv(shader->view_pos, 1, colour);
+  glUniform1f(shader->ambient_strength, 0.1f);
+  glUniform1f(shader->specular_strength, 0.5f);
+  glEnableVertexAttribArray(shader->position_attr);
+  glEnableVertexAttribArray(shader->normal_attr);
+
+  printf("Vertex layouts: %d cubes, %d vertices a frame\n", num_cubes, num_vertices);
+  VertexLayoutKind kinds[2] = { VERTEX_LAYOUT_SPLIT, VERTEX_LAYOUT_INTERLEAVED };
+  for (int k = 0; k < 2; k++) {
+    VertexLayout layout;
+    vertex_layout_upload(&layout, kinds[k], positions, normals, uvs, num_vertices);
+
+    CommandList list;
+    command_list_init(&list);
+    record_vertex_layout(&list, &layout, shader);
+    cmd_draw_arrays(&list, GL_TRIANGLES, 0, num_vertices);
+
+    /* One frame to warm up, then time the rest */
+    command_list_replay(&list, 1, NULL);
+    glFinish();
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int f = 0; f < num_frames; f++) {
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+      command_list_replay(&list, 1, NULL);
+      glFinish();
+    }
+    double ms = (double) (SDL_GetPerformanceCounter() - start) * 1000.0
+      / (double) SDL_GetPerformanceFrequency() / num_frames;
+
+    printf("\t%-12s %d buffers, %6.1f KB, %8.3f ms/frame, %7.1f M vertices/s\n",
+	   vertex_layout_name(kinds[k]), layout.num_buffers, layout.bytes / 1024.0,
+	   ms, num_vertices / ms / 1000.0);
+
+    command_list_destroy(&list);
+    vertex_layout_destroy(&layout);
+  }
+
+  glDisableVertexAttribArray(shader->position_attr);
+  glDisableVertexAttribArray(shader->normal_attr);
+  glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+  free(positions);
+  free(normals);
+  free(uvs);
+}
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef DEBUG_BOUNDS_HEADER
+#define DEBUG_BOUNDS_HEADER
+
+#include <stdlib.h>
+
+#include <cglm/cglm.h>
+#include <GLES2/gl2.h>
+
+#include "frustum_cull.h"
+#include "shader_loader.h"
+#include "stream_buffer.h"
+
+// C header-only library that draws the world-space bounding boxes the
+// culling uses as red lines. The boxes change every frame, so the line
+// vertices go through a StreamBuffer rather than a static VBO.
+
+#define DEBUG_BOUNDS_MAX_BOXES 1024
+#define DEBUG_BOUNDS_BOX_FLOATS (24 * 3)
+
+typedef struct {
+  GLuint program;
+  GLint position_attr;
+  GLint mvp;
+  StreamBuffer stream;
+  float *lines;
+} DebugBounds;
+
+void debug_bounds_init(DebugBounds *debug, const char *vertex_path,
+		       const char *fragment_path, StreamStrategy strategy) {
+  debug->program = load_shaders(vertex_path, fragment_path);
+  debug->position_attr = glGetAttribLocation(debug->program, "vPosition");
+  debug->mvp = glGetUniformLocation(debug->program, "mvp");
+
+  size_t frame_size = DEBUG_BOUNDS_MAX_BOXES * DEBUG_BOUNDS_BOX_FLOATS * sizeof(float);
+  stream_buffer_init(&debug->stream, GL_ARRAY_BUFFER, frame_size, strategy);
+  debug->lines = (float *) malloc(frame_size);
+}
+
+void debug_bounds_destroy(DebugBounds *debug) {
+  stream_buffer_destroy(&debug->stream);
+  glDeleteProgram(debug->program);
+  free(debug->lines);
+}
+
+/* The 12 edges of the box around object i, as 24 line vertices */
+void debug_bounds_box(const CullSet *set, int i, float *out) {
+  static const int edges[12][2] = {
+    {0, 1}, {2, 3}, {4, 5}, {6, 7},  /* along x */
+    {0, 2}, {1, 3}, {4, 6}, {5, 7},  /* along y */
+    {0, 4}, {1, 5}, {2, 6}, {3, 7}   /* along z */
+  };
+  for (int e = 0; e < 12; e++) {
+    for (int end = 0; end < 2; end++) {
+      int corner = edges[e][end];
+      for (int k = 0; k < 3; k++) {
+	float sign = (corner >> k) & 1 ? 1.0f : -1.0f;
+	out[6 * e + 3 * end + k] = set->center[k][i] + sign * set->extent[k][i];
+      }
+    }
+  }
+}
+
+/* Draw the boxes of the objects the culling left visible */
+void debug_bounds_draw(DebugBounds *debug, const CullSet *set, mat4 view_projection) {
+
+  int num_boxes = 0;
+  for (int i = 0; i < set->count && num_boxes < DEBUG_BOUNDS_MAX_BOXES; i++) {
+    if (set->visible[i]) {
+      debug_bounds_box(set, i, &debug->lines[num_boxes * DEBUG_BOUNDS_BOX_FLOATS]);
+      num_boxes += 1;
+    }
+  }
+
+  GLuint buffer;
+  size_t offset;
+  if (num_boxes > 0
+      && stream_buffer_write(&debug->stream, debug->lines,
+			     num_boxes * DEBUG_BOUNDS_BOX_FLOATS * sizeof(float),
+			     &buffer, &offset)) {
+    glUseProgram(debug->program);
+    glUniformMatrix4fv(debug->mvp, 1, GL_FALSE, view_projection[0]);
+    glEnableVertexAttribArray(debug->position_attr);
+    glVertexAttribPointer(debug->position_attr, 3, GL_FLOAT, GL_FALSE,
+			  3 * sizeof(GLfloat), (void *) offset);
+    glDrawArrays(GL_LINES, 0, num_boxes * 24);
+    glDisableVertexAttribArray(debug->position_attr);
+  }
+  stream_buffer_end_frame(&debug->stream);
+  stream_buffer_report(&debug->stream, "debug bounds");
+}
+
+#endif
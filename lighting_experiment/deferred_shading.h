@@ -0,0 +1,618 @@
+#ifndef DEFERRED_SHADING_HEADER
+#define DEFERRED_SHADING_HEADER
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <cglm/cglm.h>
+#include <GLES2/gl2.h>
+#include <SDL2/SDL.h>
+
+#include "clustered_lighting.h"
+#include "command_list.h"
+#include "cube.h"
+#include "cube_draw.h"
+#include "gl_caps.h"
+#include "light_clusters.h"
+#include "shader_loader.h"
+
+// C header-only library that lights the cubes with the same moving
+// point lights as clustered_lighting.h, but deferred: ES3 only.
+//
+// The cube draws fill a G-buffer through multiple render targets,
+// with the same uniforms as the lighting shader:
+//
+//   0  RGB10_A2 light accumulation, starting at the ambient term
+//   1  RGBA8    albedo, specular strength
+//   2  RGBA16UI octahedral normal (16 bits a component), view depth
+//               as the bits of a float
+//   +  DEPTH24_STENCIL8
+//
+// 20 bytes a pixel. Each light is then an instance of a sphere hull.
+// A stencil pass counts, per pixel, the lights whose volume holds the
+// surface (front faces in front of it add one, back faces in front of
+// it take one away), and the light pass draws the back faces behind
+// the surface where that count is not zero - the stencil doing what a
+// depth bounds test would. Lights whose volume reaches the camera
+// cannot be counted that way and are drawn without the stencil test.
+//
+// Every lit pixel then costs a shader run per light on it, rather than
+// per light per fragment drawn. The price is memory traffic: on a
+// tile-based GPU the G-buffer has to leave the tile after the geometry
+// pass and come back for the light pass, where forward shading writes
+// just the colour. deferred_shading_report estimates both.
+
+#define DEFERRED_SPHERE_SUBDIVISIONS 1
+
+typedef struct {
+  int num_lights;
+  PointLight lights[LIGHT_CLUSTERS_MAX_LIGHTS];
+  LightOrbit orbits[LIGHT_CLUSTERS_MAX_LIGHTS];
+  int width;
+  int height;
+  float ndc_scale[2];      /* 1 / P00, 1 / P11 */
+  float near;
+
+  GLuint gbuffer_framebuffer;
+  GLuint light_framebuffer;  /* the accumulation target and the depth */
+  GLuint textures[2];        /* albedo and specular, normal and depth */
+  GLuint renderbuffers[2];   /* light accumulation, depth and stencil */
+  GLint target_framebuffer;  /* bound at begin, where the result goes */
+
+  /* Geometry pass: the lighting shader's uniform names */
+  GLuint program;
+  LightingShader shader;
+  GLint view;
+
+  /* Light volumes */
+  GLuint light_program;
+  GLuint stencil_program;
+  GLint position_attr[2];  /* light, stencil */
+  GLint light_attr[2];
+  GLint colour_attr[2];
+  GLint view_projection[2];
+  GLint inverse_view;
+  GLint ndc_scale_uniform;
+  GLint screen_size;
+  GLint view_pos;
+  GLint normal_depth_texture;
+  GLint albedo_texture;
+
+  GLuint sphere_buffer;
+  int sphere_vertices;
+  float sphere_scale;      /* hull vertex radius so the hull holds the sphere */
+  GLuint instance_buffer;
+  float instances[LIGHT_CLUSTERS_MAX_LIGHTS][8];  /* position, radius, colour */
+  int num_outside;         /* instances before it are stencil culled */
+
+  /* Since the last report */
+  int frames;
+  double volume_pixels;    /* screen area the volumes cover, roughly */
+  long inside_lights;
+  int report_frames;
+} DeferredShading;
+
+/* The unit icosahedron, subdivided onto the sphere, as a triangle list */
+static int sphere_hull(float *out, const float *a, const float *b, const float *c,
+		       int depth) {
+  if (depth == 0) {
+    memcpy(out, a, 3 * sizeof(float));
+    memcpy(out + 3, b, 3 * sizeof(float));
+    memcpy(out + 6, c, 3 * sizeof(float));
+    return 3;
+  }
+  float ab[3], bc[3], ca[3];
+  for (int i = 0; i < 3; i++) {
+    ab[i] = a[i] + b[i];
+    bc[i] = b[i] + c[i];
+    ca[i] = c[i] + a[i];
+  }
+  glm_vec3_normalize(ab);
+  glm_vec3_normalize(bc);
+  glm_vec3_normalize(ca);
+  int n = sphere_hull(out, a, ab, ca, depth - 1);
+  n += sphere_hull(out + 3 * n, ab, b, bc, depth - 1);
+  n += sphere_hull(out + 3 * n, ca, bc, c, depth - 1);
+  n += sphere_hull(out + 3 * n, ab, bc, ca, depth - 1);
+  return n;
+}
+
+static void build_light_sphere(DeferredShading *deferred) {
+
+  const float t = 1.6180340f;
+  float corners[12][3] = {
+    { -1, t, 0 }, { 1, t, 0 }, { -1, -t, 0 }, { 1, -t, 0 },
+    { 0, -1, t }, { 0, 1, t }, { 0, -1, -t }, { 0, 1, -t },
+    { t, 0, -1 }, { t, 0, 1 }, { -t, 0, -1 }, { -t, 0, 1 }
+  };
+  const int faces[20][3] = {
+    { 0, 11, 5 }, { 0, 5, 1 }, { 0, 1, 7 }, { 0, 7, 10 }, { 0, 10, 11 },
+    { 1, 5, 9 }, { 5, 11, 4 }, { 11, 10, 2 }, { 10, 7, 6 }, { 7, 1, 8 },
+    { 3, 9, 4 }, { 3, 4, 2 }, { 3, 2, 6 }, { 3, 6, 8 }, { 3, 8, 9 },
+    { 4, 9, 5 }, { 2, 4, 11 }, { 6, 2, 10 }, { 8, 6, 7 }, { 9, 8, 1 }
+  };
+  for (int i = 0; i < 12; i++) {
+    glm_vec3_normalize(corners[i]);
+  }
+
+  int triangles = 20;
+  for (int i = 0; i < DEFERRED_SPHERE_SUBDIVISIONS; i++) {
+    triangles *= 4;
+  }
+  float *vertices = (float *) malloc(triangles * 9 * sizeof(float));
+  int count = 0;
+  for (int f = 0; f < 20; f++) {
+    count += sphere_hull(vertices + 3 * count, corners[faces[f][0]], corners[faces[f][1]],
+			 corners[faces[f][2]], DEFERRED_SPHERE_SUBDIVISIONS);
+  }
+
+  /* The faces cut inside the sphere; push the hull out until the
+     closest face plane is at radius 1 */
+  float closest = 1.0f;
+  for (int i = 0; i < count; i += 3) {
+    float *v = vertices + 3 * i;
+    vec3 e1, e2, normal;
+    glm_vec3_sub(v + 3, v, e1);
+    glm_vec3_sub(v + 6, v, e2);
+    glm_vec3_cross(e1, e2, normal);
+    glm_vec3_normalize(normal);
+    float distance = fabsf(glm_vec3_dot(normal, v));
+    if (distance < closest) {
+      closest = distance;
+    }
+  }
+  deferred->sphere_scale = 1.0f / closest;
+  for (int i = 0; i < 3 * count; i++) {
+    vertices[i] *= deferred->sphere_scale;
+  }
+
+  glGenBuffers(1, &deferred->sphere_buffer);
+  glBindBuffer(GL_ARRAY_BUFFER, deferred->sphere_buffer);
+  glBufferData(GL_ARRAY_BUFFER, count * 3 * sizeof(float), vertices, GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  deferred->sphere_vertices = count;
+  free(vertices);
+}
+
+static GLuint gbuffer_texture(GLint internal_format, GLenum format, GLenum type,
+			      int width, int height) {
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, type, NULL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  return texture;
+}
+
+/* Whether this context can do it: ES3 with three draw buffers,
+   instancing and blits. */
+bool deferred_shading_supported(void) {
+  if (!gl_caps.es3 || gl_caps.DrawBuffers == NULL || gl_caps.BlitFramebuffer == NULL
+      || gl_caps.VertexAttribDivisor == NULL || gl_caps.DrawArraysInstanced == NULL) {
+    return false;
+  }
+  GLint draw_buffers = 0;
+  glGetIntegerv(GL_MAX_DRAW_BUFFERS, &draw_buffers);
+  return draw_buffers >= 3;
+}
+
+/* False, with nothing left to destroy, when the context cannot do
+   deferred shading, so the caller can fall back to forward. */
+bool deferred_shading_init(DeferredShading *deferred, int num_lights, mat4 projection,
+			   int width, int height) {
+
+  memset(deferred, 0, sizeof(*deferred));
+  if (!deferred_shading_supported()) {
+    printf("Deferred shading: needs ES3 with 3 draw buffers\n");
+    return false;
+  }
+
+  /* The targets */
+  deferred->width = width;
+  deferred->height = height;
+  deferred->textures[0] = gbuffer_texture(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE,
+					  width, height);
+  deferred->textures[1] = gbuffer_texture(GL_RGBA16UI, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT,
+					  width, height);
+  glGenRenderbuffers(2, deferred->renderbuffers);
+  glBindRenderbuffer(GL_RENDERBUFFER, deferred->renderbuffers[0]);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGB10_A2, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, deferred->renderbuffers[1]);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  GLuint framebuffers[2];
+  glGenFramebuffers(2, framebuffers);
+  deferred->gbuffer_framebuffer = framebuffers[0];
+  deferred->light_framebuffer = framebuffers[1];
+  GLenum status[2];
+  for (int f = 0; f < 2; f++) {
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[f]);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER,
+			      deferred->renderbuffers[0]);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER,
+			      deferred->renderbuffers[1]);
+    if (f == 0) {
+      const GLenum buffers[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1,
+				  GL_COLOR_ATTACHMENT2 };
+      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D,
+			     deferred->textures[0], 0);
+      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D,
+			     deferred->textures[1], 0);
+      gl_caps.DrawBuffers(3, buffers);
+    }
+    status[f] = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  if (status[0] != GL_FRAMEBUFFER_COMPLETE || status[1] != GL_FRAMEBUFFER_COMPLETE) {
+    printf("ERROR: deferred shading framebuffers incomplete: 0x%x 0x%x\n",
+	   status[0], status[1]);
+    glDeleteFramebuffers(2, framebuffers);
+    glDeleteRenderbuffers(2, deferred->renderbuffers);
+    glDeleteTextures(2, deferred->textures);
+    return false;
+  }
+
+  /* The geometry pass takes over the cube draws */
+  deferred->program = load_shaders("shaders/clustered_es3.vert", "shaders/gbuffer.frag");
+  lighting_shader_locations(deferred->program, &deferred->shader);
+  deferred->view = glGetUniformLocation(deferred->program, "view");
+
+  deferred->light_program = load_shaders("shaders/light_volume.vert",
+					 "shaders/light_volume.frag");
+  deferred->stencil_program = load_shaders("shaders/light_volume.vert",
+					   "shaders/light_stencil.frag");
+  GLuint programs[2] = { deferred->light_program, deferred->stencil_program };
+  for (int p = 0; p < 2; p++) {
+    deferred->position_attr[p] = glGetAttribLocation(programs[p], "vPosition");
+    deferred->light_attr[p] = glGetAttribLocation(programs[p], "lightPositionRadius");
+    deferred->colour_attr[p] = glGetAttribLocation(programs[p], "lightColourIn");
+    deferred->view_projection[p] = glGetUniformLocation(programs[p], "viewProjection");
+  }
+  GLuint program = deferred->light_program;
+  deferred->inverse_view = glGetUniformLocation(program, "inverseView");
+  deferred->ndc_scale_uniform = glGetUniformLocation(program, "ndcScale");
+  deferred->screen_size = glGetUniformLocation(program, "screenSize");
+  deferred->view_pos = glGetUniformLocation(program, "viewPos");
+  deferred->normal_depth_texture = glGetUniformLocation(program, "normalDepthTexture");
+  deferred->albedo_texture = glGetUniformLocation(program, "albedoTexture");
+
+  build_light_sphere(deferred);
+  glGenBuffers(1, &deferred->instance_buffer);
+
+  /* Symmetric perspective: P00, P11 and the near plane */
+  deferred->ndc_scale[0] = 1.0f / projection[0][0];
+  deferred->ndc_scale[1] = 1.0f / projection[1][1];
+  deferred->near = projection[3][2] / (projection[2][2] - 1.0f);
+
+  if (num_lights > LIGHT_CLUSTERS_MAX_LIGHTS) {
+    num_lights = LIGHT_CLUSTERS_MAX_LIGHTS;
+  }
+  deferred->num_lights = num_lights;
+  place_scene_lights(deferred->lights, deferred->orbits, num_lights);
+  deferred->report_frames = 300;
+
+  printf("Deferred shading: %d lights, %dx%d G-buffer at 20 bytes a pixel (%.1f MB), "
+	 "%d triangle light volumes\n", num_lights, width, height,
+	 20.0 * width * height / (1024.0 * 1024.0), deferred->sphere_vertices / 3);
+  return true;
+}
+
+void deferred_shading_destroy(DeferredShading *deferred) {
+  GLuint framebuffers[2] = { deferred->gbuffer_framebuffer, deferred->light_framebuffer };
+  glDeleteFramebuffers(2, framebuffers);
+  glDeleteRenderbuffers(2, deferred->renderbuffers);
+  glDeleteTextures(2, deferred->textures);
+  glDeleteProgram(deferred->program);
+  glDeleteProgram(deferred->light_program);
+  glDeleteProgram(deferred->stencil_program);
+  glDeleteBuffers(1, &deferred->sphere_buffer);
+  glDeleteBuffers(1, &deferred->instance_buffer);
+}
+
+/* Move the lights to where they are at time seconds and sort them into
+   those the stencil can cull and those reaching the camera. Sets the
+   geometry pass's view uniform. */
+void deferred_shading_update(DeferredShading *deferred, mat4 view, float time) {
+
+  animate_lights(deferred->lights, deferred->orbits, deferred->num_lights, time);
+
+  /* Anything within this of the eye might cross the near plane */
+  float near_corner = deferred->near * sqrtf(1.0f + deferred->ndc_scale[0] * deferred->ndc_scale[0]
+					     + deferred->ndc_scale[1] * deferred->ndc_scale[1]);
+  float half_height = 0.5f * deferred->height / deferred->ndc_scale[1];
+  int outside = 0;
+  int inside = deferred->num_lights;
+  for (int i = 0; i < deferred->num_lights; i++) {
+    const PointLight *light = &deferred->lights[i];
+    vec3 eye;
+    glm_mat4_mulv3(view, (float *) light->position, 1.0f, eye);
+    float reach = light->radius * deferred->sphere_scale;
+    float *instance;
+    if (glm_vec3_norm(eye) > reach + near_corner) {
+      instance = deferred->instances[outside];
+      outside += 1;
+
+      /* What the light pass will cover, roughly */
+      float depth = -eye[2];
+      if (depth > 0.0f) {
+	float radius = reach / depth * half_height;
+	float pixels = 3.1415927f * radius * radius;
+	if (pixels > (float) deferred->width * deferred->height) {
+	  pixels = (float) deferred->width * deferred->height;
+	}
+	deferred->volume_pixels += pixels;
+      }
+    } else {
+      inside -= 1;
+      instance = deferred->instances[inside];
+      deferred->volume_pixels += (double) deferred->width * deferred->height;
+      deferred->inside_lights += 1;
+    }
+    memcpy(instance, light->position, 3 * sizeof(float));
+    instance[3] = light->radius;
+    memcpy(instance + 4, light->colour, 3 * sizeof(float));
+    instance[7] = 0.0f;
+  }
+  deferred->num_outside = outside;
+
+  glBindBuffer(GL_ARRAY_BUFFER, deferred->instance_buffer);
+  glBufferData(GL_ARRAY_BUFFER, deferred->num_lights * sizeof(deferred->instances[0]),
+	       deferred->instances, GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  glUseProgram(deferred->program);
+  glUniformMatrix4fv(deferred->view, 1, GL_FALSE, view[0]);
+}
+
+/* Bind and clear the G-buffer, ready for the cube draws */
+void deferred_shading_begin(DeferredShading *deferred) {
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &deferred->target_framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, deferred->gbuffer_framebuffer);
+
+  /* Only the accumulation target is ever read where nothing was
+     drawn, but clearing all of them lets a tiler skip loading them.
+     glClear is undefined on the integer target, so that one is cleared
+     on its own. */
+  GLfloat colour[4];
+  const GLuint zero[4] = { 0, 0, 0, 0 };
+  glGetFloatv(GL_COLOR_CLEAR_VALUE, colour);
+  gl_caps.ClearBufferfv(GL_COLOR, 0, colour);
+  gl_caps.ClearBufferfv(GL_COLOR, 1, colour);
+  gl_caps.ClearBufferuiv(GL_COLOR, 2, zero);
+  glClear(GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+}
+
+/* Instances first to first + count of the light volumes, program p */
+static void draw_light_volumes(DeferredShading *deferred, int p, int first, int count) {
+  if (count <= 0) {
+    return;
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, deferred->sphere_buffer);
+  glVertexAttribPointer(deferred->position_attr[p], 3, GL_FLOAT, GL_FALSE, 0, NULL);
+  glBindBuffer(GL_ARRAY_BUFFER, deferred->instance_buffer);
+  glVertexAttribPointer(deferred->light_attr[p], 4, GL_FLOAT, GL_FALSE,
+			sizeof(deferred->instances[0]),
+			(void *) (first * sizeof(deferred->instances[0])));
+  glVertexAttribPointer(deferred->colour_attr[p], 3, GL_FLOAT, GL_FALSE,
+			sizeof(deferred->instances[0]),
+			(void *) (first * sizeof(deferred->instances[0]) + 4 * sizeof(float)));
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  gl_caps.DrawArraysInstanced(GL_TRIANGLES, 0, deferred->sphere_vertices, count);
+}
+
+/* After the cube draws: the stencil and light passes into the
+   accumulation target. Leaves it bound, with the scene's depth, for
+   anything drawn forward on top. */
+void deferred_shading_light(DeferredShading *deferred, mat4 view, mat4 projection,
+			    float *view_position) {
+
+  mat4 view_projection;
+  mat4 inverse_view;
+  glm_mat4_mul(projection, view, view_projection);
+  glm_mat4_inv(view, inverse_view);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, deferred->light_framebuffer);
+  glDepthMask(GL_FALSE);
+  glEnable(GL_STENCIL_TEST);
+  for (int p = 0; p < 2; p++) {
+    glEnableVertexAttribArray(deferred->position_attr[p]);
+    glEnableVertexAttribArray(deferred->light_attr[p]);
+    glEnableVertexAttribArray(deferred->colour_attr[p]);
+    gl_caps.VertexAttribDivisor(deferred->light_attr[p], 1);
+    gl_caps.VertexAttribDivisor(deferred->colour_attr[p], 1);
+  }
+
+  /* Count the volumes holding each surface: both faces, depth tested
+     against the scene, no colour */
+  glUseProgram(deferred->stencil_program);
+  glUniformMatrix4fv(deferred->view_projection[1], 1, GL_FALSE, view_projection[0]);
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+  glStencilFunc(GL_ALWAYS, 0, 0xFF);
+  glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_KEEP, GL_INCR_WRAP);
+  glStencilOpSeparate(GL_BACK, GL_KEEP, GL_KEEP, GL_DECR_WRAP);
+  draw_light_volumes(deferred, 1, 0, deferred->num_outside);
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+  /* Light the surfaces in front of the back faces, added together */
+  glUseProgram(deferred->light_program);
+  glUniformMatrix4fv(deferred->view_projection[0], 1, GL_FALSE, view_projection[0]);
+  glUniformMatrix4fv(deferred->inverse_view, 1, GL_FALSE, inverse_view[0]);
+  glUniform2fv(deferred->ndc_scale_uniform, 1, deferred->ndc_scale);
+  glUniform2f(deferred->screen_size, (float) deferred->width, (float) deferred->height);
+  glUniform3fv(deferred->view_pos, 1, view_position);
+  glUniform1i(deferred->albedo_texture, 0);
+  glUniform1i(deferred->normal_depth_texture, 1);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, deferred->textures[0]);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, deferred->textures[1]);
+
+  glEnable(GL_CULL_FACE);
+  glCullFace(GL_FRONT);
+  glDepthFunc(GL_GEQUAL);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_ONE, GL_ONE);
+  glStencilFunc(GL_NOTEQUAL, 0, 0xFF);
+  glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+  draw_light_volumes(deferred, 0, 0, deferred->num_outside);
+  glDisable(GL_STENCIL_TEST);
+  draw_light_volumes(deferred, 0, deferred->num_outside,
+		     deferred->num_lights - deferred->num_outside);
+
+  for (int p = 0; p < 2; p++) {
+    gl_caps.VertexAttribDivisor(deferred->light_attr[p], 0);
+    gl_caps.VertexAttribDivisor(deferred->colour_attr[p], 0);
+    glDisableVertexAttribArray(deferred->position_attr[p]);
+    glDisableVertexAttribArray(deferred->light_attr[p]);
+    glDisableVertexAttribArray(deferred->colour_attr[p]);
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glDisable(GL_BLEND);
+  glDisable(GL_CULL_FACE);
+  glCullFace(GL_BACK);
+  glDepthFunc(GL_LESS);
+  glDepthMask(GL_TRUE);
+  deferred->frames += 1;
+}
+
+/* Copy the lit image to the framebuffer bound at begin, the window's or
+   post-processing's, and bind that again */
+void deferred_shading_end(DeferredShading *deferred) {
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, deferred->target_framebuffer);
+  gl_caps.BlitFramebuffer(0, 0, deferred->width, deferred->height,
+			  0, 0, deferred->width, deferred->height,
+			  GL_COLOR_BUFFER_BIT, GL_NEAREST);
+  glBindFramebuffer(GL_FRAMEBUFFER, deferred->target_framebuffer);
+}
+
+/* Per frame memory traffic in MB, were the G-buffer to leave the tile
+   between passes, next to forward shading's colour write */
+static void deferred_traffic(const DeferredShading *deferred, double volume_pixels,
+			     double *gbuffer_mb, double *forward_mb) {
+  double pixels = (double) deferred->width * deferred->height;
+  double mb = 1024.0 * 1024.0;
+
+  /* Geometry pass stores 20 bytes, the light pass loads the
+     accumulation and depth-stencil back (8), reads albedo, normal and
+     depth per light pixel (12) and stores the accumulation again (4);
+     then the blit reads and writes 4 each */
+  *gbuffer_mb = (pixels * (20.0 + 8.0 + 4.0 + 8.0) + volume_pixels * 12.0) / mb;
+  *forward_mb = pixels * 4.0 / mb;
+}
+
+/* Prints every report_frames frames and resets. */
+void deferred_shading_report(DeferredShading *deferred) {
+
+  if (deferred->frames < deferred->report_frames) {
+    return;
+  }
+  double volume_pixels = deferred->volume_pixels / deferred->frames;
+  double gbuffer_mb, forward_mb;
+  deferred_traffic(deferred, volume_pixels, &gbuffer_mb, &forward_mb);
+  printf("deferred shading: %d lights, %.1f reaching the camera, light volumes "
+	 "~%.2f M pixels/frame (%.1f per screen pixel)\n",
+	 deferred->num_lights, (double) deferred->inside_lights / deferred->frames,
+	 volume_pixels / 1e6, volume_pixels / ((double) deferred->width * deferred->height));
+  printf("deferred shading: on a tiler ~%.1f MB/frame of G-buffer traffic "
+	 "(%.2f GB/s at 60 fps) against %.1f MB/frame forward\n",
+	 gbuffer_mb, gbuffer_mb * 60.0 / 1024.0, forward_mb);
+  deferred->frames = 0;
+  deferred->volume_pixels = 0.0;
+  deferred->inside_lights = 0;
+}
+
+/* --bench-deferred: layers of cube walls, each one shaded, lit by more
+   and more lights: forward naive, forward clustered and deferred. Each
+   frame is finished, so the times are the whole frame's. */
+void benchmark_deferred_shading(JobSystem *jobs, const Cube *cube, mat4 view,
+				mat4 projection, float *view_position,
+				int width, int height) {
+
+  const int counts[] = { 16, 32, 64, 128, 256 };
+  const int num_frames = 60;
+  const int layers = 4;
+
+  mat4 view_projection;
+  glm_mat4_mul(projection, view, view_projection);
+  vec3 min = { -12.0f, -6.0f, 0.5f };
+  vec3 max = { 12.0f, 6.0f, 4.0f };
+
+  if (!deferred_shading_supported()) {
+    printf("Deferred shading benchmark: needs ES3 with 3 draw buffers\n");
+    return;
+  }
+  printf("Deferred shading, %d layers of %dx%d cube walls, %d frames each:\n",
+	 layers, LIGHT_WALL_COLUMNS, LIGHT_WALL_ROWS, num_frames);
+  printf("\t%8s %12s %12s %12s %16s %16s\n", "lights", "naive ms", "clustered ms",
+	 "deferred ms", "deferred MB/f", "forward MB/f");
+  for (int c = 0; c < (int) (sizeof(counts) / sizeof(counts[0])); c++) {
+    double ms[3];
+    double gbuffer_mb = 0.0;
+    double forward_mb = 0.0;
+    for (int mode = 0; mode < 3; mode++) {
+      ClusteredLighting lighting;
+      DeferredShading deferred = {0};
+      CommandList list;
+      command_list_init(&list);
+      if (mode < 2) {
+	clustered_lighting_init(&lighting, counts[c], mode == 0, projection, width, height);
+	clustered_lighting_place(&lighting, counts[c], min, max);
+	record_light_wall(&list, lighting.program, &lighting.shader, cube, view_projection,
+			  view_position, layers);
+      } else {
+	if (!deferred_shading_init(&deferred, counts[c], projection, width, height)) {
+	  printf("Deferred shading benchmark: could not set up the G-buffer\n");
+	  command_list_destroy(&list);
+	  return;
+	}
+	place_lights(deferred.lights, deferred.orbits, counts[c], min, max);
+	record_light_wall(&list, deferred.program, &deferred.shader, cube, view_projection,
+			  view_position, layers);
+      }
+
+      /* One frame to warm up, then time the rest */
+      Uint64 start = 0;
+      for (int f = -1; f < num_frames; f++) {
+	if (f == 0) {
+	  deferred.volume_pixels = 0.0;
+	  start = SDL_GetPerformanceCounter();
+	}
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	if (mode < 2) {
+	  clustered_lighting_update(&lighting, jobs, view, f / 60.0f);
+	  command_list_replay(&list, 1, NULL);
+	} else {
+	  deferred_shading_update(&deferred, view, f / 60.0f);
+	  deferred_shading_begin(&deferred);
+	  command_list_replay(&list, 1, NULL);
+	  deferred_shading_light(&deferred, view, projection, view_position);
+	  deferred_shading_end(&deferred);
+	}
+	glFinish();
+      }
+      ms[mode] = (double) (SDL_GetPerformanceCounter() - start) * 1000.0
+	/ (double) SDL_GetPerformanceFrequency() / num_frames;
+
+      command_list_destroy(&list);
+      if (mode < 2) {
+	clustered_lighting_destroy(&lighting);
+      } else {
+	deferred_traffic(&deferred, deferred.volume_pixels / num_frames, &gbuffer_mb,
+			 &forward_mb);
+	deferred_shading_destroy(&deferred);
+      }
+    }
+    printf("\t%8d %12.3f %12.3f %12.3f %16.1f %16.1f\n", counts[c], ms[0], ms[1], ms[2],
+	   gbuffer_mb, forward_mb);
+  }
+}
+
+#endif
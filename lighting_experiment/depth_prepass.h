@@ -0,0 +1,647 @@
+#ifndef DEPTH_PREPASS_HEADER
+#define DEPTH_PREPASS_HEADER
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cglm/cglm.h>
+#include <GLES2/gl2.h>
+#include <SDL2/SDL.h>
+
+#include "clustered_lighting.h"
+#include "command_list.h"
+#include "cube.h"
+#include "cube_draw.h"
+#include "gl_caps.h"
+#include "shader_loader.h"
+#include "static_batch.h"
+#include "transform_store.h"
+
+// C header-only library for laying down the opaque cubes' depth before
+// they are lit, so each pixel is only lit once.
+//
+// The pre-pass draws every opaque draw with colour writes masked and a
+// shader that only reads positions, from a tightly packed copy of each
+// mesh's positions. The lit draws then test GL_EQUAL against that depth
+// with depth writes off; every vertex shader involved declares
+// gl_Position invariant so the depths match exactly. Invariance only
+// holds between shaders of the same GLSL version, so when the lit
+// draws use #version 300 es shaders (clustered on ES3, deferred) the
+// pre-pass does too.
+//
+// It costs a second trip through the geometry, which on a tile-based GPU
+// means binning everything twice, and only pays off when there is
+// overdraw to save. Sorting the draws front to back, which is always
+// done unless turned off, already saves most of it for the cheap
+// scenes. So the pre-pass is off, on, or auto: auto times frames both
+// ways every so often (EXT_disjoint_timer_query, else frame intervals)
+// and keeps whichever was faster.
+
+typedef enum {
+  DEPTH_PREPASS_OFF,
+  DEPTH_PREPASS_ON,
+  DEPTH_PREPASS_AUTO
+} DepthPrepassMode;
+
+#define DEPTH_PREPASS_MAX_MESHES 4
+#define DEPTH_PREPASS_QUERIES 4
+
+typedef struct {
+  float depth;
+  int index;
+} DepthKey;
+
+typedef struct {
+  DepthPrepassMode mode;
+  bool front_to_back;
+  bool enabled;         /* this frame */
+  bool timer_query;     /* auto mode times with queries */
+
+  GLuint program;
+  GLint position_attr;
+  GLint mvp;
+
+  /* Packed positions per mesh, ours to delete unless the mesh's own
+     position stream was already packed */
+  int num_meshes;
+  const Mesh *meshes[DEPTH_PREPASS_MAX_MESHES];
+  GLuint position_buffers[DEPTH_PREPASS_MAX_MESHES];
+  bool owned[DEPTH_PREPASS_MAX_MESHES];
+
+  CommandList list;
+
+  /* Sorting scratch, max_draws long */
+  int max_draws;
+  DepthKey *keys;
+  CubeDraw *sorted;
+
+  /* Auto: a ring of timer queries around the opaque draws, tagged with
+     whether the pre-pass ran */
+  GLuint queries[DEPTH_PREPASS_QUERIES];
+  bool query_pending[DEPTH_PREPASS_QUERIES];
+  bool query_prepass[DEPTH_PREPASS_QUERIES];
+  int query_ix;
+  Uint64 last_frame_counter;
+
+  /* Auto: probe_frames without then with the pre-pass, then keep the
+     faster for probe_interval frames */
+  int probe_frames;
+  int probe_interval;
+  int probe_frame;
+  double probe_ms[2];
+  int probe_samples[2];
+
+  /* Since the last report */
+  int frames;
+  int prepass_frames;
+  long prepass_vertices;
+  double pass_ms[2];
+  int pass_samples[2];
+  int report_frames;
+} DepthPrepass;
+
+const char *depth_prepass_mode_name(DepthPrepassMode mode) {
+  const char *names[3] = { "off", "on", "auto" };
+  return names[mode];
+}
+
+/* --depth-prepass off|on|auto, off if not given. --no-front-to-back
+   leaves the draws in scene order. */
+DepthPrepassMode depth_prepass_parse_args(int argc, char *argv[], bool *front_to_back) {
+  DepthPrepassMode mode = DEPTH_PREPASS_OFF;
+  *front_to_back = true;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--depth-prepass") == 0 && i + 1 < argc) {
+      bool known = false;
+      for (int m = DEPTH_PREPASS_OFF; m <= DEPTH_PREPASS_AUTO; m++) {
+	if (strcmp(argv[i + 1], depth_prepass_mode_name((DepthPrepassMode) m)) == 0) {
+	  mode = (DepthPrepassMode) m;
+	  known = true;
+	}
+      }
+      if (!known) {
+	printf("ERROR: unknown depth pre-pass mode %s\n", argv[i + 1]);
+      }
+    } else if (strcmp(argv[i], "--no-front-to-back") == 0) {
+      *front_to_back = false;
+    }
+  }
+  return mode;
+}
+
+/* Sorting up to max_draws draws a frame. timer_query is false when
+   something else is already timing the same draws, as only one
+   GL_TIME_ELAPSED_EXT query can run at once. es3_shaders is true when
+   the lit draws' vertex shader is #version 300 es. */
+void depth_prepass_init(DepthPrepass *prepass, DepthPrepassMode mode, bool front_to_back,
+			int max_draws, bool timer_query, bool es3_shaders) {
+
+  memset(prepass, 0, sizeof(*prepass));
+  prepass->mode = mode;
+  prepass->front_to_back = front_to_back;
+  prepass->enabled = mode == DEPTH_PREPASS_ON;
+  prepass->timer_query = timer_query && gl_caps.timer_query && mode == DEPTH_PREPASS_AUTO;
+  prepass->probe_frames = 30;
+  prepass->probe_interval = 600;
+  prepass->report_frames = 300;
+
+  if (es3_shaders) {
+    prepass->program = load_shaders("shaders/depth_prepass_es3.vert",
+				    "shaders/depth_prepass_es3.frag");
+  } else {
+    prepass->program = load_shaders("shaders/depth_prepass.vert",
+				    "shaders/depth_prepass.frag");
+  }
+  prepass->position_attr = glGetAttribLocation(prepass->program, "vPosition");
+  prepass->mvp = glGetUniformLocation(prepass->program, "mvp");
+  command_list_init(&prepass->list);
+
+  prepass->max_draws = max_draws;
+  prepass->keys = (DepthKey *) malloc(max_draws * sizeof(DepthKey));
+  prepass->sorted = (CubeDraw *) malloc(max_draws * sizeof(CubeDraw));
+
+  if (prepass->timer_query) {
+    gl_caps.GenQueriesEXT(DEPTH_PREPASS_QUERIES, prepass->queries);
+  }
+  prepass->last_frame_counter = SDL_GetPerformanceCounter();
+
+  printf("Depth pre-pass: %s", depth_prepass_mode_name(mode));
+  if (mode == DEPTH_PREPASS_AUTO) {
+    printf(", chosen from %s", prepass->timer_query ? "GPU timer queries" : "frame intervals");
+  }
+  printf(", draws %s\n", front_to_back ? "sorted front to back" : "in scene order");
+}
+
+void depth_prepass_destroy(DepthPrepass *prepass) {
+  for (int m = 0; m < prepass->num_meshes; m++) {
+    if (prepass->owned[m]) {
+      glDeleteBuffers(1, &prepass->position_buffers[m]);
+    }
+  }
+  if (prepass->timer_query) {
+    gl_caps.DeleteQueriesEXT(DEPTH_PREPASS_QUERIES, prepass->queries);
+  }
+  glDeleteProgram(prepass->program);
+  command_list_destroy(&prepass->list);
+  free(prepass->keys);
+  free(prepass->sorted);
+}
+
+/* A packed position stream for the mesh; a split mesh already has one.
+   Meshes that were never added are drawn from their own layout. */
+void depth_prepass_add_mesh(DepthPrepass *prepass, const Mesh *mesh) {
+  for (int m = 0; m < prepass->num_meshes; m++) {
+    if (prepass->meshes[m] == mesh) {
+      return;
+    }
+  }
+  if (prepass->num_meshes == DEPTH_PREPASS_MAX_MESHES) {
+    printf("ERROR: depth pre-pass has no room for another mesh\n");
+    return;
+  }
+
+  int m = prepass->num_meshes;
+  const VertexStream *position = &mesh->layout.position;
+  prepass->meshes[m] = mesh;
+  if (position->stride == 0 || position->stride == 3 * sizeof(GLfloat)) {
+    prepass->position_buffers[m] = position->buffer;
+    prepass->owned[m] = false;
+  } else {
+    glGenBuffers(1, &prepass->position_buffers[m]);
+    glBindBuffer(GL_ARRAY_BUFFER, prepass->position_buffers[m]);
+    glBufferData(GL_ARRAY_BUFFER, 9 * mesh->num_triangles * sizeof(GLfloat),
+		 mesh->vertices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    prepass->owned[m] = true;
+  }
+  prepass->num_meshes += 1;
+}
+
+static int depth_key_compare(const void *a, const void *b) {
+  const DepthKey *ka = (const DepthKey *) a;
+  const DepthKey *kb = (const DepthKey *) b;
+  if (ka->depth != kb->depth) {
+    return ka->depth < kb->depth ? -1 : 1;
+  }
+  return ka->index - kb->index;
+}
+
+/* Nearest first, ties kept in order */
+void depth_keys_sort(DepthKey *keys, int num_keys) {
+  qsort(keys, num_keys, sizeof(DepthKey), depth_key_compare);
+}
+
+/* Reorder the draws nearest first, by the view depth of their mesh's
+   bounds centre */
+void depth_prepass_sort(DepthPrepass *prepass, CubeDraw *draws, int num_draws,
+			const TransformStore *transforms, mat4 view) {
+
+  if (!prepass->front_to_back || num_draws < 2) {
+    return;
+  }
+  if (num_draws > prepass->max_draws) {
+    num_draws = prepass->max_draws;
+  }
+  for (int i = 0; i < num_draws; i++) {
+    const Cube *cube = draws[i].cube;
+    mat4 world_view;
+    vec3 centre;
+    glm_mat4_mul(view, transforms->world[cube->transform], world_view);
+    glm_mat4_mulv3(world_view, (float *) cube->mesh->bounds.center, 1.0f, centre);
+    prepass->keys[i].depth = -centre[2];
+    prepass->keys[i].index = i;
+  }
+  depth_keys_sort(prepass->keys, num_draws);
+  for (int i = 0; i < num_draws; i++) {
+    prepass->sorted[i] = draws[prepass->keys[i].index];
+  }
+  memcpy(draws, prepass->sorted, num_draws * sizeof(CubeDraw));
+}
+
+static void record_prepass_mesh(CommandList *list, const DepthPrepass *prepass,
+				const Mesh *mesh) {
+  for (int m = 0; m < prepass->num_meshes; m++) {
+    if (prepass->meshes[m] == mesh) {
+      cmd_bind_buffer(list, GL_ARRAY_BUFFER, prepass->position_buffers[m]);
+      cmd_vertex_attrib(list, prepass->position_attr, 3, 0, 0);
+      return;
+    }
+  }
+  const VertexStream *position = &mesh->layout.position;
+  cmd_bind_buffer(list, GL_ARRAY_BUFFER, position->buffer);
+  cmd_vertex_attrib(list, prepass->position_attr, position->size, position->stride,
+		    position->offset);
+}
+
+/* The draws and the static batch, depth only. The batch keeps no copy
+   of its vertices, so it is read from its interleaved buffer. */
+void record_depth_prepass(CommandList *list, DepthPrepass *prepass,
+			  const CubeDraw *draws, int num_draws, const DrawFrame *frame,
+			  const StaticBatch *batch, mat4 view_projection) {
+
+  long vertices = 0;
+  const Mesh *mesh = NULL;
+  cmd_use_program(list, prepass->program);
+  cmd_enable_attrib(list, prepass->position_attr);
+  for (int i = 0; i < num_draws; i++) {
+    const Cube *cube = draws[i].cube;
+    if (cube->mesh != mesh) {
+      mesh = cube->mesh;
+      record_prepass_mesh(list, prepass, mesh);
+    }
+    cmd_uniform_matrix4(list, prepass->mvp, frame->transforms->mvp[cube->transform][0]);
+    cmd_draw_arrays(list, GL_TRIANGLES, 0, 3 * mesh->num_triangles);
+    vertices += 3 * mesh->num_triangles;
+  }
+
+  if (batch != NULL && batch->num_chunks > 0) {
+    cmd_uniform_matrix4(list, prepass->mvp, view_projection[0]);
+    cmd_bind_buffer(list, GL_ARRAY_BUFFER, batch->vertex_buffer);
+    cmd_bind_buffer(list, GL_ELEMENT_ARRAY_BUFFER, batch->index_buffer);
+    for (int c = 0; c < batch->num_chunks; c++) {
+      const StaticChunk *chunk = &batch->chunks[c];
+      cmd_vertex_attrib(list, prepass->position_attr, 3, STATIC_BATCH_STRIDE,
+			chunk->vertex_offset);
+      cmd_draw_elements(list, GL_TRIANGLES, chunk->num_indices, GL_UNSIGNED_SHORT,
+			chunk->index_offset);
+      vertices += chunk->num_indices;
+    }
+    cmd_bind_buffer(list, GL_ELEMENT_ARRAY_BUFFER, 0);
+  }
+  cmd_disable_attrib(list, prepass->position_attr);
+  prepass->prepass_vertices += vertices;
+}
+
+/* Before the opaque draws. Draws the pre-pass when it is on this frame
+   and leaves the depth test at GL_EQUAL for the lit draws. */
+void depth_prepass_begin(DepthPrepass *prepass, const CubeDraw *draws, int num_draws,
+			 const DrawFrame *frame, const StaticBatch *batch,
+			 mat4 view_projection) {
+
+  if (prepass->timer_query && !prepass->query_pending[prepass->query_ix]) {
+    gl_caps.BeginQueryEXT(GL_TIME_ELAPSED_EXT, prepass->queries[prepass->query_ix]);
+  }
+  if (!prepass->enabled) {
+    return;
+  }
+
+  command_list_reset(&prepass->list);
+  record_depth_prepass(&prepass->list, prepass, draws, num_draws, frame, batch,
+		       view_projection);
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+  command_list_replay(&prepass->list, 1, NULL);
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+  glDepthFunc(GL_EQUAL);
+  glDepthMask(GL_FALSE);
+  prepass->prepass_frames += 1;
+}
+
+/* After the opaque draws, back to GL_LESS for whatever follows */
+void depth_prepass_end(DepthPrepass *prepass) {
+  if (prepass->enabled) {
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+  }
+  if (prepass->timer_query && !prepass->query_pending[prepass->query_ix]) {
+    gl_caps.EndQueryEXT(GL_TIME_ELAPSED_EXT);
+    prepass->query_pending[prepass->query_ix] = true;
+    prepass->query_prepass[prepass->query_ix] = prepass->enabled;
+  }
+  prepass->query_ix = (prepass->query_ix + 1) % DEPTH_PREPASS_QUERIES;
+}
+
+/* Every finished query's time goes to whichever way it was drawn */
+static void depth_prepass_sample(DepthPrepass *prepass, double *ms, int *samples) {
+
+  if (!prepass->timer_query) {
+    Uint64 now = SDL_GetPerformanceCounter();
+    ms[prepass->enabled] += (double) (now - prepass->last_frame_counter) * 1000.0
+      / (double) SDL_GetPerformanceFrequency();
+    samples[prepass->enabled] += 1;
+    prepass->last_frame_counter = now;
+    return;
+  }
+
+  GLint disjoint = 0;
+  glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+  for (int i = 1; i <= DEPTH_PREPASS_QUERIES; i++) {
+    int slot = (prepass->query_ix + i) % DEPTH_PREPASS_QUERIES;
+    if (!prepass->query_pending[slot]) {
+      continue;
+    }
+    GLuint available = 0;
+    gl_caps.GetQueryObjectuivEXT(prepass->queries[slot], GL_QUERY_RESULT_AVAILABLE_EXT,
+				 &available);
+    if (!available) {
+      continue;
+    }
+    GLuint64 elapsed_ns = 0;
+    gl_caps.GetQueryObjectui64vEXT(prepass->queries[slot], GL_QUERY_RESULT_EXT,
+				   &elapsed_ns);
+    prepass->query_pending[slot] = false;
+    if (!disjoint) {
+      ms[prepass->query_prepass[slot]] += (double) elapsed_ns / 1.0e6;
+      samples[prepass->query_prepass[slot]] += 1;
+    }
+  }
+}
+
+/* Once a frame, after the swap. In auto, picks whether next frame
+   draws the pre-pass. */
+void depth_prepass_update(DepthPrepass *prepass) {
+
+  double ms[2] = { 0.0, 0.0 };
+  int samples[2] = { 0, 0 };
+  if (prepass->mode == DEPTH_PREPASS_AUTO) {
+    depth_prepass_sample(prepass, ms, samples);
+  }
+  for (int p = 0; p < 2; p++) {
+    prepass->pass_ms[p] += ms[p];
+    prepass->pass_samples[p] += samples[p];
+  }
+
+  if (prepass->mode == DEPTH_PREPASS_AUTO) {
+    /* Without, then with, then a few frames more for the last queries
+       to come back */
+    int decide = 2 * prepass->probe_frames + DEPTH_PREPASS_QUERIES;
+    if (prepass->probe_frame < decide) {
+      for (int p = 0; p < 2; p++) {
+	prepass->probe_ms[p] += ms[p];
+	prepass->probe_samples[p] += samples[p];
+      }
+    }
+
+    prepass->probe_frame += 1;
+    if (prepass->probe_frame < prepass->probe_frames) {
+      prepass->enabled = false;
+    } else if (prepass->probe_frame < decide) {
+      prepass->enabled = true;
+    } else if (prepass->probe_frame == decide) {
+      if (prepass->probe_samples[0] > 0 && prepass->probe_samples[1] > 0) {
+	prepass->enabled = prepass->probe_ms[1] / prepass->probe_samples[1]
+	  < prepass->probe_ms[0] / prepass->probe_samples[0];
+      }
+    } else if (prepass->probe_frame >= decide + prepass->probe_interval) {
+      prepass->probe_frame = 0;
+      prepass->enabled = false;
+      memset(prepass->probe_ms, 0, sizeof(prepass->probe_ms));
+      memset(prepass->probe_samples, 0, sizeof(prepass->probe_samples));
+    }
+  }
+
+  prepass->frames += 1;
+  if (prepass->frames == prepass->report_frames) {
+    printf("depth pre-pass: %s, drawn %d of %d frames, %ld vertices/frame",
+	   depth_prepass_mode_name(prepass->mode), prepass->prepass_frames,
+	   prepass->frames,
+	   prepass->prepass_frames > 0 ? prepass->prepass_vertices / prepass->prepass_frames : 0);
+    if (prepass->mode == DEPTH_PREPASS_AUTO) {
+      const char *names[2] = { "without", "with" };
+      for (int p = 0; p < 2; p++) {
+	if (prepass->pass_samples[p] > 0) {
+	  printf(", %s %.2f ms x %d", names[p], prepass->pass_ms[p] / prepass->pass_samples[p],
+		 prepass->pass_samples[p]);
+	}
+      }
+      printf(" (%s), %s now", prepass->timer_query ? "opaque draws" : "frame",
+	     prepass->enabled ? "on" : "off");
+    }
+    printf("\n");
+    prepass->frames = 0;
+    prepass->prepass_frames = 0;
+    prepass->prepass_vertices = 0;
+    memset(prepass->pass_ms, 0, sizeof(prepass->pass_ms));
+    memset(prepass->pass_samples, 0, sizeof(prepass->pass_samples));
+  }
+}
+
+/* The wall's cubes in draw order, models[layer * per_layer + i] for
+   back to front or sorted nearest first */
+static void depth_bench_wall(mat4 *models, int layers, bool front_to_back, mat4 view,
+			     DepthKey *keys) {
+
+  int per_layer = LIGHT_WALL_COLUMNS * LIGHT_WALL_ROWS;
+  int count = layers * per_layer;
+  mat4 *wall = (mat4 *) malloc(count * sizeof(mat4));
+  for (int layer = layers - 1, n = 0; layer >= 0; layer--) {
+    for (int i = 0; i < per_layer; i++, n++) {
+      light_wall_model(layer, i, wall[n]);
+      vec4 centre;
+      glm_mat4_mulv(view, wall[n][3], centre);
+      keys[n].depth = -centre[2];
+      keys[n].index = n;
+    }
+  }
+  if (front_to_back) {
+    depth_keys_sort(keys, count);
+  }
+  for (int n = 0; n < count; n++) {
+    glm_mat4_copy(wall[keys[n].index], models[n]);
+  }
+  free(wall);
+}
+
+static void record_depth_bench(CommandList *list, GLuint program, GLint position_attr,
+			       GLint mvp_location, GLuint positions, const Mesh *mesh,
+			       mat4 *models, int count, mat4 view_projection) {
+  cmd_use_program(list, program);
+  cmd_enable_attrib(list, position_attr);
+  cmd_bind_buffer(list, GL_ARRAY_BUFFER, positions);
+  cmd_vertex_attrib(list, position_attr, 3, 0, 0);
+  for (int n = 0; n < count; n++) {
+    mat4 mvp;
+    glm_mat4_mul(view_projection, models[n], mvp);
+    cmd_uniform_matrix4(list, mvp_location, mvp[0]);
+    cmd_draw_arrays(list, GL_TRIANGLES, 0, 3 * mesh->num_triangles);
+  }
+  cmd_disable_attrib(list, position_attr);
+}
+
+/* --bench-prepass: the cube wall several layers deep, lit by one light,
+   drawn back to front, front to back and front to back after a depth
+   pre-pass. Frames are finished, so the times are whole frames. The
+   overdraw is counted on the GPU, one fragment per blended add, over
+   the pixels anything covered. */
+void benchmark_depth_prepass(const Cube *cube, mat4 view, mat4 projection,
+			     float *view_position, int width, int height) {
+
+  const int layer_counts[] = { 1, 2, 4, 8 };
+  const char *orders[3] = { "back to front", "front to back", "pre-pass" };
+  const int num_frames = 30;
+
+  DepthPrepass prepass;
+  depth_prepass_init(&prepass, DEPTH_PREPASS_ON, true, 1, false, false);
+  depth_prepass_add_mesh(&prepass, cube->mesh);
+  GLuint positions = prepass.position_buffers[0];
+  GLuint count_program = load_shaders("shaders/depth_prepass.vert", "shaders/overdraw.frag");
+  GLint count_position = glGetAttribLocation(count_program, "vPosition");
+  GLint count_mvp = glGetUniformLocation(count_program, "mvp");
+
+  LightingShader shader;
+  lighting_shader_locations(cube->shaderProgramAddress, &shader);
+  vec3 light_position = { 0.0f, 1.0f, 3.0f };
+  vec3 light_colour = { 0.8f, 0.8f, 0.8f };
+  vec3 white = GLM_VEC3_ONE_INIT;
+
+  mat4 view_projection;
+  glm_mat4_mul(projection, view, view_projection);
+  int max_count = 8 * LIGHT_WALL_COLUMNS * LIGHT_WALL_ROWS;
+  mat4 *models = (mat4 *) malloc(max_count * sizeof(mat4));
+  DepthKey *keys = (DepthKey *) malloc(max_count * sizeof(DepthKey));
+  unsigned char *pixels = (unsigned char *) malloc((size_t) width * height * 4);
+  GLfloat clear_colour[4];
+  glGetFloatv(GL_COLOR_CLEAR_VALUE, clear_colour);
+
+  printf("Depth pre-pass, %dx%d cube wall, %d frames each:\n",
+	 LIGHT_WALL_COLUMNS, LIGHT_WALL_ROWS, num_frames);
+  printf("\t%6s %14s %10s %16s %10s\n", "layers", "order", "frame ms",
+	 "fragments/pixel", "vertices");
+  for (int l = 0; l < (int) (sizeof(layer_counts) / sizeof(layer_counts[0])); l++) {
+    int layers = layer_counts[l];
+    int count = layers * LIGHT_WALL_COLUMNS * LIGHT_WALL_ROWS;
+    for (int o = 0; o < 3; o++) {
+      depth_bench_wall(models, layers, o > 0, view, keys);
+      bool with_prepass = o == 2;
+
+      CommandList prepass_list;
+      CommandList lit_list;
+      CommandList count_list;
+      command_list_init(&prepass_list);
+      command_list_init(&lit_list);
+      command_list_init(&count_list);
+      record_depth_bench(&prepass_list, prepass.program, prepass.position_attr, prepass.mvp,
+			 positions, cube->mesh, models, count, view_projection);
+      record_depth_bench(&count_list, count_program, count_position, count_mvp,
+			 positions, cube->mesh, models, count, view_projection);
+
+      cmd_use_program(&lit_list, cube->shaderProgramAddress);
+      cmd_uniform3f(&lit_list, shader.object_colour, white);
+      cmd_uniform3f(&lit_list, shader.light_colour, light_colour);
+      cmd_uniform3f(&lit_list, shader.light_pos, light_position);
+      cmd_uniform3f(&lit_list, shader.view_pos, view_position);
+      cmd_uniform1f(&lit_list, shader.ambient_strength, 0.05f);
+      cmd_uniform1f(&lit_list, shader.specular_strength, 0.5f);
+      cmd_enable_attrib(&lit_list, shader.position_attr);
+      cmd_enable_attrib(&lit_list, shader.normal_attr);
+      record_vertex_layout(&lit_list, &cube->mesh->layout, &shader);
+      for (int n = 0; n < count; n++) {
+	mat4 mvp;
+	mat4 normal;
+	glm_mat4_mul(view_projection, models[n], mvp);
+	glm_mat4_inv(models[n], normal);
+	glm_mat4_transpose(normal);
+	cmd_uniform_matrix4(&lit_list, shader.model, models[n][0]);
+	cmd_uniform_matrix4(&lit_list, shader.mvp, mvp[0]);
+	cmd_uniform_matrix4(&lit_list, shader.mat_normal, normal[0]);
+	cmd_draw_arrays(&lit_list, GL_TRIANGLES, 0, 3 * cube->mesh->num_triangles);
+      }
+      cmd_disable_attrib(&lit_list, shader.position_attr);
+      cmd_disable_attrib(&lit_list, shader.normal_attr);
+
+      /* One frame to warm up, then time the rest */
+      Uint64 start = 0;
+      for (int f = -1; f < num_frames; f++) {
+	if (f == 0) {
+	  start = SDL_GetPerformanceCounter();
+	}
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	if (with_prepass) {
+	  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	  command_list_replay(&prepass_list, 1, NULL);
+	  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	  glDepthFunc(GL_EQUAL);
+	  glDepthMask(GL_FALSE);
+	}
+	command_list_replay(&lit_list, 1, NULL);
+	glDepthFunc(GL_LESS);
+	glDepthMask(GL_TRUE);
+	glFinish();
+      }
+      double ms = (double) (SDL_GetPerformanceCounter() - start) * 1000.0
+	/ (double) SDL_GetPerformanceFrequency() / num_frames;
+
+      /* The same again, counting what gets past the depth test */
+      glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+      if (with_prepass) {
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	command_list_replay(&prepass_list, 1, NULL);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glDepthFunc(GL_EQUAL);
+	glDepthMask(GL_FALSE);
+      }
+      glEnable(GL_BLEND);
+      glBlendFunc(GL_ONE, GL_ONE);
+      command_list_replay(&count_list, 1, NULL);
+      glDisable(GL_BLEND);
+      glDepthFunc(GL_LESS);
+      glDepthMask(GL_TRUE);
+      glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+      glClearColor(clear_colour[0], clear_colour[1], clear_colour[2], clear_colour[3]);
+
+      long fragments = 0;
+      long covered = 0;
+      for (size_t p = 0; p < (size_t) width * height; p++) {
+	fragments += pixels[4 * p];
+	covered += pixels[4 * p] > 0;
+      }
+      long vertices = (long) count * 3 * cube->mesh->num_triangles * (with_prepass ? 2 : 1);
+      printf("\t%6d %14s %10.3f %16.2f %10ld\n", layers, orders[o], ms,
+	     covered > 0 ? (double) fragments / covered : 0.0, vertices);
+
+      command_list_destroy(&prepass_list);
+      command_list_destroy(&lit_list);
+      command_list_destroy(&count_list);
+    }
+  }
+
+  free(models);
+  free(keys);
+  free(pixels);
+  glDeleteProgram(count_program);
+  depth_prepass_destroy(&prepass);
+}
+
+#endif
@@ -0,0 +1,403 @@
+#ifndef LIGHTING_TIERS_HEADER
+#define LIGHTING_TIERS_HEADER
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cglm/cglm.h>
+#include <GLES2/gl2.h>
+#include <SDL2/SDL.h>
+
+#include "clustered_lighting.h"
+#include "command_list.h"
+#include "cube.h"
+#include "cube_draw.h"
+#include "gl_caps.h"
+#include "shader_loader.h"
+
+// C header-only library of lighting quality tiers for the single light
+// the cubes are lit by. Every tier is a permutation of shader.vert and
+// lighting_shader.frag, built with a define, and takes the same
+// material uniforms:
+//
+//   phong    per pixel Phong, the reference: three normalizes and a
+//            pow per fragment
+//   blinn    Blinn-Phong, the light and half vectors from the vertex
+//            shader and the highlight from a lookup texture, so no pow
+//   gouraud  all the lighting per vertex in shader.vert, the fragment
+//            shader just multiplies by the colour
+//
+// The tier is picked at startup, or adapted: the lit draws are timed
+// (EXT_disjoint_timer_query, else the frame interval) and the tier
+// steps down when the time stays over the budget and back up when it
+// stays well under, with the same hysteresis as dynamic_resolution.
+
+/* Cheapest first, so adapting moves one up or down */
+typedef enum {
+  LIGHTING_TIER_GOURAUD,
+  LIGHTING_TIER_BLINN,
+  LIGHTING_TIER_PHONG,
+  LIGHTING_TIER_COUNT
+} LightingTier;
+
+#define LIGHTING_TIER_QUERIES 4
+
+/* Blinn-Phong needs about four times Phong's 64 for the same highlight */
+#define SPECULAR_LUT_SIZE 256
+#define SPECULAR_LUT_SHININESS 256.0f
+#define SPECULAR_LUT_UNIT 4
+
+typedef struct {
+  LightingTier tier;
+  bool adaptive;
+  float budget_ms;
+  float headroom;       /* only step up below budget_ms * headroom */
+  int settle_frames;
+  int report_frames;
+
+  GLuint programs[LIGHTING_TIER_COUNT];
+  LightingShader shaders[LIGHTING_TIER_COUNT];
+  GLint specular_lut[LIGHTING_TIER_COUNT];
+  GLuint lut_texture;
+
+  /* Ring of timer queries around the lit draws */
+  GLuint queries[LIGHTING_TIER_QUERIES];
+  bool query_pending[LIGHTING_TIER_QUERIES];
+  LightingTier query_tier[LIGHTING_TIER_QUERIES];
+  int query_ix;
+  Uint64 last_frame_counter;
+
+  /* Smoothed time and hysteresis counters */
+  float frame_ms;
+  int over_frames;
+  int under_frames;
+
+  /* Since the last report */
+  int frames;
+  int changes;
+  double tier_ms[LIGHTING_TIER_COUNT];
+  int tier_frames[LIGHTING_TIER_COUNT];
+} LightingTiers;
+
+const char *lighting_tier_name(LightingTier tier) {
+  const char *names[LIGHTING_TIER_COUNT] = { "gouraud", "blinn", "phong" };
+  return names[tier];
+}
+
+/* phong, blinn or gouraud; false for anything else */
+bool lighting_tier_parse(const char *name, LightingTier *tier) {
+  for (int t = 0; t < LIGHTING_TIER_COUNT; t++) {
+    if (strcmp(name, lighting_tier_name((LightingTier) t)) == 0) {
+      *tier = (LightingTier) t;
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Starts at tier; adaptive moves it to keep the lit draws under
+   budget_ms. */
+void lighting_tiers_init(LightingTiers *tiers, LightingTier tier, bool adaptive,
+			 float budget_ms) {
+
+  memset(tiers, 0, sizeof(*tiers));
+  tiers->tier = tier;
+  tiers->adaptive = adaptive;
+  tiers->budget_ms = budget_ms;
+  tiers->headroom = 0.6f;
+  tiers->settle_frames = 30;
+  tiers->report_frames = 300;
+
+  /* The highlight from where it is worth a texel to 1, sampled
+     texel centre to texel centre */
+  float start = powf(1.0f / 512.0f, 1.0f / SPECULAR_LUT_SHININESS);
+  unsigned char lut[SPECULAR_LUT_SIZE];
+  for (int i = 0; i < SPECULAR_LUT_SIZE; i++) {
+    float x = start + (1.0f - start) * i / (SPECULAR_LUT_SIZE - 1);
+    lut[i] = (unsigned char) (255.0f * powf(x, SPECULAR_LUT_SHININESS) + 0.5f);
+  }
+  float scale = (SPECULAR_LUT_SIZE - 1) / (1.0f - start) / SPECULAR_LUT_SIZE;
+  float offset = 0.5f / SPECULAR_LUT_SIZE - start * scale;
+
+  glGenTextures(1, &tiers->lut_texture);
+  glBindTexture(GL_TEXTURE_2D, tiers->lut_texture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, SPECULAR_LUT_SIZE, 1, 0,
+	       GL_LUMINANCE, GL_UNSIGNED_BYTE, lut);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  char defines[LIGHTING_TIER_COUNT][256];
+  snprintf(defines[LIGHTING_TIER_GOURAUD], sizeof(defines[0]), "#define LIGHTING_GOURAUD 1\n");
+  snprintf(defines[LIGHTING_TIER_BLINN], sizeof(defines[0]),
+	   "#define LIGHTING_BLINN_LUT 1\n#define SPECULAR_LUT_SHININESS %.1f\n"
+	   "#define SPECULAR_LUT_SCALE %.8f\n#define SPECULAR_LUT_OFFSET %.8f\n",
+	   SPECULAR_LUT_SHININESS, scale, offset);
+  defines[LIGHTING_TIER_PHONG][0] = '\0';
+  for (int t = 0; t < LIGHTING_TIER_COUNT; t++) {
+    tiers->programs[t] = load_shaders_defines("shaders/shader.vert",
+					      "shaders/lighting_shader.frag", defines[t]);
+    lighting_shader_locations(tiers->programs[t], &tiers->shaders[t]);
+    tiers->specular_lut[t] = glGetUniformLocation(tiers->programs[t], "specularLut");
+    if (tiers->specular_lut[t] >= 0) {
+      glUseProgram(tiers->programs[t]);
+      glUniform1i(tiers->specular_lut[t], SPECULAR_LUT_UNIT);
+    }
+  }
+
+  if (adaptive && gl_caps.timer_query) {
+    gl_caps.GenQueriesEXT(LIGHTING_TIER_QUERIES, tiers->queries);
+  }
+  tiers->last_frame_counter = SDL_GetPerformanceCounter();
+
+  printf("Lighting tiers: starting at %s", lighting_tier_name(tier));
+  if (adaptive) {
+    printf(", adapting to a %.1f ms budget from %s", budget_ms,
+	   gl_caps.timer_query ? "GPU timer queries" : "frame intervals");
+  }
+  printf("\n");
+}
+
+void lighting_tiers_destroy(LightingTiers *tiers) {
+  for (int t = 0; t < LIGHTING_TIER_COUNT; t++) {
+    glDeleteProgram(tiers->programs[t]);
+  }
+  glDeleteTextures(1, &tiers->lut_texture);
+  if (tiers->adaptive && gl_caps.timer_query) {
+    gl_caps.DeleteQueriesEXT(LIGHTING_TIER_QUERIES, tiers->queries);
+  }
+}
+
+/* Point the cubes at the current tier's program and locations */
+void lighting_tiers_apply(const LightingTiers *tiers, Cube *cubes,
+			  LightingShader *shaders, int num_cubes) {
+  for (int i = 0; i < num_cubes; i++) {
+    cubes[i].shaderProgramAddress = tiers->programs[tiers->tier];
+    shaders[i] = tiers->shaders[tiers->tier];
+  }
+}
+
+/* Around the lit draws */
+void lighting_tiers_begin(LightingTiers *tiers) {
+  glActiveTexture(GL_TEXTURE0 + SPECULAR_LUT_UNIT);
+  glBindTexture(GL_TEXTURE_2D, tiers->lut_texture);
+  glActiveTexture(GL_TEXTURE0);
+
+  if (tiers->adaptive && gl_caps.timer_query && !tiers->query_pending[tiers->query_ix]) {
+    gl_caps.BeginQueryEXT(GL_TIME_ELAPSED_EXT, tiers->queries[tiers->query_ix]);
+  }
+}
+
+void lighting_tiers_end(LightingTiers *tiers) {
+  if (tiers->adaptive && gl_caps.timer_query && !tiers->query_pending[tiers->query_ix]) {
+    gl_caps.EndQueryEXT(GL_TIME_ELAPSED_EXT);
+    tiers->query_pending[tiers->query_ix] = true;
+    tiers->query_tier[tiers->query_ix] = tiers->tier;
+  }
+  tiers->query_ix = (tiers->query_ix + 1) % LIGHTING_TIER_QUERIES;
+}
+
+/* The newest time available, or negative when there is nothing new.
+   Results from before the last tier change are dropped. */
+static float lighting_tiers_sample(LightingTiers *tiers) {
+
+  if (!tiers->adaptive || !gl_caps.timer_query) {
+    Uint64 now = SDL_GetPerformanceCounter();
+    float interval = (float) (now - tiers->last_frame_counter) * 1000.0f
+      / (float) SDL_GetPerformanceFrequency();
+    tiers->last_frame_counter = now;
+    return interval;
+  }
+
+  GLint disjoint = 0;
+  glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+
+  float newest = -1.0f;
+  for (int i = 1; i <= LIGHTING_TIER_QUERIES; i++) {
+    int slot = (tiers->query_ix + i) % LIGHTING_TIER_QUERIES;
+    if (!tiers->query_pending[slot]) {
+      continue;
+    }
+    GLuint available = 0;
+    gl_caps.GetQueryObjectuivEXT(tiers->queries[slot], GL_QUERY_RESULT_AVAILABLE_EXT,
+				 &available);
+    if (!available) {
+      continue;
+    }
+    GLuint64 elapsed_ns = 0;
+    gl_caps.GetQueryObjectui64vEXT(tiers->queries[slot], GL_QUERY_RESULT_EXT, &elapsed_ns);
+    tiers->query_pending[slot] = false;
+    if (!disjoint && tiers->query_tier[slot] == tiers->tier) {
+      newest = (float) elapsed_ns / 1.0e6f;
+    }
+  }
+  return newest;
+}
+
+/* Once a frame, after the swap. True when the tier changed, so the
+   caller has to lighting_tiers_apply again. */
+bool lighting_tiers_update(LightingTiers *tiers) {
+
+  float sample = lighting_tiers_sample(tiers);
+  if (sample >= 0.0f) {
+    tiers->tier_ms[tiers->tier] += sample;
+    tiers->tier_frames[tiers->tier] += 1;
+    if (tiers->frame_ms == 0.0f) {
+      tiers->frame_ms = sample;
+    } else {
+      tiers->frame_ms += 0.2f * (sample - tiers->frame_ms);
+    }
+  }
+
+  bool changed = false;
+  if (tiers->adaptive) {
+    /* As in dynamic_resolution: vsynced frame intervals never come in
+       under budget, so on budget is as good as it gets */
+    float under = gl_caps.timer_query ? tiers->budget_ms * tiers->headroom
+      : tiers->budget_ms * 1.05f;
+    int up_settle = gl_caps.timer_query ? tiers->settle_frames : tiers->settle_frames * 4;
+
+    if (tiers->frame_ms > tiers->budget_ms) {
+      tiers->over_frames += 1;
+      tiers->under_frames = 0;
+    } else if (tiers->frame_ms < under) {
+      tiers->under_frames += 1;
+      tiers->over_frames = 0;
+    } else {
+      tiers->over_frames = 0;
+      tiers->under_frames = 0;
+    }
+
+    if (tiers->over_frames >= tiers->settle_frames && tiers->tier > 0) {
+      tiers->tier = (LightingTier) (tiers->tier - 1);
+      changed = true;
+    } else if (tiers->under_frames >= up_settle && tiers->tier < LIGHTING_TIER_COUNT - 1) {
+      tiers->tier = (LightingTier) (tiers->tier + 1);
+      changed = true;
+    }
+    if (changed) {
+      tiers->changes += 1;
+      tiers->over_frames = 0;
+      tiers->under_frames = 0;
+      tiers->frame_ms = 0.0f;
+    }
+  }
+
+  tiers->frames += 1;
+  if (tiers->frames == tiers->report_frames) {
+    printf("lighting tiers: %s now, %d changes,", lighting_tier_name(tiers->tier),
+	   tiers->changes);
+    for (int t = LIGHTING_TIER_COUNT - 1; t >= 0; t--) {
+      if (tiers->tier_frames[t] > 0) {
+	printf(" %s %.2f ms x %d", lighting_tier_name((LightingTier) t),
+	       tiers->tier_ms[t] / tiers->tier_frames[t], tiers->tier_frames[t]);
+      }
+    }
+    printf(" (%s)\n", tiers->adaptive && gl_caps.timer_query ? "lit draws" : "frame");
+    tiers->frames = 0;
+    tiers->changes = 0;
+    memset(tiers->tier_ms, 0, sizeof(tiers->tier_ms));
+    memset(tiers->tier_frames, 0, sizeof(tiers->tier_frames));
+  }
+  return changed;
+}
+
+/* --bench-tiers: the cube wall lit by one light close in front of it,
+   in every tier. Frames are finished, so the times are whole frames;
+   the last frame of each is read back and compared with phong's. */
+void benchmark_lighting_tiers(const Cube *cube, mat4 view, mat4 projection,
+			      float *view_position, int width, int height) {
+
+  const int num_frames = 60;
+  LightingTiers tiers;
+  lighting_tiers_init(&tiers, LIGHTING_TIER_PHONG, false, 0.0f);
+
+  mat4 view_projection;
+  glm_mat4_mul(projection, view, view_projection);
+  vec3 light_position = { 0.0f, 1.0f, 3.0f };
+  vec3 light_colour = GLM_VEC3_ONE_INIT;
+
+  size_t bytes = (size_t) width * height * 4;
+  unsigned char *reference = (unsigned char *) malloc(bytes);
+  unsigned char *pixels = (unsigned char *) malloc(bytes);
+
+  printf("Lighting tiers, %dx%d cube wall, %d frames each:\n",
+	 LIGHT_WALL_COLUMNS, LIGHT_WALL_ROWS, num_frames);
+  printf("\t%8s %10s %16s %12s %14s %10s\n", "tier", "frame ms", "mean difference",
+	 "max", "pixels > 8", "PSNR dB");
+  for (int t = LIGHTING_TIER_COUNT - 1; t >= 0; t--) {
+    GLuint program = tiers.programs[t];
+    const LightingShader *shader = &tiers.shaders[t];
+    CommandList list;
+    command_list_init(&list);
+    record_light_wall(&list, program, shader, cube, view_projection, view_position, 1);
+    glUseProgram(program);
+    glUniform3fv(shader->light_pos, 1, light_position);
+    glUniform3fv(shader->light_colour, 1, light_colour);
+    lighting_tiers_begin(&tiers);
+
+    /* One frame to warm up, then time the rest */
+    Uint64 start = 0;
+    for (int f = -1; f < num_frames; f++) {
+      if (f == 0) {
+	start = SDL_GetPerformanceCounter();
+      }
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+      command_list_replay(&list, 1, NULL);
+      glFinish();
+    }
+    double ms = (double) (SDL_GetPerformanceCounter() - start) * 1000.0
+      / (double) SDL_GetPerformanceFrequency() / num_frames;
+    command_list_destroy(&list);
+
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE,
+		 t == LIGHTING_TIER_PHONG ? reference : pixels);
+    if (t == LIGHTING_TIER_PHONG) {
+      printf("\t%8s %10.3f %16s %12s %14s %10s\n", lighting_tier_name((LightingTier) t),
+	     ms, "reference", "-", "-", "-");
+      continue;
+    }
+
+    /* Colour channels only */
+    double sum = 0.0;
+    double squares = 0.0;
+    int max = 0;
+    long different = 0;
+    for (size_t p = 0; p < bytes; p += 4) {
+      int worst = 0;
+      for (int c = 0; c < 3; c++) {
+	int d = abs((int) pixels[p + c] - (int) reference[p + c]);
+	sum += d;
+	squares += (double) d * d;
+	if (d > worst) {
+	  worst = d;
+	}
+      }
+      if (worst > max) {
+	max = worst;
+      }
+      if (worst > 8) {
+	different += 1;
+      }
+    }
+    double samples = 3.0 * width * height;
+    double mse = squares / samples;
+    double psnr = mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / mse) : INFINITY;
+    printf("\t%8s %10.3f %16.3f %12d %13.2f%% %10.1f\n",
+	   lighting_tier_name((LightingTier) t), ms, sum / samples, max,
+	   100.0 * different / ((double) width * height), psnr);
+  }
+
+  free(reference);
+  free(pixels);
+  lighting_tiers_destroy(&tiers);
+}
+
+#endif
@@ -9,6 +9,7 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include <GLES2/gl2.h>
 #include <SDL2/SDL.h>
@@ -17,12 +18,33 @@
 #include "cube.h"
 #include "object_loader.h"
 #include "shader_loader.h"
+#include "job_system.h"
+#include "transform_store.h"
+#include "animation.h"
+#include "command_list.h"
+#include "cube_draw.h"
+#include "frustum_cull.h"
+#include "occlusion_cull.h"
+#include "static_batch.h"
+#include "gl_caps.h"
+#include "debug_bounds.h"
+#include "particle_scene.h"
+#include "clustered_lighting.h"
+#include "deferred_shading.h"
+#include "lighting_tiers.h"
+#include "depth_prepass.h"
+#include "post_process.h"
+#include "shadow_map.h"
 
 /* Global parameters */
 const int sizeX = 1920;
 const int sizeY = 1080;
 const char* vertexShaderPath = "shaders/shader.vert";
 const char* lightingShaderPath = "shaders/lighting_shader.frag";
+const char* debugVertexShaderPath = "shaders/debug_line.vert";
+const char* debugFragmentShaderPath = "shaders/red_shader.frag";
+
+#define NUM_CUBES 3
 
 /* Set up global variables for the window and context. */
 SDL_Window *window;
@@ -78,49 +100,72 @@ void clean_up() {
   SDL_Quit();
 }
 
-Cube create_cube(char* cube_filename) {
+/* Meshes and shader programs are shared between the cubes */
+ResourceManager resources;
+
+bool load_mesh(const char *path, const char *options, void *user, ResourceData *out) {
+  /* Resource manager loader: parse the OBJ and upload it in the vertex
+     layout named by options */
+  Mesh *mesh = (Mesh *) malloc(sizeof(Mesh));
+  memset(mesh, 0, sizeof(*mesh));
+  if (!loadOBJ(path, mesh)) {
+    free(mesh);
+    return false;
+  }
+  printf("loaded mesh from file: %s\n", path);
+
+  /* Set up buffers for the vertices, normals and uvs */
+  VertexLayoutKind layout = strcmp(options, "split") == 0
+    ? VERTEX_LAYOUT_SPLIT : VERTEX_LAYOUT_INTERLEAVED;
+  vertex_layout_upload(&mesh->layout, layout, mesh->vertices,
+		       mesh->normals, mesh->uvs, 3 * mesh->num_triangles);
+
+  out->data = mesh;
+  out->cpu_bytes = sizeof(Mesh) + 3 * mesh->num_triangles * 8 * sizeof(GLfloat);
+  out->gpu_bytes = mesh->layout.bytes;
+  return true;
+}
+
+void free_mesh(ResourceData *resource) {
+  /* We need to free up the dynamically created arrays in the mesh */
+  Mesh *mesh = (Mesh *) resource->data;
+  vertex_layout_destroy(&mesh->layout);
+  free(mesh->vertices);
+  free(mesh->uvs);
+  free(mesh->normals);
+  free(mesh);
+}
+
+Cube create_cube(char* cube_filename, VertexLayoutKind layout) {
   /* This is a function that given a path to an OBJ object file will
-     create a Cube struct with the relevant information.
+     create a Cube struct with the relevant information, its vertex
+     data uploaded in the given layout. The mesh and shader program
+     are only loaded the first time they are asked for.
   */
 
   Cube thisCube;
-  if(loadOBJ(cube_filename, &thisCube)) {
-    printf("loaded cube from file: %s\n", cube_filename);
-  } else {
+  memset(&thisCube, 0, sizeof(thisCube));
+  thisCube.mesh_handle = resource_load_mesh(&resources, cube_filename,
+					    vertex_layout_name(layout),
+					    load_mesh, free_mesh, NULL);
+  if (thisCube.mesh_handle.id == 0) {
     printf("ERROR: file load %s failed\n", cube_filename);
   }
+  thisCube.mesh = (const Mesh *) resource_mesh(&resources, thisCube.mesh_handle);
 
-  /* Set the default model matrix as the identity matrix */
-  glm_mat4_identity(thisCube.model_matrix);
-  
-  /* Set up buffers for the vertices, normals and uvs */
-  size_t vertexDataSize = thisCube.num_triangles * 3 * 3* sizeof(GLfloat);
-  size_t uvDataSize = thisCube.num_triangles * 3 * 3* sizeof(GLfloat);
+  thisCube.program_handle = resource_load_program(&resources, vertexShaderPath,
+						  lightingShaderPath);
+  thisCube.shaderProgramAddress = resource_program(&resources, thisCube.program_handle);
 
-  glGenBuffers(1, &thisCube.vertexVBO);
-  glBindBuffer(GL_ARRAY_BUFFER, thisCube.vertexVBO);
-  glBufferData(GL_ARRAY_BUFFER, vertexDataSize,
-    	       thisCube.vertices, GL_STATIC_DRAW);
-  
-  glGenBuffers(1, &thisCube.normalVBO);
-  glBindBuffer(GL_ARRAY_BUFFER, thisCube.normalVBO);
-  glBufferData(GL_ARRAY_BUFFER, vertexDataSize,
-    	       thisCube.normals, GL_STATIC_DRAW);
-  
-  glGenBuffers(1, &thisCube.uvVBO);
-  glBindBuffer(GL_ARRAY_BUFFER, thisCube.uvVBO);
-  glBufferData(GL_ARRAY_BUFFER, uvDataSize,
-	       thisCube.uvs, GL_STATIC_DRAW);
-  
   return thisCube;
   
 }
 
 void destroy_cube(Cube * thisCube) {
-  /* We need to free up the dynamically created arrays in the cubes */
-  free(thisCube->vertices);
-  free(thisCube->uvs);
-  free(thisCube->normals);
+  /* The manager frees the mesh and program with their last cube */
+  resource_release_mesh(&resources, thisCube->mesh_handle);
+  resource_release_program(&resources, thisCube->program_handle);
+  thisCube->mesh = NULL;
 }
 
 void create_view_matrix(mat4* view_matrix_ptr, vec3* view_vector_ptr) {
@@ -142,14 +187,84 @@ void create_projection_matrix(mat4* projection_matrix_ptr) {
 
 int main(int argc, char* argv[]) {  
 
-  set_up();
+  /* ./lighting_test --bench-jobs 10000 times the cube updates over
+     1..N threads and exits, --bench-transforms compares the SoA matrix
+     kernels with plain cglm, --bench-cull 10000 times the frustum test.
+     --draws N records N cube draws a frame instead of 3,
+     --static-props N lays N small static cubes out on a floor,
+     --layout split|interleaved picks how the cube vertices are stored
+     and --bench-layout 10000 times both layouts and exits.
+     --debug-bounds draws the culling boxes, streamed each frame with
+     --stream subdata|orphan|map|auto. --particles N adds a fountain of
+     N particles (--particles-lit to light them like the cubes) and
+     --bench-particles times it from 10K to 500K particles and exits.
+     --lights N lights everything with N moving point lights, binned
+     into clusters (--lights-naive loops over all of them per fragment
+     instead) and --bench-lights times both from 16 to 256 lights and
+     exits. --deferred shades the lights deferred instead, on ES3 (64
+     lights unless --lights says otherwise), and --bench-deferred
+     times it against both forward ways and exits.
+     --lighting-tier phong|blinn|gouraud picks how the one light is
+     shaded, auto adapts it to --lighting-budget MS, and --bench-tiers
+     times and compares the tiers and exits.
+     --depth-prepass off|on|auto draws the opaque depth first so each
+     pixel is lit once, auto keeping it only while it is faster, and
+     --bench-prepass compares it with plain sorting and exits. Opaque
+     draws go front to back unless --no-front-to-back.
+     --post draws the frame through bloom, tone mapping and a vignette
+     (--post-exposure to expose it automatically), and --bench-post
+     times that with and without the frame graph's savings and exits.
+     --shadows casts the light's shadows from a mostly cached map, see
+     shadow_map.h for --shadow-size, --shadow-pcf, --shadow-threshold,
+     --shadow-refresh and --no-shadow-cache, and --bench-shadows times
+     the shadow pass for static and dynamic scenes and exits. */
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--bench-jobs") == 0 && i + 1 < argc) {
+      benchmark_animation(atoi(argv[i + 1]), 200);
+      return 0;
+    }
+    if (strcmp(argv[i], "--bench-transforms") == 0) {
+      benchmark_transforms();
+      return 0;
+    }
+    if (strcmp(argv[i], "--bench-cull") == 0 && i + 1 < argc) {
+      frustum_cull_benchmark(atoi(argv[i + 1]));
+      return 0;
+    }
+  }
 
-  Cube cube_1 = create_cube("../data/cube.obj");
-  Cube cube_2 = create_cube("../data/cube.obj");
-  Cube cube_3 = create_cube("../data/cube.obj");
+  set_up();
+  resource_manager_init(&resources);
+  load_gl_caps();
+
+  /* Per-frame updates run on all cores, the main thread only does GL */
+  JobSystem *jobs = (JobSystem *) malloc(sizeof(JobSystem));
+  job_system_init(jobs, 0);
+
+  Cube cubes[NUM_CUBES];
+  CubeAnimation animations[NUM_CUBES];
+  memset(animations, 0, sizeof(animations));
+
+  /* All the cube matrices live together in the transform store */
+  TransformStore transforms;
+  transform_store_init(&transforms, NUM_CUBES);
+
+  Cube *cube_1 = &cubes[0];
+  Cube *cube_2 = &cubes[1];
+  Cube *cube_3 = &cubes[2];
+  VertexLayoutKind layout = vertex_layout_parse_args(argc, argv);
+  printf("Using the %s vertex layout\n", vertex_layout_name(layout));
+  *cube_1 = create_cube("../data/cube.obj", layout);
+  *cube_2 = create_cube("../data/cube.obj", layout);
+  *cube_3 = create_cube("../data/cube.obj", layout);
+  for (int i = 0; i < NUM_CUBES; i++) {
+    cubes[i].transform = transform_store_add(&transforms);
+    animations[i].transform = cubes[i].transform;
+  }
 
   /* TODO: I want cube_2 to be small */
-  /* glm_scale_uni(cube_2.model_matrix, 0.2f); */
+  /* vec3 small = { 0.2f, 0.2f, 0.2f };
+     transform_store_set_scale(&transforms, cube_2->transform, small); */
 
   /* Next up: we need view and projection matrices
      these stay constant */
@@ -165,61 +280,146 @@ int main(int argc, char* argv[]) {
   mat4 projection_matrix = GLM_MAT4_IDENTITY_INIT;
   create_projection_matrix(&projection_matrix);
 
-  /* Set up the openGLES shader program
-     and assign it to the relevant cubes */
-  GLuint shader_1 = load_shaders(vertexShaderPath, lightingShaderPath);
-  GLuint shader_2 = load_shaders(vertexShaderPath, lightingShaderPath);
-  GLuint shader_3 = load_shaders(vertexShaderPath, lightingShaderPath);
-
-  cube_1.shaderProgramAddress = shader_1;
-  cube_2.shaderProgramAddress = shader_2;
-  cube_3.shaderProgramAddress = shader_3;
-
-  /* Get the location of the vPosition attribute in the shader program */
-  GLint position_attr_1 = glGetAttribLocation(shader_1, "vPosition");
-  GLint position_attr_2 = glGetAttribLocation(shader_2, "vPosition");
-  GLint position_attr_3 = glGetAttribLocation(shader_3, "vPosition");
-
-  GLint normal_attr_1 = glGetAttribLocation(shader_1, "vNormal");
-  GLint normal_attr_2 = glGetAttribLocation(shader_2, "vNormal");
-  GLint normal_attr_3 = glGetAttribLocation(shader_2, "vNormal");  
-
-  /* Get the location for the uniforms */
-  GLint model_ix_1 = glGetUniformLocation(shader_1, "model");
-  GLint view_ix_1 = glGetUniformLocation(shader_1, "view");
-  GLint perspective_ix_1 = glGetUniformLocation(shader_1, "perspective");
-  GLint mat_normal_ix_1 = glGetUniformLocation(shader_1, "mat_normal");
-  
-  GLint object_col_1 = glGetUniformLocation(shader_1, "objectColour");
-  GLint lighting_col_1 = glGetUniformLocation(shader_1, "lightColour");
-  GLint ambient_strength_1 = glGetUniformLocation(shader_1, "ambientStrength");
-  GLint specular_strength_1 = glGetUniformLocation(shader_1, "specularStrength");
-  GLint lighting_pos_1 = glGetUniformLocation(shader_1, "lightPos");
-  GLint view_pos_1 = glGetUniformLocation(shader_1, "viewPos");
-  
-  GLint model_ix_2 = glGetUniformLocation(shader_2, "model");
-  GLint view_ix_2 = glGetUniformLocation(shader_2, "view");
-  GLint perspective_ix_2 = glGetUniformLocation(shader_2, "perspective");
-  GLint mat_normal_ix_2 = glGetUniformLocation(shader_2, "mat_normal");
-  
-  GLint object_col_2 = glGetUniformLocation(shader_2, "objectColour");
-  GLint lighting_col_2 = glGetUniformLocation(shader_2, "lightColour");
-  GLint ambient_strength_2 = glGetUniformLocation(shader_2, "ambientStrength");
-  GLint specular_strength_2 = glGetUniformLocation(shader_2, "specularStrength");
-  GLint lighting_pos_2 = glGetUniformLocation(shader_2, "lightPos");
-  GLint view_pos_2 = glGetUniformLocation(shader_2, "viewPos");
-
-  GLint model_ix_3 = glGetUniformLocation(shader_3, "model");
-  GLint view_ix_3 = glGetUniformLocation(shader_3, "view");
-  GLint perspective_ix_3 = glGetUniformLocation(shader_3, "perspective");
-  GLint mat_normal_ix_3 = glGetUniformLocation(shader_3, "mat_normal");
-  
-  GLint object_col_3 = glGetUniformLocation(shader_3, "objectColour");
-  GLint lighting_col_3 = glGetUniformLocation(shader_3, "lightColour");
-  GLint ambient_strength_3 = glGetUniformLocation(shader_3, "ambientStrength");
-  GLint specular_strength_3 = glGetUniformLocation(shader_3, "specularStrength");
-  GLint lighting_pos_3 = glGetUniformLocation(shader_3, "lightPos");
-  GLint view_pos_3 = glGetUniformLocation(shader_3, "viewPos");
+  /* Combined once here, the transform store folds it into each cube's
+     mvp matrix */
+  mat4 view_projection;
+  glm_mat4_mul(projection_matrix, view_matrix, view_projection);
+
+  /* The cubes all share one lighting shader program, loaded by
+     create_cube */
+  resource_manager_report(&resources);
+
+  /* --lights N swaps it for the clustered lighting program, which
+     takes the same uniforms */
+  int num_lights = 0;
+  bool naive_lights = false;
+  bool deferred = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--lights") == 0 && i + 1 < argc) {
+      num_lights = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "--lights-naive") == 0) {
+      naive_lights = true;
+    } else if (strcmp(argv[i], "--deferred") == 0) {
+      deferred = true;
+    } else if (strcmp(argv[i], "--bench-lights") == 0) {
+      benchmark_clustered_lighting(jobs, cube_1, view_matrix, projection_matrix,
+				   view_position, sizeX, sizeY);
+      clean_up();
+      return 0;
+    } else if (strcmp(argv[i], "--bench-deferred") == 0) {
+      benchmark_deferred_shading(jobs, cube_1, view_matrix, projection_matrix,
+				 view_position, sizeX, sizeY);
+      clean_up();
+      return 0;
+    }
+  }
+
+  /* --deferred falls back to forward where there are no multiple
+     render targets */
+  DeferredShading deferred_shading;
+  if (deferred) {
+    if (num_lights == 0) {
+      num_lights = 64;
+    }
+    deferred = deferred_shading_init(&deferred_shading, num_lights, projection_matrix,
+				     sizeX, sizeY);
+    if (!deferred) {
+      printf("Deferred shading unavailable, lighting forward instead\n");
+    }
+  }
+  ClusteredLighting lighting;
+  if (deferred) {
+    for (int i = 0; i < NUM_CUBES; i++) {
+      cubes[i].shaderProgramAddress = deferred_shading.program;
+    }
+  } else if (num_lights > 0) {
+    clustered_lighting_init(&lighting, num_lights, naive_lights, projection_matrix,
+			    sizeX, sizeY);
+    for (int i = 0; i < NUM_CUBES; i++) {
+      cubes[i].shaderProgramAddress = lighting.program;
+    }
+  }
+
+  /* --shadows swaps in the lighting program with the shadow lookup,
+     for the one light only */
+  ShadowConfig shadow_config;
+  shadow_map_parse_args(&shadow_config, argc, argv);
+  ShadowMap shadows;
+  bool use_shadows = false;
+  if (shadow_config.enabled && (num_lights > 0 || deferred)) {
+    printf("Shadows are only cast by the one light, not with --lights or --deferred\n");
+  } else if (shadow_config.enabled) {
+    use_shadows = shadow_map_init(&shadows, &shadow_config);
+    if (use_shadows) {
+      for (int i = 0; i < NUM_CUBES; i++) {
+	cubes[i].shaderProgramAddress = shadows.lighting_program;
+      }
+    } else {
+      /* Whatever it made before failing */
+      shadow_map_destroy(&shadows);
+    }
+  }
+
+  /* Get the location of the attributes and uniforms */
+  LightingShader shader_locations[NUM_CUBES];
+  for (int i = 0; i < NUM_CUBES; i++) {
+    lighting_shader_locations(cubes[i].shaderProgramAddress, &shader_locations[i]);
+  }
+
+  /* Quality tiers for the one light, when the many lights are off */
+  bool use_tiers = false;
+  bool adapt_tier = false;
+  LightingTier tier = LIGHTING_TIER_PHONG;
+  float tier_budget_ms = 16.0f;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--lighting-tier") == 0 && i + 1 < argc) {
+      use_tiers = true;
+      if (strcmp(argv[i + 1], "auto") == 0) {
+	adapt_tier = true;
+      } else if (!lighting_tier_parse(argv[i + 1], &tier)) {
+	printf("ERROR: unknown lighting tier %s\n", argv[i + 1]);
+      }
+    } else if (strcmp(argv[i], "--lighting-budget") == 0 && i + 1 < argc) {
+      tier_budget_ms = atof(argv[i + 1]);
+    } else if (strcmp(argv[i], "--bench-tiers") == 0) {
+      benchmark_lighting_tiers(cube_1, view_matrix, projection_matrix, view_position,
+			       sizeX, sizeY);
+      clean_up();
+      return 0;
+    } else if (strcmp(argv[i], "--bench-prepass") == 0) {
+      benchmark_depth_prepass(cube_1, view_matrix, projection_matrix, view_position,
+			      sizeX, sizeY);
+      clean_up();
+      return 0;
+    } else if (strcmp(argv[i], "--bench-shadows") == 0) {
+      benchmark_shadow_maps(cube_1, &shadow_config);
+      clean_up();
+      return 0;
+    } else if (strcmp(argv[i], "--bench-post") == 0) {
+      benchmark_post_process(cube_1, view_matrix, projection_matrix, view_position,
+			     sizeX, sizeY);
+      clean_up();
+      return 0;
+    }
+  }
+  LightingTiers tiers;
+  if (use_tiers && use_shadows) {
+    printf("Shadows are lit per pixel, ignoring --lighting-tier\n");
+  }
+  use_tiers = use_tiers && num_lights == 0 && !deferred && !use_shadows;
+  if (use_tiers) {
+    lighting_tiers_init(&tiers, tier, adapt_tier, tier_budget_ms);
+    lighting_tiers_apply(&tiers, cubes, shader_locations, NUM_CUBES);
+  }
+
+  for (int i = 1; i < argc - 1; i++) {
+    if (strcmp(argv[i], "--bench-layout") == 0) {
+      benchmark_vertex_layouts(cube_1, &shader_locations[0], view_projection,
+			       atoi(argv[i + 1]));
+      clean_up();
+      return 0;
+    }
+  }
   
   /* Set the object and lighting colours for both cubes */
   vec3 white = GLM_VEC3_ONE_INIT;
@@ -230,27 +430,208 @@ int main(int argc, char* argv[]) {
   vec3 green = GLM_VEC3_ZERO_INIT;
   green[1] = 1.0f;
   green[2] = 0.1f;
-  
-  /* Now - a main animation loop! */
-  bool shouldExit = false;
-  SDL_Event event;
 
-  /* I want to move the second cube across and make it orbit
-     the centre */
-  vec3 cube_2_position_vector = GLM_VEC3_ZERO_INIT;
-  cube_2_position_vector[0] = 3.0f;
+  /* Cube 1 is lit coral, cube 2 is the light itself and cube 3 is
+     green */
+  CubeDraw scene[NUM_CUBES];
+  memset(scene, 0, sizeof(scene));
+  for (int i = 0; i < NUM_CUBES; i++) {
+    scene[i].cube = &cubes[i];
+    scene[i].shader = &shader_locations[i];
+    scene[i].ambient_strength = 0.1f;
+    scene[i].specular_strength = 0.5f;
+    glm_vec3_copy(white, scene[i].light_colour);
+  }
+  glm_vec3_copy(white, scene[0].object_colour);
+  glm_vec3_copy(coral, scene[0].light_colour);
+  glm_vec3_copy(white, scene[1].object_colour);
+  scene[1].ambient_strength = 1.0f;
+  scene[1].specular_strength = 0.0f;
+  glm_vec3_copy(green, scene[2].object_colour);
+
+  /* --draws N repeats the scene's draws up to N, to give the command
+     lists something to chew on */
+  int num_draws = NUM_CUBES;
+  for (int i = 1; i < argc - 1; i++) {
+    if (strcmp(argv[i], "--draws") == 0 && atoi(argv[i + 1]) > NUM_CUBES) {
+      num_draws = atoi(argv[i + 1]);
+    }
+  }
+  CubeDraw *draws = (CubeDraw *) malloc(num_draws * sizeof(CubeDraw));
+  for (int i = 0; i < num_draws; i++) {
+    draws[i] = scene[i % NUM_CUBES];
+  }
 
-  vec3 cube_3_position_vector = GLM_VEC3_ZERO_INIT;
-  cube_3_position_vector[0] = -5.5f;
+  /* Only the draws whose cube survives frustum culling get recorded.
+     The camera does not move, so neither does the frustum. */
+  CubeDraw *visible_draws = (CubeDraw *) malloc(num_draws * sizeof(CubeDraw));
+  Frustum frustum;
+  frustum_from_matrix(&frustum, view_projection[0]);
+  CullSet cull_set;
+  cull_set_init(&cull_set, NUM_CUBES);
+  CullStats cull_stats;
+  cull_stats_init(&cull_stats);
+
+  /* The big spinning cube in the middle hides whatever passes behind
+     it. --no-occlusion turns the software occlusion test off. */
+  OcclusionConfig occlusion_config;
+  occlusion_default_config(&occlusion_config);
+  occlusion_parse_args(&occlusion_config, argc, argv);
+  OcclusionBuffer occlusion;
+  occlusion_init(&occlusion, &occlusion_config);
+  cube_1->occluder = true;
+
+  /* --static-props N: a floor of small cubes that never move, merged
+     into one batch so they cost a draw per material, not per cube */
+  int num_props = 0;
+  for (int i = 1; i < argc - 1; i++) {
+    if (strcmp(argv[i], "--static-props") == 0) {
+      num_props = atoi(argv[i + 1]);
+    }
+  }
+  StaticBatch static_batch;
+  StaticMesh *props = (StaticMesh *) malloc((num_props + 1) * sizeof(StaticMesh));
+  int props_per_row = (int) ceilf(sqrtf((float) num_props));
+  for (int i = 0; i < num_props; i++) {
+    mat4 world = GLM_MAT4_IDENTITY_INIT;
+    vec3 position = { -12.0f + 24.0f * (i % props_per_row) / props_per_row, -4.0f,
+		      -12.0f + 24.0f * (i / props_per_row) / props_per_row };
+    vec3 up = { 0.0f, 1.0f, 0.0f };
+    vec3 scale = { 0.3f, 0.3f, 0.3f };
+    glm_translate(world, position);
+    glm_rotate(world, 0.3f * i, up);
+    glm_scale(world, scale);
+
+    props[i].vertices = cube_1->mesh->vertices;
+    props[i].normals = cube_1->mesh->normals;
+    props[i].num_triangles = cube_1->mesh->num_triangles;
+    memcpy(props[i].world_matrix, world[0], sizeof(props[i].world_matrix));
+    /* Lit like cube 1 or cube 3, never like the light */
+    props[i].material = (i % 2 == 0) ? 0 : 2;
+  }
+  static_batch_build(&static_batch, props, num_props);
+  free(props);
+  if (use_shadows) {
+    shadow_map_set_static(&shadows, &static_batch);
+  }
+  if (num_props > 0) {
+    static_batch_report(&static_batch);
+  }
 
-  vec3 z_axis = GLM_VEC3_ZERO_INIT;
-  z_axis[2] = 1.0f;
+  /* Opaque draws sorted front to back, optionally after a depth-only
+     pass. Adapting tiers already time the lit draws, and only one timer
+     query can run at a time. */
+  bool front_to_back;
+  DepthPrepassMode prepass_mode = depth_prepass_parse_args(argc, argv, &front_to_back);
+  DepthPrepass prepass;
+  depth_prepass_init(&prepass, prepass_mode, front_to_back, num_draws,
+		     !(use_tiers && adapt_tier),
+		     deferred || (num_lights > 0 && lighting.blocks));
+  for (int i = 0; i < NUM_CUBES; i++) {
+    depth_prepass_add_mesh(&prepass, cubes[i].mesh);
+  }
 
-  vec3 cube_2_translation_vector;
-  glm_translate(cube_2.model_matrix, cube_2_position_vector);
+  /* The frame drawn into the post-processing graph's scene pass */
+  bool post = false;
+  bool post_exposure = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--post") == 0) {
+      post = true;
+    } else if (strcmp(argv[i], "--post-exposure") == 0) {
+      post = true;
+      post_exposure = true;
+    }
+  }
+  PostProcess post_process;
+  if (post) {
+    post = post_process_init(&post_process, sizeX, sizeY, post_exposure, true, NULL, NULL);
+    if (!post) {
+      printf("Post-processing unavailable, drawing straight to the window\n");
+      post_process_destroy(&post_process);
+    }
+  }
 
-  vec3 cube_3_translation_vector;
-  glm_translate(cube_3.model_matrix, cube_3_position_vector);
+  /* One command list per thread, recorded in parallel and replayed on
+     this one, plus one for the static batch */
+  int num_lists = jobs->num_threads;
+  CommandList *command_lists = (CommandList *) malloc((num_lists + 1) * sizeof(CommandList));
+  for (int i = 0; i < num_lists + 1; i++) {
+    command_list_init(&command_lists[i]);
+  }
+  CommandList *static_list = &command_lists[num_lists];
+  bool particles_lit = false;
+  int num_particles = 0;
+  bool bench_particles = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--particles") == 0 && i + 1 < argc) {
+      num_particles = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "--particles-lit") == 0) {
+      particles_lit = true;
+    } else if (strcmp(argv[i], "--bench-particles") == 0) {
+      bench_particles = true;
+    }
+  }
+
+  /* Per-frame debug geometry goes through a streaming buffer */
+  bool debug_bounds_enabled = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--debug-bounds") == 0) {
+      debug_bounds_enabled = true;
+    }
+  }
+  DebugBounds debug_bounds;
+  if (debug_bounds_enabled) {
+    debug_bounds_init(&debug_bounds, debugVertexShaderPath, debugFragmentShaderPath,
+		      stream_parse_args(argc, argv));
+  }
+
+  CommandStats command_stats;
+  memset(&command_stats, 0, sizeof(command_stats));
+  double record_wait_ms = 0.0;
+  double record_work_ms = 0.0;
+  
+  /* Now - a main animation loop! */
+  bool shouldExit = false;
+  SDL_Event event;
+
+  /* Cube 1 spins in place, cube 2 orbits the centre and cube 3 does
+     both */
+  vec3 rotAxis = GLM_VEC3_ZERO_INIT;
+  rotAxis[1] = 1.0f;
+  rotAxis[0] = 0.2f;
+
+  animations[0].spin_speed = 0.025f;
+  glm_vec3_copy(rotAxis, animations[0].spin_axis);
+
+  animations[1].orbits = true;
+
+  animations[2].spin_speed = 0.05f;
+  glm_vec3_copy(rotAxis, animations[2].spin_axis);
+  animations[2].orbits = true;
+
+  /* I want to move the orbiting cubes across to their start positions */
+  vec3 start_position = GLM_VEC3_ZERO_INIT;
+  start_position[0] = 3.0f;
+  transform_store_set_position(&transforms, cube_2->transform, start_position);
+  start_position[0] = -5.5f;
+  transform_store_set_position(&transforms, cube_3->transform, start_position);
+
+  /* The orbiting second cube carries the light */
+  vec3 light_position;
+  DrawFrame draw_frame = { &transforms, light_position, view_position };
+  transform_store_get_position(&transforms, cube_2->transform, light_position);
+
+  if (bench_particles) {
+    benchmark_particles(jobs, view_projection, view_position, light_position,
+			particles_lit, stream_parse_args(argc, argv));
+    clean_up();
+    return 0;
+  }
+  ParticleScene particles;
+  if (num_particles > 0) {
+    particle_scene_init(&particles, num_particles, particles_lit,
+			stream_parse_args(argc, argv));
+  }
 
   unsigned long int time_now = SDL_GetTicks();
   unsigned long int num_frames = 0;
@@ -258,13 +639,13 @@ int main(int argc, char* argv[]) {
   unsigned int new_time;
   int frame_max = 5 * 60;
   
-  mat4 normal_matrix_1;
-  mat4 normal_matrix_2;
-  mat4 normal_matrix_3;
-  
   while(!shouldExit) {
 
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (post) {
+      post_process_begin(&post_process);
+    } else {
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
 
     while (SDL_PollEvent(&event) != 0) {
       if(event.type == SDL_KEYDOWN) {
@@ -273,162 +654,127 @@ int main(int argc, char* argv[]) {
       }
     }
 
-    /* Update any required positions */
-    /* Apply a rotation to the cube_1 model matrix */
-    vec3 rotAxis = GLM_VEC3_ZERO_INIT;
-    rotAxis[1] = 1.0f;
-    rotAxis[0] = 0.2f;
-    glm_rotate(cube_1.model_matrix,
-	       0.025f,
-	       rotAxis);
-
-    /* Rotate cube 3 */
-    glm_rotate(cube_3.model_matrix,
-	       0.05f,
-	       rotAxis);
-    
-    /* I want the blue cube to orbit the red cube */
-    glm_vec3_cross(cube_2_position_vector, z_axis, 
-		   cube_2_translation_vector);
-
-    glm_vec3_scale(cube_2_translation_vector, 0.01, cube_2_translation_vector);
-
-    glm_vec3_add(cube_2_position_vector,
-		 cube_2_translation_vector,
-		 cube_2_position_vector);
-    
-    glm_translate(cube_2.model_matrix, cube_2_translation_vector);
-
-    /* And the third cube */
-    glm_vec3_cross(cube_3_position_vector, z_axis, 
-		   cube_3_translation_vector);
-
-    glm_vec3_scale(cube_3_translation_vector, 0.01, cube_3_translation_vector);
-
-    glm_vec3_add(cube_3_position_vector,
-		 cube_3_translation_vector,
-		 cube_3_position_vector);
-    
-    glm_translate(cube_3.model_matrix, cube_3_translation_vector);
-    
-    /* Calculate the normal matrices */
-    glm_mat4_inv(cube_1.model_matrix, normal_matrix_1);
-    glm_mat4_transpose(normal_matrix_1);
-
-    glm_mat4_inv(cube_2.model_matrix, normal_matrix_2);
-    glm_mat4_transpose(normal_matrix_2);
-    
-    glm_mat4_inv(cube_3.model_matrix, normal_matrix_3);
-    glm_mat4_transpose(normal_matrix_3);
-    
-    /* Render cube 1 */     
-    glUseProgram(cube_1.shaderProgramAddress);
-
-    /* Apply the model, view and projection matrices */
-    glUniformMatrix4fv(model_ix_1, 1, GL_FALSE, cube_1.model_matrix[0]);
-    glUniformMatrix4fv(view_ix_1, 1, GL_FALSE, view_matrix[0]);
-    glUniformMatrix4fv(perspective_ix_1, 1, GL_FALSE, projection_matrix[0]);
-    glUniformMatrix4fv(mat_normal_ix_1, 1, GL_FALSE, normal_matrix_1[0]);
-    
-    glUniform3fv(object_col_1, 1, white);
-    glUniform3fv(lighting_col_1, 1, coral);
-    glUniform3fv(lighting_pos_1, 1, cube_2_position_vector);
-    glUniform3fv(view_pos_1, 1, view_position);
-    glUniform1f(ambient_strength_1, 0.1f);
-    glUniform1f(specular_strength_1, 0.5f);
-
-    glEnableVertexAttribArray(normal_attr_1);
-    glEnableVertexAttribArray(position_attr_1);
-    
-    /* Vertices */
-    glBindBuffer(GL_ARRAY_BUFFER, cube_1.vertexVBO);
-    glVertexAttribPointer(position_attr_1, 3,
-			  GL_FLOAT, GL_FALSE,
-			  3*sizeof(GLfloat),
-			  (void*)(0*sizeof(GLfloat)));
-
-    glBindBuffer(GL_ARRAY_BUFFER, cube_1.normalVBO);
-    glVertexAttribPointer(normal_attr_1, 3,
-			  GL_FLOAT, GL_FALSE,
-			  3*sizeof(GLfloat),
-			  (void*)(0*sizeof(GLfloat)));
-    
-    glDrawArrays(GL_TRIANGLES, 0, 3 * cube_1.num_triangles);
-
-    glDisableVertexAttribArray(position_attr_1);
-    glDisableVertexAttribArray(normal_attr_1);
-    
-    /* Render cube 2  */
-    glUseProgram(cube_2.shaderProgramAddress);
+    /* Move the cubes, then rebuild every world, mvp and normal matrix */
+    animate_cubes(jobs, &transforms, animations, NUM_CUBES);
+    transform_store_update(&transforms, jobs, view_projection);
+    transform_store_get_position(&transforms, cube_2->transform, light_position);
+    if (num_particles > 0) {
+      particle_scene_update(&particles, jobs, 1.0f / 60.0f);
+    }
 
-    glUniformMatrix4fv(model_ix_2, 1, GL_FALSE, cube_2.model_matrix[0]);
-    glUniformMatrix4fv(view_ix_2, 1, GL_FALSE, view_matrix[0]);
-    glUniformMatrix4fv(perspective_ix_2, 1, GL_FALSE, projection_matrix[0]);  
-    glUniformMatrix4fv(mat_normal_ix_2, 1, GL_FALSE, normal_matrix_2[0]);
-    
-    glUniform3fv(object_col_2, 1, white);
-    glUniform3fv(lighting_col_2, 1, white);
-    glUniform3fv(lighting_pos_2, 1, cube_2_position_vector);
-    glUniform3fv(view_pos_2, 1, view_position);
-    glUniform1f(ambient_strength_2, 1.0f);
-    glUniform1f(specular_strength_2, 0.0f);
-
-    glEnableVertexAttribArray(position_attr_2);
-    glEnableVertexAttribArray(normal_attr_2);
-
-    glBindBuffer(GL_ARRAY_BUFFER, cube_2.vertexVBO);
-    glVertexAttribPointer(position_attr_2, 3,
-			  GL_FLOAT, GL_FALSE,
-			  3*sizeof(GLfloat),
-			  (void*)(0*sizeof(GLfloat)));
-
-    glBindBuffer(GL_ARRAY_BUFFER, cube_2.normalVBO);
-    glVertexAttribPointer(normal_attr_2, 3,
-			  GL_FLOAT, GL_FALSE,
-			  3*sizeof(GLfloat),
-			  (void*)(0*sizeof(GLfloat)));
-    
-    glDrawArrays(GL_TRIANGLES, 0, 3 * cube_2.num_triangles);
+    /* Cull against the world-space bounds before queueing anything */
+    for (int i = 0; i < NUM_CUBES; i++) {
+      cull_set_update(&cull_set, cubes[i].transform, &cubes[i].mesh->bounds,
+		      transforms.world[cubes[i].transform][0]);
+    }
+    frustum_cull(&frustum, &cull_set, &cull_stats);
+
+    /* Then against the occluders, drawn on the CPU */
+    if (occlusion_config.enabled) {
+      occlusion_begin_frame(&occlusion);
+      for (int i = 0; i < NUM_CUBES; i++) {
+	if (cubes[i].occluder && cull_set.visible[cubes[i].transform]) {
+	  occlusion_add_occluder(&occlusion, transforms.mvp[cubes[i].transform][0],
+				 cubes[i].mesh->vertices, cubes[i].mesh->num_triangles);
+	}
+      }
+      occlusion_rasterize(&occlusion, jobs);
+      occlusion_cull(&occlusion, view_projection[0], &cull_set);
+    }
 
-    glDisableVertexAttribArray(position_attr_2);
-    glDisableVertexAttribArray(normal_attr_2);
+    int num_visible = 0;
+    for (int i = 0; i < num_draws; i++) {
+      if (cull_set.visible[draws[i].cube->transform]) {
+	visible_draws[num_visible] = draws[i];
+	num_visible += 1;
+      }
+    }
+    depth_prepass_sort(&prepass, visible_draws, num_visible, &transforms, view_matrix);
+
+    /* Record the draws on every thread, then send them to GL from here */
+    Uint64 record_start = SDL_GetPerformanceCounter();
+    record_cube_draws(jobs, command_lists, num_lists, visible_draws, num_visible,
+		      &draw_frame);
+    Uint64 record_end = SDL_GetPerformanceCounter();
+
+    /* The light moves, so the batch's uniforms are recorded every frame */
+    command_list_reset(static_list);
+    if (num_props > 0) {
+      record_static_batch(static_list, &static_batch, scene, view_projection,
+			  &draw_frame);
+    }
 
-    /* Render cube 3  */
-    glUseProgram(cube_3.shaderProgramAddress);
+    record_wait_ms += (double) (record_end - record_start) * 1000.0
+      / (double) SDL_GetPerformanceFrequency();
+    for (int i = 0; i < num_lists; i++) {
+      record_work_ms += (double) command_lists[i].record_ticks * 1000.0
+	/ (double) SDL_GetPerformanceFrequency();
+    }
 
-    glUniformMatrix4fv(model_ix_3, 1, GL_FALSE, cube_3.model_matrix[0]);
-    glUniformMatrix4fv(view_ix_3, 1, GL_FALSE, view_matrix[0]);
-    glUniformMatrix4fv(perspective_ix_3, 1, GL_FALSE, projection_matrix[0]);  
-    glUniformMatrix4fv(mat_normal_ix_3, 1, GL_FALSE, normal_matrix_3[0]);
-    
-    glUniform3fv(object_col_3, 1, green);
-    glUniform3fv(lighting_col_3, 1, white);
-    glUniform3fv(lighting_pos_3, 1, cube_2_position_vector);
-    glUniform3fv(view_pos_3, 1, view_position);
-    glUniform1f(ambient_strength_3, 0.1f);
-    glUniform1f(specular_strength_3, 0.5f);
-
-    glEnableVertexAttribArray(position_attr_3);
-    glEnableVertexAttribArray(normal_attr_3);
-
-    glBindBuffer(GL_ARRAY_BUFFER, cube_3.vertexVBO);
-    glVertexAttribPointer(position_attr_3, 3,
-			  GL_FLOAT, GL_FALSE,
-			  3*sizeof(GLfloat),
-			  (void*)(0*sizeof(GLfloat)));
-
-    glBindBuffer(GL_ARRAY_BUFFER, cube_3.normalVBO);
-    glVertexAttribPointer(normal_attr_3, 3,
-			  GL_FLOAT, GL_FALSE,
-			  3*sizeof(GLfloat),
-			  (void*)(0*sizeof(GLfloat)));
-    
-    glDrawArrays(GL_TRIANGLES, 0, 3 * cube_3.num_triangles);
+    /* Everything but the light casts a shadow; only the props stay put */
+    if (use_shadows) {
+      ShadowCaster casters[NUM_CUBES];
+      int num_casters = 0;
+      for (int i = 0; i < NUM_CUBES; i++) {
+	if (&cubes[i] != cube_2) {
+	  casters[num_casters].mesh = cubes[i].mesh;
+	  casters[num_casters].world = transforms.world[cubes[i].transform][0];
+	  num_casters += 1;
+	}
+      }
+      shadow_map_update(&shadows, light_position, casters, num_casters);
+    }
 
-    glDisableVertexAttribArray(position_attr_3);
-    glDisableVertexAttribArray(normal_attr_3);
+    if (deferred) {
+      deferred_shading_update(&deferred_shading, view_matrix, SDL_GetTicks() / 1000.0f);
+      deferred_shading_begin(&deferred_shading);
+    } else if (num_lights > 0) {
+      clustered_lighting_update(&lighting, jobs, view_matrix, SDL_GetTicks() / 1000.0f);
+    }
+    depth_prepass_begin(&prepass, visible_draws, num_visible, &draw_frame,
+			&static_batch, view_projection);
+    if (use_tiers) {
+      lighting_tiers_begin(&tiers);
+    }
+    command_list_replay(command_lists, num_lists + 1, &command_stats);
+    if (use_tiers) {
+      lighting_tiers_end(&tiers);
+    }
+    depth_prepass_end(&prepass);
+    if (deferred) {
+      deferred_shading_light(&deferred_shading, view_matrix, projection_matrix,
+			     view_position);
+    }
+    if (debug_bounds_enabled) {
+      debug_bounds_draw(&debug_bounds, &cull_set, view_projection);
+    }
+    if (num_particles > 0) {
+      particle_scene_draw(&particles, view_projection, view_position, light_position,
+			  false);
+      particle_scene_report(&particles);
+    }
+    if (deferred) {
+      deferred_shading_end(&deferred_shading);
+    }
+    if (post) {
+      post_process_end(&post_process);
+    }
     
     SDL_GL_SwapWindow(window);
+    cull_stats_report(&cull_stats, "cube");
+    occlusion_report(&occlusion);
+    if (deferred) {
+      deferred_shading_report(&deferred_shading);
+    } else if (num_lights > 0) {
+      clustered_lighting_report(&lighting);
+    }
+    if (use_tiers && lighting_tiers_update(&tiers)) {
+      lighting_tiers_apply(&tiers, cubes, shader_locations, NUM_CUBES);
+    }
+    depth_prepass_update(&prepass);
+    if (use_shadows) {
+      shadow_map_report(&shadows);
+    }
 
     /* Frame counter */
     num_frames += 1;
@@ -438,13 +784,64 @@ int main(int argc, char* argv[]) {
       printf("current FPS: %.2f\n", (float) frame_max / (float) time_gap);
       time_now = new_time;
       num_frames = 0;
+
+      /* Recording on one thread would have cost the main thread all of
+	 record_work_ms; it only waited record_wait_ms */
+      int frames = command_stats.frames;
+      printf("command lists: %d draws in %d lists, %ld commands/frame, "
+	     "record %.3f ms/frame (main thread waited %.3f ms, %.3f ms freed), "
+	     "replay %.3f ms/frame at %.2f M commands/s, %ld binds skipped\n",
+	     num_draws, num_lists, command_stats.commands / frames,
+	     record_work_ms / frames, record_wait_ms / frames,
+	     (record_work_ms - record_wait_ms) / frames,
+	     command_stats.replay_ms / frames,
+	     command_stats.replay_ms > 0.0
+	     ? command_stats.commands / command_stats.replay_ms / 1000.0 : 0.0,
+	     command_stats.skipped / frames);
+      memset(&command_stats, 0, sizeof(command_stats));
+      record_wait_ms = 0.0;
+      record_work_ms = 0.0;
     };   
   }
  
   /* Clean up functions */
-  destroy_cube(&cube_1);
-  destroy_cube(&cube_2);
-  destroy_cube(&cube_3);
+  destroy_cube(cube_1);
+  destroy_cube(cube_2);
+  destroy_cube(cube_3);
+  resource_manager_destroy(&resources);
+  for (int i = 0; i < num_lists + 1; i++) {
+    command_list_destroy(&command_lists[i]);
+  }
+  static_batch_destroy(&static_batch);
+  if (debug_bounds_enabled) {
+    debug_bounds_destroy(&debug_bounds);
+  }
+  if (num_particles > 0) {
+    particle_scene_destroy(&particles);
+  }
+  if (deferred) {
+    deferred_shading_destroy(&deferred_shading);
+  } else if (num_lights > 0) {
+    clustered_lighting_destroy(&lighting);
+  }
+  if (use_tiers) {
+    lighting_tiers_destroy(&tiers);
+  }
+  depth_prepass_destroy(&prepass);
+  if (use_shadows) {
+    shadow_map_destroy(&shadows);
+  }
+  if (post) {
+    post_process_destroy(&post_process);
+  }
+  free(command_lists);
+  free(draws);
+  free(visible_draws);
+  cull_set_destroy(&cull_set);
+  occlusion_destroy(&occlusion);
+  transform_store_destroy(&transforms);
+  job_system_destroy(jobs);
+  free(jobs);
   clean_up();
 
   return 0;
@@ -2,7 +2,7 @@
 #include "cube.h"
 
 // C header-only library containing functions to load up TRIANGLE based OBJ files.
-bool loadOBJ(const char* path, Cube* cubePtr) {
+bool loadOBJ(const char* path, Mesh* meshPtr) {
 
   /* I need to assign some memory for the arrays.
      However I don't know how much I will need!
@@ -135,12 +135,12 @@ bool loadOBJ(const char* path, Cube* cubePtr) {
     out_vertices[(9*i)+7] = temp_vertices[vertex_ix_3][1];
     out_vertices[(9*i)+8] = temp_vertices[vertex_ix_3][2];
     
-    out_uvs[(6*i)] = temp_vertices[uv_ix_1][0];
-    out_uvs[(6*i)+1] = temp_vertices[uv_ix_1][0];
-    out_uvs[(6*i)+2] = temp_vertices[uv_ix_2][1];
-    out_uvs[(6*i)+3] = temp_vertices[uv_ix_2][1];
-    out_uvs[(6*i)+4] = temp_vertices[uv_ix_3][2];
-    out_uvs[(6*i)+5] = temp_vertices[uv_ix_3][2];
+    out_uvs[(6*i)] = temp_uvs[uv_ix_1][0];
+    out_uvs[(6*i)+1] = temp_uvs[uv_ix_1][1];
+    out_uvs[(6*i)+2] = temp_uvs[uv_ix_2][0];
+    out_uvs[(6*i)+3] = temp_uvs[uv_ix_2][1];
+    out_uvs[(6*i)+4] = temp_uvs[uv_ix_3][0];
+    out_uvs[(6*i)+5] = temp_uvs[uv_ix_3][1];
 
     out_normals[(9*i)] = temp_normals[normal_ix_1][0];
     out_normals[(9*i)+1] = temp_normals[normal_ix_1][1];
@@ -163,11 +163,14 @@ bool loadOBJ(const char* path, Cube* cubePtr) {
   fclose(fp);
 
   /* Update the output pointers. */
-  cubePtr->num_triangles = output_length;
+  meshPtr->num_triangles = output_length;
 
-  cubePtr->vertices = out_vertices;
-  cubePtr->uvs = out_uvs;
-  cubePtr->normals = out_normals;
+  meshPtr->vertices = out_vertices;
+  meshPtr->uvs = out_uvs;
+  meshPtr->normals = out_normals;
+
+  /* Bounding volumes for culling */
+  bounds_from_vertices(&meshPtr->bounds, out_vertices, 3 * output_length);
 
   return true;
 }
@@ -0,0 +1,197 @@
+#ifndef PARTICLE_SCENE_HEADER
+#define PARTICLE_SCENE_HEADER
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <cglm/cglm.h>
+#include <GLES2/gl2.h>
+#include <SDL2/SDL.h>
+
+#include "job_system.h"
+#include "particles.h"
+#include "shader_loader.h"
+#include "stream_buffer.h"
+
+// C header-only library that draws a ParticleSystem as GL_POINTS. The
+// packed particles are streamed to the GPU every frame; lit particles
+// reuse lighting_shader.frag, unlit ones fade with their life.
+//
+// Simulation, upload and draw are timed separately. The draw time is
+// only the GPU's if finish is set, which the benchmark does; in the
+// animation loop it is just the time to issue the draw.
+
+#define PARTICLE_POINT_SCALE 40.0f
+
+typedef struct {
+  ParticleSystem system;
+  StreamBuffer stream;
+  bool lit;
+
+  GLuint program;
+  GLint particle_attr;
+  GLint mvp;
+  GLint point_scale;
+  GLint eye_pos;
+  GLint object_colour;
+  GLint light_colour;
+  GLint light_pos;
+  GLint view_pos;
+  GLint ambient_strength;
+  GLint specular_strength;
+
+  /* Accumulated until the next report */
+  int frames;
+  double simulate_ms;
+  double draw_ms;
+  int report_frames;
+} ParticleScene;
+
+void particle_scene_init(ParticleScene *scene, int count, bool lit,
+			 StreamStrategy strategy) {
+
+  memset(scene, 0, sizeof(*scene));
+  vec3 emitter = { 0.0f, -2.0f, 0.0f };
+  particles_init(&scene->system, count, emitter);
+  stream_buffer_init(&scene->stream, GL_ARRAY_BUFFER,
+		     4 * scene->system.count * sizeof(GLfloat), strategy);
+  scene->lit = lit;
+  scene->report_frames = 5 * 60;
+
+  if (lit) {
+    scene->program = load_shaders("shaders/particle_lit.vert",
+				  "shaders/lighting_shader.frag");
+  } else {
+    scene->program = load_shaders("shaders/particle.vert", "shaders/particle.frag");
+  }
+  GLuint program = scene->program;
+  scene->particle_attr = glGetAttribLocation(program, "vParticle");
+  scene->mvp = glGetUniformLocation(program, "mvp");
+  scene->point_scale = glGetUniformLocation(program, "pointScale");
+  scene->eye_pos = glGetUniformLocation(program, "eyePos");
+  scene->object_colour = glGetUniformLocation(program, "objectColour");
+  scene->light_colour = glGetUniformLocation(program, "lightColour");
+  scene->light_pos = glGetUniformLocation(program, "lightPos");
+  scene->view_pos = glGetUniformLocation(program, "viewPos");
+  scene->ambient_strength = glGetUniformLocation(program, "ambientStrength");
+  scene->specular_strength = glGetUniformLocation(program, "specularStrength");
+}
+
+void particle_scene_destroy(ParticleScene *scene) {
+  stream_buffer_destroy(&scene->stream);
+  particles_destroy(&scene->system);
+  glDeleteProgram(scene->program);
+}
+
+void particle_scene_update(ParticleScene *scene, JobSystem *jobs, float dt) {
+  Uint64 start = SDL_GetPerformanceCounter();
+  particles_simulate(&scene->system, jobs, dt);
+  scene->simulate_ms += (double) (SDL_GetPerformanceCounter() - start) * 1000.0
+    / (double) SDL_GetPerformanceFrequency();
+}
+
+void particle_scene_draw(ParticleScene *scene, mat4 view_projection,
+			 float *view_position, float *light_position, bool finish) {
+
+  GLuint buffer;
+  size_t offset;
+  if (!stream_buffer_write(&scene->stream, scene->system.packed,
+			   4 * scene->system.count * sizeof(GLfloat),
+			   &buffer, &offset)) {
+    stream_buffer_end_frame(&scene->stream);
+    return;
+  }
+
+  Uint64 start = SDL_GetPerformanceCounter();
+  glUseProgram(scene->program);
+  glUniformMatrix4fv(scene->mvp, 1, GL_FALSE, view_projection[0]);
+  glUniform1f(scene->point_scale, PARTICLE_POINT_SCALE);
+  if (scene->lit) {
+    vec3 colour = { 1.0f, 0.6f, 0.2f };
+    vec3 white = GLM_VEC3_ONE_INIT;
+    glUniform3fv(scene->eye_pos, 1, view_position);
+    glUniform3fv(scene->object_colour, 1, colour);
+    glUniform3fv(scene->light_colour, 1, white);
+    glUniform3fv(scene->light_pos, 1, light_position);
+    glUniform3fv(scene->view_pos, 1, view_position);
+    glUniform1f(scene->ambient_strength, 0.2f);
+    glUniform1f(scene->specular_strength, 0.5f);
+  }
+
+  glEnableVertexAttribArray(scene->particle_attr);
+  glVertexAttribPointer(scene->particle_attr, 4, GL_FLOAT, GL_FALSE,
+			4 * sizeof(GLfloat), (void *) offset);
+  glDrawArrays(GL_POINTS, 0, scene->system.count);
+  glDisableVertexAttribArray(scene->particle_attr);
+  stream_buffer_end_frame(&scene->stream);
+
+  if (finish) {
+    glFinish();
+  }
+  scene->draw_ms += (double) (SDL_GetPerformanceCounter() - start) * 1000.0
+    / (double) SDL_GetPerformanceFrequency();
+  scene->frames += 1;
+}
+
+/* Prints every scene->report_frames frames and resets. */
+void particle_scene_report(ParticleScene *scene) {
+
+  if (scene->frames < scene->report_frames) {
+    return;
+  }
+  int frames = scene->frames;
+  StreamBuffer *stream = &scene->stream;
+  printf("particles: %d, simulate %.3f ms/frame, upload %.3f ms/frame at %.1f MB/s "
+	 "(%s, %d stalls), draw %.3f ms/frame\n",
+	 scene->system.count, scene->simulate_ms / frames,
+	 stream->upload_ms / frames,
+	 stream->upload_ms > 0.0 ? stream->bytes / stream->upload_ms / 1000.0 : 0.0,
+	 stream_strategy_name(stream->strategy), stream->stalls,
+	 scene->draw_ms / frames);
+
+  scene->frames = 0;
+  scene->simulate_ms = 0.0;
+  scene->draw_ms = 0.0;
+  stream->frames = 0;
+  stream->bytes = 0;
+  stream->upload_ms = 0.0;
+  stream->stalls = 0;
+  stream->overflows = 0;
+}
+
+/* --bench-particles: simulate, upload and draw a growing number of
+   particles, finishing the GPU each frame so the draw time is real. */
+void benchmark_particles(JobSystem *jobs, mat4 view_projection, float *view_position,
+			 float *light_position, bool lit, StreamStrategy strategy) {
+
+  const int counts[] = { 10000, 50000, 100000, 250000, 500000 };
+  const int num_frames = 120;
+
+  /* Pick the streaming strategy once, not per count */
+  if (strategy == STREAM_AUTO) {
+    strategy = stream_buffer_pick_strategy(GL_ARRAY_BUFFER, 4 * 100000 * sizeof(GLfloat));
+  }
+
+  printf("Particles (%s), %d frames each:\n", lit ? "lit" : "unlit", num_frames);
+  printf("\t%8s %12s %12s %12s %12s\n",
+	 "count", "simulate ms", "upload ms", "upload MB/s", "draw ms");
+  for (int c = 0; c < (int) (sizeof(counts) / sizeof(counts[0])); c++) {
+    ParticleScene scene;
+    particle_scene_init(&scene, counts[c], lit, strategy);
+
+    for (int f = 0; f < num_frames; f++) {
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+      particle_scene_update(&scene, jobs, 1.0f / 60.0f);
+      particle_scene_draw(&scene, view_projection, view_position, light_position, true);
+    }
+
+    StreamBuffer *stream = &scene.stream;
+    printf("\t%8d %12.3f %12.3f %12.1f %12.3f\n", scene.system.count,
+	   scene.simulate_ms / num_frames, stream->upload_ms / num_frames,
+	   stream->upload_ms > 0.0 ? stream->bytes / stream->upload_ms / 1000.0 : 0.0,
+	   scene.draw_ms / num_frames);
+    particle_scene_destroy(&scene);
+  }
+}
+
+#endif
@@ -0,0 +1,262 @@
+#ifndef POST_PROCESS_HEADER
+#define POST_PROCESS_HEADER
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cglm/cglm.h>
+#include <GLES2/gl2.h>
+#include <SDL2/SDL.h>
+
+#include "clustered_lighting.h"
+#include "command_list.h"
+#include "cube.h"
+#include "cube_draw.h"
+#include "frame_graph.h"
+#include "shader_loader.h"
+
+// C header-only library for the post-processing after the scene, as a
+// frame graph:
+//
+//   scene      the frame as before, into a transient colour and depth
+//   luminance  the scene's brightness in 64x36 blocks, for auto exposure
+//   bright     the parts bright enough to bloom, at half size
+//   blur_h     bloom blurred across
+//   blur_v     and down
+//   composite  the scene plus its bloom
+//   tonemap    brought back into range, auto exposed from luminance
+//   vignette   darker corners, into the window
+//
+// Nothing reads luminance without --post-exposure, so that pass gets
+// culled. composite, tonemap and vignette only look at their own pixel
+// and merge into one shader, bloom shares a texture with bright, and
+// the scene's depth is dropped rather than stored once the scene is
+// drawn.
+
+#define POST_LUMINANCE_WIDTH 64
+#define POST_LUMINANCE_HEIGHT 36
+
+typedef struct {
+  float direction[2];
+  GLuint program;
+  GLint location;
+} PostBlur;
+
+typedef struct {
+  FrameGraph graph;
+  bool exposure;
+  int scene_pass;
+  PostBlur blur[2];
+} PostProcess;
+
+static void post_blur_setup(void *user, GLuint program) {
+  PostBlur *blur = (PostBlur *) user;
+  if (blur->program != program) {
+    blur->program = program;
+    blur->location = glGetUniformLocation(program, "blurDirection");
+  }
+  glUniform2fv(blur->location, 1, blur->direction);
+}
+
+/* A snippet from shaders/, with defines in front of it */
+static int post_add_pass(FrameGraph *graph, const char *name, FrameGraphPassKind kind,
+			 const char *path, const char *defines, int input,
+			 FrameGraphSetup setup, void *user) {
+  char *snippet = read_shader_source(path);
+  if (snippet == NULL) {
+    printf("ERROR: could not read %s\n", path);
+    return -1;
+  }
+  char *source = (char *) malloc(strlen(defines) + strlen(snippet) + 1);
+  strcpy(source, defines);
+  strcat(source, snippet);
+  int pass = frame_graph_add_fullscreen(graph, name, kind, source, input, setup, user);
+  free(source);
+  free(snippet);
+  return pass;
+}
+
+/* Declares and compiles the graph. scene is drawn by the caller, or by
+   scene_execute when that is not NULL. optimise false compiles it
+   without culling, merging, aliasing or invalidation, to compare.
+   False when a snippet is missing or the graph does not compile; the
+   graph still has to be destroyed. */
+bool post_process_init(PostProcess *post, int width, int height, bool exposure,
+		       bool optimise, FrameGraphExecute scene_execute, void *scene_user) {
+
+  memset(post, 0, sizeof(*post));
+  post->exposure = exposure;
+  post->blur[0].direction[0] = 1.0f;
+  post->blur[1].direction[1] = 1.0f;
+
+  FrameGraph *graph = &post->graph;
+  frame_graph_init(graph);
+  graph->cull = optimise;
+  graph->merge = optimise;
+  graph->alias = optimise;
+  graph->invalidate = optimise;
+
+  int half_width = width / 2;
+  int half_height = height / 2;
+  int window = frame_graph_import(graph, "window", 0, width, height);
+  int scene = frame_graph_create(graph, "scene", FRAME_GRAPH_RGBA8, width, height);
+  int scene_depth = frame_graph_create(graph, "scene depth", FRAME_GRAPH_DEPTH, width, height);
+  int luminance = frame_graph_create(graph, "luminance", FRAME_GRAPH_RGBA8,
+				     POST_LUMINANCE_WIDTH, POST_LUMINANCE_HEIGHT);
+  int bright = frame_graph_create(graph, "bright", FRAME_GRAPH_RGBA8, half_width, half_height);
+  int bloom_h = frame_graph_create(graph, "bloom across", FRAME_GRAPH_RGBA8,
+				   half_width, half_height);
+  int bloom = frame_graph_create(graph, "bloom", FRAME_GRAPH_RGBA8, half_width, half_height);
+  int lit = frame_graph_create(graph, "lit", FRAME_GRAPH_RGBA8, width, height);
+  int mapped = frame_graph_create(graph, "mapped", FRAME_GRAPH_RGBA8, width, height);
+
+  post->scene_pass = frame_graph_add_pass(graph, "scene", scene_execute, scene_user);
+  if (post->scene_pass < 0) {
+    return false;
+  }
+  frame_graph_write(graph, post->scene_pass, scene, FRAME_GRAPH_CLEAR);
+  frame_graph_write(graph, post->scene_pass, scene_depth, FRAME_GRAPH_CLEAR);
+
+  char defines[128];
+  snprintf(defines, sizeof(defines),
+	   "#define LUMINANCE_BLOCK_X %.1f\n#define LUMINANCE_BLOCK_Y %.1f\n",
+	   (float) width / POST_LUMINANCE_WIDTH, (float) height / POST_LUMINANCE_HEIGHT);
+  int pass = post_add_pass(graph, "luminance", FRAME_GRAPH_SAMPLE,
+			   "shaders/post_luminance.glsl", defines, scene, NULL, NULL);
+  if (pass < 0) {
+    return false;
+  }
+  frame_graph_write(graph, pass, luminance, FRAME_GRAPH_DISCARD);
+
+  pass = post_add_pass(graph, "bright", FRAME_GRAPH_PIXEL, "shaders/post_bright.glsl", "",
+		       scene, NULL, NULL);
+  if (pass < 0) {
+    return false;
+  }
+  frame_graph_write(graph, pass, bright, FRAME_GRAPH_DISCARD);
+  pass = post_add_pass(graph, "blur_h", FRAME_GRAPH_SAMPLE, "shaders/post_blur.glsl", "",
+		       bright, post_blur_setup, &post->blur[0]);
+  if (pass < 0) {
+    return false;
+  }
+  frame_graph_write(graph, pass, bloom_h, FRAME_GRAPH_DISCARD);
+  pass = post_add_pass(graph, "blur_v", FRAME_GRAPH_SAMPLE, "shaders/post_blur.glsl", "",
+		       bloom_h, post_blur_setup, &post->blur[1]);
+  if (pass < 0) {
+    return false;
+  }
+  frame_graph_write(graph, pass, bloom, FRAME_GRAPH_DISCARD);
+
+  pass = post_add_pass(graph, "composite", FRAME_GRAPH_PIXEL, "shaders/post_composite.glsl",
+		       "", scene, NULL, NULL);
+  if (pass < 0) {
+    return false;
+  }
+  frame_graph_read(graph, pass, bloom, "bloom");
+  frame_graph_write(graph, pass, lit, FRAME_GRAPH_DISCARD);
+  pass = post_add_pass(graph, "tonemap", FRAME_GRAPH_PIXEL, "shaders/post_tonemap.glsl",
+		       exposure ? "#define AUTO_EXPOSURE 1\n" : "", lit, NULL, NULL);
+  if (pass < 0) {
+    return false;
+  }
+  if (exposure) {
+    frame_graph_read(graph, pass, luminance, "luminance");
+  }
+  frame_graph_write(graph, pass, mapped, FRAME_GRAPH_DISCARD);
+  pass = post_add_pass(graph, "vignette", FRAME_GRAPH_PIXEL, "shaders/post_vignette.glsl",
+		       "", mapped, NULL, NULL);
+  if (pass < 0) {
+    return false;
+  }
+  frame_graph_write(graph, pass, window, FRAME_GRAPH_DISCARD);
+
+  bool ok = frame_graph_compile(graph);
+  frame_graph_print(graph);
+  return ok;
+}
+
+void post_process_destroy(PostProcess *post) {
+  frame_graph_destroy(&post->graph);
+}
+
+/* Instead of clearing the window: binds the scene's targets, cleared */
+void post_process_begin(PostProcess *post) {
+  int pass = frame_graph_execute(&post->graph);
+  if (pass != post->scene_pass) {
+    printf("ERROR: post-processing expected the scene pass, got %d\n", pass);
+  }
+}
+
+/* Once the scene is drawn: the rest of the passes, into the window */
+void post_process_end(PostProcess *post) {
+  frame_graph_execute(&post->graph);
+}
+
+typedef struct {
+  CommandList *list;
+} PostBenchScene;
+
+static void post_bench_scene(void *user) {
+  PostBenchScene *scene = (PostBenchScene *) user;
+  command_list_replay(scene->list, 1, NULL);
+}
+
+/* --bench-post: the lit cube wall post-processed, the graph compiled
+   with and without its optimisations. Frames are finished, so the
+   times are whole frames. */
+void benchmark_post_process(const Cube *cube, mat4 view, mat4 projection,
+			    float *view_position, int width, int height) {
+
+  const int num_frames = 30;
+  const char *names[2] = { "plain", "optimised" };
+  double ms[2];
+
+  LightingShader shader;
+  lighting_shader_locations(cube->shaderProgramAddress, &shader);
+  vec3 light_position = { 0.0f, 1.0f, 3.0f };
+  vec3 light_colour = GLM_VEC3_ONE_INIT;
+  glUseProgram(cube->shaderProgramAddress);
+  glUniform3fv(shader.light_pos, 1, light_position);
+  glUniform3fv(shader.light_colour, 1, light_colour);
+
+  mat4 view_projection;
+  glm_mat4_mul(projection, view, view_projection);
+  CommandList list;
+  command_list_init(&list);
+  record_light_wall(&list, cube->shaderProgramAddress, &shader, cube, view_projection,
+		    view_position, 1);
+  PostBenchScene scene = { &list };
+
+  for (int optimise = 0; optimise < 2; optimise++) {
+    PostProcess post;
+    printf("Post-processing, %s:\n", names[optimise]);
+    if (!post_process_init(&post, width, height, true, optimise, post_bench_scene, &scene)) {
+      printf("Post-processing benchmark: the graph did not compile\n");
+      post_process_destroy(&post);
+      command_list_destroy(&list);
+      return;
+    }
+
+    /* One frame to warm up, then time the rest */
+    Uint64 start = 0;
+    for (int f = -1; f < num_frames; f++) {
+      if (f == 0) {
+	start = SDL_GetPerformanceCounter();
+      }
+      frame_graph_execute(&post.graph);
+      glFinish();
+    }
+    ms[optimise] = (double) (SDL_GetPerformanceCounter() - start) * 1000.0
+      / (double) SDL_GetPerformanceFrequency() / num_frames;
+    post_process_destroy(&post);
+  }
+
+  printf("Post-processing, %dx%d cube wall, %d frames each: plain %.3f ms, "
+	 "optimised %.3f ms\n", LIGHT_WALL_COLUMNS, LIGHT_WALL_ROWS, num_frames,
+	 ms[0], ms[1]);
+  command_list_destroy(&list);
+}
+
+#endif
@@ -0,0 +1,118 @@
+#version 100
+
+/* lighting_shader.frag for many point lights (light_clusters.h).
+
+   The CPU bins the lights into view-space clusters every frame and
+   hands them over as textures: the cluster table, the lights' indices
+   and the lights themselves. A fragment finds its cluster from its
+   pixel and view depth and only lights itself with that cluster's
+   lights. With NAIVE_LIGHTS defined it loops over every light
+   instead, for comparison.
+
+   The CLUSTERS_, MAX_ and INDEX_WIDTH defines come from the program.
+   Decoding the table needs integers up to MAX_INDICES, more than
+   mediump promises, so this wants highp where there is one. */
+
+#ifdef GL_FRAGMENT_PRECISION_HIGH
+precision highp float;
+#else
+precision mediump float;
+#endif
+
+uniform vec3 objectColour;
+uniform vec3 viewPos;
+
+uniform float ambientStrength;
+uniform float specularStrength;
+
+uniform sampler2D clusterTexture;  /* X * Y by Z: offset, count */
+uniform sampler2D indexTexture;    /* INDEX_WIDTH wide, a light per texel */
+uniform sampler2D lightTexture;    /* MAX_LIGHTS by 3 */
+uniform vec3 lightBoundsMin;
+uniform vec3 lightBoundsSize;
+uniform float maxRadius;
+uniform vec2 tileScale;            /* tiles per pixel */
+uniform float sliceScale;
+uniform float sliceBias;
+uniform float numLights;
+
+varying vec3 Normal;
+varying vec3 FragPos;
+varying float ViewDepth;
+
+/* Texels come back as bytes / 255 give or take, so round each byte
+   before scaling the high one up */
+vec2 bytes(vec2 texel) {
+  return floor(texel * 255.0 + 0.5);
+}
+
+float decode16(vec2 texel) {
+  return dot(bytes(texel), vec2(256.0, 1.0)) / 65535.0;
+}
+
+vec3 pointLight(float index, vec3 norm, vec3 viewDir) {
+  float u = (index + 0.5) / float(MAX_LIGHTS);
+  vec4 xy = texture2D(lightTexture, vec2(u, 0.5 / 3.0));
+  vec4 zr = texture2D(lightTexture, vec2(u, 1.5 / 3.0));
+  vec3 lightColour = texture2D(lightTexture, vec2(u, 2.5 / 3.0)).rgb;
+  vec3 lightPos = lightBoundsMin
+    + lightBoundsSize * vec3(decode16(xy.rg), decode16(xy.ba), decode16(zr.rg));
+  float radius = maxRadius * decode16(zr.ba);
+
+  vec3 toLight = lightPos - FragPos;
+  float distance2 = dot(toLight, toLight);
+  float radius2 = radius * radius;
+  if (distance2 >= radius2) {
+    return vec3(0.0);
+  }
+
+  /* Smooth falloff to nothing at the radius */
+  float falloff = 1.0 - distance2 / radius2;
+  falloff *= falloff;
+
+  vec3 lightDir = toLight * inversesqrt(distance2);
+  float diff = max(dot(norm, lightDir), 0.0);
+  vec3 reflectDir = reflect(-lightDir, norm);
+  float spec = pow(max(dot(viewDir, reflectDir), 0.0), 64.0);
+  return falloff * (diff + specularStrength * spec) * lightColour;
+}
+
+void main() {
+
+  vec3 norm = normalize(Normal);
+  vec3 viewDir = normalize(viewPos - FragPos);
+  vec3 result = vec3(ambientStrength);
+
+#ifdef NAIVE_LIGHTS
+  for (int i = 0; i < MAX_LIGHTS; i++) {
+    if (float(i) >= numLights) {
+      break;
+    }
+    result += pointLight(float(i), norm, viewDir);
+  }
+#else
+  vec2 tile = floor(gl_FragCoord.xy * tileScale);
+  float slice = clamp(floor(log(ViewDepth) * sliceScale + sliceBias),
+		      0.0, float(CLUSTERS_Z - 1));
+  vec4 cluster = texture2D(clusterTexture,
+			   vec2((tile.y * float(CLUSTERS_X) + tile.x + 0.5)
+				/ float(CLUSTERS_X * CLUSTERS_Y),
+				(slice + 0.5) / float(CLUSTERS_Z)));
+  float offset = dot(bytes(cluster.rg), vec2(1.0, 256.0));
+  float count = dot(bytes(cluster.ba), vec2(1.0, 256.0));
+
+  for (int i = 0; i < MAX_LIGHTS; i++) {
+    if (float(i) >= count) {
+      break;
+    }
+    float at = offset + float(i);
+    float row = floor(at / float(INDEX_WIDTH));
+    vec2 uv = vec2((at - row * float(INDEX_WIDTH) + 0.5) / float(INDEX_WIDTH),
+		   (row + 0.5) / float(MAX_INDICES / INDEX_WIDTH));
+    float index = floor(texture2D(indexTexture, uv).r * 255.0 + 0.5);
+    result += pointLight(index, norm, viewDir);
+  }
+#endif
+
+  gl_FragColor = vec4(result * objectColour, 1.0);
+}
@@ -0,0 +1,27 @@
+#version 100
+
+/* shader.vert plus the view depth clustered.frag picks its cluster
+   with */
+
+/* Like shader.vert, invariant for the depth pre-pass */
+invariant gl_Position;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 mvp;
+uniform mat4 mat_normal;
+
+attribute vec3 vPosition;
+attribute vec3 vNormal;
+
+varying vec3 Normal;
+varying vec3 FragPos;
+varying float ViewDepth;
+
+void main() {
+  gl_Position = mvp * vec4(vPosition, 1.0);
+
+  Normal = mat3(mat_normal) * vNormal;
+  FragPos = vec3(model * vec4(vPosition, 1.0));
+  ViewDepth = -(view * vec4(FragPos, 1.0)).z;
+}
@@ -0,0 +1,86 @@
+#version 300 es
+
+/* clustered.frag with the lights, cluster table and indices in
+   uniform blocks rather than textures. The table is a uint per
+   cluster, offset | count << 16, and the indices are bytes, four to a
+   uint. */
+
+precision highp float;
+precision highp int;
+
+uniform vec3 objectColour;
+uniform vec3 viewPos;
+
+uniform float ambientStrength;
+uniform float specularStrength;
+
+uniform vec2 tileScale;
+uniform float sliceScale;
+uniform float sliceBias;
+uniform int numLights;
+
+layout(std140) uniform ClusterLights {
+  vec4 lights[2 * MAX_LIGHTS];  /* position and radius, colour */
+};
+layout(std140) uniform ClusterTable {
+  uvec4 clusters[CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z / 4];
+};
+layout(std140) uniform ClusterIndices {
+  uvec4 indices[MAX_INDICES / 16];
+};
+
+in vec3 Normal;
+in vec3 FragPos;
+in float ViewDepth;
+
+out vec4 fragColour;
+
+vec3 pointLight(int index, vec3 norm, vec3 viewDir) {
+  vec4 positionRadius = lights[2 * index];
+  vec3 lightColour = lights[2 * index + 1].rgb;
+
+  vec3 toLight = positionRadius.xyz - FragPos;
+  float distance2 = dot(toLight, toLight);
+  float radius2 = positionRadius.w * positionRadius.w;
+  if (distance2 >= radius2) {
+    return vec3(0.0);
+  }
+
+  float falloff = 1.0 - distance2 / radius2;
+  falloff *= falloff;
+
+  vec3 lightDir = toLight * inversesqrt(distance2);
+  float diff = max(dot(norm, lightDir), 0.0);
+  vec3 reflectDir = reflect(-lightDir, norm);
+  float spec = pow(max(dot(viewDir, reflectDir), 0.0), 64.0);
+  return falloff * (diff + specularStrength * spec) * lightColour;
+}
+
+void main() {
+
+  vec3 norm = normalize(Normal);
+  vec3 viewDir = normalize(viewPos - FragPos);
+  vec3 result = vec3(ambientStrength);
+
+#ifdef NAIVE_LIGHTS
+  for (int i = 0; i < numLights; i++) {
+    result += pointLight(i, norm, viewDir);
+  }
+#else
+  ivec2 tile = min(ivec2(gl_FragCoord.xy * tileScale), ivec2(CLUSTERS_X - 1, CLUSTERS_Y - 1));
+  int slice = clamp(int(floor(log(ViewDepth) * sliceScale + sliceBias)), 0, CLUSTERS_Z - 1);
+  int cluster = (slice * CLUSTERS_Y + tile.y) * CLUSTERS_X + tile.x;
+  uint entry = clusters[cluster / 4][cluster % 4];
+  int offset = int(entry & 0xFFFFu);
+  int count = int(entry >> 16);
+
+  for (int i = 0; i < count; i++) {
+    int at = offset + i;
+    uint four = indices[at / 16][(at / 4) % 4];
+    int index = int((four >> uint(8 * (at % 4))) & 0xFFu);
+    result += pointLight(index, norm, viewDir);
+  }
+#endif
+
+  fragColour = vec4(result * objectColour, 1.0);
+}
@@ -0,0 +1,25 @@
+#version 300 es
+
+/* clustered.vert for clustered_es3.frag and gbuffer.frag */
+
+invariant gl_Position;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 mvp;
+uniform mat4 mat_normal;
+
+in vec3 vPosition;
+in vec3 vNormal;
+
+out vec3 Normal;
+out vec3 FragPos;
+out float ViewDepth;
+
+void main() {
+  gl_Position = mvp * vec4(vPosition, 1.0);
+
+  Normal = mat3(mat_normal) * vNormal;
+  FragPos = vec3(model * vec4(vPosition, 1.0));
+  ViewDepth = -(view * vec4(FragPos, 1.0)).z;
+}
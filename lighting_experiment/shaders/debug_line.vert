@@ -0,0 +1,9 @@
+#version 100
+
+uniform mat4 mvp;
+
+attribute vec3 vPosition;
+
+void main() {
+  gl_Position = mvp * vec4(vPosition, 1.0);
+}
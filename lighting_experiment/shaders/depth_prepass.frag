@@ -0,0 +1,8 @@
+#version 100
+
+precision mediump float;
+
+/* Colour writes are masked off during the pre-pass */
+void main() {
+  gl_FragColor = vec4(0.0);
+}
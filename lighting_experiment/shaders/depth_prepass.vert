@@ -0,0 +1,15 @@
+#version 100
+
+/* Positions only, for the depth pre-pass. gl_Position is computed as
+   in the lit #version 100 shaders and invariant in all of them, so the
+   depth the lit draws write again is bit for bit the same. */
+
+invariant gl_Position;
+
+uniform mat4 mvp;
+
+attribute vec3 vPosition;
+
+void main() {
+  gl_Position = mvp * vec4(vPosition, 1.0);
+}
@@ -0,0 +1,10 @@
+#version 300 es
+
+precision mediump float;
+
+out vec4 fragColour;
+
+/* Colour writes are masked off during the pre-pass */
+void main() {
+  fragColour = vec4(0.0);
+}
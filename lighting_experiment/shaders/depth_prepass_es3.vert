@@ -0,0 +1,14 @@
+#version 300 es
+
+/* depth_prepass.vert for lit draws in #version 300 es shaders, as
+   invariance is only promised between shaders of the same version */
+
+invariant gl_Position;
+
+uniform mat4 mvp;
+
+in vec3 vPosition;
+
+void main() {
+  gl_Position = mvp * vec4(vPosition, 1.0);
+}
@@ -0,0 +1,43 @@
+#version 300 es
+
+/* Fills the G-buffer for deferred shading. The ambient term goes
+   straight into the light accumulation target, which the light
+   volumes then add to. The normal is octahedral encoded, 16 bits a
+   component, and the view depth goes in as the bits of the float so
+   the light pass can rebuild the position without reading the depth
+   buffer it is stencil testing against. */
+
+precision highp float;
+precision highp int;
+
+uniform vec3 objectColour;
+uniform float ambientStrength;
+uniform float specularStrength;
+
+in vec3 Normal;
+in vec3 FragPos;
+in float ViewDepth;
+
+layout(location = 0) out vec4 ambient;
+layout(location = 1) out vec4 albedoSpecular;
+layout(location = 2) out uvec4 normalDepth;
+
+/* The unit sphere folded onto the -1 to 1 square */
+vec2 octahedral(vec3 n) {
+  n /= abs(n.x) + abs(n.y) + abs(n.z);
+  if (n.z < 0.0) {
+    vec2 flip = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return (1.0 - abs(n.yx)) * flip;
+  }
+  return n.xy;
+}
+
+void main() {
+  vec3 norm = normalize(Normal);
+  uvec2 encoded = uvec2(round((octahedral(norm) * 0.5 + 0.5) * 65535.0));
+  uint depth = floatBitsToUint(ViewDepth);
+
+  ambient = vec4(ambientStrength * objectColour, 1.0);
+  albedoSpecular = vec4(objectColour, specularStrength);
+  normalDepth = uvec4(encoded, depth >> 16, depth & 0xFFFFu);
+}
@@ -0,0 +1,11 @@
+#version 300 es
+
+/* Light volumes into the stencil only */
+
+precision mediump float;
+
+out vec4 fragColour;
+
+void main() {
+  fragColour = vec4(0.0);
+}
@@ -0,0 +1,60 @@
+#version 300 es
+
+/* One light on whatever G-buffer pixel its volume covers, added to the
+   light accumulation target. Same light as clustered.frag. */
+
+precision highp float;
+precision highp int;
+
+uniform highp usampler2D normalDepthTexture;
+uniform sampler2D albedoTexture;
+
+uniform mat4 inverseView;
+uniform vec2 ndcScale;    /* view x and y per unit depth at the screen edge */
+uniform vec2 screenSize;
+uniform vec3 viewPos;
+
+flat in vec4 PositionRadius;
+flat in vec3 LightColour;
+
+out vec4 fragColour;
+
+vec3 unoctahedral(vec2 e) {
+  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  if (n.z < 0.0) {
+    vec2 flip = vec2(e.x >= 0.0 ? 1.0 : -1.0, e.y >= 0.0 ? 1.0 : -1.0);
+    n.xy = (1.0 - abs(n.yx)) * flip;
+  }
+  return normalize(n);
+}
+
+void main() {
+  ivec2 pixel = ivec2(gl_FragCoord.xy);
+  uvec4 normalDepth = texelFetch(normalDepthTexture, pixel, 0);
+  float depth = uintBitsToFloat((normalDepth.z << 16) | normalDepth.w);
+
+  /* Back to world space through the view ray */
+  vec2 ndc = gl_FragCoord.xy / screenSize * 2.0 - 1.0;
+  vec3 FragPos = (inverseView * vec4(ndc * ndcScale * depth, -depth, 1.0)).xyz;
+
+  vec3 toLight = PositionRadius.xyz - FragPos;
+  float distance2 = dot(toLight, toLight);
+  float radius2 = PositionRadius.w * PositionRadius.w;
+  if (distance2 >= radius2) {
+    discard;
+  }
+
+  vec4 albedoSpecular = texelFetch(albedoTexture, pixel, 0);
+  vec3 norm = unoctahedral(vec2(normalDepth.xy) / 65535.0 * 2.0 - 1.0);
+  vec3 viewDir = normalize(viewPos - FragPos);
+
+  float falloff = 1.0 - distance2 / radius2;
+  falloff *= falloff;
+
+  vec3 lightDir = toLight * inversesqrt(distance2);
+  float diff = max(dot(norm, lightDir), 0.0);
+  vec3 reflectDir = reflect(-lightDir, norm);
+  float spec = pow(max(dot(viewDir, reflectDir), 0.0), 64.0);
+  vec3 light = falloff * (diff + albedoSpecular.a * spec) * LightColour;
+  fragColour = vec4(light * albedoSpecular.rgb, 0.0);
+}
@@ -0,0 +1,21 @@
+#version 300 es
+
+/* A light volume: the unit sphere hull moved to one light, taken from
+   the instance attributes */
+
+uniform mat4 viewProjection;
+
+in vec3 vPosition;
+in vec4 lightPositionRadius;
+in vec3 lightColourIn;
+
+flat out vec4 PositionRadius;
+flat out vec3 LightColour;
+
+void main() {
+  vec3 world = lightPositionRadius.xyz + vPosition * lightPositionRadius.w;
+  gl_Position = viewProjection * vec4(world, 1.0);
+
+  PositionRadius = lightPositionRadius;
+  LightColour = lightColourIn;
+}
@@ -3,9 +3,19 @@
 precision mediump float;
 
 uniform vec3 objectColour;
+
+#ifdef LIGHTING_GOURAUD
+
+/* Lit per vertex in shader.vert */
+varying vec3 Lighting;
+
+void main() {
+  gl_FragColor = vec4(Lighting * objectColour, 1.0);
+}
+
+#else
+
 uniform vec3 lightColour;
-uniform vec3 lightPos;
-uniform vec3 viewPos;
 
 uniform float ambientStrength;
 uniform float specularStrength;
@@ -13,6 +23,73 @@ uniform float specularStrength;
 varying vec3 Normal;
 varying vec3 FragPos;
 
+#ifdef LIGHTING_BLINN_LUT
+
+/* pow(n.h, SPECULAR_LUT_SHININESS), n.h * SPECULAR_LUT_SCALE +
+   SPECULAR_LUT_OFFSET across. It starts where the highlight becomes
+   next to nothing. */
+uniform sampler2D specularLut;
+
+varying vec3 LightDir;
+varying vec3 HalfDir;
+
+void main() {
+
+  vec3 ambient = ambientStrength * lightColour;
+
+  vec3 norm = normalize(Normal);
+  float diff = max(dot(norm, normalize(LightDir)), 0.0);
+  vec3 diffuse = diff * lightColour;
+
+  float specDot = dot(norm, normalize(HalfDir));
+  float spec = texture2D(specularLut,
+			 vec2(specDot * SPECULAR_LUT_SCALE + SPECULAR_LUT_OFFSET, 0.5)).r;
+  vec3 specular = specularStrength * spec * lightColour;
+
+  gl_FragColor = vec4((ambient + diffuse + specular) * objectColour, 1.0);
+}
+
+#else
+
+uniform vec3 lightPos;
+uniform vec3 viewPos;
+
+#ifdef SHADOWS
+
+/* Depths need more than mediump's 10 bits */
+#ifdef GL_FRAGMENT_PRECISION_HIGH
+#define SHADOW_PRECISION highp
+#else
+#define SHADOW_PRECISION mediump
+#endif
+
+uniform SHADOW_PRECISION sampler2D shadowMap;
+uniform vec2 shadowTexel;
+
+varying SHADOW_PRECISION vec4 ShadowCoord;
+
+/* How lit the fragment is, from SHADOW_PCF by SHADOW_PCF depth tests a
+   texel apart. Outside the light's frustum counts as lit. */
+float shadow() {
+  SHADOW_PRECISION vec3 coord = ShadowCoord.xyz / ShadowCoord.w;
+  if (ShadowCoord.w <= 0.0 || coord.z > 1.0
+      || any(lessThan(coord.xy, vec2(0.0))) || any(greaterThan(coord.xy, vec2(1.0)))) {
+    return 1.0;
+  }
+
+  float lit = 0.0;
+  for (int y = 0; y < SHADOW_PCF; y++) {
+    for (int x = 0; x < SHADOW_PCF; x++) {
+      SHADOW_PRECISION vec2 offset = (vec2(float(x), float(y)) - 0.5 * float(SHADOW_PCF - 1))
+	* shadowTexel;
+      lit += step(coord.z, texture2D(shadowMap, coord.xy + offset).r);
+    }
+  }
+  return lit / float(SHADOW_PCF * SHADOW_PCF);
+}
+
+#endif
+
 void main() {
 
   /* Implement ambient lighting */
@@ -32,8 +109,17 @@ void main() {
   float max_bit = max(dot_bit, 0.0);
   float spec = pow(max_bit, float(64));
   vec3 specular = specularStrength * spec * lightColour;
+
+#ifdef SHADOWS
+  float lit = shadow();
+  diffuse *= lit;
+  specular *= lit;
+#endif
   
   vec3 result = (ambient + diffuse + specular) * objectColour;
   
   gl_FragColor = vec4(result, 1.0);
 }
+
+#endif
+#endif
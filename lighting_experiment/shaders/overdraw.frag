@@ -0,0 +1,9 @@
+#version 100
+
+precision mediump float;
+
+/* Added up with GL_ONE, GL_ONE: red counts the fragments shaded per
+   pixel */
+void main() {
+  gl_FragColor = vec4(1.0 / 255.0, 0.0, 0.0, 0.0);
+}
@@ -0,0 +1,11 @@
+#version 100
+
+precision mediump float;
+
+varying float Life;
+
+void main() {
+  /* White hot when fresh, fading to a dull orange */
+  float heat = clamp(Life / 4.0, 0.0, 1.0);
+  gl_FragColor = vec4(mix(vec3(0.6, 0.2, 0.05), vec3(1.0, 0.95, 0.8), heat), 1.0);
+}
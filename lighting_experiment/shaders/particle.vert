@@ -0,0 +1,15 @@
+#version 100
+
+uniform mat4 mvp;
+uniform float pointScale;
+
+/* xyz position and the seconds it has left to live */
+attribute vec4 vParticle;
+
+varying float Life;
+
+void main() {
+  gl_Position = mvp * vec4(vParticle.xyz, 1.0);
+  gl_PointSize = pointScale / gl_Position.w;
+  Life = vParticle.w;
+}
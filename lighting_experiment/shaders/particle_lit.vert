@@ -0,0 +1,20 @@
+#version 100
+
+/* Points for lighting_shader.frag: each particle is lit as a small
+   surface facing the camera */
+
+uniform mat4 mvp;
+uniform float pointScale;
+uniform vec3 eyePos;
+
+attribute vec4 vParticle;
+
+varying vec3 Normal;
+varying vec3 FragPos;
+
+void main() {
+  gl_Position = mvp * vec4(vParticle.xyz, 1.0);
+  gl_PointSize = pointScale / gl_Position.w;
+  FragPos = vParticle.xyz;
+  Normal = eyePos - vParticle.xyz;
+}
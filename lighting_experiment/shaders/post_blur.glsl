@@ -0,0 +1,13 @@
+/* Nine tap Gaussian along blurDirection in five bilinear fetches,
+   run once across and once down */
+uniform vec2 blurDirection;
+
+vec4 apply(vec2 uv) {
+  vec2 texel = blurDirection * sourceTexel;
+  vec3 sum = texture2D(source, uv).rgb * 0.2270270;
+  sum += texture2D(source, uv + texel * 1.3846154).rgb * 0.3162162;
+  sum += texture2D(source, uv - texel * 1.3846154).rgb * 0.3162162;
+  sum += texture2D(source, uv + texel * 3.2307692).rgb * 0.0702703;
+  sum += texture2D(source, uv - texel * 3.2307692).rgb * 0.0702703;
+  return vec4(sum, 1.0);
+}
@@ -0,0 +1,6 @@
+/* Bloom: what is bright enough to glow, fading in so the edge of the
+   threshold does not flicker */
+vec4 apply(vec4 colour, vec2 uv) {
+  float luma = dot(colour.rgb, vec3(0.2126, 0.7152, 0.0722));
+  return vec4(colour.rgb * smoothstep(0.7, 0.95, luma), 1.0);
+}
@@ -0,0 +1,7 @@
+/* The scene with its bloom added. Merged with the passes after it the
+   sum stays in the shader, so it can go over 1 until the tone map. */
+uniform sampler2D bloom;
+
+vec4 apply(vec4 colour, vec2 uv) {
+  return vec4(colour.rgb + 0.6 * texture2D(bloom, uv).rgb, 1.0);
+}
@@ -0,0 +1,13 @@
+/* Average brightness over this texel's block of the scene, from a
+   4x4 grid of bilinear fetches */
+vec4 apply(vec2 uv) {
+  vec2 block = sourceTexel * vec2(LUMINANCE_BLOCK_X, LUMINANCE_BLOCK_Y);
+  float sum = 0.0;
+  for (int y = 0; y < 4; y++) {
+    for (int x = 0; x < 4; x++) {
+      vec2 offset = (vec2(float(x), float(y)) - 1.5) * 0.25 * block;
+      sum += dot(texture2D(source, uv + offset).rgb, vec3(0.2126, 0.7152, 0.0722));
+    }
+  }
+  return vec4(vec3(sum / 16.0), 1.0);
+}
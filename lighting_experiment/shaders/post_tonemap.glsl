@@ -0,0 +1,19 @@
+/* Extended Reinhard, white point 2. With AUTO_EXPOSURE the scene's
+   average brightness, from four spots of the luminance target, is
+   brought to mid grey first. */
+#ifdef AUTO_EXPOSURE
+uniform sampler2D luminance;
+#endif
+
+vec4 apply(vec4 colour, vec2 uv) {
+  vec3 c = colour.rgb;
+#ifdef AUTO_EXPOSURE
+  float average = 0.25 * (texture2D(luminance, vec2(0.25, 0.25)).r
+			  + texture2D(luminance, vec2(0.75, 0.25)).r
+			  + texture2D(luminance, vec2(0.25, 0.75)).r
+			  + texture2D(luminance, vec2(0.75, 0.75)).r);
+  c *= 0.5 / max(average, 0.1);
+#endif
+  c = c * (1.0 + c / 4.0) / (1.0 + c);
+  return vec4(c, colour.a);
+}
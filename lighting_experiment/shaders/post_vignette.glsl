@@ -0,0 +1,5 @@
+/* Darken towards the corners */
+vec4 apply(vec4 colour, vec2 uv) {
+  float edge = smoothstep(0.45, 0.8, distance(uv, vec2(0.5)));
+  return vec4(colour.rgb * (1.0 - 0.35 * edge), colour.a);
+}
@@ -1,8 +1,16 @@
 #version 100
 
+/* The lighting tiers are permutations of this and lighting_shader.frag:
+   with no defines it is per pixel Phong, LIGHTING_BLINN_LUT moves the
+   half vector here for Blinn-Phong with a specular lookup texture and
+   LIGHTING_GOURAUD does all the lighting here, per vertex. SHADOWS
+   passes the position on to the shadow map lookup. */
+
+/* The same depth as depth_prepass.vert, so it passes GL_EQUAL */
+invariant gl_Position;
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 perspective;
+uniform mat4 mvp;
 uniform mat4 mat_normal;
 
 attribute vec3 vPosition;
@@ -11,13 +19,57 @@ attribute vec3 vNormal;
 varying vec3 Normal;
 varying vec3 FragPos;
 
+#if defined(LIGHTING_BLINN_LUT) || defined(LIGHTING_GOURAUD)
+uniform vec3 lightPos;
+uniform vec3 viewPos;
+#endif
+
+#ifdef LIGHTING_BLINN_LUT
+varying vec3 LightDir;
+varying vec3 HalfDir;
+#endif
+
+#ifdef SHADOWS
+/* World to shadow map texture coordinates and depth */
+uniform mat4 shadowMatrix;
+
+varying vec4 ShadowCoord;
+#endif
+
+#ifdef LIGHTING_GOURAUD
+uniform vec3 lightColour;
+uniform float ambientStrength;
+uniform float specularStrength;
+
+varying vec3 Lighting;
+#endif
+
 void main() {
-  gl_Position = perspective * view * model * vec4(vPosition, 1.0);
+  gl_Position = mvp * vec4(vPosition, 1.0);
 
   /* Pass information to fragment shader */
 
   /* multiply by the normal matrix */
   Normal = mat3(mat_normal) * vNormal;
   FragPos = vec3(model * vec4(vPosition, 1.0));
+
+#ifdef SHADOWS
+  ShadowCoord = shadowMatrix * vec4(FragPos, 1.0);
+#endif
+
+#ifdef LIGHTING_BLINN_LUT
+  LightDir = normalize(lightPos - FragPos);
+  HalfDir = LightDir + normalize(viewPos - FragPos);
+#endif
+
+#ifdef LIGHTING_GOURAUD
+  vec3 norm = normalize(Normal);
+  vec3 lightDir = normalize(lightPos - FragPos);
+  float diff = max(dot(norm, lightDir), 0.0);
+  vec3 viewDir = normalize(viewPos - FragPos);
+  vec3 reflectDir = reflect(-lightDir, norm);
+  float spec = pow(max(dot(viewDir, reflectDir), 0.0), 64.0);
+  Lighting = (ambientStrength + diff + specularStrength * spec) * lightColour;
+#endif
   
 }
@@ -0,0 +1,733 @@
+#ifndef SHADOW_MAP_HEADER
+#define SHADOW_MAP_HEADER
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cglm/cglm.h>
+#include <GLES2/gl2.h>
+#include <SDL2/SDL.h>
+
+#include "command_list.h"
+#include "cube.h"
+#include "gl_caps.h"
+#include "shader_loader.h"
+#include "static_batch.h"
+
+// C header-only library for the orbiting light's shadows, from a depth
+// map that is mostly cached rather than drawn every frame:
+//
+//   cache    the static casters' depth from the light. Drawn again only
+//            once the light has moved threshold away from where it was
+//            drawn from, into a second cache refresh_tiles tiles a
+//            frame, which is swapped in when it is complete.
+//   map      what the lighting samples: the cache with the dynamic
+//            casters drawn over it. Each frame only the tiles the
+//            dynamic casters covered the frame before are blitted back
+//            from the cache, then the dynamic casters are drawn.
+//
+// Without glBlitFramebuffer (ES2) nothing could be copied out of a
+// cache, so there is none: the static casters are drawn again straight
+// into the map, scissored to the dirty tiles, and only their command
+// list is re-aimed once the light has moved threshold away.
+//
+// Everything is drawn from where the cache was, so until it catches up
+// the shadows are cast from at most threshold away from the light. The
+// map is one perspective view from the light towards the origin, which
+// everything orbits, lit through a SHADOW_PCF permutation of the
+// lighting shader.
+
+#define SHADOW_MAP_TILES 8                    /* a side, one bit each */
+#define SHADOW_MAP_ALL_TILES UINT64_MAX
+#define SHADOW_MAP_UNIT 5
+#define SHADOW_MAP_QUERIES 4
+#define SHADOW_MAP_FOV 120.0f
+#define SHADOW_MAP_NEAR 0.5f
+#define SHADOW_MAP_FAR 40.0f
+
+typedef struct {
+  bool enabled;
+  int size;            /* texels a side */
+  int pcf;             /* depth tests a side */
+  float threshold;     /* how far the light moves before the cache is redrawn */
+  int refresh_tiles;   /* cache tiles redrawn a frame */
+  bool cache;          /* false draws every caster every frame */
+} ShadowConfig;
+
+typedef struct {
+  const Mesh *mesh;
+  const float *world;  /* column-major */
+} ShadowCaster;
+
+typedef struct {
+  GLuint texture;
+  GLuint framebuffer;
+} ShadowTarget;
+
+typedef struct {
+  ShadowConfig config;
+  ShadowTarget cache;
+  ShadowTarget pending;  /* the cache being redrawn */
+  ShadowTarget map;
+
+  /* Depth only */
+  GLuint program;
+  GLint position_attr;
+  GLint mvp;
+
+  /* The lighting shader with shadows, and its shadow uniforms */
+  GLuint lighting_program;
+  GLint shadow_matrix;
+  GLint shadow_map;
+  GLint shadow_texel;
+
+  const StaticBatch *batch;
+  CommandList static_list;   /* the static casters from the cache's light */
+  CommandList pending_list;  /* and from the pending cache's */
+  CommandList dynamic_list;
+
+  bool blit;                 /* cache and pending exist and are blitted from */
+  bool valid;                /* the cache has been drawn */
+  vec3 light;                /* where the cache was drawn from */
+  mat4 view_projection;
+  vec3 pending_light;
+  mat4 pending_view_projection;
+  int refresh_tile;          /* next pending tile, -1 when not redrawing */
+  uint64_t dirty;            /* map tiles the dynamic casters covered */
+
+  GLuint queries[SHADOW_MAP_QUERIES];
+  bool query_pending[SHADOW_MAP_QUERIES];
+  int query_ix;
+
+  /* Since the last report */
+  int frames;
+  int redraws;
+  long refreshed_tiles;
+  long restored_tiles;
+  long dynamic_draws;
+  double pass_ms;
+  int pass_samples;
+  int report_frames;
+} ShadowMap;
+
+static int shadow_clamp(int value, int low, int high) {
+  return value < low ? low : value > high ? high : value;
+}
+
+/* --shadows turns them on. --shadow-size N texels a side (1024),
+   --shadow-pcf N depth tests a side (2), --shadow-threshold D how far
+   the light moves before the cache is redrawn (0.25), --shadow-refresh
+   N tiles of it a frame (all of them) and --no-shadow-cache draws
+   everything every frame. */
+void shadow_map_parse_args(ShadowConfig *config, int argc, char *argv[]) {
+  config->enabled = false;
+  config->size = 1024;
+  config->pcf = 2;
+  config->threshold = 0.25f;
+  config->refresh_tiles = SHADOW_MAP_TILES * SHADOW_MAP_TILES;
+  config->cache = true;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--shadows") == 0) {
+      config->enabled = true;
+    } else if (strcmp(argv[i], "--no-shadow-cache") == 0) {
+      config->cache = false;
+    } else if (i + 1 < argc) {
+      if (strcmp(argv[i], "--shadow-size") == 0) {
+	config->size = atoi(argv[i + 1]);
+      } else if (strcmp(argv[i], "--shadow-pcf") == 0) {
+	config->pcf = atoi(argv[i + 1]);
+      } else if (strcmp(argv[i], "--shadow-threshold") == 0) {
+	config->threshold = atof(argv[i + 1]);
+      } else if (strcmp(argv[i], "--shadow-refresh") == 0) {
+	config->refresh_tiles = atoi(argv[i + 1]);
+      }
+    }
+  }
+
+  /* Whole tiles, and at most 4x4 taps */
+  config->size = shadow_clamp(config->size, 64, 4096) / SHADOW_MAP_TILES * SHADOW_MAP_TILES;
+  config->pcf = shadow_clamp(config->pcf, 1, 4);
+  config->refresh_tiles = shadow_clamp(config->refresh_tiles, 1,
+				       SHADOW_MAP_TILES * SHADOW_MAP_TILES);
+}
+
+static bool shadow_target_init(ShadowTarget *target, int size) {
+  glGenTextures(1, &target->texture);
+  glBindTexture(GL_TEXTURE_2D, target->texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, gl_caps.es3 ? GL_DEPTH_COMPONENT24 : GL_DEPTH_COMPONENT,
+	       size, size, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  glGenFramebuffers(1, &target->framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, target->framebuffer);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
+			 target->texture, 0);
+  GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  if (status != GL_FRAMEBUFFER_COMPLETE) {
+    printf("ERROR: shadow map framebuffer incomplete: 0x%x\n", status);
+    return false;
+  }
+  return true;
+}
+
+static void shadow_target_destroy(ShadowTarget *target) {
+  glDeleteFramebuffers(1, &target->framebuffer);
+  glDeleteTextures(1, &target->texture);
+}
+
+/* False when there are no depth textures to sample */
+bool shadow_map_init(ShadowMap *shadows, const ShadowConfig *config) {
+
+  memset(shadows, 0, sizeof(*shadows));
+  shadows->config = *config;
+  shadows->refresh_tile = -1;
+  shadows->report_frames = 300;
+  if (!gl_caps.depth_texture) {
+    printf("Shadows need depth textures, which this context does not have\n");
+    return false;
+  }
+
+  int size = config->size;
+  bool ok = shadow_target_init(&shadows->map, size);
+  shadows->blit = config->cache && gl_caps.BlitFramebuffer != NULL;
+  if (shadows->blit) {
+    ok = shadow_target_init(&shadows->cache, size) && ok;
+    ok = shadow_target_init(&shadows->pending, size) && ok;
+  }
+
+  shadows->program = load_shaders("shaders/depth_prepass.vert", "shaders/depth_prepass.frag");
+  shadows->position_attr = glGetAttribLocation(shadows->program, "vPosition");
+  shadows->mvp = glGetUniformLocation(shadows->program, "mvp");
+
+  char defines[64];
+  snprintf(defines, sizeof(defines), "#define SHADOWS 1\n#define SHADOW_PCF %d\n",
+	   config->pcf);
+  shadows->lighting_program = load_shaders_defines("shaders/shader.vert",
+						   "shaders/lighting_shader.frag", defines);
+  shadows->shadow_matrix = glGetUniformLocation(shadows->lighting_program, "shadowMatrix");
+  shadows->shadow_map = glGetUniformLocation(shadows->lighting_program, "shadowMap");
+  shadows->shadow_texel = glGetUniformLocation(shadows->lighting_program, "shadowTexel");
+  glUseProgram(shadows->lighting_program);
+  glUniform1i(shadows->shadow_map, SHADOW_MAP_UNIT);
+  glUniform2f(shadows->shadow_texel, 1.0f / size, 1.0f / size);
+
+  command_list_init(&shadows->static_list);
+  command_list_init(&shadows->pending_list);
+  command_list_init(&shadows->dynamic_list);
+  if (gl_caps.timer_query) {
+    gl_caps.GenQueriesEXT(SHADOW_MAP_QUERIES, shadows->queries);
+  }
+
+  printf("Shadows: %dx%d map, %dx%d PCF, ", size, size, config->pcf, config->pcf);
+  if (shadows->blit) {
+    printf("static casters cached, redrawn %d tiles a frame after the light moves %.2f,"
+	   " restored by blitting\n", config->refresh_tiles, config->threshold);
+  } else if (config->cache) {
+    printf("static casters drawn again under the dynamic ones, re-aimed after the light"
+	   " moves %.2f\n", config->threshold);
+  } else {
+    printf("everything drawn every frame\n");
+  }
+  return ok;
+}
+
+void shadow_map_destroy(ShadowMap *shadows) {
+  shadow_target_destroy(&shadows->map);
+  if (shadows->blit) {
+    shadow_target_destroy(&shadows->cache);
+    shadow_target_destroy(&shadows->pending);
+  }
+  glDeleteProgram(shadows->program);
+  glDeleteProgram(shadows->lighting_program);
+  command_list_destroy(&shadows->static_list);
+  command_list_destroy(&shadows->pending_list);
+  command_list_destroy(&shadows->dynamic_list);
+  if (gl_caps.timer_query) {
+    gl_caps.DeleteQueriesEXT(SHADOW_MAP_QUERIES, shadows->queries);
+  }
+}
+
+/* The static casters; the batch is drawn into the cache, never moved */
+void shadow_map_set_static(ShadowMap *shadows, const StaticBatch *batch) {
+  shadows->batch = batch;
+  shadows->valid = false;
+}
+
+/* Looking from the light at the origin. The light orbits about z, so z
+   is up unless the light is on the z axis. */
+static void shadow_light_view_projection(const float *light, mat4 view_projection) {
+  vec3 eye = { light[0], light[1], light[2] };
+  vec3 centre = GLM_VEC3_ZERO_INIT;
+  vec3 up = { 0.0f, 0.0f, 1.0f };
+  if (fabsf(light[0]) + fabsf(light[1]) < 1.0e-3f) {
+    up[1] = 1.0f;
+    up[2] = 0.0f;
+  }
+  mat4 view;
+  mat4 projection;
+  glm_lookat(eye, centre, up, view);
+  glm_perspective(glm_rad(SHADOW_MAP_FOV), 1.0f, SHADOW_MAP_NEAR, SHADOW_MAP_FAR,
+		  projection);
+  glm_mat4_mul(projection, view, view_projection);
+}
+
+static void record_static_casters(CommandList *list, const ShadowMap *shadows,
+				  mat4 view_projection) {
+  const StaticBatch *batch = shadows->batch;
+  command_list_reset(list);
+  if (batch == NULL || batch->num_chunks == 0) {
+    return;
+  }
+  cmd_use_program(list, shadows->program);
+  cmd_enable_attrib(list, shadows->position_attr);
+  cmd_uniform_matrix4(list, shadows->mvp, view_projection[0]);
+  cmd_bind_buffer(list, GL_ARRAY_BUFFER, batch->vertex_buffer);
+  cmd_bind_buffer(list, GL_ELEMENT_ARRAY_BUFFER, batch->index_buffer);
+  for (int c = 0; c < batch->num_chunks; c++) {
+    const StaticChunk *chunk = &batch->chunks[c];
+    cmd_vertex_attrib(list, shadows->position_attr, 3, STATIC_BATCH_STRIDE,
+		      chunk->vertex_offset);
+    cmd_draw_elements(list, GL_TRIANGLES, chunk->num_indices, GL_UNSIGNED_SHORT,
+		      chunk->index_offset);
+  }
+  cmd_bind_buffer(list, GL_ELEMENT_ARRAY_BUFFER, 0);
+  cmd_disable_attrib(list, shadows->position_attr);
+}
+
+/* The tiles a caster's bounds cover, a texel around for rounding; all
+   of them when it reaches behind the light and none when it is off the
+   map */
+static uint64_t shadow_footprint(const ShadowCaster *caster, mat4 view_projection,
+				 int size) {
+  const Bounds *bounds = &caster->mesh->bounds;
+  mat4 world;
+  mat4 mvp;
+  memcpy(world, caster->world, sizeof(world));
+  glm_mat4_mul(view_projection, world, mvp);
+
+  float low[2] = { 1.0e9f, 1.0e9f };
+  float high[2] = { -1.0e9f, -1.0e9f };
+  for (int c = 0; c < 8; c++) {
+    vec4 corner = { (c & 1) ? bounds->max[0] : bounds->min[0],
+		    (c & 2) ? bounds->max[1] : bounds->min[1],
+		    (c & 4) ? bounds->max[2] : bounds->min[2], 1.0f };
+    vec4 clip;
+    glm_mat4_mulv(mvp, corner, clip);
+    if (clip[3] < SHADOW_MAP_NEAR) {
+      return SHADOW_MAP_ALL_TILES;
+    }
+    for (int a = 0; a < 2; a++) {
+      float texel = (clip[a] / clip[3] * 0.5f + 0.5f) * size;
+      low[a] = fminf(low[a], texel - 1.0f);
+      high[a] = fmaxf(high[a], texel + 1.0f);
+    }
+  }
+
+  int tile_size = size / SHADOW_MAP_TILES;
+  int first[2];
+  int last[2];
+  for (int a = 0; a < 2; a++) {
+    if (high[a] < 0.0f || low[a] >= size) {
+      return 0;
+    }
+    first[a] = shadow_clamp((int) low[a], 0, size - 1) / tile_size;
+    last[a] = shadow_clamp((int) high[a], 0, size - 1) / tile_size;
+  }
+  uint64_t tiles = 0;
+  for (int y = first[1]; y <= last[1]; y++) {
+    for (int x = first[0]; x <= last[0]; x++) {
+      tiles |= (uint64_t) 1 << (y * SHADOW_MAP_TILES + x);
+    }
+  }
+  return tiles;
+}
+
+/* Runs of set tiles along a row, as texel rectangles. Returns the
+   number of tiles in them. */
+static int shadow_tile_runs(uint64_t tiles, int size, int runs[][4], int *num_runs) {
+  int tile_size = size / SHADOW_MAP_TILES;
+  int count = 0;
+  *num_runs = 0;
+  for (int y = 0; y < SHADOW_MAP_TILES; y++) {
+    int x = 0;
+    while (x < SHADOW_MAP_TILES) {
+      if (!(tiles >> (y * SHADOW_MAP_TILES + x) & 1)) {
+	x++;
+	continue;
+      }
+      int start = x;
+      while (x < SHADOW_MAP_TILES && (tiles >> (y * SHADOW_MAP_TILES + x) & 1)) {
+	x++;
+      }
+      int *run = runs[(*num_runs)++];
+      run[0] = start * tile_size;
+      run[1] = y * tile_size;
+      run[2] = (x - start) * tile_size;
+      run[3] = tile_size;
+      count += x - start;
+    }
+  }
+  return count;
+}
+
+/* Clear the tiles of a target and draw a list into them. The scissor
+   covers the rectangle round all of them, so the list is replayed once;
+   the clean tiles inside it get the same depths drawn again. */
+static void shadow_draw_tiles(const ShadowMap *shadows, const ShadowTarget *target,
+			      CommandList *list, uint64_t tiles) {
+  glBindFramebuffer(GL_FRAMEBUFFER, target->framebuffer);
+  if (tiles == SHADOW_MAP_ALL_TILES) {
+    glClear(GL_DEPTH_BUFFER_BIT);
+    command_list_replay(list, 1, NULL);
+    return;
+  }
+
+  int tile_size = shadows->config.size / SHADOW_MAP_TILES;
+  int first[2] = { SHADOW_MAP_TILES, SHADOW_MAP_TILES };
+  int last[2] = { -1, -1 };
+  for (int y = 0; y < SHADOW_MAP_TILES; y++) {
+    for (int x = 0; x < SHADOW_MAP_TILES; x++) {
+      if (tiles >> (y * SHADOW_MAP_TILES + x) & 1) {
+	first[0] = x < first[0] ? x : first[0];
+	first[1] = y < first[1] ? y : first[1];
+	last[0] = x > last[0] ? x : last[0];
+	last[1] = y > last[1] ? y : last[1];
+      }
+    }
+  }
+  if (last[0] < 0) {
+    return;
+  }
+  glEnable(GL_SCISSOR_TEST);
+  glScissor(first[0] * tile_size, first[1] * tile_size,
+	    (last[0] - first[0] + 1) * tile_size, (last[1] - first[1] + 1) * tile_size);
+  glClear(GL_DEPTH_BUFFER_BIT);
+  command_list_replay(list, 1, NULL);
+  glDisable(GL_SCISSOR_TEST);
+}
+
+/* Copy tiles of the cache back into the map, or without a cache draw
+   the static casters into them again */
+static void shadow_restore_tiles(ShadowMap *shadows, uint64_t tiles) {
+  if (tiles == 0) {
+    return;
+  }
+  if (!shadows->blit) {
+    shadow_draw_tiles(shadows, &shadows->map, &shadows->static_list, tiles);
+  } else {
+    int runs[SHADOW_MAP_TILES * SHADOW_MAP_TILES][4];
+    int num_runs;
+    shadow_tile_runs(tiles, shadows->config.size, runs, &num_runs);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, shadows->cache.framebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, shadows->map.framebuffer);
+    for (int r = 0; r < num_runs; r++) {
+      int x1 = runs[r][0] + runs[r][2];
+      int y1 = runs[r][1] + runs[r][3];
+      gl_caps.BlitFramebuffer(runs[r][0], runs[r][1], x1, y1, runs[r][0], runs[r][1], x1, y1,
+			      GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    }
+  }
+  shadows->restored_tiles += __builtin_popcountll(tiles);
+}
+
+/* The next refresh_tiles tiles of the pending cache, swapping it in
+   once they are all drawn. True when it was swapped in. */
+static bool shadow_refresh(ShadowMap *shadows) {
+  int num_tiles = SHADOW_MAP_TILES * SHADOW_MAP_TILES;
+  int count = shadows->config.refresh_tiles;
+  if (count > num_tiles - shadows->refresh_tile) {
+    count = num_tiles - shadows->refresh_tile;
+  }
+  uint64_t tiles = count == num_tiles ? SHADOW_MAP_ALL_TILES
+    : (((uint64_t) 1 << count) - 1) << shadows->refresh_tile;
+  shadow_draw_tiles(shadows, &shadows->pending, &shadows->pending_list, tiles);
+  shadows->refresh_tile += count;
+  shadows->refreshed_tiles += count;
+  if (shadows->refresh_tile < num_tiles) {
+    return false;
+  }
+
+  ShadowTarget target = shadows->cache;
+  shadows->cache = shadows->pending;
+  shadows->pending = target;
+  CommandList list = shadows->static_list;
+  shadows->static_list = shadows->pending_list;
+  shadows->pending_list = list;
+  glm_vec3_copy(shadows->pending_light, shadows->light);
+  glm_mat4_copy(shadows->pending_view_projection, shadows->view_projection);
+  shadows->refresh_tile = -1;
+  shadows->redraws += 1;
+  return true;
+}
+
+/* Bring the map up to date for the light and the casters that moved,
+   then hand it to the lighting program. Before the lit draws; the
+   framebuffer and viewport are put back. */
+void shadow_map_update(ShadowMap *shadows, const float *light,
+		       const ShadowCaster *dynamic, int num_dynamic) {
+
+  GLint framebuffer;
+  GLint viewport[4];
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &framebuffer);
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  if (gl_caps.timer_query && !shadows->query_pending[shadows->query_ix]) {
+    gl_caps.BeginQueryEXT(GL_TIME_ELAPSED_EXT, shadows->queries[shadows->query_ix]);
+  }
+
+  /* Not sampled while it is drawn into */
+  glActiveTexture(GL_TEXTURE0 + SHADOW_MAP_UNIT);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glActiveTexture(GL_TEXTURE0);
+  glViewport(0, 0, shadows->config.size, shadows->config.size);
+  glEnable(GL_POLYGON_OFFSET_FILL);
+  glPolygonOffset(1.5f, 4.0f);
+
+  uint64_t restore = shadows->dirty;
+  if (!shadows->config.cache) {
+    shadow_light_view_projection(light, shadows->view_projection);
+    record_static_casters(&shadows->static_list, shadows, shadows->view_projection);
+    shadow_draw_tiles(shadows, &shadows->map, &shadows->static_list, SHADOW_MAP_ALL_TILES);
+    restore = 0;
+  } else if (!shadows->valid) {
+    glm_vec3_copy((float *) light, shadows->light);
+    shadow_light_view_projection(light, shadows->view_projection);
+    record_static_casters(&shadows->static_list, shadows, shadows->view_projection);
+    if (shadows->blit) {
+      shadow_draw_tiles(shadows, &shadows->cache, &shadows->static_list,
+			SHADOW_MAP_ALL_TILES);
+    }
+    shadows->valid = true;
+    shadows->refresh_tile = -1;
+    shadows->redraws += 1;
+    restore = SHADOW_MAP_ALL_TILES;
+  } else if (!shadows->blit) {
+    /* The whole map is drawn from the new list below */
+    if (glm_vec3_distance((float *) light, shadows->light) > shadows->config.threshold) {
+      glm_vec3_copy((float *) light, shadows->light);
+      shadow_light_view_projection(light, shadows->view_projection);
+      record_static_casters(&shadows->static_list, shadows, shadows->view_projection);
+      shadows->redraws += 1;
+      restore = SHADOW_MAP_ALL_TILES;
+    }
+  } else {
+    if (shadows->refresh_tile < 0
+	&& glm_vec3_distance((float *) light, shadows->light) > shadows->config.threshold) {
+      glm_vec3_copy((float *) light, shadows->pending_light);
+      shadow_light_view_projection(light, shadows->pending_view_projection);
+      record_static_casters(&shadows->pending_list, shadows,
+			    shadows->pending_view_projection);
+      shadows->refresh_tile = 0;
+    }
+    if (shadows->refresh_tile >= 0 && shadow_refresh(shadows)) {
+      restore = SHADOW_MAP_ALL_TILES;
+    }
+  }
+  shadow_restore_tiles(shadows, restore);
+
+  /* The dynamic casters that land on the map, over the restored cache */
+  CommandList *list = &shadows->dynamic_list;
+  command_list_reset(list);
+  cmd_use_program(list, shadows->program);
+  cmd_enable_attrib(list, shadows->position_attr);
+  uint64_t covered = 0;
+  for (int i = 0; i < num_dynamic; i++) {
+    uint64_t tiles = shadow_footprint(&dynamic[i], shadows->view_projection,
+				      shadows->config.size);
+    if (tiles == 0) {
+      continue;
+    }
+    covered |= tiles;
+
+    const Mesh *mesh = dynamic[i].mesh;
+    const VertexStream *position = &mesh->layout.position;
+    mat4 world;
+    mat4 mvp;
+    memcpy(world, dynamic[i].world, sizeof(world));
+    glm_mat4_mul(shadows->view_projection, world, mvp);
+    cmd_bind_buffer(list, GL_ARRAY_BUFFER, position->buffer);
+    cmd_vertex_attrib(list, shadows->position_attr, position->size, position->stride,
+		      position->offset);
+    cmd_uniform_matrix4(list, shadows->mvp, mvp[0]);
+    cmd_draw_arrays(list, GL_TRIANGLES, 0, 3 * mesh->num_triangles);
+    shadows->dynamic_draws += 1;
+  }
+  cmd_disable_attrib(list, shadows->position_attr);
+  glBindFramebuffer(GL_FRAMEBUFFER, shadows->map.framebuffer);
+  command_list_replay(list, 1, NULL);
+  shadows->dirty = covered;
+
+  glDisable(GL_POLYGON_OFFSET_FILL);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+  if (gl_caps.timer_query && !shadows->query_pending[shadows->query_ix]) {
+    gl_caps.EndQueryEXT(GL_TIME_ELAPSED_EXT);
+    shadows->query_pending[shadows->query_ix] = true;
+  }
+  shadows->query_ix = (shadows->query_ix + 1) % SHADOW_MAP_QUERIES;
+
+  /* From light space to the map's texture coordinates and depth */
+  mat4 bias = GLM_MAT4_IDENTITY_INIT;
+  vec3 half = { 0.5f, 0.5f, 0.5f };
+  glm_translate(bias, half);
+  glm_scale(bias, half);
+  mat4 shadow_matrix;
+  glm_mat4_mul(bias, shadows->view_projection, shadow_matrix);
+  glUseProgram(shadows->lighting_program);
+  glUniformMatrix4fv(shadows->shadow_matrix, 1, GL_FALSE, shadow_matrix[0]);
+  glActiveTexture(GL_TEXTURE0 + SHADOW_MAP_UNIT);
+  glBindTexture(GL_TEXTURE_2D, shadows->map.texture);
+  glActiveTexture(GL_TEXTURE0);
+  shadows->frames += 1;
+}
+
+/* Once a frame, after the swap: collects the pass times and reports
+   every report_frames frames */
+void shadow_map_report(ShadowMap *shadows) {
+
+  if (gl_caps.timer_query) {
+    GLint disjoint = 0;
+    glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+    for (int slot = 0; slot < SHADOW_MAP_QUERIES; slot++) {
+      if (!shadows->query_pending[slot]) {
+	continue;
+      }
+      GLuint available = 0;
+      gl_caps.GetQueryObjectuivEXT(shadows->queries[slot], GL_QUERY_RESULT_AVAILABLE_EXT,
+				   &available);
+      if (!available) {
+	continue;
+      }
+      GLuint64 elapsed_ns = 0;
+      gl_caps.GetQueryObjectui64vEXT(shadows->queries[slot], GL_QUERY_RESULT_EXT,
+				     &elapsed_ns);
+      shadows->query_pending[slot] = false;
+      if (!disjoint) {
+	shadows->pass_ms += (double) elapsed_ns / 1.0e6;
+	shadows->pass_samples += 1;
+      }
+    }
+  }
+
+  if (shadows->frames < shadows->report_frames) {
+    return;
+  }
+  double frames = shadows->frames;
+  printf("shadows: ");
+  if (shadows->pass_samples > 0) {
+    printf("%.3f ms a frame, ", shadows->pass_ms / shadows->pass_samples);
+  }
+  printf("%.1f dynamic casters and %.1f tiles restored a frame, %d cache redraws "
+	 "(%.1f tiles a frame)\n", shadows->dynamic_draws / frames,
+	 shadows->restored_tiles / frames, shadows->redraws,
+	 shadows->refreshed_tiles / frames);
+  shadows->frames = 0;
+  shadows->redraws = 0;
+  shadows->refreshed_tiles = 0;
+  shadows->restored_tiles = 0;
+  shadows->dynamic_draws = 0;
+  shadows->pass_ms = 0.0;
+  shadows->pass_samples = 0;
+}
+
+/* --bench-shadows: a 16x16 field of cubes under the light, none, one in
+   eight or all of them spinning, with the light still or circling.
+   The shadow pass alone is finished and timed each frame, drawn every
+   frame and cached. */
+void benchmark_shadow_maps(const Cube *cube, const ShadowConfig *base) {
+
+  const int side = 16;
+  const int num_casters = side * side;
+  const int num_frames = 60;
+  const int dynamic_every[3] = { 0, 8, 1 };
+  const char *scenes[3] = { "static", "partly dynamic", "dynamic" };
+
+  mat4 *worlds = (mat4 *) malloc(num_casters * sizeof(mat4));
+  StaticMesh *meshes = (StaticMesh *) malloc(num_casters * sizeof(StaticMesh));
+  ShadowCaster *dynamic = (ShadowCaster *) malloc(num_casters * sizeof(ShadowCaster));
+  vec3 up = { 0.0f, 1.0f, 0.0f };
+
+  printf("Shadow maps, %d cubes, %dx%d map, %d frames each:\n", num_casters,
+	 base->size, base->size, num_frames);
+  printf("\t%15s %8s %7s %14s %9s %15s %8s\n", "scene", "dynamic", "light", "mode",
+	 "pass ms", "tiles restored", "redraws");
+  for (int s = 0; s < 3; s++) {
+    StaticBatch batch;
+    int num_static = 0;
+    int num_dynamic = 0;
+    for (int i = 0; i < num_casters; i++) {
+      vec3 position = { 1.0f * (i % side - side / 2), 0.0f, 1.0f * (i / side - side / 2) };
+      vec3 scale = { 0.35f, 0.35f, 0.35f };
+      glm_mat4_identity(worlds[i]);
+      glm_translate(worlds[i], position);
+      glm_scale(worlds[i], scale);
+      if (dynamic_every[s] > 0 && i % dynamic_every[s] == 0) {
+	dynamic[num_dynamic].mesh = cube->mesh;
+	dynamic[num_dynamic].world = worlds[i][0];
+	num_dynamic += 1;
+      } else {
+	meshes[num_static].vertices = cube->mesh->vertices;
+	meshes[num_static].normals = cube->mesh->normals;
+	meshes[num_static].num_triangles = cube->mesh->num_triangles;
+	memcpy(meshes[num_static].world_matrix, worlds[i][0], sizeof(meshes[0].world_matrix));
+	meshes[num_static].material = 0;
+	num_static += 1;
+      }
+    }
+    static_batch_build(&batch, meshes, num_static);
+
+    for (int moving = 0; moving < 2; moving++) {
+      for (int cached = 0; cached < 2; cached++) {
+	ShadowConfig config = *base;
+	config.cache = cached;
+	ShadowMap shadows;
+	shadow_map_init(&shadows, &config);
+	shadow_map_set_static(&shadows, &batch);
+
+	double ms = 0.0;
+	for (int f = -1; f < num_frames; f++) {
+	  /* Circling 0.04 a frame, so past the default threshold every
+	     seventh frame */
+	  float angle = moving ? 0.02f * f : 0.0f;
+	  vec3 light = { 2.0f * cosf(angle), 8.0f, 2.0f * sinf(angle) };
+	  for (int i = 0; i < num_casters; i += dynamic_every[s] > 0 ? dynamic_every[s]
+		 : num_casters) {
+	    glm_rotate(worlds[i], 0.05f, up);
+	  }
+	  if (f == 0) {
+	    shadows.frames = 0;
+	    shadows.redraws = 0;
+	    shadows.restored_tiles = 0;
+	  }
+	  Uint64 start = SDL_GetPerformanceCounter();
+	  shadow_map_update(&shadows, light, dynamic, num_dynamic);
+	  glFinish();
+	  if (f >= 0) {
+	    ms += (double) (SDL_GetPerformanceCounter() - start) * 1000.0
+	      / (double) SDL_GetPerformanceFrequency();
+	  }
+	}
+	printf("\t%15s %8d %7s %14s %9.3f %15.1f %8d\n", scenes[s], num_dynamic,
+	       moving ? "moving" : "still", cached ? "cached" : "every frame",
+	       ms / num_frames, (double) shadows.restored_tiles / num_frames,
+	       shadows.redraws);
+	shadow_map_destroy(&shadows);
+      }
+    }
+    static_batch_destroy(&batch);
+  }
+  free(worlds);
+  free(meshes);
+  free(dynamic);
+}
+
+#endif
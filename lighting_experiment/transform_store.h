@@ -0,0 +1,379 @@
+#ifndef TRANSFORM_STORE_HEADER
+#define TRANSFORM_STORE_HEADER
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cglm/cglm.h>
+#include <SDL2/SDL.h>
+
+#include "job_system.h"
+#include "simd.h"
+
+// C header-only library holding object transforms as a structure of
+// arrays, so that the per-frame matrix work can be done four objects at
+// a time with SSE/NEON instead of one cglm call chain per object.
+
+/* Batches of four objects per job */
+#define TRANSFORM_GRAIN 64
+
+typedef struct {
+  /* C struct holding every object's transform:
+     - Position, rotation quaternion (x, y, z, w) and scale, one array
+       per component
+     - The world, model-view-projection and normal matrices computed
+       from them each frame, as ordinary cglm matrices for glUniform
+
+     Capacity is a multiple of four and unused slots hold an identity
+     transform, so the kernels never need a scalar tail.
+   */
+  int count;
+  int capacity;
+
+  float *position[3];
+  float *rotation[4];
+  float *scale[3];
+
+  mat4 *world;
+  mat4 *mvp;
+  mat4 *normal;
+
+  /* Batches whose normal matrix was just the world matrix (uniform
+     scale) in the last update */
+  atomic_int rigid_batches;
+} TransformStore;
+
+void transform_store_init(TransformStore *store, int capacity) {
+
+  capacity = (capacity + 3) & ~3;
+  memset(store, 0, sizeof(*store));
+  store->capacity = capacity;
+
+  for (int i = 0; i < 3; i++) {
+    store->position[i] = (float *) calloc(capacity, sizeof(float));
+    store->scale[i] = (float *) calloc(capacity, sizeof(float));
+  }
+  for (int i = 0; i < 4; i++) {
+    store->rotation[i] = (float *) calloc(capacity, sizeof(float));
+  }
+
+  /* cglm wants its matrices aligned */
+  store->world = (mat4 *) aligned_alloc(32, capacity * sizeof(mat4));
+  store->mvp = (mat4 *) aligned_alloc(32, capacity * sizeof(mat4));
+  store->normal = (mat4 *) aligned_alloc(32, capacity * sizeof(mat4));
+
+  for (int i = 0; i < capacity; i++) {
+    store->rotation[3][i] = 1.0f;
+    store->scale[0][i] = 1.0f;
+    store->scale[1][i] = 1.0f;
+    store->scale[2][i] = 1.0f;
+    glm_mat4_identity(store->world[i]);
+    glm_mat4_identity(store->mvp[i]);
+    glm_mat4_identity(store->normal[i]);
+  }
+}
+
+void transform_store_destroy(TransformStore *store) {
+  for (int i = 0; i < 3; i++) {
+    free(store->position[i]);
+    free(store->scale[i]);
+  }
+  for (int i = 0; i < 4; i++) {
+    free(store->rotation[i]);
+  }
+  free(store->world);
+  free(store->mvp);
+  free(store->normal);
+}
+
+/* Add an object with an identity transform. Returns its index, or -1
+   when the store is full. */
+int transform_store_add(TransformStore *store) {
+  if (store->count == store->capacity) {
+    printf("ERROR: transform store is full (%d)\n", store->capacity);
+    return -1;
+  }
+  store->count += 1;
+  return store->count - 1;
+}
+
+void transform_store_set_position(TransformStore *store, int index, vec3 position) {
+  store->position[0][index] = position[0];
+  store->position[1][index] = position[1];
+  store->position[2][index] = position[2];
+}
+
+void transform_store_get_position(TransformStore *store, int index, vec3 position) {
+  position[0] = store->position[0][index];
+  position[1] = store->position[1][index];
+  position[2] = store->position[2][index];
+}
+
+void transform_store_set_scale(TransformStore *store, int index, vec3 scale) {
+  store->scale[0][index] = scale[0];
+  store->scale[1][index] = scale[1];
+  store->scale[2][index] = scale[2];
+}
+
+/* Post-multiply the rotation, i.e. spin about the object's own axes
+   like glm_rotate on the model matrix. */
+void transform_store_rotate(TransformStore *store, int index, versor rotation) {
+  versor current = {
+    store->rotation[0][index], store->rotation[1][index],
+    store->rotation[2][index], store->rotation[3][index]
+  };
+  glm_quat_mul(current, rotation, current);
+  glm_quat_normalize(current);
+  for (int i = 0; i < 4; i++) {
+    store->rotation[i][index] = current[i];
+  }
+}
+
+/* Write four lanes of four column components as one column of four
+   consecutive matrices. */
+static inline void store_columns(mat4 *matrices, int column,
+				 f32x4 x, f32x4 y, f32x4 z, f32x4 w) {
+  f32x4_transpose(&x, &y, &z, &w);
+  f32x4_store(matrices[0][column], x);
+  f32x4_store(matrices[1][column], y);
+  f32x4_store(matrices[2][column], z);
+  f32x4_store(matrices[3][column], w);
+}
+
+/* Compose TRS, multiply by view_projection and build the normal
+   matrices for objects [begin, end), both multiples of four. */
+void transform_store_update_range(TransformStore *store, mat4 view_projection,
+				  int begin, int end) {
+
+  f32x4 zero = f32x4_zero();
+  f32x4 one = f32x4_set1(1.0f);
+  f32x4 two = f32x4_set1(2.0f);
+
+  /* view_projection[k][r] broadcast once for the whole range */
+  f32x4 vp[4][4];
+  for (int k = 0; k < 4; k++) {
+    for (int r = 0; r < 4; r++) {
+      vp[k][r] = f32x4_set1(view_projection[k][r]);
+    }
+  }
+
+  int rigid_batches = 0;
+
+  for (int i = begin; i < end; i += 4) {
+
+    f32x4 qx = f32x4_load(&store->rotation[0][i]);
+    f32x4 qy = f32x4_load(&store->rotation[1][i]);
+    f32x4 qz = f32x4_load(&store->rotation[2][i]);
+    f32x4 qw = f32x4_load(&store->rotation[3][i]);
+    f32x4 sx = f32x4_load(&store->scale[0][i]);
+    f32x4 sy = f32x4_load(&store->scale[1][i]);
+    f32x4 sz = f32x4_load(&store->scale[2][i]);
+
+    /* Rotation matrix from the quaternion, same layout as glm_quat_mat4 */
+    f32x4 xx = f32x4_mul(qx, qx), yy = f32x4_mul(qy, qy), zz = f32x4_mul(qz, qz);
+    f32x4 xy = f32x4_mul(qx, qy), xz = f32x4_mul(qx, qz), yz = f32x4_mul(qy, qz);
+    f32x4 wx = f32x4_mul(qw, qx), wy = f32x4_mul(qw, qy), wz = f32x4_mul(qw, qz);
+
+    /* World matrix columns: rotation columns times scale, then position */
+    f32x4 w[4][4];
+    w[0][0] = f32x4_mul(f32x4_sub(one, f32x4_mul(two, f32x4_add(yy, zz))), sx);
+    w[0][1] = f32x4_mul(f32x4_mul(two, f32x4_add(xy, wz)), sx);
+    w[0][2] = f32x4_mul(f32x4_mul(two, f32x4_sub(xz, wy)), sx);
+    w[1][0] = f32x4_mul(f32x4_mul(two, f32x4_sub(xy, wz)), sy);
+    w[1][1] = f32x4_mul(f32x4_sub(one, f32x4_mul(two, f32x4_add(xx, zz))), sy);
+    w[1][2] = f32x4_mul(f32x4_mul(two, f32x4_add(yz, wx)), sy);
+    w[2][0] = f32x4_mul(f32x4_mul(two, f32x4_add(xz, wy)), sz);
+    w[2][1] = f32x4_mul(f32x4_mul(two, f32x4_sub(yz, wx)), sz);
+    w[2][2] = f32x4_mul(f32x4_sub(one, f32x4_mul(two, f32x4_add(xx, yy))), sz);
+    w[3][0] = f32x4_load(&store->position[0][i]);
+    w[3][1] = f32x4_load(&store->position[1][i]);
+    w[3][2] = f32x4_load(&store->position[2][i]);
+    w[0][3] = zero;
+    w[1][3] = zero;
+    w[2][3] = zero;
+    w[3][3] = one;
+
+    for (int c = 0; c < 4; c++) {
+      store_columns(&store->world[i], c, w[c][0], w[c][1], w[c][2], w[c][3]);
+    }
+
+    /* mvp = view_projection * world, column by column. The last row of
+       the world matrix is (0, 0, 0, 1). */
+    for (int c = 0; c < 4; c++) {
+      f32x4 m[4];
+      for (int r = 0; r < 4; r++) {
+	m[r] = f32x4_mul(vp[0][r], w[c][0]);
+	m[r] = f32x4_madd(vp[1][r], w[c][1], m[r]);
+	m[r] = f32x4_madd(vp[2][r], w[c][2], m[r]);
+	if (c == 3) {
+	  m[r] = f32x4_add(vp[3][r], m[r]);
+	}
+      }
+      store_columns(&store->mvp[i], c, m[0], m[1], m[2], m[3]);
+    }
+
+    /* Normal matrix. With uniform scale the upper 3x3 of the world
+       matrix only differs from its inverse transpose by a factor, and
+       the fragment shader normalises anyway, so use it directly. */
+    int uniform = f32x4_movemask(f32x4_and(f32x4_cmpeq(sx, sy),
+					   f32x4_cmpeq(sy, sz)));
+    if (uniform == 0xF) {
+      for (int c = 0; c < 3; c++) {
+	store_columns(&store->normal[i], c, w[c][0], w[c][1], w[c][2], zero);
+      }
+      rigid_batches += 1;
+    } else {
+      /* Inverse transpose of the 3x3 with columns a, b, c is
+	 [b x c, c x a, a x b] / det */
+      f32x4 n[3][3];
+      for (int col = 0; col < 3; col++) {
+	int p = (col + 1) % 3;
+	int q = (col + 2) % 3;
+	n[col][0] = f32x4_sub(f32x4_mul(w[p][1], w[q][2]), f32x4_mul(w[p][2], w[q][1]));
+	n[col][1] = f32x4_sub(f32x4_mul(w[p][2], w[q][0]), f32x4_mul(w[p][0], w[q][2]));
+	n[col][2] = f32x4_sub(f32x4_mul(w[p][0], w[q][1]), f32x4_mul(w[p][1], w[q][0]));
+      }
+      f32x4 det = f32x4_mul(w[0][0], n[0][0]);
+      det = f32x4_madd(w[0][1], n[0][1], det);
+      det = f32x4_madd(w[0][2], n[0][2], det);
+      f32x4 inv_det = f32x4_div(one, det);
+      for (int c = 0; c < 3; c++) {
+	store_columns(&store->normal[i], c,
+		      f32x4_mul(n[c][0], inv_det),
+		      f32x4_mul(n[c][1], inv_det),
+		      f32x4_mul(n[c][2], inv_det), zero);
+      }
+    }
+    store_columns(&store->normal[i], 3, zero, zero, zero, one);
+  }
+
+  atomic_fetch_add_explicit(&store->rigid_batches, rigid_batches,
+			    memory_order_relaxed);
+}
+
+typedef struct {
+  TransformStore *store;
+  float *view_projection;
+} TransformJob;
+
+void transform_store_job(void *data, int begin, int end) {
+  TransformJob *job = (TransformJob *) data;
+  transform_store_update_range(job->store, (vec4 *) job->view_projection,
+			       begin * 4, end * 4);
+}
+
+/* Update every object's matrices, spread over the job system. */
+void transform_store_update(TransformStore *store, JobSystem *jobs,
+			    mat4 view_projection) {
+  TransformJob job = { store, view_projection[0] };
+  atomic_store(&store->rigid_batches, 0);
+  int batches = (store->count + 3) / 4;
+  parallel_for(jobs, batches, TRANSFORM_GRAIN, transform_store_job, &job);
+}
+
+void benchmark_transforms(void) {
+  /* Compare the per-object cglm path (build the model matrix, multiply
+     by view-projection, full 4x4 inverse for the normal matrix) with
+     the SoA kernels, single threaded, at 1K to 100K objects. */
+
+  const int counts[] = { 1000, 10000, 100000 };
+  const int num_frames = 20;
+
+  mat4 view_projection;
+  glm_perspective(glm_rad(45.0f), 16.0f / 9.0f, 0.1f, 100.0f, view_projection);
+
+  printf("Transform benchmark (%s), %d frames\n",
+#if defined(SIMD_SSE)
+	 "SSE",
+#elif defined(SIMD_NEON)
+	 "NEON",
+#else
+	 "scalar",
+#endif
+	 num_frames);
+
+  for (int c = 0; c < (int) (sizeof(counts) / sizeof(counts[0])); c++) {
+    int count = counts[c];
+
+    TransformStore store;
+    transform_store_init(&store, count);
+    for (int i = 0; i < count; i++) {
+      int index = transform_store_add(&store);
+      vec3 position = { (float) (i % 100), (float) (i / 100 % 100), -10.0f };
+      vec3 axis = { 0.2f, 1.0f, 0.0f };
+      versor rotation;
+      glm_quatv(rotation, 0.001f * i, axis);
+      transform_store_set_position(&store, index, position);
+      transform_store_rotate(&store, index, rotation);
+      if (i % 2 == 1) {
+	vec3 scale = { 1.0f, 2.0f, 0.5f };
+	transform_store_set_scale(&store, index, scale);
+      }
+    }
+
+    /* cglm, one object at a time */
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int frame = 0; frame < num_frames; frame++) {
+      for (int i = 0; i < count; i++) {
+	versor rotation = {
+	  store.rotation[0][i], store.rotation[1][i],
+	  store.rotation[2][i], store.rotation[3][i]
+	};
+	vec3 position = { store.position[0][i], store.position[1][i],
+			  store.position[2][i] };
+	vec3 scale = { store.scale[0][i], store.scale[1][i], store.scale[2][i] };
+
+	mat4 rotation_matrix;
+	glm_translate_make(store.world[i], position);
+	glm_quat_mat4(rotation, rotation_matrix);
+	glm_mat4_mul(store.world[i], rotation_matrix, store.world[i]);
+	glm_scale(store.world[i], scale);
+	glm_mat4_mul(view_projection, store.world[i], store.mvp[i]);
+	glm_mat4_inv(store.world[i], store.normal[i]);
+	glm_mat4_transpose(store.normal[i]);
+      }
+    }
+    double cglm_ms = (double) (SDL_GetPerformanceCounter() - start) * 1000.0
+      / (double) SDL_GetPerformanceFrequency() / num_frames;
+
+    /* Keep the cglm results to check the kernels against */
+    mat4 reference_mvp;
+    mat4 reference_normal;
+    int check = count - 1;
+    glm_mat4_copy(store.mvp[check], reference_mvp);
+    glm_mat4_copy(store.normal[check], reference_normal);
+
+    /* SoA kernels */
+    start = SDL_GetPerformanceCounter();
+    for (int frame = 0; frame < num_frames; frame++) {
+      transform_store_update_range(&store, view_projection, 0, store.capacity);
+    }
+    double soa_ms = (double) (SDL_GetPerformanceCounter() - start) * 1000.0
+      / (double) SDL_GetPerformanceFrequency() / num_frames;
+
+    float max_error = 0.0f;
+    for (int col = 0; col < 4; col++) {
+      for (int row = 0; row < 4; row++) {
+	float error = fabsf(reference_mvp[col][row] - store.mvp[check][col][row]);
+	/* Only the upper 3x3 of the normal matrix is used */
+	if (col < 3 && row < 3) {
+	  float normal_error = fabsf(reference_normal[col][row]
+				     - store.normal[check][col][row]);
+	  error = normal_error > error ? normal_error : error;
+	}
+	max_error = error > max_error ? error : max_error;
+      }
+    }
+
+    printf("\t%6d objects: cglm %8.3f ms, SoA %8.3f ms, speedup %.2fx, "
+	   "max error %g\n",
+	   count, cglm_ms, soa_ms, cglm_ms / soa_ms, max_error);
+
+    transform_store_destroy(&store);
+  }
+}
+
+#endif
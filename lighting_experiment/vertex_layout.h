@@ -0,0 +1,136 @@
+#ifndef VERTEX_LAYOUT_HEADER
+#define VERTEX_LAYOUT_HEADER
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <GLES2/gl2.h>
+
+// C header-only library describing how a mesh's vertex attributes sit in
+// GL buffers.
+//
+// SPLIT keeps one tightly packed buffer per attribute, which is simple
+// but means every vertex fetch reads from three places. INTERLEAVED puts
+// position, normal and uv for each vertex next to each other in one
+// buffer, so a vertex is one contiguous 32 byte read and a mesh needs a
+// single buffer bind. Tile-based GPUs (Mali, VideoCore) tend to prefer
+// the interleaved one.
+
+typedef enum {
+  VERTEX_LAYOUT_SPLIT,
+  VERTEX_LAYOUT_INTERLEAVED
+} VertexLayoutKind;
+
+typedef struct {
+  /* Where one attribute lives: its buffer, float count, stride and
+     byte offset of the first vertex */
+  GLuint buffer;
+  GLint size;
+  GLsizei stride;
+  size_t offset;
+} VertexStream;
+
+typedef struct {
+  VertexLayoutKind kind;
+  VertexStream position;
+  VertexStream normal;
+  VertexStream uv;
+  int num_buffers;
+  GLuint buffers[3];
+  size_t bytes;  /* uploaded to GL */
+} VertexLayout;
+
+const char *vertex_layout_name(VertexLayoutKind kind) {
+  return kind == VERTEX_LAYOUT_INTERLEAVED ? "interleaved" : "split";
+}
+
+/* --layout split|interleaved, interleaved if not given */
+VertexLayoutKind vertex_layout_parse_args(int argc, char *argv[]) {
+  VertexLayoutKind kind = VERTEX_LAYOUT_INTERLEAVED;
+  for (int i = 1; i < argc - 1; i++) {
+    if (strcmp(argv[i], "--layout") == 0) {
+      if (strcmp(argv[i + 1], "split") == 0) {
+	kind = VERTEX_LAYOUT_SPLIT;
+      } else if (strcmp(argv[i + 1], "interleaved") == 0) {
+	kind = VERTEX_LAYOUT_INTERLEAVED;
+      } else {
+	printf("ERROR: unknown vertex layout %s\n", argv[i + 1]);
+      }
+    }
+  }
+  return kind;
+}
+
+static GLuint vertex_layout_buffer(VertexLayout *layout, const void *data, size_t bytes) {
+  GLuint buffer;
+  glGenBuffers(1, &buffer);
+  glBindBuffer(GL_ARRAY_BUFFER, buffer);
+  glBufferData(GL_ARRAY_BUFFER, bytes, data, GL_STATIC_DRAW);
+
+  layout->buffers[layout->num_buffers] = buffer;
+  layout->num_buffers += 1;
+  layout->bytes += bytes;
+  return buffer;
+}
+
+/* Upload num_vertices vertices (xyz positions and normals, uv pairs) in
+   the given layout. uvs may be NULL, in which case there is no uv
+   stream (uv.size is 0). */
+void vertex_layout_upload(VertexLayout *layout, VertexLayoutKind kind,
+			  const GLfloat *positions, const GLfloat *normals,
+			  const GLfloat *uvs, int num_vertices) {
+
+  memset(layout, 0, sizeof(*layout));
+  layout->kind = kind;
+  int uv_size = uvs != NULL ? 2 : 0;
+
+  if (kind == VERTEX_LAYOUT_SPLIT) {
+    layout->position.buffer = vertex_layout_buffer(layout, positions,
+						   num_vertices * 3 * sizeof(GLfloat));
+    layout->position.size = 3;
+    layout->position.stride = 3 * sizeof(GLfloat);
+
+    layout->normal.buffer = vertex_layout_buffer(layout, normals,
+						 num_vertices * 3 * sizeof(GLfloat));
+    layout->normal.size = 3;
+    layout->normal.stride = 3 * sizeof(GLfloat);
+
+    if (uvs != NULL) {
+      layout->uv.buffer = vertex_layout_buffer(layout, uvs,
+					       num_vertices * 2 * sizeof(GLfloat));
+      layout->uv.size = 2;
+      layout->uv.stride = 2 * sizeof(GLfloat);
+    }
+  } else {
+    int floats = 3 + 3 + uv_size;
+    GLfloat *data = (GLfloat *) malloc(num_vertices * floats * sizeof(GLfloat));
+    for (int i = 0; i < num_vertices; i++) {
+      GLfloat *out = &data[i * floats];
+      memcpy(out, &positions[3 * i], 3 * sizeof(GLfloat));
+      memcpy(out + 3, &normals[3 * i], 3 * sizeof(GLfloat));
+      if (uvs != NULL) {
+	memcpy(out + 6, &uvs[2 * i], 2 * sizeof(GLfloat));
+      }
+    }
+    GLuint buffer = vertex_layout_buffer(layout, data,
+					 num_vertices * floats * sizeof(GLfloat));
+    free(data);
+
+    GLsizei stride = floats * sizeof(GLfloat);
+    VertexStream position = { buffer, 3, stride, 0 };
+    VertexStream normal = { buffer, 3, stride, 3 * sizeof(GLfloat) };
+    VertexStream uv = { buffer, uv_size, stride, 6 * sizeof(GLfloat) };
+    layout->position = position;
+    layout->normal = normal;
+    layout->uv = uv;
+  }
+}
+
+void vertex_layout_destroy(VertexLayout *layout) {
+  glDeleteBuffers(layout->num_buffers, layout->buffers);
+  layout->num_buffers = 0;
+  layout->bytes = 0;
+}
+
+#endif
@@ -0,0 +1,573 @@
+/* Quadric error metric simplification into a chain of LODs. */
+#include <float.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+
+#include "mesh_lod.h"
+
+/* Weight of the quadrics that pin open edges in place */
+#define BOUNDARY_WEIGHT 100.0
+
+/* Symmetric 4x4 matrix: a2 ab ac ad b2 bc bd c2 cd d2 */
+typedef struct {
+  double q[10];
+} Quadric;
+
+typedef struct {
+  int count;
+  int capacity;
+  int *items;
+} IntList;
+
+typedef struct {
+  float cost;
+  int a;
+  int b;
+  int version_a;
+  int version_b;
+  float target[3];
+} Collapse;
+
+typedef struct {
+  int num_vertices;
+  float (*positions)[3];
+  Quadric *quadrics;
+  int *versions;       /* -1 once collapsed away */
+  IntList *triangles;  /* triangles around each vertex */
+
+  int num_triangles;
+  int num_alive;
+  int (*corners)[3];
+  bool *alive;
+
+  Collapse *heap;
+  int heap_size;
+  int heap_capacity;
+
+  float max_cost;
+} Simplifier;
+
+/* ---- Small helpers ---- */
+
+static void list_push(IntList *list, int value) {
+  if (list->count == list->capacity) {
+    list->capacity = list->capacity ? list->capacity * 2 : 8;
+    list->items = (int *) realloc(list->items, list->capacity * sizeof(int));
+  }
+  list->items[list->count] = value;
+  list->count += 1;
+}
+
+static void quadric_add_plane(Quadric *quadric, double a, double b, double c,
+			      double d, double weight) {
+  double *q = quadric->q;
+  q[0] += weight * a * a; q[1] += weight * a * b; q[2] += weight * a * c;
+  q[3] += weight * a * d; q[4] += weight * b * b; q[5] += weight * b * c;
+  q[6] += weight * b * d; q[7] += weight * c * c; q[8] += weight * c * d;
+  q[9] += weight * d * d;
+}
+
+static double quadric_error(const Quadric *quadric, const float *v) {
+  const double *q = quadric->q;
+  double x = v[0], y = v[1], z = v[2];
+  return q[0] * x * x + 2.0 * q[1] * x * y + 2.0 * q[2] * x * z + 2.0 * q[3] * x
+    + q[4] * y * y + 2.0 * q[5] * y * z + 2.0 * q[6] * y
+    + q[7] * z * z + 2.0 * q[8] * z + q[9];
+}
+
+static void face_normal(const float *p0, const float *p1, const float *p2,
+			float *normal) {
+  float u[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+  float v[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+  normal[0] = u[1] * v[2] - u[2] * v[1];
+  normal[1] = u[2] * v[0] - u[0] * v[2];
+  normal[2] = u[0] * v[1] - u[1] * v[0];
+}
+
+static float normalize(float *v) {
+  float length = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+  if (length > 0.0f) {
+    v[0] /= length;
+    v[1] /= length;
+    v[2] /= length;
+  }
+  return length;
+}
+
+/* ---- Welding ---- */
+
+typedef struct {
+  float position[3];
+  int index;
+} WeldEntry;
+
+static int compare_weld(const void *left, const void *right) {
+  const WeldEntry *a = (const WeldEntry *) left;
+  const WeldEntry *b = (const WeldEntry *) right;
+  for (int i = 0; i < 3; i++) {
+    if (a->position[i] < b->position[i]) return -1;
+    if (a->position[i] > b->position[i]) return 1;
+  }
+  return a->index - b->index;
+}
+
+/* Share vertices with identical positions. Fills corners and returns
+   the number of unique positions. */
+static int weld(Simplifier *s, const float *vertices, int num_triangles) {
+
+  int num_corners = 3 * num_triangles;
+  WeldEntry *entries = (WeldEntry *) malloc(num_corners * sizeof(WeldEntry));
+  for (int i = 0; i < num_corners; i++) {
+    memcpy(entries[i].position, &vertices[3 * i], 3 * sizeof(float));
+    entries[i].index = i;
+  }
+  qsort(entries, num_corners, sizeof(WeldEntry), compare_weld);
+
+  s->positions = malloc(num_corners * sizeof(*s->positions));
+  int *flat_corners = (int *) s->corners;
+  int num_vertices = 0;
+  for (int i = 0; i < num_corners; i++) {
+    if (i == 0 || memcmp(entries[i].position, entries[i - 1].position,
+			 3 * sizeof(float)) != 0) {
+      memcpy(s->positions[num_vertices], entries[i].position, 3 * sizeof(float));
+      num_vertices += 1;
+    }
+    flat_corners[entries[i].index] = num_vertices - 1;
+  }
+
+  free(entries);
+  return num_vertices;
+}
+
+/* ---- Boundary edges ---- */
+
+typedef struct {
+  int low;
+  int high;
+  int triangle;
+} EdgeEntry;
+
+static int compare_edge(const void *left, const void *right) {
+  const EdgeEntry *a = (const EdgeEntry *) left;
+  const EdgeEntry *b = (const EdgeEntry *) right;
+  if (a->low != b->low) return a->low - b->low;
+  return a->high - b->high;
+}
+
+static void add_boundary_quadrics(Simplifier *s) {
+
+  int num_edges = 3 * s->num_triangles;
+  EdgeEntry *edges = (EdgeEntry *) malloc(num_edges * sizeof(EdgeEntry));
+  for (int t = 0; t < s->num_triangles; t++) {
+    for (int e = 0; e < 3; e++) {
+      int a = s->corners[t][e];
+      int b = s->corners[t][(e + 1) % 3];
+      edges[3 * t + e].low = a < b ? a : b;
+      edges[3 * t + e].high = a < b ? b : a;
+      edges[3 * t + e].triangle = t;
+    }
+  }
+  qsort(edges, num_edges, sizeof(EdgeEntry), compare_edge);
+
+  for (int i = 0; i < num_edges; i++) {
+    bool shared = (i > 0 && compare_edge(&edges[i], &edges[i - 1]) == 0)
+      || (i + 1 < num_edges && compare_edge(&edges[i], &edges[i + 1]) == 0);
+    if (shared) {
+      continue;
+    }
+
+    /* Plane through the edge, at right angles to its face */
+    int *tri = s->corners[edges[i].triangle];
+    float normal[3];
+    face_normal(s->positions[tri[0]], s->positions[tri[1]], s->positions[tri[2]],
+		normal);
+    const float *p0 = s->positions[edges[i].low];
+    const float *p1 = s->positions[edges[i].high];
+    float edge[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+    float plane[3] = {
+      edge[1] * normal[2] - edge[2] * normal[1],
+      edge[2] * normal[0] - edge[0] * normal[2],
+      edge[0] * normal[1] - edge[1] * normal[0]
+    };
+    if (normalize(plane) == 0.0f) {
+      continue;
+    }
+    double d = -(plane[0] * p0[0] + plane[1] * p0[1] + plane[2] * p0[2]);
+    quadric_add_plane(&s->quadrics[edges[i].low], plane[0], plane[1], plane[2], d,
+		      BOUNDARY_WEIGHT);
+    quadric_add_plane(&s->quadrics[edges[i].high], plane[0], plane[1], plane[2], d,
+		      BOUNDARY_WEIGHT);
+  }
+
+  free(edges);
+}
+
+/* ---- Collapse heap ---- */
+
+static void heap_push(Simplifier *s, const Collapse *collapse) {
+  if (s->heap_size == s->heap_capacity) {
+    s->heap_capacity = s->heap_capacity ? s->heap_capacity * 2 : 1024;
+    s->heap = (Collapse *) realloc(s->heap, s->heap_capacity * sizeof(Collapse));
+  }
+  int i = s->heap_size;
+  s->heap_size += 1;
+  while (i > 0 && s->heap[(i - 1) / 2].cost > collapse->cost) {
+    s->heap[i] = s->heap[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  s->heap[i] = *collapse;
+}
+
+static Collapse heap_pop(Simplifier *s) {
+  Collapse top = s->heap[0];
+  s->heap_size -= 1;
+  Collapse last = s->heap[s->heap_size];
+  int i = 0;
+  while (true) {
+    int child = 2 * i + 1;
+    if (child >= s->heap_size) {
+      break;
+    }
+    if (child + 1 < s->heap_size && s->heap[child + 1].cost < s->heap[child].cost) {
+      child += 1;
+    }
+    if (s->heap[child].cost >= last.cost) {
+      break;
+    }
+    s->heap[i] = s->heap[child];
+    i = child;
+  }
+  if (s->heap_size > 0) {
+    s->heap[i] = last;
+  }
+  return top;
+}
+
+/* Cheapest of the two end points and the midpoint. Solving for the
+   optimal point is more accurate but falls over on flat regions. */
+static void push_collapse(Simplifier *s, int a, int b) {
+
+  Quadric q;
+  for (int i = 0; i < 10; i++) {
+    q.q[i] = s->quadrics[a].q[i] + s->quadrics[b].q[i];
+  }
+
+  const float *pa = s->positions[a];
+  const float *pb = s->positions[b];
+  float mid[3] = { 0.5f * (pa[0] + pb[0]), 0.5f * (pa[1] + pb[1]),
+		   0.5f * (pa[2] + pb[2]) };
+  const float *candidates[3] = { pa, pb, mid };
+
+  Collapse collapse;
+  collapse.cost = FLT_MAX;
+  for (int c = 0; c < 3; c++) {
+    double error = quadric_error(&q, candidates[c]);
+    if (error < collapse.cost) {
+      collapse.cost = error < 0.0 ? 0.0f : (float) error;
+      memcpy(collapse.target, candidates[c], 3 * sizeof(float));
+    }
+  }
+  collapse.a = a;
+  collapse.b = b;
+  collapse.version_a = s->versions[a];
+  collapse.version_b = s->versions[b];
+  heap_push(s, &collapse);
+}
+
+/* Would moving a and b to target turn any surviving face over? */
+static bool collapse_flips(Simplifier *s, int a, int b, const float *target) {
+  int ends[2] = { a, b };
+  for (int e = 0; e < 2; e++) {
+    IntList *list = &s->triangles[ends[e]];
+    for (int i = 0; i < list->count; i++) {
+      int t = list->items[i];
+      int *tri = s->corners[t];
+      if (!s->alive[t]) {
+	continue;
+      }
+      bool has_a = tri[0] == a || tri[1] == a || tri[2] == a;
+      bool has_b = tri[0] == b || tri[1] == b || tri[2] == b;
+      if (has_a && has_b) {
+	continue;  /* collapses away */
+      }
+
+      const float *before[3];
+      const float *after[3];
+      for (int c = 0; c < 3; c++) {
+	before[c] = s->positions[tri[c]];
+	after[c] = (tri[c] == a || tri[c] == b) ? target : before[c];
+      }
+      float old_normal[3], new_normal[3];
+      face_normal(before[0], before[1], before[2], old_normal);
+      face_normal(after[0], after[1], after[2], new_normal);
+      float dot = old_normal[0] * new_normal[0] + old_normal[1] * new_normal[1]
+	+ old_normal[2] * new_normal[2];
+      if (dot <= 0.0f) {
+	return true;
+      }
+    }
+  }
+  return false;
+}
+
+/* Move b into a. Returns false if the collapse was refused. */
+static bool collapse_edge(Simplifier *s, const Collapse *collapse) {
+
+  int a = collapse->a;
+  int b = collapse->b;
+  if (collapse_flips(s, a, b, collapse->target)) {
+    return false;
+  }
+
+  memcpy(s->positions[a], collapse->target, 3 * sizeof(float));
+  for (int i = 0; i < 10; i++) {
+    s->quadrics[a].q[i] += s->quadrics[b].q[i];
+  }
+  s->versions[a] += 1;
+  s->versions[b] = -1;
+  if (collapse->cost > s->max_cost) {
+    s->max_cost = collapse->cost;
+  }
+
+  IntList *list_b = &s->triangles[b];
+  for (int i = 0; i < list_b->count; i++) {
+    int t = list_b->items[i];
+    if (!s->alive[t]) {
+      continue;
+    }
+    int *tri = s->corners[t];
+    bool has_a = tri[0] == a || tri[1] == a || tri[2] == a;
+    if (has_a) {
+      s->alive[t] = false;
+      s->num_alive -= 1;
+      continue;
+    }
+    for (int c = 0; c < 3; c++) {
+      if (tri[c] == b) {
+	tri[c] = a;
+      }
+    }
+    list_push(&s->triangles[a], t);
+  }
+  free(list_b->items);
+  memset(list_b, 0, sizeof(*list_b));
+
+  /* Re-cost every edge out of the moved vertex, and drop dead faces
+     from its list while we are here */
+  IntList *list_a = &s->triangles[a];
+  int kept = 0;
+  for (int i = 0; i < list_a->count; i++) {
+    int t = list_a->items[i];
+    if (!s->alive[t]) {
+      continue;
+    }
+    list_a->items[kept] = t;
+    kept += 1;
+    for (int c = 0; c < 3; c++) {
+      int other = s->corners[t][c];
+      if (other != a) {
+	push_collapse(s, a, other);
+      }
+    }
+  }
+  list_a->count = kept;
+  return true;
+}
+
+static void snapshot(Simplifier *s, MeshLOD *lod) {
+
+  lod->num_triangles = s->num_alive;
+  lod->vertices = (float *) malloc(9 * s->num_alive * sizeof(float));
+  lod->normals = (float *) malloc(9 * s->num_alive * sizeof(float));
+  lod->error = sqrtf(s->max_cost);
+
+  int out = 0;
+  for (int t = 0; t < s->num_triangles; t++) {
+    if (!s->alive[t]) {
+      continue;
+    }
+    int *tri = s->corners[t];
+    float normal[3];
+    face_normal(s->positions[tri[0]], s->positions[tri[1]], s->positions[tri[2]],
+		normal);
+    normalize(normal);
+    for (int c = 0; c < 3; c++) {
+      memcpy(&lod->vertices[9 * out + 3 * c], s->positions[tri[c]], 3 * sizeof(float));
+      memcpy(&lod->normals[9 * out + 3 * c], normal, 3 * sizeof(float));
+    }
+    out += 1;
+  }
+}
+
+/* ---- Public interface ---- */
+
+void mesh_lod_build(MeshLODChain *chain, const float *vertices, int num_triangles,
+		    const float *ratios, int num_ratios) {
+
+  Uint64 start = SDL_GetPerformanceCounter();
+  memset(chain, 0, sizeof(*chain));
+  if (num_triangles <= 0) {
+    printf("ERROR: mesh LOD needs some triangles\n");
+    return;
+  }
+  if (num_ratios > MESH_LOD_MAX_LEVELS - 1) {
+    num_ratios = MESH_LOD_MAX_LEVELS - 1;
+  }
+
+  /* Level 0 is the mesh as loaded */
+  MeshLOD *full = &chain->levels[0];
+  full->num_triangles = num_triangles;
+  full->vertices = (float *) malloc(9 * num_triangles * sizeof(float));
+  full->normals = (float *) malloc(9 * num_triangles * sizeof(float));
+  memcpy(full->vertices, vertices, 9 * num_triangles * sizeof(float));
+  for (int t = 0; t < num_triangles; t++) {
+    float normal[3];
+    face_normal(&vertices[9 * t], &vertices[9 * t + 3], &vertices[9 * t + 6], normal);
+    normalize(normal);
+    for (int c = 0; c < 3; c++) {
+      memcpy(&full->normals[9 * t + 3 * c], normal, 3 * sizeof(float));
+    }
+  }
+  chain->num_levels = 1;
+
+  Simplifier s;
+  memset(&s, 0, sizeof(s));
+  s.num_triangles = num_triangles;
+  s.num_alive = num_triangles;
+  s.corners = malloc(num_triangles * sizeof(*s.corners));
+  s.alive = (bool *) malloc(num_triangles * sizeof(bool));
+  s.num_vertices = weld(&s, vertices, num_triangles);
+  s.quadrics = (Quadric *) calloc(s.num_vertices, sizeof(Quadric));
+  s.versions = (int *) calloc(s.num_vertices, sizeof(int));
+  s.triangles = (IntList *) calloc(s.num_vertices, sizeof(IntList));
+
+  /* Every face's plane goes into the quadric of its three corners */
+  for (int t = 0; t < num_triangles; t++) {
+    int *tri = s.corners[t];
+    s.alive[t] = true;
+    float normal[3];
+    face_normal(s.positions[tri[0]], s.positions[tri[1]], s.positions[tri[2]],
+		normal);
+    if (normalize(normal) == 0.0f) {
+      /* Degenerate: never in a vertex's list, so never updated or
+	 collapsed away, and nothing to draw */
+      s.alive[t] = false;
+      s.num_alive -= 1;
+      continue;
+    }
+    const float *p = s.positions[tri[0]];
+    double d = -(normal[0] * p[0] + normal[1] * p[1] + normal[2] * p[2]);
+    for (int c = 0; c < 3; c++) {
+      quadric_add_plane(&s.quadrics[tri[c]], normal[0], normal[1], normal[2], d, 1.0);
+      list_push(&s.triangles[tri[c]], t);
+    }
+  }
+  add_boundary_quadrics(&s);
+
+  /* Each edge once, from its lower numbered end */
+  for (int t = 0; t < num_triangles; t++) {
+    if (!s.alive[t]) {
+      continue;
+    }
+    for (int e = 0; e < 3; e++) {
+      int a = s.corners[t][e];
+      int b = s.corners[t][(e + 1) % 3];
+      if (a < b) {
+	push_collapse(&s, a, b);
+      }
+    }
+  }
+
+  for (int r = 0; r < num_ratios; r++) {
+    int target = (int) (ratios[r] * num_triangles);
+    while (s.num_alive > target && s.heap_size > 0) {
+      Collapse collapse = heap_pop(&s);
+      if (s.versions[collapse.a] != collapse.version_a
+	  || s.versions[collapse.b] != collapse.version_b) {
+	continue;  /* stale */
+      }
+      collapse_edge(&s, &collapse);
+    }
+    if (s.num_alive < 4
+	|| s.num_alive >= chain->levels[chain->num_levels - 1].num_triangles) {
+      printf("mesh LOD: stopping at %d levels, nothing useful below %d "
+	     "triangles\n", chain->num_levels,
+	     chain->levels[chain->num_levels - 1].num_triangles);
+      break;
+    }
+    snapshot(&s, &chain->levels[chain->num_levels]);
+    chain->num_levels += 1;
+  }
+
+  for (int v = 0; v < s.num_vertices; v++) {
+    free(s.triangles[v].items);
+  }
+  free(s.triangles);
+  free(s.versions);
+  free(s.quadrics);
+  free(s.positions);
+  free(s.corners);
+  free(s.alive);
+  free(s.heap);
+
+  chain->build_ms = (double) (SDL_GetPerformanceCounter() - start) * 1000.0
+    / (double) SDL_GetPerformanceFrequency();
+
+  printf("mesh LOD: %d welded vertices, built %d levels in %.1f ms\n",
+	 s.num_vertices, chain->num_levels, chain->build_ms);
+  for (int i = 0; i < chain->num_levels; i++) {
+    printf("\tLOD %d: %d triangles, error %g\n", i,
+	   chain->levels[i].num_triangles, chain->levels[i].error);
+  }
+}
+
+void mesh_lod_free(MeshLODChain *chain) {
+  for (int i = 0; i < chain->num_levels; i++) {
+    free(chain->levels[i].vertices);
+    free(chain->levels[i].normals);
+  }
+  chain->num_levels = 0;
+}
+
+float mesh_lod_screen_radius(float radius, float distance,
+			     float projection_y_scale, int viewport_height) {
+  if (distance <= 0.0f) {
+    return FLT_MAX;
+  }
+  return radius * projection_y_scale / distance * 0.5f * viewport_height;
+}
+
+int mesh_lod_select(const MeshLODChain *chain, int current, float screen_radius_px) {
+
+  if (current < 0) {
+    current = 0;
+  }
+  if (current >= chain->num_levels) {
+    current = chain->num_levels - 1;
+  }
+
+  /* Step one level at a time, and only once we are clearly past the
+     threshold between the two */
+  while (current + 1 < chain->num_levels) {
+    float threshold = MESH_LOD_BASE_PX / (float) (1 << current);
+    if (screen_radius_px < threshold * (1.0f - MESH_LOD_HYSTERESIS)) {
+      current += 1;
+    } else {
+      break;
+    }
+  }
+  while (current > 0) {
+    float threshold = MESH_LOD_BASE_PX / (float) (1 << (current - 1));
+    if (screen_radius_px > threshold * (1.0f + MESH_LOD_HYSTERESIS)) {
+      current -= 1;
+    } else {
+      break;
+    }
+  }
+  return current;
+}
@@ -0,0 +1,56 @@
+#ifndef MESH_LOD_H_
+#define MESH_LOD_H_
+
+/* Mesh levels of detail.
+
+   mesh_lod_build welds a triangle soup by position and simplifies it
+   with quadric error metric edge collapses (Garland and Heckbert),
+   snapshotting the mesh as it passes each requested fraction of the
+   original triangle count. Open edges get an extra perpendicular
+   quadric so holes and rims keep their shape. Collapses that would
+   flip a face are refused.
+
+   Each level records its error bound: the square root of the largest
+   quadric error accepted so far. Roughly, no vertex has moved further
+   than that from the planes it started on, in model units.
+
+   Levels are picked per frame from the object's projected radius in
+   pixels, with some hysteresis so an object sitting near a threshold
+   does not flicker between two levels.
+*/
+
+#define MESH_LOD_MAX_LEVELS 6
+
+/* Level k is used while the projected radius is below
+   MESH_LOD_BASE_PX / 2^(k - 1) pixels */
+#define MESH_LOD_BASE_PX 200.0f
+#define MESH_LOD_HYSTERESIS 0.15f
+
+typedef struct {
+  int num_triangles;
+  float *vertices;  /* xyz per vertex, three vertices per triangle */
+  float *normals;   /* flat, one per vertex */
+  float error;      /* model units */
+} MeshLOD;
+
+typedef struct {
+  int num_levels;
+  MeshLOD levels[MESH_LOD_MAX_LEVELS];
+  double build_ms;
+} MeshLODChain;
+
+/* Level 0 is a copy of the input; then one level per entry in ratios,
+   e.g. { 0.5f, 0.25f, 0.125f }. */
+void mesh_lod_build(MeshLODChain *chain, const float *vertices, int num_triangles,
+		    const float *ratios, int num_ratios);
+void mesh_lod_free(MeshLODChain *chain);
+
+/* Radius in pixels of a sphere of radius at distance in front of a
+   perspective camera. projection_y_scale is projection[1][1]. */
+float mesh_lod_screen_radius(float radius, float distance,
+			     float projection_y_scale, int viewport_height);
+
+/* The level to draw next, given the one drawn last frame. */
+int mesh_lod_select(const MeshLODChain *chain, int current, float screen_radius_px);
+
+#endif // MESH_LOD_H_
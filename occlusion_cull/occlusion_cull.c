@@ -0,0 +1,419 @@
+/* Software depth rasteriser and hierarchical Z occlusion tests. */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "occlusion_cull.h"
+#include "simd.h"
+
+/* Triangles with a vertex this close to the eye plane are left out.
+   Dropping an occluder is always safe. */
+#define NEAR_W 1e-3f
+
+static double ms_since(Uint64 start) {
+  return (double) (SDL_GetPerformanceCounter() - start) * 1000.0
+    / (double) SDL_GetPerformanceFrequency();
+}
+
+static bool is_power_of_two(int value) {
+  return value > 0 && (value & (value - 1)) == 0;
+}
+
+void occlusion_default_config(OcclusionConfig *config) {
+  config->width = 256;
+  config->height = 128;
+  config->enabled = true;
+  config->report_frames = 5 * 60;
+}
+
+void occlusion_parse_args(OcclusionConfig *config, int argc, char *argv[]) {
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--no-occlusion") == 0) {
+      config->enabled = false;
+    } else if (strcmp(argv[i], "--occlusion-size") == 0 && i + 1 < argc) {
+      int width, height;
+      if (sscanf(argv[i + 1], "%dx%d", &width, &height) == 2
+	  && is_power_of_two(width) && is_power_of_two(height) && width >= 4) {
+	config->width = width;
+	config->height = height;
+      } else {
+	printf("ERROR: --occlusion-size wants powers of two like 256x128, "
+	       "got %s\n", argv[i + 1]);
+      }
+    }
+  }
+}
+
+void occlusion_init(OcclusionBuffer *buffer, const OcclusionConfig *config) {
+
+  memset(buffer, 0, sizeof(*buffer));
+  buffer->config = *config;
+
+  int width = config->width;
+  int height = config->height;
+  while (buffer->num_levels < OCCLUSION_MAX_LEVELS && width >= 1 && height >= 1) {
+    buffer->level_width[buffer->num_levels] = width;
+    buffer->level_height[buffer->num_levels] = height;
+    buffer->levels[buffer->num_levels] = (float *) malloc(width * height * sizeof(float));
+    buffer->num_levels += 1;
+    if (width == 1 || height == 1) {
+      break;
+    }
+    width /= 2;
+    height /= 2;
+  }
+
+  buffer->triangle_capacity = 1024;
+  buffer->triangles = (float *) malloc(buffer->triangle_capacity * 9 * sizeof(float));
+
+  printf("Occlusion culling: %s, %dx%d depth buffer, %d pyramid levels\n",
+	 config->enabled ? "on" : "off", config->width, config->height,
+	 buffer->num_levels);
+}
+
+void occlusion_destroy(OcclusionBuffer *buffer) {
+  for (int i = 0; i < buffer->num_levels; i++) {
+    free(buffer->levels[i]);
+    buffer->levels[i] = NULL;
+  }
+  free(buffer->triangles);
+  buffer->triangles = NULL;
+}
+
+void occlusion_begin_frame(OcclusionBuffer *buffer) {
+  buffer->num_triangles = 0;
+}
+
+void occlusion_add_occluder(OcclusionBuffer *buffer, const float *mvp,
+			    const float *vertices, int num_triangles) {
+
+  Uint64 start = SDL_GetPerformanceCounter();
+
+  if (buffer->num_triangles + num_triangles > buffer->triangle_capacity) {
+    int capacity = buffer->triangle_capacity;
+    while (buffer->num_triangles + num_triangles > capacity) {
+      capacity *= 2;
+    }
+    float *triangles = (float *) realloc(buffer->triangles,
+					 capacity * 9 * sizeof(float));
+    if (triangles == NULL) {
+      printf("ERROR: could not grow the occluder list to %d triangles\n", capacity);
+      return;
+    }
+    buffer->triangles = triangles;
+    buffer->triangle_capacity = capacity;
+  }
+
+  f32x4 column[4];
+  for (int c = 0; c < 4; c++) {
+    column[c] = f32x4_load(&mvp[4 * c]);
+  }
+  float half_width = 0.5f * buffer->config.width;
+  float half_height = 0.5f * buffer->config.height;
+
+  for (int t = 0; t < num_triangles; t++) {
+    float *out = &buffer->triangles[9 * buffer->num_triangles];
+    bool behind = false;
+
+    for (int v = 0; v < 3; v++) {
+      const float *in = &vertices[9 * t + 3 * v];
+      f32x4 clip = f32x4_madd(column[0], f32x4_set1(in[0]), column[3]);
+      clip = f32x4_madd(column[1], f32x4_set1(in[1]), clip);
+      clip = f32x4_madd(column[2], f32x4_set1(in[2]), clip);
+
+      float xyzw[4];
+      f32x4_store(xyzw, clip);
+      if (xyzw[3] < NEAR_W) {
+	behind = true;
+	break;
+      }
+      float inv_w = 1.0f / xyzw[3];
+      out[3 * v] = (xyzw[0] * inv_w + 1.0f) * half_width;
+      out[3 * v + 1] = (xyzw[1] * inv_w + 1.0f) * half_height;
+      out[3 * v + 2] = xyzw[2] * inv_w * 0.5f + 0.5f;
+    }
+
+    if (!behind) {
+      buffer->num_triangles += 1;
+    }
+  }
+
+  buffer->raster_ms += ms_since(start);
+}
+
+/* Draw every queued triangle into rows [row_begin, row_end). */
+static void rasterize_band(OcclusionBuffer *buffer, int row_begin, int row_end) {
+
+  int width = buffer->config.width;
+  float *depth = buffer->levels[0];
+
+  for (int i = row_begin * width; i < row_end * width; i++) {
+    depth[i] = 1.0f;
+  }
+
+  f32x4 zero = f32x4_zero();
+  f32x4 lane_offset = f32x4_set(0.5f, 1.5f, 2.5f, 3.5f);
+
+  for (int t = 0; t < buffer->num_triangles; t++) {
+    const float *tri = &buffer->triangles[9 * t];
+    float x0 = tri[0], y0 = tri[1], z0 = tri[2];
+    float x1 = tri[3], y1 = tri[4], z1 = tri[5];
+    float x2 = tri[6], y2 = tri[7], z2 = tri[8];
+
+    float area = (x1 - x0) * (y2 - y0) - (x2 - x0) * (y1 - y0);
+    if (area == 0.0f) {
+      continue;
+    }
+    if (area < 0.0f) {
+      /* Either winding will do for depth - make it counter-clockwise */
+      float swap;
+      swap = x1; x1 = x2; x2 = swap;
+      swap = y1; y1 = y2; y2 = swap;
+      swap = z1; z1 = z2; z2 = swap;
+      area = -area;
+    }
+
+    /* Bounding box, clipped to the band and the buffer */
+    float min_y = fminf(y0, fminf(y1, y2));
+    float max_y = fmaxf(y0, fmaxf(y1, y2));
+    int y_begin = (int) floorf(min_y);
+    int y_end = (int) ceilf(max_y);
+    y_begin = y_begin < row_begin ? row_begin : y_begin;
+    y_end = y_end > row_end ? row_end : y_end;
+    if (y_begin >= y_end) {
+      continue;
+    }
+    float min_x = fminf(x0, fminf(x1, x2));
+    float max_x = fmaxf(x0, fmaxf(x1, x2));
+    int x_begin = (int) floorf(min_x);
+    int x_end = (int) ceilf(max_x);
+    x_begin = x_begin < 0 ? 0 : x_begin & ~3;
+    x_end = x_end > width ? width : x_end;
+    if (x_begin >= x_end) {
+      continue;
+    }
+
+    /* Edge functions e = a x + b y + c, positive inside. Each is moved
+       in by half a pixel, so a pixel centre only passes when the whole
+       pixel is inside: a partly covered pixel must not hide anything. */
+    float a0 = y1 - y2, b0 = x2 - x1, c0 = x1 * y2 - x2 * y1;
+    float a1 = y2 - y0, b1 = x0 - x2, c1 = x2 * y0 - x0 * y2;
+    float a2 = y0 - y1, b2 = x1 - x0, c2 = x0 * y1 - x1 * y0;
+    c0 -= 0.5f * (fabsf(a0) + fabsf(b0));
+    c1 -= 0.5f * (fabsf(a1) + fabsf(b1));
+    c2 -= 0.5f * (fabsf(a2) + fabsf(b2));
+
+    /* Depth is affine in screen space: z = z0 + dzdx (x - x0) + dzdy (y - y0).
+       It is written at the farthest corner of the pixel rather than
+       its centre, for the same reason. */
+    float inv_area = 1.0f / area;
+    float dzdx = (a0 * z0 + a1 * z1 + a2 * z2) * inv_area;
+    float dzdy = (b0 * z0 + b1 * z1 + b2 * z2) * inv_area;
+    float z_corner = 0.5f * (fabsf(dzdx) + fabsf(dzdy));
+
+    f32x4 va0 = f32x4_set1(a0), va1 = f32x4_set1(a1), va2 = f32x4_set1(a2);
+    f32x4 vdzdx = f32x4_set1(dzdx);
+
+    for (int y = y_begin; y < y_end; y++) {
+      float py = y + 0.5f;
+      f32x4 row0 = f32x4_set1(b0 * py + c0);
+      f32x4 row1 = f32x4_set1(b1 * py + c1);
+      f32x4 row2 = f32x4_set1(b2 * py + c2);
+      f32x4 row_z = f32x4_set1(z0 + dzdy * (py - y0) - dzdx * x0 + z_corner);
+      float *depth_row = &depth[y * width];
+
+      for (int x = x_begin; x < x_end; x += 4) {
+	f32x4 px = f32x4_add(f32x4_set1((float) x), lane_offset);
+	f32x4 e0 = f32x4_madd(va0, px, row0);
+	f32x4 e1 = f32x4_madd(va1, px, row1);
+	f32x4 e2 = f32x4_madd(va2, px, row2);
+	f32x4 outside = f32x4_or(f32x4_cmplt(e0, zero),
+				 f32x4_or(f32x4_cmplt(e1, zero),
+					  f32x4_cmplt(e2, zero)));
+	if (f32x4_movemask(outside) == 0xF) {
+	  continue;
+	}
+
+	f32x4 z = f32x4_madd(vdzdx, px, row_z);
+	f32x4 old = f32x4_load(&depth_row[x]);
+	f32x4_store(&depth_row[x], f32x4_select(outside, old, f32x4_min(old, z)));
+      }
+    }
+  }
+}
+
+static void rasterize_job(void *data, int begin, int end) {
+  OcclusionBuffer *buffer = (OcclusionBuffer *) data;
+  for (int band = begin; band < end; band++) {
+    int row_begin = band * OCCLUSION_BAND_ROWS;
+    int row_end = row_begin + OCCLUSION_BAND_ROWS;
+    if (row_end > buffer->config.height) {
+      row_end = buffer->config.height;
+    }
+    rasterize_band(buffer, row_begin, row_end);
+  }
+}
+
+/* Each texel of a level is the farthest of the four below it */
+static void build_level(OcclusionBuffer *buffer, int level) {
+  const float *below = buffer->levels[level - 1];
+  int below_width = buffer->level_width[level - 1];
+  float *out = buffer->levels[level];
+  int width = buffer->level_width[level];
+  int height = buffer->level_height[level];
+
+  for (int y = 0; y < height; y++) {
+    const float *row_a = &below[(2 * y) * below_width];
+    const float *row_b = &below[(2 * y + 1) * below_width];
+    for (int x = 0; x < width; x++) {
+      float a = fmaxf(row_a[2 * x], row_a[2 * x + 1]);
+      float b = fmaxf(row_b[2 * x], row_b[2 * x + 1]);
+      out[y * width + x] = fmaxf(a, b);
+    }
+  }
+}
+
+void occlusion_rasterize(OcclusionBuffer *buffer, JobSystem *jobs) {
+
+  Uint64 start = SDL_GetPerformanceCounter();
+
+  int num_bands = (buffer->config.height + OCCLUSION_BAND_ROWS - 1)
+    / OCCLUSION_BAND_ROWS;
+  parallel_for(jobs, num_bands, 1, rasterize_job, buffer);
+
+  for (int level = 1; level < buffer->num_levels; level++) {
+    build_level(buffer, level);
+  }
+
+  buffer->triangles_drawn += buffer->num_triangles;
+  buffer->raster_ms += ms_since(start);
+}
+
+bool occlusion_test_box(const OcclusionBuffer *buffer, const float *vp,
+			const float *center, const float *extent) {
+
+  /* All eight corners at once, four per vector */
+  f32x4 corner_x = f32x4_set(-1.0f, 1.0f, -1.0f, 1.0f);
+  f32x4 corner_y = f32x4_set(-1.0f, -1.0f, 1.0f, 1.0f);
+  f32x4 xs = f32x4_madd(corner_x, f32x4_set1(extent[0]), f32x4_set1(center[0]));
+  f32x4 ys = f32x4_madd(corner_y, f32x4_set1(extent[1]), f32x4_set1(center[1]));
+
+  float screen_min_x = 1e30f, screen_max_x = -1e30f;
+  float screen_min_y = 1e30f, screen_max_y = -1e30f;
+  float nearest = 1e30f;
+
+  for (int half = 0; half < 2; half++) {
+    f32x4 zs = f32x4_set1(center[2] + (half == 0 ? -extent[2] : extent[2]));
+    f32x4 clip[4];
+    for (int r = 0; r < 4; r++) {
+      clip[r] = f32x4_madd(f32x4_set1(vp[r]), xs, f32x4_set1(vp[12 + r]));
+      clip[r] = f32x4_madd(f32x4_set1(vp[4 + r]), ys, clip[r]);
+      clip[r] = f32x4_madd(f32x4_set1(vp[8 + r]), zs, clip[r]);
+    }
+
+    /* A box reaching behind the eye can't be tested, call it visible */
+    if (f32x4_movemask(f32x4_cmplt(clip[3], f32x4_set1(NEAR_W))) != 0) {
+      return false;
+    }
+
+    f32x4 inv_w = f32x4_div(f32x4_set1(1.0f), clip[3]);
+    float sx[4], sy[4], sz[4];
+    f32x4_store(sx, f32x4_mul(clip[0], inv_w));
+    f32x4_store(sy, f32x4_mul(clip[1], inv_w));
+    f32x4_store(sz, f32x4_mul(clip[2], inv_w));
+    for (int i = 0; i < 4; i++) {
+      screen_min_x = fminf(screen_min_x, sx[i]);
+      screen_max_x = fmaxf(screen_max_x, sx[i]);
+      screen_min_y = fminf(screen_min_y, sy[i]);
+      screen_max_y = fmaxf(screen_max_y, sy[i]);
+      nearest = fminf(nearest, sz[i]);
+    }
+  }
+
+  /* NDC to level 0 pixels, clamped to the buffer */
+  int width = buffer->config.width;
+  int height = buffer->config.height;
+  float x0 = (screen_min_x + 1.0f) * 0.5f * width;
+  float x1 = (screen_max_x + 1.0f) * 0.5f * width;
+  float y0 = (screen_min_y + 1.0f) * 0.5f * height;
+  float y1 = (screen_max_y + 1.0f) * 0.5f * height;
+  nearest = nearest * 0.5f + 0.5f;
+  if (x1 < 0.0f || y1 < 0.0f || x0 >= width || y0 >= height || nearest < 0.0f) {
+    /* Off screen or through the near plane - frustum culling's call */
+    return false;
+  }
+  int px0 = x0 < 0.0f ? 0 : (int) x0;
+  int py0 = y0 < 0.0f ? 0 : (int) y0;
+  int px1 = x1 >= width ? width - 1 : (int) x1;
+  int py1 = y1 >= height ? height - 1 : (int) y1;
+
+  /* Pick the level where the box spans at most about two texels */
+  int span = px1 - px0 > py1 - py0 ? px1 - px0 : py1 - py0;
+  int level = 0;
+  while (span > 2 && level < buffer->num_levels - 1) {
+    span >>= 1;
+    level += 1;
+  }
+
+  const float *depth = buffer->levels[level];
+  int level_width = buffer->level_width[level];
+  for (int y = py0 >> level; y <= py1 >> level; y++) {
+    for (int x = px0 >> level; x <= px1 >> level; x++) {
+      if (nearest <= depth[y * level_width + x]) {
+	return false;
+      }
+    }
+  }
+  return true;
+}
+
+int occlusion_cull(OcclusionBuffer *buffer, const float *view_projection,
+		   CullSet *set) {
+
+  Uint64 start = SDL_GetPerformanceCounter();
+
+  int occluded = 0;
+  int tested = 0;
+  for (int i = 0; i < set->count; i++) {
+    if (!set->visible[i]) {
+      continue;
+    }
+    float center[3] = { set->center[0][i], set->center[1][i], set->center[2][i] };
+    float extent[3] = { set->extent[0][i], set->extent[1][i], set->extent[2][i] };
+    tested += 1;
+    if (occlusion_test_box(buffer, view_projection, center, extent)) {
+      set->visible[i] = 0;
+      occluded += 1;
+    }
+  }
+
+  buffer->frames += 1;
+  buffer->tested += tested;
+  buffer->occluded += occluded;
+  buffer->test_ms += ms_since(start);
+  return occluded;
+}
+
+void occlusion_report(OcclusionBuffer *buffer) {
+
+  if (buffer->frames < buffer->config.report_frames) {
+    return;
+  }
+
+  int frames = buffer->frames;
+  printf("occlusion culling: %.1f of %.1f draws/frame eliminated (%.1f%%), "
+	 "%.1f occluder triangles, raster %.3f ms + test %.3f ms per frame\n",
+	 (double) buffer->occluded / frames, (double) buffer->tested / frames,
+	 buffer->tested > 0 ? 100.0 * buffer->occluded / buffer->tested : 0.0,
+	 (double) buffer->triangles_drawn / frames,
+	 buffer->raster_ms / frames, buffer->test_ms / frames);
+
+  buffer->frames = 0;
+  buffer->triangles_drawn = 0;
+  buffer->tested = 0;
+  buffer->occluded = 0;
+  buffer->raster_ms = 0.0;
+  buffer->test_ms = 0.0;
+}
@@ -0,0 +1,92 @@
+#ifndef OCCLUSION_CULL_H_
+#define OCCLUSION_CULL_H_
+
+/* Software occlusion culling.
+
+   Designated occluder meshes are rasterised on the CPU into a small
+   depth buffer (256x128 by default), split into horizontal bands that
+   the job system fills in parallel, four pixels at a time. A
+   hierarchical Z pyramid is built on top, each texel holding the
+   farthest depth of the four below it. Occludees are then tested by
+   projecting their world-space boxes and comparing the box's nearest
+   depth with the pyramid level where the box covers a few texels.
+
+   Everything stays on the CPU, so unlike occlusion queries there is no
+   waiting on the GPU. Occluders are drawn conservatively: a triangle
+   only writes the pixels it covers completely, at the farthest depth
+   within the pixel. Thin occluders and the pixels along the edges
+   between an occluder's triangles stay empty, which costs some culling
+   but never hides something visible.
+*/
+
+#include <stdbool.h>
+
+#include <SDL2/SDL.h>
+
+#include "frustum_cull.h"
+#include "job_system.h"
+
+#define OCCLUSION_MAX_LEVELS 10
+#define OCCLUSION_BAND_ROWS 8
+
+typedef struct {
+  int width;   /* powers of two */
+  int height;
+  bool enabled;
+  int report_frames;
+} OcclusionConfig;
+
+typedef struct {
+  OcclusionConfig config;
+
+  /* Level 0 is the depth buffer itself, depths in [0, 1] */
+  int num_levels;
+  int level_width[OCCLUSION_MAX_LEVELS];
+  int level_height[OCCLUSION_MAX_LEVELS];
+  float *levels[OCCLUSION_MAX_LEVELS];
+
+  /* Occluder triangles this frame, in screen space: x, y, z per vertex */
+  float *triangles;
+  int num_triangles;
+  int triangle_capacity;
+
+  /* Stats */
+  int frames;
+  long triangles_drawn;
+  long tested;
+  long occluded;
+  double raster_ms;
+  double test_ms;
+} OcclusionBuffer;
+
+void occlusion_default_config(OcclusionConfig *config);
+/* --no-occlusion turns it off, --occlusion-size WxH sets the buffer */
+void occlusion_parse_args(OcclusionConfig *config, int argc, char *argv[]);
+
+void occlusion_init(OcclusionBuffer *buffer, const OcclusionConfig *config);
+void occlusion_destroy(OcclusionBuffer *buffer);
+
+/* Forget last frame's occluders. */
+void occlusion_begin_frame(OcclusionBuffer *buffer);
+
+/* Queue num_triangles triangles (xyz per vertex, not indexed) drawn
+   with the column-major mvp matrix. */
+void occlusion_add_occluder(OcclusionBuffer *buffer, const float *mvp,
+			    const float *vertices, int num_triangles);
+
+/* Rasterise the queued occluders and build the pyramid. */
+void occlusion_rasterize(OcclusionBuffer *buffer, JobSystem *jobs);
+
+/* True if the world-space box (centre, half extents) is hidden. */
+bool occlusion_test_box(const OcclusionBuffer *buffer, const float *view_projection,
+			const float *center, const float *extent);
+
+/* Test every object set->visible still claims, and clear the flag of
+   the ones that are hidden. Returns how many were hidden. */
+int occlusion_cull(OcclusionBuffer *buffer, const float *view_projection,
+		   CullSet *set);
+
+/* Prints every report_frames frames and resets. */
+void occlusion_report(OcclusionBuffer *buffer);
+
+#endif // OCCLUSION_CULL_H_
@@ -1,4 +1,7 @@
 #include <iostream>
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
@@ -8,6 +11,16 @@
 
 extern "C" {
   #include "shader_loader.h"
+  #include "gl_caps.h"
+  #include "frame_pacing.h"
+  #include "dynamic_resolution.h"
+  #include "frame_capture.h"
+  #include "startup.h"
+  #include "ktx.h"
+  #include "texture_prep.h"
+  #include "atlas.h"
+  #include "texture_stream.h"
+  #include "resource_manager.h"
 }
 
 // This code is based on some example code at:
@@ -15,17 +28,587 @@ extern "C" {
 // https://www.opengl-tutorial.org/beginners-tutorials/tutorial-3-matrices/
 
 // Set some parameters
-const int sizeX = 2560;
-const int sizeY = 1440;
-
 const char* fragmentShaderPath = "shaders/shader.frag";
 const char* vertexShaderPath = "shaders/shader.vert";
+// The compressed texture is made by texture_tool; without it we fall
+// back to the PNG.
+const char* compressedTexturePath = "image/texture.ktx";
 const char* texturePath = "image/texture.png";
 
+// Shared, ref-counted textures
+static ResourceManager resources;
+
+// Startup assets. The file reading and PNG decoding happen on a
+// background thread while the window and context are created; the GL
+// half runs on this thread once both are ready. A PNG's mips are baked
+// there too (and cached next to it), so the GL half is only uploads.
+struct TextureAsset {
+  const char* path;
+  bool isKtx;
+  bool allowCompressed;
+  MipFilter mipFilter;
+  bool useCache;
+  char cachePath[512];
+  TexturePrepStats prepStats;
+  KtxTexture ktx;
+  char options[64];  // what it was uploaded as, part of the resource key
+  TextureHandle handle;
+  GLuint id;
+};
+
+static bool is_ktx_path(const char* path) {
+  const char* dot = strrchr(path, '.');
+  return dot != NULL && (strcmp(dot, ".ktx") == 0 || strcmp(dot, ".ktx2") == 0);
+}
+
+struct ProgramAsset {
+  const char* vertexPath;
+  const char* fragmentPath;
+  char* vertexSource;
+  char* fragmentSource;
+  GLuint id;
+};
+
+static bool load_texture_asset(void* data) {
+  TextureAsset* texture = (TextureAsset*) data;
+  if (texture->isKtx) {
+    return ktx_load(&texture->ktx, texture->path);
+  }
+  snprintf(texture->cachePath, sizeof(texture->cachePath), "%s.mips.ktx", texture->path);
+  return texture_prep_load(texture->path, texture->useCache ? texture->cachePath : NULL,
+			   texture->mipFilter, NULL, &texture->ktx, &texture->prepStats);
+}
+
+// The resource manager's loader: the file is already read, so this
+// only uploads it. The GL texture name is stored in the data pointer.
+static bool upload_texture_resource(const char* path, const char* options, void* user,
+				    ResourceData* out) {
+  (void) path;
+  (void) options;
+  TextureAsset* texture = (TextureAsset*) user;
+  if (texture->ktx.num_levels == 0) {
+    return false;
+  }
+
+  // The file is kept until after --bench-texture
+  KtxUploadStats stats;
+  GLuint id = ktx_upload(&texture->ktx, texture->allowCompressed, &stats);
+  out->data = (void*) (uintptr_t) id;
+  out->gpu_bytes = stats.gpu_bytes;
+  if (!texture->isKtx) {
+    texture_prep_report(&texture->prepStats, texture->path);
+    printf("Loaded texture: %s, %d by %d %s, %d levels (%s filter): %.1f KB on the GPU, "
+	   "upload %.2f ms\n",
+	   texture->path, texture->ktx.width, texture->ktx.height,
+	   ktx_format_name(texture->ktx.internal_format), texture->ktx.num_levels,
+	   mip_filter_name(texture->mipFilter), stats.gpu_bytes / 1024.0, stats.upload_ms);
+    return true;
+  }
+  printf("Loaded texture: %s, %d by %d %s, %d levels, %s: %.1f KB on the GPU "
+	 "(%.1f KB as GL_RGB, %.0f%% saved), upload %.2f ms\n",
+	 texture->path, texture->ktx.width, texture->ktx.height,
+	 ktx_format_name(texture->ktx.internal_format), texture->ktx.num_levels,
+	 stats.compressed ? "compressed" : "decoded to GL_RGB",
+	 stats.gpu_bytes / 1024.0, stats.rgb_bytes / 1024.0,
+	 100.0 * (1.0 - (double) stats.gpu_bytes / (double) stats.rgb_bytes),
+	 stats.upload_ms);
+  return true;
+}
+
+static void free_texture_resource(ResourceData* resource) {
+  GLuint id = (GLuint) (uintptr_t) resource->data;
+  glDeleteTextures(1, &id);
+}
+
+static void upload_texture_asset(void* data) {
+  TextureAsset* texture = (TextureAsset*) data;
+  snprintf(texture->options, sizeof(texture->options), "%s %s",
+	   texture->allowCompressed ? "compressed" : "rgb",
+	   texture->isKtx ? "ktx" : mip_filter_name(texture->mipFilter));
+  texture->handle = resource_load_texture(&resources, texture->path, texture->options,
+					  upload_texture_resource, free_texture_resource,
+					  texture);
+  texture->id = (GLuint) (uintptr_t) resource_texture(&resources, texture->handle);
+}
+
+static bool load_program_asset(void* data) {
+  ProgramAsset* program = (ProgramAsset*) data;
+  program->vertexSource = read_shader_source(program->vertexPath);
+  program->fragmentSource = read_shader_source(program->fragmentPath);
+  return program->vertexSource != NULL && program->fragmentSource != NULL;
+}
+
+static void upload_program_asset(void* data) {
+  ProgramAsset* program = (ProgramAsset*) data;
+  program->id = load_shaders_source(program->vertexSource, program->fragmentSource);
+  free(program->vertexSource);
+  free(program->fragmentSource);
+  program->vertexSource = NULL;
+  program->fragmentSource = NULL;
+}
+
+// --atlas N: a ring of N small cubes round the big one, each with its
+// own generated image. --atlas-mode picks how they are drawn: separate
+// binds each image and draws each cube on its own; atlas packs the
+// images into one texture, rewrites the ring's UVs and draws it in one
+// call; array does the same with an ES3 texture array, a layer per
+// image. stream draws like separate, but from 4x bigger images baked
+// to image/stream_NN.ktx whose mips are streamed in as the cubes come
+// closer, within --texture-budget KB.
+enum AtlasMode { ATLAS_MODE_SEPARATE, ATLAS_MODE_ATLAS, ATLAS_MODE_ARRAY, ATLAS_MODE_STREAM };
+
+struct AtlasScene {
+  int count;
+  AtlasMode mode;
+  KtxTexture images[ATLAS_MAX_IMAGES];
+  Atlas atlas;
+  GLuint textures[ATLAS_MAX_IMAGES];  // one each, or just the atlas
+  TextureStream stream;
+  size_t streamBudget;
+  int streamTextures[ATLAS_MAX_IMAGES];
+  GLuint VBO;
+  GLuint arrayProgram;
+  GLint arrayPosition;
+  GLint arrayColour;
+  GLint arrayTexCoord;
+  GLint arrayMVP;
+  GLint arrayTexture;
+};
+
+// A checkerboard with its own colour and cell size, in a few sizes so
+// the packer has some work to do. scale makes it bigger, cells and all.
+static bool make_atlas_image(int index, int scale, KtxTexture* out) {
+  static const int sizes[][2] = { {256, 256}, {128, 128}, {256, 128}, {128, 256}, {64, 64} };
+  int width = scale * sizes[index % 5][0];
+  int height = scale * sizes[index % 5][1];
+  int cell = scale * (8 << (index % 3));
+  float hue = 0.618034f * index;
+  hue -= floorf(hue);
+
+  Uint32* pixels = (Uint32*) malloc((size_t) width * height * sizeof(Uint32));
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      float shade = ((x / cell + y / cell) & 1) ? 1.0f : 0.35f;
+      Uint32 pixel = 0;
+      for (int c = 0; c < 3; c++) {
+	float channel = 0.5f + 0.5f * cosf(6.2831853f * (hue - c / 3.0f));
+	pixel |= (Uint32) (255.0f * channel * shade) << (16 - 8 * c);
+      }
+      pixels[y * width + x] = pixel;
+    }
+  }
+
+  SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormatFrom(pixels, width, height, 32,
+							    width * 4, SDL_PIXELFORMAT_RGB888);
+  TexturePrepStats stats;
+  bool ok = surface != NULL && texture_prep_surface(surface, MIP_FILTER_BOX, NULL, out, &stats);
+  SDL_FreeSurface(surface);
+  free(pixels);
+  return ok;
+}
+
+static void stream_image_path(int index, char* path, size_t size) {
+  snprintf(path, size, "image/stream_%02d.ktx", index);
+}
+
+// The streamed images are only baked the first time; after that the
+// stream reads them a level at a time.
+static bool bake_stream_images(const AtlasScene* scene) {
+  for (int i = 0; i < scene->count; i++) {
+    char path[64];
+    stream_image_path(i, path, sizeof(path));
+    FILE* file = fopen(path, "rb");
+    if (file != NULL) {
+      fclose(file);
+      continue;
+    }
+    KtxTexture image;
+    if (!make_atlas_image(i, 4, &image)) {
+      return false;
+    }
+    bool ok = ktx_write(&image, path, false);
+    ktx_free(&image);
+    if (!ok) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool load_atlas_scene(void* data) {
+  AtlasScene* scene = (AtlasScene*) data;
+  if (scene->mode == ATLAS_MODE_STREAM) {
+    return bake_stream_images(scene);
+  }
+  for (int i = 0; i < scene->count; i++) {
+    if (!make_atlas_image(i, 1, &scene->images[i])) {
+      return false;
+    }
+  }
+  if (scene->mode == ATLAS_MODE_SEPARATE) {
+    return true;
+  }
+  return atlas_build(&scene->atlas, scene->mode == ATLAS_MODE_ARRAY ? ATLAS_ARRAY : ATLAS_2D,
+		     scene->images, scene->count, 4096);
+}
+
+static void upload_atlas_scene(void* data) {
+  AtlasScene* scene = (AtlasScene*) data;
+
+  if (scene->mode == ATLAS_MODE_STREAM) {
+    texture_stream_init(&scene->stream, scene->streamBudget, true);
+    for (int i = 0; i < scene->count; i++) {
+      char path[64];
+      stream_image_path(i, path, sizeof(path));
+      scene->streamTextures[i] = texture_stream_add(&scene->stream, path);
+    }
+    printf("Atlas scene: %d streamed textures, %.1f KB resident, budget %.1f KB\n",
+	   scene->count, scene->stream.resident_bytes / 1024.0, scene->streamBudget / 1024.0);
+    return;
+  }
+
+  if (scene->mode == ATLAS_MODE_ARRAY && gl_caps.TexImage3D == NULL) {
+    std::cout << "Texture arrays need ES3, using an atlas" << std::endl;
+    atlas_destroy(&scene->atlas);
+    scene->mode = ATLAS_MODE_ATLAS;
+    if (!atlas_build(&scene->atlas, ATLAS_2D, scene->images, scene->count, 4096)) {
+      std::cout << "Error: The images do not fit in an atlas either" << std::endl;
+      for (int i = 0; i < scene->count; i++) {
+	ktx_free(&scene->images[i]);
+      }
+      scene->count = 0;
+      return;
+    }
+  }
+
+  if (scene->mode == ATLAS_MODE_SEPARATE) {
+    size_t gpuBytes = 0;
+    for (int i = 0; i < scene->count; i++) {
+      KtxUploadStats stats;
+      scene->textures[i] = ktx_upload(&scene->images[i], false, &stats);
+      gpuBytes += stats.gpu_bytes;
+    }
+    printf("Atlas scene: %d separate textures, %.1f KB, %d draw calls and texture "
+	   "binds a frame\n", scene->count, gpuBytes / 1024.0, scene->count);
+  } else {
+    scene->textures[0] = atlas_upload(&scene->atlas);
+    atlas_report(&scene->atlas, scene->count, 1);
+  }
+  for (int i = 0; i < scene->count; i++) {
+    ktx_free(&scene->images[i]);
+  }
+
+  if (scene->mode == ATLAS_MODE_ARRAY) {
+    scene->arrayProgram = load_shaders("shaders/atlas_array.vert", "shaders/atlas_array.frag");
+    scene->arrayPosition = glGetAttribLocation(scene->arrayProgram, "vPosition");
+    scene->arrayColour = glGetAttribLocation(scene->arrayProgram, "vColour");
+    scene->arrayTexCoord = glGetAttribLocation(scene->arrayProgram, "vTexCoord");
+    scene->arrayMVP = glGetUniformLocation(scene->arrayProgram, "MVP");
+    scene->arrayTexture = glGetUniformLocation(scene->arrayProgram, "u_texture");
+  }
+}
+
+static int atlas_scene_stride(const AtlasScene* scene) {
+  // Array texture coordinates carry the layer as a third component
+  return scene->mode == ATLAS_MODE_ARRAY ? 9 : 8;
+}
+
+// The ring is baked into one buffer in model space, so it turns with
+// the big cube; with an atlas each cube's UVs point at its image.
+static void build_atlas_ring(AtlasScene* scene, const GLfloat* cube, int cubeVertices) {
+  int stride = atlas_scene_stride(scene);
+  size_t size = (size_t) scene->count * cubeVertices * stride * sizeof(GLfloat);
+  GLfloat* vertices = (GLfloat*) malloc(size);
+
+  for (int i = 0; i < scene->count; i++) {
+    float angle = 6.2831853f * i / scene->count;
+    float centre[3] = { 2.6f * cosf(angle), 0.0f, 2.6f * sinf(angle) };
+    for (int v = 0; v < cubeVertices; v++) {
+      const GLfloat* in = cube + 8 * v;
+      GLfloat* out = vertices + stride * (i * cubeVertices + v);
+      for (int c = 0; c < 3; c++) {
+	out[c] = centre[c] + 0.4f * in[c];
+	out[3 + c] = in[3 + c];
+      }
+      if (scene->mode == ATLAS_MODE_SEPARATE || scene->mode == ATLAS_MODE_STREAM) {
+	out[6] = in[6];
+	out[7] = in[7];
+      } else {
+	atlas_transform_uv(&scene->atlas, i, in + 6, out + 6);
+      }
+      if (stride == 9) {
+	out[8] = (GLfloat) scene->atlas.uvs[i].layer;
+      }
+    }
+  }
+
+  glGenBuffers(1, &scene->VBO);
+  glBindBuffer(GL_ARRAY_BUFFER, scene->VBO);
+  glBufferData(GL_ARRAY_BUFFER, size, vertices, GL_STATIC_DRAW);
+  free(vertices);
+}
+
+// Drawn with the cube's program and attributes already in use, except
+// for the array, which has its own.
+static void draw_atlas_ring(const AtlasScene* scene, GLint position_attr_i,
+			    GLint colour_attr_i, GLint tex_attr_i, const glm::mat4& mvp) {
+  int stride = atlas_scene_stride(scene);
+  bool array = scene->mode == ATLAS_MODE_ARRAY;
+  if (array) {
+    glUseProgram(scene->arrayProgram);
+    glUniformMatrix4fv(scene->arrayMVP, 1, GL_FALSE, &mvp[0][0]);
+    glUniform1i(scene->arrayTexture, 0);
+    position_attr_i = scene->arrayPosition;
+    colour_attr_i = scene->arrayColour;
+    tex_attr_i = scene->arrayTexCoord;
+    glEnableVertexAttribArray(position_attr_i);
+    glEnableVertexAttribArray(colour_attr_i);
+    glEnableVertexAttribArray(tex_attr_i);
+  }
+
+  glBindBuffer(GL_ARRAY_BUFFER, scene->VBO);
+  glVertexAttribPointer(position_attr_i, 3, GL_FLOAT, GL_FALSE, stride*sizeof(GLfloat),
+			(void*) (0*sizeof(GLfloat)));
+  glVertexAttribPointer(colour_attr_i, 3, GL_FLOAT, GL_FALSE, stride*sizeof(GLfloat),
+			(void*) (3*sizeof(GLfloat)));
+  glVertexAttribPointer(tex_attr_i, stride - 6, GL_FLOAT, GL_FALSE, stride*sizeof(GLfloat),
+			(void*) (6*sizeof(GLfloat)));
+
+  glActiveTexture(GL_TEXTURE0);
+  if (scene->mode == ATLAS_MODE_SEPARATE) {
+    for (int i = 0; i < scene->count; i++) {
+      glBindTexture(GL_TEXTURE_2D, scene->textures[i]);
+      glDrawArrays(GL_TRIANGLES, 12*3 * i, 12*3);
+    }
+  } else if (scene->mode == ATLAS_MODE_STREAM) {
+    for (int i = 0; i < scene->count; i++) {
+      glBindTexture(GL_TEXTURE_2D, scene->streamTextures[i] >= 0 ?
+		    texture_stream_id(&scene->stream, scene->streamTextures[i]) : 0);
+      glDrawArrays(GL_TRIANGLES, 12*3 * i, 12*3);
+    }
+  } else {
+    glBindTexture(array ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D, scene->textures[0]);
+    glDrawArrays(GL_TRIANGLES, 0, 12*3 * scene->count);
+  }
+
+  if (array) {
+    glDisableVertexAttribArray(position_attr_i);
+    glDisableVertexAttribArray(colour_attr_i);
+    glDisableVertexAttribArray(tex_attr_i);
+  }
+}
+
+// Tells the stream how big each ring cube is on screen this frame: its
+// width over its distance from the eye, scaled by the projection.
+// Then the stream swaps levels for next frame.
+static void update_texture_stream(AtlasScene* scene, const glm::mat4& modelView,
+				  const glm::mat4& projection, int screenHeight) {
+  for (int i = 0; i < scene->count; i++) {
+    if (scene->streamTextures[i] < 0) {
+      continue;
+    }
+    float angle = 6.2831853f * i / scene->count;
+    glm::vec4 centre = modelView * glm::vec4(2.6f * cosf(angle), 0.0f, 2.6f * sinf(angle), 1.0f);
+    float distance = fmaxf(-centre.z, 0.1f);
+    float pixels = 0.8f * projection[1][1] * 0.5f * screenHeight / distance;
+    texture_stream_use(&scene->stream, scene->streamTextures[i], pixels);
+  }
+  texture_stream_update(&scene->stream);
+}
+
+static void destroy_atlas_scene(AtlasScene* scene) {
+  if (scene->mode == ATLAS_MODE_STREAM) {
+    texture_stream_report(&scene->stream);
+    texture_stream_destroy(&scene->stream);
+    glDeleteBuffers(1, &scene->VBO);
+    return;
+  }
+  int textures = scene->mode == ATLAS_MODE_SEPARATE ? scene->count : 1;
+  glDeleteTextures(textures, scene->textures);
+  glDeleteBuffers(1, &scene->VBO);
+  glDeleteProgram(scene->arrayProgram);
+  atlas_destroy(&scene->atlas);
+}
+
+// --bench-texture N: a sampling heavy scene (the cube, big and drawn
+// many times over itself) for N frames with the compressed texture and
+// again with it decoded to GL_RGB. Each frame is finished, so the
+// times are the GPU's.
+static void benchmark_texture_sampling(const KtxTexture* ktx, int frames,
+				       GLuint programID, GLuint VBO,
+				       GLint position_attr_i, GLint colour_attr_i,
+				       GLint tex_attr_i, GLuint MatrixID,
+				       GLuint TextureHandle, glm::mat4 viewProjection) {
+  const int layers = 16;
+
+  KtxUploadStats stats[2];
+  GLuint textures[2] = {
+    ktx_upload(ktx, true, &stats[0]),
+    ktx_upload(ktx, false, &stats[1])
+  };
+  if (!stats[0].compressed) {
+    std::cout << "--bench-texture: " << ktx_format_name(ktx->internal_format)
+	      << " is not supported here, nothing to compare" << std::endl;
+    glDeleteTextures(2, textures);
+    return;
+  }
+
+  glUseProgram(programID);
+  glBindBuffer(GL_ARRAY_BUFFER, VBO);
+  glVertexAttribPointer(position_attr_i, 3, GL_FLOAT, GL_FALSE, 8*sizeof(GLfloat),
+			(void*) (0*sizeof(GLfloat)));
+  glVertexAttribPointer(colour_attr_i, 3, GL_FLOAT, GL_FALSE, 8*sizeof(GLfloat),
+			(void*) (3*sizeof(GLfloat)));
+  glVertexAttribPointer(tex_attr_i, 2, GL_FLOAT, GL_FALSE, 8*sizeof(GLfloat),
+			(void*) (6*sizeof(GLfloat)));
+  glEnableVertexAttribArray(position_attr_i);
+  glEnableVertexAttribArray(colour_attr_i);
+  glEnableVertexAttribArray(tex_attr_i);
+  glActiveTexture(GL_TEXTURE0);
+  glUniform1i(TextureHandle, 0);
+  glDisable(GL_DEPTH_TEST);
+
+  double ms[2];
+  for (int t = 0; t < 2; t++) {
+    glBindTexture(GL_TEXTURE_2D, textures[t]);
+    glFinish();
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int f = 0; f < frames; f++) {
+      glClear(GL_COLOR_BUFFER_BIT);
+      for (int l = 0; l < layers; l++) {
+	glm::mat4 model = glm::rotate(glm::scale(glm::mat4(1.0f), glm::vec3(2.5f)),
+				      0.05f * (f + l), glm::vec3(1.0, 0.2, 0.1));
+	glm::mat4 mvp = viewProjection * model;
+	glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &mvp[0][0]);
+	glDrawArrays(GL_TRIANGLES, 0, 12*3);
+      }
+      glFinish();
+    }
+    ms[t] = (double) (SDL_GetPerformanceCounter() - start) * 1000.0
+      / (double) SDL_GetPerformanceFrequency() / frames;
+  }
+
+  printf("Texture sampling, %d frames of %d layers:\n", frames, layers);
+  printf("\t%-8s %8.1f KB %8.3f ms/frame\n", ktx_format_name(ktx->internal_format),
+	 stats[0].gpu_bytes / 1024.0, ms[0]);
+  printf("\t%-8s %8.1f KB %8.3f ms/frame\n", "GL_RGB", stats[1].gpu_bytes / 1024.0, ms[1]);
+  printf("\t%.0f%% less memory, %.1f%% less frame time\n",
+	 100.0 * (1.0 - (double) stats[0].gpu_bytes / (double) stats[1].gpu_bytes),
+	 100.0 * (1.0 - ms[0] / ms[1]));
+
+  glDisableVertexAttribArray(position_attr_i);
+  glDisableVertexAttribArray(colour_attr_i);
+  glDisableVertexAttribArray(tex_attr_i);
+  glEnable(GL_DEPTH_TEST);
+  glDeleteTextures(2, textures);
+}
+
 int main(int argc, char* argv[]) {
 
-  SDL_Init(SDL_INIT_VIDEO);
+  // Startup options: --serial-startup, --startup-threads N
+  int startupThreads = 2;
+  bool serialStartup = false;
+  startup_parse_args(argc, argv, &startupThreads, &serialStartup);
+  StartupPipeline startup;
+  startup_init(&startup, startupThreads, serialStartup);
+
+  // Presentation / latency options, e.g.
+  // ./opengles_fullscreen --swap adaptive --frame-delay 8 --throttle fence --max-queued 1
+  LatencyConfig latencyConfig;
+  latency_default_config(&latencyConfig);
+  latency_parse_args(&latencyConfig, argc, argv);
+
+  // Dynamic resolution options, e.g. --dynres-target 14 --dynres-min-scale 0.5
+  DynResConfig dynresConfig;
+  dynres_default_config(&dynresConfig);
+  dynres_parse_args(&dynresConfig, argc, argv);
+
+  // Capture options, e.g. --capture demo.y4m or --capture frames/frame_%05d.ppm
+  CaptureConfig captureConfig;
+  capture_default_config(&captureConfig);
+  capture_parse_args(&captureConfig, argc, argv);
+
+  // Start on the assets first; IMG_Init has to come before any IMG_Load.
   IMG_Init(IMG_INIT_PNG);
+  // --texture picks the file (PNG or KTX), --texture-uncompressed
+  // decodes a KTX to GL_RGB for comparison, --bench-texture N compares
+  // sampling speed. A PNG's mips use --mip-filter box|kaiser and are
+  // rebaked every run with --no-texture-cache.
+  resource_manager_init(&resources);
+  TextureAsset texture = {};
+  texture.path = compressedTexturePath;
+  texture.allowCompressed = true;
+  texture.mipFilter = mip_filter_parse_args(argc, argv);
+  texture.useCache = true;
+  int benchTextureFrames = 0;
+  // --atlas N, --atlas-mode separate|atlas|array|stream: the textured
+  // ring. --texture-budget KB caps what stream keeps on the GPU.
+  AtlasScene atlasScene = {};
+  atlasScene.mode = ATLAS_MODE_ATLAS;
+  atlasScene.streamBudget = 4096 * 1024;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--texture") == 0 && i + 1 < argc) {
+      texture.path = argv[i + 1];
+    } else if (strcmp(argv[i], "--texture-uncompressed") == 0) {
+      texture.allowCompressed = false;
+    } else if (strcmp(argv[i], "--bench-texture") == 0 && i + 1 < argc) {
+      benchTextureFrames = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "--no-texture-cache") == 0) {
+      texture.useCache = false;
+    } else if (strcmp(argv[i], "--atlas") == 0 && i + 1 < argc) {
+      atlasScene.count = atoi(argv[i + 1]);
+      if (atlasScene.count > ATLAS_MAX_IMAGES) {
+	atlasScene.count = ATLAS_MAX_IMAGES;
+      }
+    } else if (strcmp(argv[i], "--atlas-mode") == 0 && i + 1 < argc) {
+      if (strcmp(argv[i + 1], "separate") == 0) {
+	atlasScene.mode = ATLAS_MODE_SEPARATE;
+      } else if (strcmp(argv[i + 1], "array") == 0) {
+	atlasScene.mode = ATLAS_MODE_ARRAY;
+      } else if (strcmp(argv[i + 1], "stream") == 0) {
+	atlasScene.mode = ATLAS_MODE_STREAM;
+      } else {
+	atlasScene.mode = ATLAS_MODE_ATLAS;
+      }
+    } else if (strcmp(argv[i], "--texture-budget") == 0 && i + 1 < argc) {
+      atlasScene.streamBudget = (size_t) atoi(argv[i + 1]) * 1024;
+    }
+  }
+  if (texture.path == compressedTexturePath) {
+    FILE* file = fopen(texture.path, "rb");
+    if (file != NULL) {
+      fclose(file);
+    } else {
+      std::cout << "No " << compressedTexturePath << " (make it with texture_tool), using "
+		<< texturePath << std::endl;
+      texture.path = texturePath;
+    }
+  }
+  texture.isKtx = is_ktx_path(texture.path);
+  ProgramAsset program = { vertexShaderPath, fragmentShaderPath, NULL, NULL, 0 };
+  int textureTask = startup_add(&startup, "texture", load_texture_asset,
+				upload_texture_asset, &texture);
+  int programTask = startup_add(&startup, "shaders", load_program_asset,
+				upload_program_asset, &program);
+  int atlasTask = -1;
+  if (atlasScene.count > 0) {
+    atlasTask = startup_add(&startup, "atlas", load_atlas_scene, upload_atlas_scene,
+			    &atlasScene);
+  }
+  startup_start(&startup);
+
+  SDL_Init(SDL_INIT_VIDEO);
+
+  // Use whatever mode the display is already in rather than a fixed size.
+  SDL_DisplayMode displayMode;
+  if (SDL_GetDesktopDisplayMode(0, &displayMode) != 0) {
+    std::cout << "Error: Could not get display mode: " << SDL_GetError() << std::endl;
+    displayMode.w = 1920;
+    displayMode.h = 1080;
+  }
+  const int sizeX = displayMode.w;
+  const int sizeY = displayMode.h;
+  std::cout << "Display mode is " << sizeX << " by " << sizeY << std::endl;
 
   // Not interested in the cursor.
   SDL_ShowCursor(SDL_DISABLE);
@@ -50,9 +633,18 @@ int main(int argc, char* argv[]) {
   } else {
     std::cout << "Error: Could not create window: " << SDL_GetError() << std::endl;
   }
+  startup_mark(&startup, "window");
 
   // Now create the actual context.
   SDL_GLContext glcontext = SDL_GL_CreateContext(window);
+  startup_mark(&startup, "context");
+
+  // Upload whatever has already loaded; the texture upload needs to know
+  // which compressed formats there are.
+  if (glcontext) {
+    load_gl_caps();
+  }
+  startup_poll(&startup);
 
   // Now - I'm going to merge the geometry and the colours into a singleVBO.
   static const GLfloat g_vertex_buffer_data[] = {
@@ -123,7 +715,10 @@ int main(int argc, char* argv[]) {
 					  0.1f, 100.0f);
 
   // Set up the shader program and use it.
-  GLuint programID = load_shaders(vertexShaderPath, fragmentShaderPath);
+  if (!startup_wait(&startup, programTask)) {
+    std::cout << "Error: Could not load the shaders" << std::endl;
+  }
+  GLuint programID = program.id;
   glUseProgram(programID);
   
   // Get uniform and attribute locations
@@ -141,14 +736,35 @@ int main(int argc, char* argv[]) {
     	    << "\n\tcolour " << colour_attr_i
 	    << "\n\ttexture " << tex_attr_i << std::endl;
   
+  FramePacer pacer = {};
+  DynamicResolution dynres = {};
+  bool useDynres = false;
+  FrameCapture capture = {};
+
   if (glcontext) {
     std::cout << "\tOpenGLES version: " << glGetString(GL_VERSION) << std::endl;
     std::cout << "\tVendor: " << glGetString(GL_VENDOR) << std::endl;
     std::cout << "\tRenderer: " << glGetString(GL_RENDERER) << std::endl;
     std::cout << "\tShading Language Version: " << glGetString(GL_SHADING_LANGUAGE_VERSION) << std::endl;
 
-    // Set the interval for vsync
-    SDL_GL_SetSwapInterval(1);
+    // Set the interval for vsync and the latency options
+    latency_init(&pacer, &latencyConfig);
+
+    // The scene goes to an offscreen target scaled to the GPU budget.
+    int drawableX, drawableY;
+    SDL_GL_GetDrawableSize(window, &drawableX, &drawableY);
+    // Without it the scene is drawn straight into the window.
+    useDynres = dynres_init(&dynres, &dynresConfig, drawableX, drawableY);
+    if (!useDynres) {
+      std::cout << "Error: Could not set up dynamic resolution, drawing at full size"
+		<< std::endl;
+      dynres_destroy(&dynres);
+    }
+
+    if (captureConfig.path != NULL &&
+	!capture_init(&capture, &captureConfig, drawableX, drawableY)) {
+      std::cout << "Error: Could not start capture" << std::endl;
+    }
 
     // Set the clear colour and depth testing
     glClearColor(0.0f, 0.0f, 0.4f, 1.0f);
@@ -159,29 +775,33 @@ int main(int argc, char* argv[]) {
     std::cout << "Error: Could not create OpenGLES context" << std::endl;
   }
 
-  // Load up an image to use as a texture
-  SDL_Surface* tex_surf = IMG_Load(texturePath);
-
-  std::cout << "Loaded texture: " << texturePath << std::endl;
-  std::cout << "Texture size is " << tex_surf->w << " by " << tex_surf->h << std::endl;
-
-  GLuint textureID;
-  glGenTextures(1, &textureID);
-  glBindTexture(GL_TEXTURE_2D, textureID);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB,
-   	       tex_surf->w, tex_surf->h,
-   	       0, GL_RGB, GL_UNSIGNED_BYTE,
-   	       tex_surf->pixels);
-  std::cout << "Loaded TexImage2D" << std::endl;
-
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-  
-  glGenerateMipmap(GL_TEXTURE_2D);
-  std::cout << "Generated MipMap" << std::endl;
-
-  // Don't need the image anymore.
-  SDL_FreeSurface(tex_surf);
+  // The texture is usually in by now; if not, wait for it.
+  if (!startup_wait(&startup, textureTask)) {
+    std::cout << "Error: Could not load texture: " << texture.path << std::endl;
+  }
+  GLuint textureID = texture.id;
+  if (atlasTask >= 0) {
+    // An upload that fails drops the scene by zeroing its count
+    if (startup_wait(&startup, atlasTask) && atlasScene.count > 0) {
+      build_atlas_ring(&atlasScene, g_vertex_buffer_data, 12*3);
+    } else {
+      std::cout << "Error: Could not build the atlas scene" << std::endl;
+      atlasScene.count = 0;
+    }
+  }
+  startup_finish(&startup);
+
+  if (benchTextureFrames > 0) {
+    if (texture.ktx.num_levels > 0 && texture.ktx.type == 0) {
+      benchmark_texture_sampling(&texture.ktx, benchTextureFrames, programID, VBO,
+				 position_attr_i, colour_attr_i, tex_attr_i,
+				 MatrixID, TextureHandle, Projection * View);
+    } else {
+      std::cout << "--bench-texture needs a compressed KTX texture" << std::endl;
+    }
+  }
+  ktx_free(&texture.ktx);
+  resource_manager_report(&resources);
 
   bool shouldExit = false;
   SDL_Event event;
@@ -189,20 +809,38 @@ int main(int argc, char* argv[]) {
   // Declare the uniforms (float time and mvp)
   float float_time;
   glm::mat4 mvp;
+  bool firstFrame = true;
    
   while(!shouldExit) {
 
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
- 
+    // Sleep / throttle first so the input and mvp below are as fresh
+    // as possible when the frame is swapped.
+    latency_begin_frame(&pacer);
+
+    // Mouse movement spins the cube, so we have some input to measure.
+    float mouse_spin = 0.0f;
     while (SDL_PollEvent(&event) != 0) {
       if(event.type == SDL_KEYDOWN) {
 	shouldExit = true;
 	break;
+      } else if (event.type == SDL_MOUSEMOTION) {
+	mouse_spin += 0.005f * (float) event.motion.xrel;
+	latency_mark_input(&pacer, &event);
       }
     }
-   
+
+    // Draw the scene at the current render scale.
+    if (useDynres) {
+      dynres_begin_scene(&dynres);
+    }
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glUseProgram(programID);
+
     // Rotate the mvp by 0.01 radians every frame.
     Model = glm::rotate(Model, 0.01f, glm::vec3(1.0, 0.2, 0.1));
+    if (mouse_spin != 0.0f) {
+      Model = glm::rotate(Model, mouse_spin, glm::vec3(0.0, 1.0, 0.0));
+    }
     mvp = Projection * View * Model;
     
     // Positions here.
@@ -246,15 +884,48 @@ int main(int argc, char* argv[]) {
     
     glDrawArrays(GL_TRIANGLES, 0, 12*3);
 
-    SDL_GL_SwapWindow(window);
-    
+    if (atlasScene.count > 0) {
+      draw_atlas_ring(&atlasScene, position_attr_i, colour_attr_i, tex_attr_i, mvp);
+      if (atlasScene.mode == ATLAS_MODE_STREAM) {
+	update_texture_stream(&atlasScene, View * Model, Projection, sizeY);
+      }
+    }
+
     glDisableVertexAttribArray(position_attr_i);
     glDisableVertexAttribArray(colour_attr_i);
     glDisableVertexAttribArray(tex_attr_i);
 
+    // Stretch it onto the screen and present.
+    if (useDynres) {
+      dynres_upscale(&dynres);
+    }
+    capture_frame(&capture);
+    latency_end_frame(&pacer, window);
+    if (useDynres) {
+      dynres_update(&dynres);
+    }
+
+    if (firstFrame) {
+      startup_mark(&startup, "first frame");
+      startup_report(&startup);
+      firstFrame = false;
+    }
+
   }
   
   // Clean up
+  startup_destroy(&startup);
+  resource_release_texture(&resources, texture.handle);
+  resource_manager_destroy(&resources);
+  if (atlasScene.count > 0) {
+    destroy_atlas_scene(&atlasScene);
+  }
+  glDeleteProgram(programID);
+  capture_destroy(&capture);
+  if (useDynres) {
+    dynres_destroy(&dynres);
+  }
+  latency_destroy(&pacer);
   SDL_GL_DeleteContext(glcontext);
   SDL_DestroyWindow(window);
   IMG_Quit();
@@ -0,0 +1,137 @@
+/* SoA particle simulation on the job system. */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "particles.h"
+#include "simd.h"
+
+/* Cheap per particle random numbers that do not need any shared state
+   between threads: hash the particle index and the frame */
+static float hash_unit(uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x7feb352dU;
+  x ^= x >> 15;
+  x *= 0x846ca68bU;
+  x ^= x >> 16;
+  return (float) (x >> 8) * (1.0f / 16777216.0f);
+}
+
+static void spawn(ParticleSystem *system, int i, float life) {
+  uint32_t seed = (uint32_t) i * 0x9e3779b9U + system->frame * 0x85ebca6bU;
+  for (int k = 0; k < 3; k++) {
+    system->position[k][i] = system->emitter[k];
+  }
+  system->velocity[0][i] = 3.0f * hash_unit(seed) - 1.5f;
+  system->velocity[1][i] = 4.0f + 3.0f * hash_unit(seed + 1);
+  system->velocity[2][i] = 3.0f * hash_unit(seed + 2) - 1.5f;
+  system->life[i] = life;
+}
+
+void particles_init(ParticleSystem *system, int count, const float *emitter) {
+
+  memset(system, 0, sizeof(*system));
+  system->count = (count + 3) & ~3;
+  for (int k = 0; k < 3; k++) {
+    system->position[k] = (float *) aligned_alloc(16, system->count * sizeof(float));
+    system->velocity[k] = (float *) aligned_alloc(16, system->count * sizeof(float));
+    system->emitter[k] = emitter[k];
+  }
+  system->life = (float *) aligned_alloc(16, system->count * sizeof(float));
+  system->packed = (float *) aligned_alloc(16, 4 * system->count * sizeof(float));
+
+  system->gravity = -9.8f;
+  system->floor_y = -4.0f;
+  system->restitution = 0.5f;
+  system->max_life = 4.0f;
+
+  /* Staggered lives so they do not all respawn on the same frame */
+  for (int i = 0; i < system->count; i++) {
+    spawn(system, i, system->max_life * hash_unit((uint32_t) i * 0x27d4eb2dU));
+  }
+}
+
+void particles_destroy(ParticleSystem *system) {
+  for (int k = 0; k < 3; k++) {
+    free(system->position[k]);
+    free(system->velocity[k]);
+  }
+  free(system->life);
+  free(system->packed);
+}
+
+typedef struct {
+  ParticleSystem *system;
+  float dt;
+} SimulateBatch;
+
+/* [begin, end) are groups of four particles */
+static void simulate_job(void *data, int begin, int end) {
+
+  SimulateBatch *batch = (SimulateBatch *) data;
+  ParticleSystem *system = batch->system;
+  float **p = system->position;
+  float **v = system->velocity;
+
+  f32x4 dt = f32x4_set1(batch->dt);
+  f32x4 gravity_dt = f32x4_set1(system->gravity * batch->dt);
+  f32x4 floor_y = f32x4_set1(system->floor_y);
+  f32x4 bounce = f32x4_set1(-system->restitution);
+  f32x4 friction = f32x4_set1(0.8f);
+  f32x4 zero = f32x4_zero();
+
+  for (int group = begin; group < end; group++) {
+    int i = 4 * group;
+
+    f32x4 vx = f32x4_load(&v[0][i]);
+    f32x4 vy = f32x4_add(f32x4_load(&v[1][i]), gravity_dt);
+    f32x4 vz = f32x4_load(&v[2][i]);
+    f32x4 x = f32x4_madd(vx, dt, f32x4_load(&p[0][i]));
+    f32x4 y = f32x4_madd(vy, dt, f32x4_load(&p[1][i]));
+    f32x4 z = f32x4_madd(vz, dt, f32x4_load(&p[2][i]));
+    f32x4 life = f32x4_sub(f32x4_load(&system->life[i]), dt);
+
+    /* Bounce off the floor, losing some speed */
+    f32x4 below = f32x4_cmplt(y, floor_y);
+    y = f32x4_select(below, floor_y, y);
+    vy = f32x4_select(below, f32x4_mul(vy, bounce), vy);
+    vx = f32x4_select(below, f32x4_mul(vx, friction), vx);
+    vz = f32x4_select(below, f32x4_mul(vz, friction), vz);
+
+    f32x4_store(&p[0][i], x);
+    f32x4_store(&p[1][i], y);
+    f32x4_store(&p[2][i], z);
+    f32x4_store(&v[0][i], vx);
+    f32x4_store(&v[1][i], vy);
+    f32x4_store(&v[2][i], vz);
+    f32x4_store(&system->life[i], life);
+
+    int dead = f32x4_movemask(f32x4_cmpgt(zero, life));
+    if (dead == 0) {
+      /* Four x, y, z, life rows become four particles */
+      f32x4_transpose(&x, &y, &z, &life);
+      f32x4_store(&system->packed[4 * i], x);
+      f32x4_store(&system->packed[4 * i + 4], y);
+      f32x4_store(&system->packed[4 * i + 8], z);
+      f32x4_store(&system->packed[4 * i + 12], life);
+      continue;
+    }
+
+    for (int lane = 0; lane < 4; lane++) {
+      if (dead & (1 << lane)) {
+	spawn(system, i + lane, system->max_life);
+      }
+      float *out = &system->packed[4 * (i + lane)];
+      out[0] = p[0][i + lane];
+      out[1] = p[1][i + lane];
+      out[2] = p[2][i + lane];
+      out[3] = system->life[i + lane];
+    }
+  }
+}
+
+void particles_simulate(ParticleSystem *system, JobSystem *jobs, float dt) {
+  SimulateBatch batch = { system, dt };
+  parallel_for(jobs, system->count / 4, PARTICLE_GRAIN / 4, simulate_job, &batch);
+  system->frame += 1;
+}
@@ -0,0 +1,42 @@
+#ifndef PARTICLES_H_
+#define PARTICLES_H_
+
+/* A CPU particle fountain, big enough to load the machine.
+
+   Particles are stored one array per component and simulated four at a
+   time with the simd.h kernels, split over the job system: gravity,
+   a bouncy floor, and a respawn at the emitter when their life runs
+   out. The same pass packs each particle as x, y, z, life into
+   `packed`, ready to be streamed to a vertex buffer and drawn as
+   points.
+*/
+
+#include "job_system.h"
+
+/* Particles per job */
+#define PARTICLE_GRAIN 4096
+
+typedef struct {
+  int count;     /* a multiple of four */
+
+  float *position[3];
+  float *velocity[3];
+  float *life;   /* seconds left */
+  float *packed; /* 4 floats per particle */
+
+  float emitter[3];
+  float gravity;
+  float floor_y;
+  float restitution;  /* fraction of speed kept on a bounce */
+  float max_life;
+  unsigned int frame;
+} ParticleSystem;
+
+/* count is rounded up to a multiple of four. */
+void particles_init(ParticleSystem *system, int count, const float *emitter);
+void particles_destroy(ParticleSystem *system);
+
+/* Step every particle by dt seconds and refill packed. */
+void particles_simulate(ParticleSystem *system, JobSystem *jobs, float dt);
+
+#endif // PARTICLES_H_
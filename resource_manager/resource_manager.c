@@ -0,0 +1,266 @@
+/* Ref-counted resource cache keyed by canonical path and options. */
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "resource_manager.h"
+#include "shader_loader.h"
+
+static const char *type_names[RESOURCE_NUM_TYPES] = { "meshes", "textures", "programs" };
+
+void resource_manager_init(ResourceManager *manager) {
+  memset(manager, 0, sizeof(*manager));
+}
+
+static ResourceEntry *entry(const ResourceManager *manager, int id) {
+  if (id <= 0 || id > manager->num_entries || manager->entries[id - 1].refs == 0) {
+    return NULL;
+  }
+  return &manager->entries[id - 1];
+}
+
+static void free_entry(ResourceManager *manager, ResourceEntry *resource) {
+  ResourceType type = resource->type;
+  manager->live[type] -= 1;
+  manager->cpu_bytes[type] -= resource->resource.cpu_bytes;
+  manager->gpu_bytes[type] -= resource->resource.gpu_bytes;
+
+  if (resource->free != NULL) {
+    resource->free(&resource->resource);
+  }
+  free(resource->key);
+  memset(resource, 0, sizeof(*resource));
+}
+
+void resource_manager_destroy(ResourceManager *manager) {
+  for (int i = 0; i < manager->num_entries; i++) {
+    ResourceEntry *resource = &manager->entries[i];
+    if (resource->refs > 0) {
+      int path_length = (int) (strchr(resource->key, '\n') - resource->key);
+      printf("ERROR: %.*s still has %d references at shutdown\n",
+	     path_length, resource->key, resource->refs);
+      free_entry(manager, resource);
+    }
+  }
+  free(manager->entries);
+  manager->entries = NULL;
+  manager->num_entries = 0;
+  manager->capacity = 0;
+}
+
+static char *make_key(const char *path, const char *options) {
+  char canonical[PATH_MAX];
+  if (realpath(path, canonical) == NULL) {
+    /* Not on disk (yet); the loader will report it */
+    strncpy(canonical, path, sizeof(canonical) - 1);
+    canonical[sizeof(canonical) - 1] = 0;
+  }
+  if (options == NULL) {
+    options = "";
+  }
+  size_t length = strlen(canonical) + 1 + strlen(options) + 1;
+  char *key = (char *) malloc(length);
+  snprintf(key, length, "%s\n%s", canonical, options);
+  return key;
+}
+
+int resource_acquire(ResourceManager *manager, ResourceType type,
+		     const char *path, const char *options,
+		     ResourceLoadFunction load, ResourceFreeFunction free_resource,
+		     void *user) {
+
+  char *key = make_key(path, options);
+
+  int free_slot = -1;
+  for (int i = 0; i < manager->num_entries; i++) {
+    ResourceEntry *resource = &manager->entries[i];
+    if (resource->refs == 0) {
+      if (free_slot < 0) {
+	free_slot = i;
+      }
+    } else if (resource->type == type && strcmp(resource->key, key) == 0) {
+      resource->refs += 1;
+      manager->hits[type] += 1;
+      free(key);
+      return i + 1;
+    }
+  }
+
+  ResourceData data;
+  memset(&data, 0, sizeof(data));
+  if (!load(path, options, user, &data)) {
+    printf("ERROR: could not load %s\n", path);
+    free(key);
+    return 0;
+  }
+
+  if (free_slot < 0) {
+    if (manager->num_entries == manager->capacity) {
+      manager->capacity = manager->capacity ? 2 * manager->capacity : 16;
+      manager->entries = (ResourceEntry *) realloc(manager->entries,
+						   manager->capacity * sizeof(ResourceEntry));
+    }
+    free_slot = manager->num_entries;
+    manager->num_entries += 1;
+  }
+
+  ResourceEntry *resource = &manager->entries[free_slot];
+  resource->type = type;
+  resource->key = key;
+  resource->refs = 1;
+  resource->resource = data;
+  resource->free = free_resource;
+
+  manager->live[type] += 1;
+  manager->loads[type] += 1;
+  manager->cpu_bytes[type] += data.cpu_bytes;
+  manager->gpu_bytes[type] += data.gpu_bytes;
+  return free_slot + 1;
+}
+
+void resource_retain(ResourceManager *manager, int id) {
+  ResourceEntry *resource = entry(manager, id);
+  if (resource != NULL) {
+    resource->refs += 1;
+  }
+}
+
+void resource_release(ResourceManager *manager, int id) {
+  ResourceEntry *resource = entry(manager, id);
+  if (resource == NULL) {
+    if (id != 0) {
+      printf("ERROR: released resource %d, which is not loaded\n", id);
+    }
+    return;
+  }
+  resource->refs -= 1;
+  if (resource->refs == 0) {
+    free_entry(manager, resource);
+  }
+}
+
+void *resource_data(const ResourceManager *manager, int id) {
+  ResourceEntry *resource = entry(manager, id);
+  return resource != NULL ? resource->resource.data : NULL;
+}
+
+/* ---- Typed handles ---- */
+
+MeshHandle resource_load_mesh(ResourceManager *manager, const char *path,
+			      const char *options, ResourceLoadFunction load,
+			      ResourceFreeFunction free_resource, void *user) {
+  MeshHandle mesh = {
+    resource_acquire(manager, RESOURCE_MESH, path, options, load, free_resource, user)
+  };
+  return mesh;
+}
+
+void *resource_mesh(const ResourceManager *manager, MeshHandle mesh) {
+  return resource_data(manager, mesh.id);
+}
+
+void resource_release_mesh(ResourceManager *manager, MeshHandle mesh) {
+  resource_release(manager, mesh.id);
+}
+
+TextureHandle resource_load_texture(ResourceManager *manager, const char *path,
+				    const char *options, ResourceLoadFunction load,
+				    ResourceFreeFunction free_resource, void *user) {
+  TextureHandle texture = {
+    resource_acquire(manager, RESOURCE_TEXTURE, path, options, load, free_resource, user)
+  };
+  return texture;
+}
+
+void *resource_texture(const ResourceManager *manager, TextureHandle texture) {
+  return resource_data(manager, texture.id);
+}
+
+void resource_release_texture(ResourceManager *manager, TextureHandle texture) {
+  resource_release(manager, texture.id);
+}
+
+/* The GL program name is stored in the data pointer itself */
+static bool load_program(const char *vertex_path, const char *fragment_path,
+			 void *user, ResourceData *out) {
+  (void) user;
+  GLuint program = load_shaders(vertex_path, fragment_path);
+  if (program == 0) {
+    return false;
+  }
+  out->data = (void *) (uintptr_t) program;
+  return true;
+}
+
+/* user is the two sources, already read */
+static bool load_program_source(const char *vertex_path, const char *fragment_path,
+				void *user, ResourceData *out) {
+  (void) vertex_path;
+  (void) fragment_path;
+  const char **sources = (const char **) user;
+  GLuint program = load_shaders_source(sources[0], sources[1]);
+  if (program == 0) {
+    return false;
+  }
+  out->data = (void *) (uintptr_t) program;
+  return true;
+}
+
+static void free_program(ResourceData *resource) {
+  glDeleteProgram((GLuint) (uintptr_t) resource->data);
+}
+
+static ProgramHandle acquire_program(ResourceManager *manager,
+				     const char *vertex_path, const char *fragment_path,
+				     ResourceLoadFunction load, void *user) {
+  /* The fragment shader is a path too, so make it canonical as well */
+  char canonical[PATH_MAX];
+  if (realpath(fragment_path, canonical) == NULL) {
+    strncpy(canonical, fragment_path, sizeof(canonical) - 1);
+    canonical[sizeof(canonical) - 1] = 0;
+  }
+  int id = resource_acquire(manager, RESOURCE_PROGRAM, vertex_path, canonical,
+			    load, free_program, user);
+  ProgramHandle program = { id };
+  return program;
+}
+
+ProgramHandle resource_load_program(ResourceManager *manager,
+				    const char *vertex_path, const char *fragment_path) {
+  return acquire_program(manager, vertex_path, fragment_path, load_program, NULL);
+}
+
+ProgramHandle resource_load_program_source(ResourceManager *manager,
+					   const char *vertex_path,
+					   const char *fragment_path,
+					   const char *vertex_source,
+					   const char *fragment_source) {
+  const char *sources[2] = { vertex_source, fragment_source };
+  return acquire_program(manager, vertex_path, fragment_path,
+			 load_program_source, sources);
+}
+
+GLuint resource_program(const ResourceManager *manager, ProgramHandle program) {
+  return (GLuint) (uintptr_t) resource_data(manager, program.id);
+}
+
+void resource_release_program(ResourceManager *manager, ProgramHandle program) {
+  resource_release(manager, program.id);
+}
+
+void resource_manager_report(const ResourceManager *manager) {
+  printf("Resources:\n");
+  for (int type = 0; type < RESOURCE_NUM_TYPES; type++) {
+    int requests = manager->loads[type] + manager->hits[type];
+    if (requests == 0) {
+      continue;
+    }
+    printf("\t%-8s %d live, %d requests, %d loaded, %d shared, "
+	   "%.1f KB CPU, %.1f KB GPU\n",
+	   type_names[type], manager->live[type], requests, manager->loads[type],
+	   manager->hits[type], manager->cpu_bytes[type] / 1024.0,
+	   manager->gpu_bytes[type] / 1024.0);
+  }
+}
@@ -0,0 +1,111 @@
+#ifndef RESOURCE_MANAGER_H_
+#define RESOURCE_MANAGER_H_
+
+/* Shared, ref-counted meshes, textures and shader programs.
+
+   Resources are keyed by type, canonical path (realpath, so
+   "../data/cube.obj" and "../data//cube.obj" are the same file) and a
+   load options string, e.g. the vertex layout a mesh is uploaded in.
+   Asking for a resource that is already loaded returns the same one
+   and bumps its count; the last release frees it.
+
+   What a mesh or texture actually is belongs to the program using it,
+   so those are loaded and freed by callbacks, which also say how much
+   CPU and GPU memory they took. Programs are built in: the key is the
+   vertex shader path and the options are the fragment shader path.
+
+   Handles are small typed ids, 0 being no resource. Looking one up is
+   a plain array read, so any thread may do it while nothing is being
+   acquired or released.
+*/
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <GLES2/gl2.h>
+
+typedef enum {
+  RESOURCE_MESH,
+  RESOURCE_TEXTURE,
+  RESOURCE_PROGRAM,
+  RESOURCE_NUM_TYPES
+} ResourceType;
+
+typedef struct { int id; } MeshHandle;
+typedef struct { int id; } TextureHandle;
+typedef struct { int id; } ProgramHandle;
+
+typedef struct {
+  /* Filled in by a loader */
+  void *data;
+  size_t cpu_bytes;
+  size_t gpu_bytes;
+} ResourceData;
+
+typedef bool (*ResourceLoadFunction)(const char *path, const char *options,
+				     void *user, ResourceData *out);
+typedef void (*ResourceFreeFunction)(ResourceData *resource);
+
+typedef struct {
+  ResourceType type;
+  char *key;  /* canonical path, a newline, then the options */
+  int refs;   /* 0 for a free slot */
+  ResourceData resource;
+  ResourceFreeFunction free;
+} ResourceEntry;
+
+typedef struct {
+  ResourceEntry *entries;  /* handle id is index + 1 */
+  int num_entries;
+  int capacity;
+
+  /* Per type counters */
+  int live[RESOURCE_NUM_TYPES];
+  int loads[RESOURCE_NUM_TYPES];
+  int hits[RESOURCE_NUM_TYPES];  /* requests served without loading */
+  size_t cpu_bytes[RESOURCE_NUM_TYPES];
+  size_t gpu_bytes[RESOURCE_NUM_TYPES];
+} ResourceManager;
+
+void resource_manager_init(ResourceManager *manager);
+
+/* Frees everything, reporting anything still referenced. */
+void resource_manager_destroy(ResourceManager *manager);
+
+/* Generic form: returns the id, or 0 if loading failed. */
+int resource_acquire(ResourceManager *manager, ResourceType type,
+		     const char *path, const char *options,
+		     ResourceLoadFunction load, ResourceFreeFunction free_resource,
+		     void *user);
+void resource_retain(ResourceManager *manager, int id);
+void resource_release(ResourceManager *manager, int id);
+void *resource_data(const ResourceManager *manager, int id);
+
+MeshHandle resource_load_mesh(ResourceManager *manager, const char *path,
+			      const char *options, ResourceLoadFunction load,
+			      ResourceFreeFunction free_resource, void *user);
+void *resource_mesh(const ResourceManager *manager, MeshHandle mesh);
+void resource_release_mesh(ResourceManager *manager, MeshHandle mesh);
+
+TextureHandle resource_load_texture(ResourceManager *manager, const char *path,
+				    const char *options, ResourceLoadFunction load,
+				    ResourceFreeFunction free_resource, void *user);
+void *resource_texture(const ResourceManager *manager, TextureHandle texture);
+void resource_release_texture(ResourceManager *manager, TextureHandle texture);
+
+ProgramHandle resource_load_program(ResourceManager *manager,
+				    const char *vertex_path, const char *fragment_path);
+/* With the sources already read, e.g. on a loading thread. The paths
+   are still the key; the sources are only compiled on a miss. */
+ProgramHandle resource_load_program_source(ResourceManager *manager,
+					   const char *vertex_path,
+					   const char *fragment_path,
+					   const char *vertex_source,
+					   const char *fragment_source);
+GLuint resource_program(const ResourceManager *manager, ProgramHandle program);
+void resource_release_program(ResourceManager *manager, ProgramHandle program);
+
+/* Live resources, cache hits and memory per type. */
+void resource_manager_report(const ResourceManager *manager);
+
+#endif // RESOURCE_MANAGER_H_
@@ -1,6 +1,7 @@
 /* Function to load and compile an OpenGLES shader program. */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <EGL/egl.h>
 #include <GLES2/gl2.h>
@@ -8,34 +9,92 @@
 #include "shader_loader.h"
 
 
+char *read_shader_source(const char *path) {
+
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    printf("ERROR: could not open shader %s\n", path);
+    return NULL;
+  }
+
+  fseek(file, 0, SEEK_END);
+  long fsize = ftell(file);
+  rewind(file);
+
+  char *source = malloc(fsize + 1);
+  fread(source, fsize, 1, file);
+  fclose(file);
+
+  source[fsize] = 0;
+  return source;
+}
+
 GLuint load_shaders(const char *vertex_shader_path,
 		    const char *fragment_shader_path) {
  
   /* load the vertex shader and fragment shader code */
-  FILE *vertex_file = fopen(vertex_shader_path, "rb");
-  FILE *fragment_file = fopen(fragment_shader_path, "rb");
+  char *vertex_shader_source = read_shader_source(vertex_shader_path);
+  char *fragment_shader_source = read_shader_source(fragment_shader_path);
+  if (vertex_shader_source == NULL || fragment_shader_source == NULL) {
+    free(vertex_shader_source);
+    free(fragment_shader_source);
+    return 0;
+  }
 
-  fseek(vertex_file, 0, SEEK_END);
-  fseek(fragment_file, 0, SEEK_END);
+  GLuint shader_program = load_shaders_source(vertex_shader_source,
+					      fragment_shader_source);
 
-  long vertex_fsize = ftell(vertex_file);
-  long fragment_fsize = ftell(fragment_file);
+  free(vertex_shader_source);
+  free(fragment_shader_source);
 
-  rewind(vertex_file);
-  rewind(fragment_file);
+  return shader_program;
+}
 
-  char * vertex_shader_source = malloc(vertex_fsize + 1);
-  char * fragment_shader_source = malloc(fragment_fsize + 1);
+/* Nothing but comments may come before #version, so the defines go
+   on the line after it */
+static char *add_defines(const char *source, const char *defines) {
 
-  fread(vertex_shader_source, vertex_fsize, 1, vertex_file);
-  fread(fragment_shader_source, fragment_fsize, 1, fragment_file);
+  size_t split = 0;
+  if (strncmp(source, "#version", 8) == 0) {
+    const char *end = strchr(source, '\n');
+    split = end != NULL ? (size_t) (end - source) + 1 : strlen(source);
+  }
 
-  fclose(vertex_file);
-  fclose(fragment_file);
+  size_t length = strlen(source) + strlen(defines) + 2;
+  char *result = malloc(length);
+  snprintf(result, length, "%.*s%s%s%s", (int) split, source,
+	   (split > 0 && source[split - 1] != '\n') ? "\n" : "", defines, source + split);
+  return result;
+}
+
+GLuint load_shaders_defines(const char *vertex_shader_path,
+			    const char *fragment_shader_path,
+			    const char *defines) {
+
+  char *vertex_shader_source = read_shader_source(vertex_shader_path);
+  char *fragment_shader_source = read_shader_source(fragment_shader_path);
+  if (vertex_shader_source == NULL || fragment_shader_source == NULL) {
+    free(vertex_shader_source);
+    free(fragment_shader_source);
+    return 0;
+  }
+
+  char *vertex_with_defines = add_defines(vertex_shader_source, defines);
+  char *fragment_with_defines = add_defines(fragment_shader_source, defines);
+  GLuint shader_program = load_shaders_source(vertex_with_defines,
+					      fragment_with_defines);
+
+  free(vertex_shader_source);
+  free(fragment_shader_source);
+  free(vertex_with_defines);
+  free(fragment_with_defines);
+
+  return shader_program;
+}
+
+GLuint load_shaders_source(const char *vertex_shader_source,
+			   const char *fragment_shader_source) {
 
-  vertex_shader_source[vertex_fsize] = 0;
-  fragment_shader_source[fragment_fsize] = 0;
-  
   const GLchar * final_vertex_shader_source = vertex_shader_source;
   const GLchar * final_fragment_shader_source = fragment_shader_source;
 
@@ -92,9 +151,6 @@ GLuint load_shaders(const char *vertex_shader_path,
   glDeleteShader(vertex_shader);
   glDeleteShader(fragment_shader);
 
-  free(vertex_shader_source);
-  free(fragment_shader_source);
-  
   return shader_program;
   
 }
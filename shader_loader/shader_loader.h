@@ -5,6 +5,19 @@
 GLuint load_shaders(const char *vertex_shader_path,
 		    const char *fragment_shader_path);
 
+/* The same from source already in memory, e.g. read on another
+   thread with read_shader_source (free the result with free). */
+GLuint load_shaders_source(const char *vertex_shader_source,
+			   const char *fragment_shader_source);
+char *read_shader_source(const char *path);
+
+/* load_shaders with defines ("#define NAME 1\n" lines) added to both
+   sources, after the #version line if there is one. One file can then
+   be built as several variants. */
+GLuint load_shaders_defines(const char *vertex_shader_path,
+			    const char *fragment_shader_path,
+			    const char *defines);
+
 
 #endif // SHADER_LOADER_H_
 
@@ -0,0 +1,17 @@
+#version 300 es
+
+precision mediump float;
+precision mediump sampler2DArray;
+
+uniform sampler2DArray u_texture;
+
+in vec3 fragmentColour;
+in vec3 texCoord;
+
+out vec4 fragColour;
+
+void main() {
+
+  fragColour = mix(texture(u_texture, texCoord), vec4(fragmentColour, 1.0), 0.5);
+  
+}
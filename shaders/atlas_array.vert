@@ -0,0 +1,18 @@
+#version 300 es
+
+in vec3 vPosition;
+in vec3 vColour;
+in vec3 vTexCoord;   // u, v and the array layer
+
+uniform mat4 MVP;
+
+out vec3 fragmentColour;
+out vec3 texCoord;
+
+void main() {
+
+  fragmentColour = vColour;
+  texCoord = vTexCoord;
+  gl_Position = MVP * vec4(vPosition, 1.0);
+  
+}
@@ -0,0 +1,15 @@
+#version 100
+
+precision mediump float;
+
+uniform sampler2D u_texture;
+uniform vec2 u_uvMax;
+
+varying vec2 texCoord;
+
+void main() {
+
+  /* Clamp so the bilinear filter never reads outside the used corner */
+  gl_FragColor = texture2D(u_texture, min(texCoord, u_uvMax));
+
+}
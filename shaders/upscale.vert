@@ -0,0 +1,15 @@
+#version 100
+
+attribute vec2 aPos;
+
+uniform vec2 u_uvScale;
+
+varying vec2 texCoord;
+
+void main() {
+
+  /* Map the full-screen triangle onto the used corner of the target */
+  texCoord = (aPos * 0.5 + 0.5) * u_uvScale;
+  gl_Position = vec4(aPos, 0.0, 1.0);
+
+}
@@ -0,0 +1,291 @@
+#ifndef SIMD_H_
+#define SIMD_H_
+
+/* Header-only 4-wide float vectors for the batch kernels.
+
+   Maps onto SSE on x86, NEON on the pi (armv7 and aarch64) and a
+   plain struct of four floats everywhere else, so kernels are written
+   once against the f32x4_* functions (build with -DSIMD_FORCE_SCALAR
+   to compare against the plain C path). Masks are vectors with every bit
+   of a lane set or clear, as produced by the comparisons.
+*/
+
+#include <stdint.h>
+
+#if defined(SIMD_FORCE_SCALAR)
+#define SIMD_SCALAR 1
+#elif defined(__SSE2__) || defined(_M_X64)
+#define SIMD_SSE 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define SIMD_NEON 1
+#include <arm_neon.h>
+#else
+#define SIMD_SCALAR 1
+#endif
+
+#if defined(SIMD_SSE)
+
+typedef __m128 f32x4;
+typedef __m128i i32x4;
+
+static inline f32x4 f32x4_load(const float *p) { return _mm_loadu_ps(p); }
+static inline void f32x4_store(float *p, f32x4 a) { _mm_storeu_ps(p, a); }
+static inline f32x4 f32x4_set1(float a) { return _mm_set1_ps(a); }
+static inline f32x4 f32x4_set(float a, float b, float c, float d) {
+  return _mm_setr_ps(a, b, c, d);
+}
+static inline f32x4 f32x4_zero(void) { return _mm_setzero_ps(); }
+static inline f32x4 f32x4_add(f32x4 a, f32x4 b) { return _mm_add_ps(a, b); }
+static inline f32x4 f32x4_sub(f32x4 a, f32x4 b) { return _mm_sub_ps(a, b); }
+static inline f32x4 f32x4_mul(f32x4 a, f32x4 b) { return _mm_mul_ps(a, b); }
+static inline f32x4 f32x4_div(f32x4 a, f32x4 b) { return _mm_div_ps(a, b); }
+static inline f32x4 f32x4_min(f32x4 a, f32x4 b) { return _mm_min_ps(a, b); }
+static inline f32x4 f32x4_max(f32x4 a, f32x4 b) { return _mm_max_ps(a, b); }
+static inline f32x4 f32x4_sqrt(f32x4 a) { return _mm_sqrt_ps(a); }
+/* a * b + c */
+static inline f32x4 f32x4_madd(f32x4 a, f32x4 b, f32x4 c) {
+  return _mm_add_ps(_mm_mul_ps(a, b), c);
+}
+static inline f32x4 f32x4_cmpgt(f32x4 a, f32x4 b) { return _mm_cmpgt_ps(a, b); }
+static inline f32x4 f32x4_cmplt(f32x4 a, f32x4 b) { return _mm_cmplt_ps(a, b); }
+static inline f32x4 f32x4_cmpeq(f32x4 a, f32x4 b) { return _mm_cmpeq_ps(a, b); }
+static inline f32x4 f32x4_and(f32x4 a, f32x4 b) { return _mm_and_ps(a, b); }
+static inline f32x4 f32x4_or(f32x4 a, f32x4 b) { return _mm_or_ps(a, b); }
+/* mask ? a : b */
+static inline f32x4 f32x4_select(f32x4 mask, f32x4 a, f32x4 b) {
+  return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+/* One bit per lane, lane 0 in bit 0 */
+static inline int f32x4_movemask(f32x4 mask) { return _mm_movemask_ps(mask); }
+
+static inline i32x4 f32x4_to_i32x4(f32x4 a) { return _mm_cvttps_epi32(a); }
+static inline f32x4 i32x4_to_f32x4(i32x4 a) { return _mm_cvtepi32_ps(a); }
+static inline void i32x4_store(int32_t *p, i32x4 a) {
+  _mm_storeu_si128((__m128i *) p, a);
+}
+static inline i32x4 i32x4_load(const int32_t *p) { return _mm_loadu_si128((const __m128i *) p); }
+static inline i32x4 i32x4_set1(int32_t a) { return _mm_set1_epi32(a); }
+static inline i32x4 i32x4_and(i32x4 a, i32x4 b) { return _mm_and_si128(a, b); }
+static inline i32x4 i32x4_or(i32x4 a, i32x4 b) { return _mm_or_si128(a, b); }
+/* Logical shifts of every lane */
+static inline i32x4 i32x4_srl(i32x4 a, int n) { return _mm_srl_epi32(a, _mm_cvtsi32_si128(n)); }
+static inline i32x4 i32x4_sll(i32x4 a, int n) { return _mm_sll_epi32(a, _mm_cvtsi32_si128(n)); }
+/* The whole vector moved up n bytes in memory order, zero filled; n
+   must be a constant */
+#define i32x4_shift_bytes(a, n) _mm_slli_si128((a), (n))
+
+static inline void f32x4_transpose(f32x4 *a, f32x4 *b, f32x4 *c, f32x4 *d) {
+  _MM_TRANSPOSE4_PS(*a, *b, *c, *d);
+}
+
+#elif defined(SIMD_NEON)
+
+typedef float32x4_t f32x4;
+typedef int32x4_t i32x4;
+
+static inline f32x4 f32x4_load(const float *p) { return vld1q_f32(p); }
+static inline void f32x4_store(float *p, f32x4 a) { vst1q_f32(p, a); }
+static inline f32x4 f32x4_set1(float a) { return vdupq_n_f32(a); }
+static inline f32x4 f32x4_set(float a, float b, float c, float d) {
+  float values[4] = { a, b, c, d };
+  return vld1q_f32(values);
+}
+static inline f32x4 f32x4_zero(void) { return vdupq_n_f32(0.0f); }
+static inline f32x4 f32x4_add(f32x4 a, f32x4 b) { return vaddq_f32(a, b); }
+static inline f32x4 f32x4_sub(f32x4 a, f32x4 b) { return vsubq_f32(a, b); }
+static inline f32x4 f32x4_mul(f32x4 a, f32x4 b) { return vmulq_f32(a, b); }
+static inline f32x4 f32x4_min(f32x4 a, f32x4 b) { return vminq_f32(a, b); }
+static inline f32x4 f32x4_max(f32x4 a, f32x4 b) { return vmaxq_f32(a, b); }
+static inline f32x4 f32x4_madd(f32x4 a, f32x4 b, f32x4 c) {
+  return vmlaq_f32(c, a, b);
+}
+
+#if defined(__aarch64__)
+static inline f32x4 f32x4_div(f32x4 a, f32x4 b) { return vdivq_f32(a, b); }
+static inline f32x4 f32x4_sqrt(f32x4 a) { return vsqrtq_f32(a); }
+#else
+/* armv7 NEON has no divide or square root: estimate and refine twice */
+static inline f32x4 f32x4_div(f32x4 a, f32x4 b) {
+  f32x4 r = vrecpeq_f32(b);
+  r = vmulq_f32(vrecpsq_f32(b, r), r);
+  r = vmulq_f32(vrecpsq_f32(b, r), r);
+  return vmulq_f32(a, r);
+}
+static inline f32x4 f32x4_sqrt(f32x4 a) {
+  f32x4 r = vrsqrteq_f32(a);
+  r = vmulq_f32(vrsqrtsq_f32(vmulq_f32(a, r), r), r);
+  r = vmulq_f32(vrsqrtsq_f32(vmulq_f32(a, r), r), r);
+  /* sqrt(0) would come out as 0 * inf */
+  uint32x4_t zero = vceqq_f32(a, vdupq_n_f32(0.0f));
+  return vbslq_f32(zero, a, vmulq_f32(a, r));
+}
+#endif
+
+static inline f32x4 f32x4_cmpgt(f32x4 a, f32x4 b) {
+  return vreinterpretq_f32_u32(vcgtq_f32(a, b));
+}
+static inline f32x4 f32x4_cmplt(f32x4 a, f32x4 b) {
+  return vreinterpretq_f32_u32(vcltq_f32(a, b));
+}
+static inline f32x4 f32x4_cmpeq(f32x4 a, f32x4 b) {
+  return vreinterpretq_f32_u32(vceqq_f32(a, b));
+}
+static inline f32x4 f32x4_and(f32x4 a, f32x4 b) {
+  return vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(a),
+					 vreinterpretq_u32_f32(b)));
+}
+static inline f32x4 f32x4_or(f32x4 a, f32x4 b) {
+  return vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(a),
+					 vreinterpretq_u32_f32(b)));
+}
+static inline f32x4 f32x4_select(f32x4 mask, f32x4 a, f32x4 b) {
+  return vbslq_f32(vreinterpretq_u32_f32(mask), a, b);
+}
+static inline int f32x4_movemask(f32x4 mask) {
+  uint32_t lanes[4];
+  vst1q_u32(lanes, vreinterpretq_u32_f32(mask));
+  return (lanes[0] >> 31) | ((lanes[1] >> 31) << 1)
+    | ((lanes[2] >> 31) << 2) | ((lanes[3] >> 31) << 3);
+}
+
+static inline i32x4 f32x4_to_i32x4(f32x4 a) { return vcvtq_s32_f32(a); }
+static inline f32x4 i32x4_to_f32x4(i32x4 a) { return vcvtq_f32_s32(a); }
+static inline void i32x4_store(int32_t *p, i32x4 a) { vst1q_s32(p, a); }
+static inline i32x4 i32x4_load(const int32_t *p) { return vld1q_s32(p); }
+static inline i32x4 i32x4_set1(int32_t a) { return vdupq_n_s32(a); }
+static inline i32x4 i32x4_and(i32x4 a, i32x4 b) { return vandq_s32(a, b); }
+static inline i32x4 i32x4_or(i32x4 a, i32x4 b) { return vorrq_s32(a, b); }
+/* Logical shifts of every lane */
+static inline i32x4 i32x4_srl(i32x4 a, int n) {
+  return vreinterpretq_s32_u32(vshlq_u32(vreinterpretq_u32_s32(a), vdupq_n_s32(-n)));
+}
+static inline i32x4 i32x4_sll(i32x4 a, int n) { return vshlq_s32(a, vdupq_n_s32(n)); }
+/* The whole vector moved up n bytes in memory order, zero filled; n
+   must be a constant */
+#define i32x4_shift_bytes(a, n) \
+  vreinterpretq_s32_u8(vextq_u8(vdupq_n_u8(0), vreinterpretq_u8_s32(a), 16 - (n)))
+
+static inline void f32x4_transpose(f32x4 *a, f32x4 *b, f32x4 *c, f32x4 *d) {
+  float32x4x2_t ab = vtrnq_f32(*a, *b);
+  float32x4x2_t cd = vtrnq_f32(*c, *d);
+  *a = vcombine_f32(vget_low_f32(ab.val[0]), vget_low_f32(cd.val[0]));
+  *b = vcombine_f32(vget_low_f32(ab.val[1]), vget_low_f32(cd.val[1]));
+  *c = vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0]));
+  *d = vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1]));
+}
+
+#else /* SIMD_SCALAR */
+
+#include <math.h>
+#include <string.h>
+
+typedef struct { float v[4]; } f32x4;
+typedef struct { int32_t v[4]; } i32x4;
+
+#define SIMD_LANES(expr) \
+  f32x4 r; for (int i = 0; i < 4; i++) { r.v[i] = (expr); } return r;
+
+static inline f32x4 f32x4_load(const float *p) {
+  f32x4 r; memcpy(r.v, p, sizeof(r.v)); return r;
+}
+static inline void f32x4_store(float *p, f32x4 a) { memcpy(p, a.v, sizeof(a.v)); }
+static inline f32x4 f32x4_set1(float a) { SIMD_LANES(a) }
+static inline f32x4 f32x4_set(float a, float b, float c, float d) {
+  f32x4 r = { { a, b, c, d } }; return r;
+}
+static inline f32x4 f32x4_zero(void) { SIMD_LANES(0.0f) }
+static inline f32x4 f32x4_add(f32x4 a, f32x4 b) { SIMD_LANES(a.v[i] + b.v[i]) }
+static inline f32x4 f32x4_sub(f32x4 a, f32x4 b) { SIMD_LANES(a.v[i] - b.v[i]) }
+static inline f32x4 f32x4_mul(f32x4 a, f32x4 b) { SIMD_LANES(a.v[i] * b.v[i]) }
+static inline f32x4 f32x4_div(f32x4 a, f32x4 b) { SIMD_LANES(a.v[i] / b.v[i]) }
+static inline f32x4 f32x4_min(f32x4 a, f32x4 b) { SIMD_LANES(a.v[i] < b.v[i] ? a.v[i] : b.v[i]) }
+static inline f32x4 f32x4_max(f32x4 a, f32x4 b) { SIMD_LANES(a.v[i] > b.v[i] ? a.v[i] : b.v[i]) }
+static inline f32x4 f32x4_sqrt(f32x4 a) { SIMD_LANES(sqrtf(a.v[i])) }
+static inline f32x4 f32x4_madd(f32x4 a, f32x4 b, f32x4 c) { SIMD_LANES(a.v[i] * b.v[i] + c.v[i]) }
+
+static inline float simd_mask_lane(int set) {
+  uint32_t bits = set ? 0xFFFFFFFFu : 0u; float f; memcpy(&f, &bits, 4); return f;
+}
+static inline uint32_t simd_lane_bits(float f) {
+  uint32_t bits; memcpy(&bits, &f, 4); return bits;
+}
+static inline f32x4 f32x4_cmpgt(f32x4 a, f32x4 b) { SIMD_LANES(simd_mask_lane(a.v[i] > b.v[i])) }
+static inline f32x4 f32x4_cmplt(f32x4 a, f32x4 b) { SIMD_LANES(simd_mask_lane(a.v[i] < b.v[i])) }
+static inline f32x4 f32x4_cmpeq(f32x4 a, f32x4 b) { SIMD_LANES(simd_mask_lane(a.v[i] == b.v[i])) }
+static inline f32x4 f32x4_and(f32x4 a, f32x4 b) {
+  f32x4 r;
+  for (int i = 0; i < 4; i++) {
+    uint32_t bits = simd_lane_bits(a.v[i]) & simd_lane_bits(b.v[i]);
+    memcpy(&r.v[i], &bits, 4);
+  }
+  return r;
+}
+static inline f32x4 f32x4_or(f32x4 a, f32x4 b) {
+  f32x4 r;
+  for (int i = 0; i < 4; i++) {
+    uint32_t bits = simd_lane_bits(a.v[i]) | simd_lane_bits(b.v[i]);
+    memcpy(&r.v[i], &bits, 4);
+  }
+  return r;
+}
+static inline f32x4 f32x4_select(f32x4 mask, f32x4 a, f32x4 b) {
+  SIMD_LANES(simd_lane_bits(mask.v[i]) ? a.v[i] : b.v[i])
+}
+static inline int f32x4_movemask(f32x4 mask) {
+  int bits = 0;
+  for (int i = 0; i < 4; i++) {
+    bits |= (simd_lane_bits(mask.v[i]) >> 31) << i;
+  }
+  return bits;
+}
+
+static inline i32x4 f32x4_to_i32x4(f32x4 a) {
+  i32x4 r; for (int i = 0; i < 4; i++) { r.v[i] = (int32_t) a.v[i]; } return r;
+}
+static inline f32x4 i32x4_to_f32x4(i32x4 a) { SIMD_LANES((float) a.v[i]) }
+static inline void i32x4_store(int32_t *p, i32x4 a) { memcpy(p, a.v, sizeof(a.v)); }
+static inline i32x4 i32x4_load(const int32_t *p) {
+  i32x4 r; memcpy(r.v, p, sizeof(r.v)); return r;
+}
+static inline i32x4 i32x4_set1(int32_t a) {
+  i32x4 r; for (int i = 0; i < 4; i++) { r.v[i] = a; } return r;
+}
+static inline i32x4 i32x4_and(i32x4 a, i32x4 b) {
+  i32x4 r; for (int i = 0; i < 4; i++) { r.v[i] = a.v[i] & b.v[i]; } return r;
+}
+static inline i32x4 i32x4_or(i32x4 a, i32x4 b) {
+  i32x4 r; for (int i = 0; i < 4; i++) { r.v[i] = a.v[i] | b.v[i]; } return r;
+}
+/* Logical shifts of every lane */
+static inline i32x4 i32x4_srl(i32x4 a, int n) {
+  i32x4 r; for (int i = 0; i < 4; i++) { r.v[i] = (int32_t) ((uint32_t) a.v[i] >> n); } return r;
+}
+static inline i32x4 i32x4_sll(i32x4 a, int n) {
+  i32x4 r; for (int i = 0; i < 4; i++) { r.v[i] = (int32_t) ((uint32_t) a.v[i] << n); } return r;
+}
+/* The whole vector moved up n bytes in memory order, zero filled */
+static inline i32x4 i32x4_shift_bytes(i32x4 a, int n) {
+  unsigned char bytes[32] = { 0 };
+  memcpy(bytes + 16, a.v, sizeof(a.v));
+  i32x4 r; memcpy(r.v, bytes + 16 - n, sizeof(r.v)); return r;
+}
+
+static inline void f32x4_transpose(f32x4 *a, f32x4 *b, f32x4 *c, f32x4 *d) {
+  f32x4 *rows[4] = { a, b, c, d };
+  float m[4][4];
+  for (int i = 0; i < 4; i++) {
+    memcpy(m[i], rows[i]->v, sizeof(m[i]));
+  }
+  for (int i = 0; i < 4; i++) {
+    for (int j = 0; j < 4; j++) {
+      rows[i]->v[j] = m[j][i];
+    }
+  }
+}
+
+#undef SIMD_LANES
+
+#endif
+
+#endif // SIMD_H_
@@ -0,0 +1,246 @@
+/* Asset loading on background threads while the window and context come up. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "startup.h"
+
+static double ms_between(Uint64 start, Uint64 end) {
+  return (double) (end - start) * 1000.0 / (double) SDL_GetPerformanceFrequency();
+}
+
+void startup_init(StartupPipeline *pipeline, int num_threads, bool serial) {
+  memset(pipeline, 0, sizeof(*pipeline));
+  pipeline->start = SDL_GetPerformanceCounter();
+  pipeline->serial = serial;
+  if (num_threads < 1) {
+    num_threads = 1;
+  }
+  if (num_threads > STARTUP_MAX_THREADS) {
+    num_threads = STARTUP_MAX_THREADS;
+  }
+  pipeline->num_threads = serial ? 0 : num_threads;
+  pipeline->mutex = SDL_CreateMutex();
+  pipeline->loaded = SDL_CreateCond();
+}
+
+void startup_parse_args(int argc, char *argv[], int *num_threads, bool *serial) {
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--serial-startup") == 0) {
+      *serial = true;
+    } else if (strcmp(argv[i], "--startup-threads") == 0 && i + 1 < argc) {
+      *num_threads = atoi(argv[i + 1]);
+    }
+  }
+}
+
+int startup_add(StartupPipeline *pipeline, const char *name,
+		StartupLoadFunction load, StartupUploadFunction upload, void *data) {
+  if (pipeline->num_tasks == STARTUP_MAX_TASKS) {
+    printf("ERROR: too many startup tasks, dropping %s\n", name);
+    return -1;
+  }
+  StartupTask *task = &pipeline->tasks[pipeline->num_tasks];
+  task->name = name;
+  task->load = load;
+  task->upload = upload;
+  task->data = data;
+  task->state = STARTUP_QUEUED;
+  return pipeline->num_tasks++;
+}
+
+/* Returns the state the task ends up in */
+static StartupState run_load(StartupTask *task, int thread) {
+  task->thread = thread;
+  task->load_start = SDL_GetPerformanceCounter();
+  bool ok = task->load(task->data);
+  task->load_end = SDL_GetPerformanceCounter();
+  if (!ok) {
+    printf("ERROR: startup task %s failed to load\n", task->name);
+  }
+  return ok ? STARTUP_LOADED : STARTUP_FAILED;
+}
+
+static int worker(void *data) {
+  StartupPipeline *pipeline = (StartupPipeline *) data;
+
+  SDL_LockMutex(pipeline->mutex);
+  int thread = ++pipeline->num_started;
+  while (pipeline->next_task < pipeline->num_tasks) {
+    StartupTask *task = &pipeline->tasks[pipeline->next_task++];
+    task->state = STARTUP_LOADING;
+    SDL_UnlockMutex(pipeline->mutex);
+
+    /* The task is ours until it is marked loaded, so no lock here */
+    StartupState state = run_load(task, thread);
+
+    SDL_LockMutex(pipeline->mutex);
+    task->state = state;
+    SDL_CondBroadcast(pipeline->loaded);
+  }
+  SDL_UnlockMutex(pipeline->mutex);
+  return 0;
+}
+
+void startup_start(StartupPipeline *pipeline) {
+  if (pipeline->serial) {
+    for (int i = 0; i < pipeline->num_tasks; i++) {
+      pipeline->tasks[i].state = run_load(&pipeline->tasks[i], 0);
+    }
+    pipeline->next_task = pipeline->num_tasks;
+    return;
+  }
+
+  int num_threads = pipeline->num_threads;
+  if (num_threads > pipeline->num_tasks) {
+    num_threads = pipeline->num_tasks;
+  }
+  int started = 0;
+  for (int i = 0; i < num_threads; i++) {
+    pipeline->threads[i] = SDL_CreateThread(worker, "startup", pipeline);
+    if (pipeline->threads[i] == NULL) {
+      printf("ERROR: could not start a startup thread: %s\n", SDL_GetError());
+    } else {
+      started += 1;
+    }
+  }
+
+  /* Without any threads the loads still have to happen */
+  if (started == 0) {
+    for (int i = 0; i < pipeline->num_tasks; i++) {
+      pipeline->tasks[i].state = run_load(&pipeline->tasks[i], 0);
+    }
+    pipeline->next_task = pipeline->num_tasks;
+  }
+}
+
+void startup_mark(StartupPipeline *pipeline, const char *name) {
+  if (pipeline->num_marks == STARTUP_MAX_MARKS) {
+    return;
+  }
+  StartupMark *mark = &pipeline->marks[pipeline->num_marks++];
+  mark->name = name;
+  mark->time = SDL_GetPerformanceCounter();
+}
+
+int startup_poll(StartupPipeline *pipeline) {
+  int uploaded = 0;
+  for (int i = 0; i < pipeline->num_tasks; i++) {
+    StartupTask *task = &pipeline->tasks[i];
+
+    /* Only this thread moves a task on from loaded */
+    SDL_LockMutex(pipeline->mutex);
+    bool ready = task->state == STARTUP_LOADED;
+    SDL_UnlockMutex(pipeline->mutex);
+    if (!ready) {
+      continue;
+    }
+
+    task->upload_start = SDL_GetPerformanceCounter();
+    if (task->upload != NULL) {
+      task->upload(task->data);
+    }
+    task->upload_end = SDL_GetPerformanceCounter();
+    task->state = STARTUP_DONE;
+    uploaded += 1;
+  }
+  return uploaded;
+}
+
+bool startup_wait(StartupPipeline *pipeline, int task) {
+  if (task < 0 || task >= pipeline->num_tasks) {
+    return false;
+  }
+  StartupTask *wanted = &pipeline->tasks[task];
+  for (;;) {
+    startup_poll(pipeline);
+
+    SDL_LockMutex(pipeline->mutex);
+    StartupState state = wanted->state;
+    if (state != STARTUP_DONE && state != STARTUP_FAILED && state != STARTUP_LOADED) {
+      SDL_CondWait(pipeline->loaded, pipeline->mutex);
+    }
+    SDL_UnlockMutex(pipeline->mutex);
+
+    if (state == STARTUP_DONE || state == STARTUP_FAILED) {
+      return state == STARTUP_DONE;
+    }
+  }
+}
+
+bool startup_finish(StartupPipeline *pipeline) {
+  bool ok = true;
+  for (int i = 0; i < pipeline->num_tasks; i++) {
+    ok = startup_wait(pipeline, i) && ok;
+  }
+  for (int i = 0; i < STARTUP_MAX_THREADS; i++) {
+    if (pipeline->threads[i] != NULL) {
+      SDL_WaitThread(pipeline->threads[i], NULL);
+      pipeline->threads[i] = NULL;
+    }
+  }
+  return ok;
+}
+
+void startup_report(const StartupPipeline *pipeline) {
+  Uint64 start = pipeline->start;
+
+  printf("Startup (%s", pipeline->serial ? "serial" : "parallel");
+  if (!pipeline->serial) {
+    printf(", %d threads", pipeline->num_threads);
+  }
+  printf("):\n");
+
+  for (int i = 0; i < pipeline->num_marks; i++) {
+    printf("\t%8.1f ms  %s\n", ms_between(start, pipeline->marks[i].time),
+	   pipeline->marks[i].name);
+  }
+
+  double loading_ms = 0.0;
+  double uploading_ms = 0.0;
+  for (int i = 0; i < pipeline->num_tasks; i++) {
+    const StartupTask *task = &pipeline->tasks[i];
+    if (task->load_end == 0) {
+      continue;
+    }
+    double load_ms = ms_between(task->load_start, task->load_end);
+    loading_ms += load_ms;
+    if (task->thread == 0) {
+      printf("\t%-16s load %8.1f - %8.1f ms (%.1f ms, main thread)",
+	     task->name, ms_between(start, task->load_start),
+	     ms_between(start, task->load_end), load_ms);
+    } else {
+      printf("\t%-16s load %8.1f - %8.1f ms (%.1f ms, thread %d)",
+	     task->name, ms_between(start, task->load_start),
+	     ms_between(start, task->load_end), load_ms, task->thread);
+    }
+    if (task->state == STARTUP_DONE) {
+      double upload_ms = ms_between(task->upload_start, task->upload_end);
+      uploading_ms += upload_ms;
+      printf(", upload %8.1f - %8.1f ms (%.1f ms)",
+	     ms_between(start, task->upload_start),
+	     ms_between(start, task->upload_end), upload_ms);
+    } else if (task->state == STARTUP_FAILED) {
+      printf(", failed");
+    }
+    printf("\n");
+  }
+
+  printf("\t%.1f ms loading, %.1f ms uploading", loading_ms, uploading_ms);
+  if (pipeline->num_marks > 0) {
+    const StartupMark *last = &pipeline->marks[pipeline->num_marks - 1];
+    printf(", %.1f ms to %s", ms_between(start, last->time), last->name);
+  }
+  printf("\n");
+}
+
+void startup_destroy(StartupPipeline *pipeline) {
+  for (int i = 0; i < STARTUP_MAX_THREADS; i++) {
+    if (pipeline->threads[i] != NULL) {
+      SDL_WaitThread(pipeline->threads[i], NULL);
+      pipeline->threads[i] = NULL;
+    }
+  }
+  SDL_DestroyCond(pipeline->loaded);
+  SDL_DestroyMutex(pipeline->mutex);
+}
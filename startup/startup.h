@@ -0,0 +1,109 @@
+#ifndef STARTUP_H_
+#define STARTUP_H_
+
+/* Overlapping asset loading with window and context creation.
+
+   Creating the window and the GL context takes a while, and none of it
+   needs the assets, so reading files, parsing meshes and decoding
+   images runs on a few background threads in the meantime. Each task
+   is split in two: load runs on a background thread and must not touch
+   GL; upload runs on the thread that owns the context, once the context
+   exists and the load is done, in whatever order the loads finish.
+
+   The main thread marks its own steps ("window", "context", "first
+   frame") so the report can show both as one timeline. With serial set
+   every load runs inline in startup_start instead, which is how
+   startup looked before and gives the numbers to compare against.
+*/
+
+#include <stdbool.h>
+
+#include <SDL2/SDL.h>
+
+#define STARTUP_MAX_TASKS 16
+#define STARTUP_MAX_THREADS 4
+#define STARTUP_MAX_MARKS 16
+
+/* load returns false on failure, in which case upload is skipped */
+typedef bool (*StartupLoadFunction)(void *data);
+typedef void (*StartupUploadFunction)(void *data);
+
+typedef enum {
+  STARTUP_QUEUED,
+  STARTUP_LOADING,
+  STARTUP_LOADED,
+  STARTUP_DONE,
+  STARTUP_FAILED
+} StartupState;
+
+typedef struct {
+  const char *name;
+  StartupLoadFunction load;
+  StartupUploadFunction upload;  /* may be NULL */
+  void *data;
+
+  StartupState state;  /* guarded by the pipeline mutex */
+  int thread;          /* which background thread loaded it, 0 if inline */
+  Uint64 load_start;
+  Uint64 load_end;
+  Uint64 upload_start;
+  Uint64 upload_end;
+} StartupTask;
+
+typedef struct {
+  const char *name;
+  Uint64 time;
+} StartupMark;
+
+typedef struct {
+  bool serial;
+  Uint64 start;
+
+  StartupTask tasks[STARTUP_MAX_TASKS];
+  int num_tasks;
+  int next_task;  /* next one for a background thread to take */
+
+  int num_threads;
+  int num_started;  /* gives each background thread its number */
+  SDL_Thread *threads[STARTUP_MAX_THREADS];
+  SDL_mutex *mutex;
+  SDL_cond *loaded;
+
+  StartupMark marks[STARTUP_MAX_MARKS];
+  int num_marks;
+} StartupPipeline;
+
+/* Safe to call before SDL_Init. Starts the clock. */
+void startup_init(StartupPipeline *pipeline, int num_threads, bool serial);
+
+/* --serial-startup loads everything on the main thread; --startup-threads N. */
+void startup_parse_args(int argc, char *argv[], int *num_threads, bool *serial);
+
+/* Returns the task index, or -1 if there is no room. Add everything
+   before startup_start. */
+int startup_add(StartupPipeline *pipeline, const char *name,
+		StartupLoadFunction load, StartupUploadFunction upload, void *data);
+
+void startup_start(StartupPipeline *pipeline);
+
+/* Main thread: something happened at this point in the timeline. */
+void startup_mark(StartupPipeline *pipeline, const char *name);
+
+/* Context thread: upload whatever has loaded. Never blocks; returns
+   the number of tasks uploaded. */
+int startup_poll(StartupPipeline *pipeline);
+
+/* Context thread: upload ready tasks until this one is done. Returns
+   false if it failed to load. */
+bool startup_wait(StartupPipeline *pipeline, int task);
+
+/* Context thread: wait for and upload everything, then join the
+   background threads. Returns false if anything failed. */
+bool startup_finish(StartupPipeline *pipeline);
+
+/* The timeline, relative to startup_init, ending at the last mark. */
+void startup_report(const StartupPipeline *pipeline);
+
+void startup_destroy(StartupPipeline *pipeline);
+
+#endif // STARTUP_H_
@@ -0,0 +1,220 @@
+/* Packs static meshes into shared vertex and index buffers. */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+
+#include "static_batch.h"
+
+typedef struct {
+  float key[6];  /* position and normal */
+  int index;
+} WeldEntry;
+
+static int compare_weld(const void *left, const void *right) {
+  const WeldEntry *a = (const WeldEntry *) left;
+  const WeldEntry *b = (const WeldEntry *) right;
+  for (int i = 0; i < 6; i++) {
+    if (a->key[i] < b->key[i]) return -1;
+    if (a->key[i] > b->key[i]) return 1;
+  }
+  return a->index - b->index;
+}
+
+static const StaticMesh *sort_meshes;
+
+static int compare_material(const void *left, const void *right) {
+  int a = *(const int *) left;
+  int b = *(const int *) right;
+  if (sort_meshes[a].material != sort_meshes[b].material) {
+    return sort_meshes[a].material - sort_meshes[b].material;
+  }
+  return a - b;
+}
+
+/* Upper 3x3 inverse transpose of a column-major 4x4, for the normals */
+static void normal_matrix(const float *m, float *n) {
+  float a[3] = { m[0], m[1], m[2] };
+  float b[3] = { m[4], m[5], m[6] };
+  float c[3] = { m[8], m[9], m[10] };
+  float bc[3] = { b[1] * c[2] - b[2] * c[1], b[2] * c[0] - b[0] * c[2],
+		  b[0] * c[1] - b[1] * c[0] };
+  float ca[3] = { c[1] * a[2] - c[2] * a[1], c[2] * a[0] - c[0] * a[2],
+		  c[0] * a[1] - c[1] * a[0] };
+  float ab[3] = { a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2],
+		  a[0] * b[1] - a[1] * b[0] };
+  float det = a[0] * bc[0] + a[1] * bc[1] + a[2] * bc[2];
+  float inv_det = det != 0.0f ? 1.0f / det : 0.0f;
+  for (int i = 0; i < 3; i++) {
+    n[i] = bc[i] * inv_det;
+    n[3 + i] = ca[i] * inv_det;
+    n[6 + i] = ab[i] * inv_det;
+  }
+}
+
+typedef struct {
+  float *vertices;
+  int num_vertices;
+  int vertex_capacity;
+  uint16_t *indices;
+  int num_indices;
+  int index_capacity;
+} BatchData;
+
+static void reserve(BatchData *data, int vertices, int indices) {
+  if (data->num_vertices + vertices > data->vertex_capacity) {
+    while (data->num_vertices + vertices > data->vertex_capacity) {
+      data->vertex_capacity = data->vertex_capacity ? data->vertex_capacity * 2 : 4096;
+    }
+    data->vertices = (float *) realloc(data->vertices,
+				       data->vertex_capacity * 6 * sizeof(float));
+  }
+  if (data->num_indices + indices > data->index_capacity) {
+    while (data->num_indices + indices > data->index_capacity) {
+      data->index_capacity = data->index_capacity ? data->index_capacity * 2 : 4096;
+    }
+    data->indices = (uint16_t *) realloc(data->indices,
+					 data->index_capacity * sizeof(uint16_t));
+  }
+}
+
+void static_batch_build(StaticBatch *batch, const StaticMesh *meshes, int num_meshes) {
+
+  Uint64 start = SDL_GetPerformanceCounter();
+  memset(batch, 0, sizeof(*batch));
+  batch->num_meshes = num_meshes;
+  if (num_meshes == 0) {
+    return;
+  }
+
+  /* Material order, keeping the given order within a material */
+  int *order = (int *) malloc(num_meshes * sizeof(int));
+  for (int i = 0; i < num_meshes; i++) {
+    order[i] = i;
+  }
+  sort_meshes = meshes;
+  qsort(order, num_meshes, sizeof(int), compare_material);
+
+  BatchData data;
+  memset(&data, 0, sizeof(data));
+  batch->chunks = (StaticChunk *) malloc(num_meshes * sizeof(StaticChunk));
+  StaticChunk *chunk = NULL;
+
+  for (int o = 0; o < num_meshes; o++) {
+    const StaticMesh *mesh = &meshes[order[o]];
+    int num_corners = 3 * mesh->num_triangles;
+    batch->source_bytes += 2 * num_corners * 3 * sizeof(float);
+
+    /* Weld corners that share a position and normal */
+    WeldEntry *entries = (WeldEntry *) malloc(num_corners * sizeof(WeldEntry));
+    for (int i = 0; i < num_corners; i++) {
+      memcpy(entries[i].key, &mesh->vertices[3 * i], 3 * sizeof(float));
+      memcpy(&entries[i].key[3], &mesh->normals[3 * i], 3 * sizeof(float));
+      entries[i].index = i;
+    }
+    qsort(entries, num_corners, sizeof(WeldEntry), compare_weld);
+    int *remap = (int *) malloc(num_corners * sizeof(int));
+    int num_unique = 0;
+    for (int i = 0; i < num_corners; i++) {
+      if (i == 0 || memcmp(entries[i].key, entries[i - 1].key, 6 * sizeof(float)) != 0) {
+	num_unique += 1;
+      }
+      remap[entries[i].index] = num_unique - 1;
+    }
+
+    if (num_unique > STATIC_BATCH_MAX_VERTICES) {
+      printf("ERROR: static mesh with %d vertices is too big to batch\n", num_unique);
+      free(entries);
+      free(remap);
+      continue;
+    }
+
+    /* New chunk for a new material or when the indices would overflow */
+    int chunk_start = chunk == NULL ? 0
+      : (int) (chunk->vertex_offset / STATIC_BATCH_STRIDE);
+    if (chunk == NULL || chunk->material != mesh->material
+	|| data.num_vertices - chunk_start + num_unique > STATIC_BATCH_MAX_VERTICES) {
+      chunk = &batch->chunks[batch->num_chunks];
+      batch->num_chunks += 1;
+      chunk->material = mesh->material;
+      chunk->vertex_offset = data.num_vertices * STATIC_BATCH_STRIDE;
+      chunk->index_offset = data.num_indices * sizeof(uint16_t);
+      chunk->num_indices = 0;
+      chunk_start = data.num_vertices;
+    }
+
+    reserve(&data, num_unique, num_corners);
+
+    /* Unique vertices into world space */
+    const float *m = mesh->world_matrix;
+    float n[9];
+    normal_matrix(m, n);
+    int base = data.num_vertices;
+    for (int i = 0; i < num_corners; i++) {
+      if (i > 0 && remap[entries[i].index] == remap[entries[i - 1].index]) {
+	continue;
+      }
+      const float *p = entries[i].key;
+      const float *v = &entries[i].key[3];
+      float *out = &data.vertices[6 * (base + remap[entries[i].index])];
+      for (int r = 0; r < 3; r++) {
+	out[r] = m[r] * p[0] + m[4 + r] * p[1] + m[8 + r] * p[2] + m[12 + r];
+	out[3 + r] = n[r] * v[0] + n[3 + r] * v[1] + n[6 + r] * v[2];
+      }
+    }
+    data.num_vertices += num_unique;
+
+    for (int i = 0; i < num_corners; i++) {
+      data.indices[data.num_indices + i] = (uint16_t) (base - chunk_start + remap[i]);
+    }
+    data.num_indices += num_corners;
+    chunk->num_indices += num_corners;
+
+    free(entries);
+    free(remap);
+  }
+  free(order);
+
+  batch->num_vertices = data.num_vertices;
+  batch->num_indices = data.num_indices;
+  batch->batch_bytes = data.num_vertices * STATIC_BATCH_STRIDE
+    + data.num_indices * sizeof(uint16_t);
+
+  glGenBuffers(1, &batch->vertex_buffer);
+  glBindBuffer(GL_ARRAY_BUFFER, batch->vertex_buffer);
+  glBufferData(GL_ARRAY_BUFFER, data.num_vertices * STATIC_BATCH_STRIDE,
+	       data.vertices, GL_STATIC_DRAW);
+  glGenBuffers(1, &batch->index_buffer);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch->index_buffer);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, data.num_indices * sizeof(uint16_t),
+	       data.indices, GL_STATIC_DRAW);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+  free(data.vertices);
+  free(data.indices);
+
+  batch->build_ms = (double) (SDL_GetPerformanceCounter() - start) * 1000.0
+    / (double) SDL_GetPerformanceFrequency();
+}
+
+void static_batch_destroy(StaticBatch *batch) {
+  if (batch->num_meshes > 0) {
+    glDeleteBuffers(1, &batch->vertex_buffer);
+    glDeleteBuffers(1, &batch->index_buffer);
+  }
+  free(batch->chunks);
+  batch->chunks = NULL;
+  batch->num_chunks = 0;
+}
+
+void static_batch_report(const StaticBatch *batch) {
+  printf("Static batch: %d meshes in %d draws (%d draw calls saved), "
+	 "%d vertices, %d indices\n"
+	 "\t%.1f KB of shared buffers for %.1f KB of source meshes, "
+	 "built in %.2f ms\n",
+	 batch->num_meshes, batch->num_chunks, batch->num_meshes - batch->num_chunks,
+	 batch->num_vertices, batch->num_indices,
+	 batch->batch_bytes / 1024.0, batch->source_bytes / 1024.0, batch->build_ms);
+}
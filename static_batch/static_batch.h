@@ -0,0 +1,60 @@
+#ifndef STATIC_BATCH_H_
+#define STATIC_BATCH_H_
+
+/* Static geometry batching.
+
+   Meshes that never move are welded, transformed into world space and
+   packed into one interleaved vertex buffer (position then normal) and
+   one index buffer, grouped by material. Each material then draws with
+   one glDrawElements per chunk instead of one draw per mesh.
+
+   ES2 only guarantees 16-bit indices, so a material's geometry is split
+   into chunks of at most 65535 vertices; each chunk is drawn with its
+   attribute pointers offset to where its vertices start.
+*/
+
+#include <stddef.h>
+
+#include <GLES2/gl2.h>
+
+#define STATIC_BATCH_MAX_VERTICES 65535
+#define STATIC_BATCH_STRIDE (6 * sizeof(GLfloat))
+
+typedef struct {
+  const float *vertices;  /* xyz per vertex, three per triangle */
+  const float *normals;
+  int num_triangles;
+  float world_matrix[16]; /* column-major */
+  int material;
+} StaticMesh;
+
+typedef struct {
+  int material;
+  size_t vertex_offset;   /* bytes into the vertex buffer */
+  size_t index_offset;    /* bytes into the index buffer */
+  int num_indices;
+} StaticChunk;
+
+typedef struct {
+  GLuint vertex_buffer;
+  GLuint index_buffer;
+
+  int num_chunks;
+  StaticChunk *chunks;    /* sorted by material */
+
+  int num_meshes;
+  int num_vertices;
+  int num_indices;
+  size_t batch_bytes;     /* both buffers */
+  size_t source_bytes;    /* the meshes' own vertex and normal data */
+  double build_ms;
+} StaticBatch;
+
+/* Build and upload the batch. Needs a current GL context. */
+void static_batch_build(StaticBatch *batch, const StaticMesh *meshes, int num_meshes);
+void static_batch_destroy(StaticBatch *batch);
+
+/* Draw calls before and after, and the memory it took. */
+void static_batch_report(const StaticBatch *batch);
+
+#endif // STATIC_BATCH_H_
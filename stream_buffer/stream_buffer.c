@@ -0,0 +1,304 @@
+/* Multi-frame streaming vertex buffers with a per-driver strategy. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stream_buffer.h"
+
+#define STREAM_ALIGN 16
+
+/* Startup benchmark: this many frames per strategy, each written in
+   this many pieces with a draw reading each one */
+#define PICK_FRAMES 30
+#define PICK_WRITES 8
+
+static double ms_since(Uint64 start) {
+  return (double) (SDL_GetPerformanceCounter() - start) * 1000.0
+    / (double) SDL_GetPerformanceFrequency();
+}
+
+const char *stream_strategy_name(StreamStrategy strategy) {
+  switch (strategy) {
+  case STREAM_SUBDATA: return "subdata";
+  case STREAM_ORPHAN: return "orphan";
+  case STREAM_MAP: return "map";
+  default: return "auto";
+  }
+}
+
+StreamStrategy stream_parse_args(int argc, char *argv[]) {
+  StreamStrategy strategy = STREAM_AUTO;
+  for (int i = 1; i < argc - 1; i++) {
+    if (strcmp(argv[i], "--stream") != 0) {
+      continue;
+    }
+    if (strcmp(argv[i + 1], "subdata") == 0) {
+      strategy = STREAM_SUBDATA;
+    } else if (strcmp(argv[i + 1], "orphan") == 0) {
+      strategy = STREAM_ORPHAN;
+    } else if (strcmp(argv[i + 1], "map") == 0) {
+      strategy = STREAM_MAP;
+    } else if (strcmp(argv[i + 1], "auto") == 0) {
+      strategy = STREAM_AUTO;
+    } else {
+      printf("ERROR: unknown stream strategy %s\n", argv[i + 1]);
+    }
+  }
+  return strategy;
+}
+
+static bool can_map(void) {
+  return gl_caps.MapBufferRange != NULL && gl_caps.UnmapBuffer != NULL
+    && gl_caps.FenceSync != NULL;
+}
+
+void stream_buffer_init(StreamBuffer *stream, GLenum target, size_t frame_size,
+			StreamStrategy strategy) {
+
+  memset(stream, 0, sizeof(*stream));
+  stream->target = target;
+  stream->frame_size = (frame_size + STREAM_ALIGN - 1) & ~(size_t) (STREAM_ALIGN - 1);
+  stream->report_frames = 5 * 60;
+
+  if (strategy == STREAM_AUTO) {
+    strategy = stream_buffer_pick_strategy(target, frame_size);
+  }
+  if (strategy == STREAM_MAP && !can_map()) {
+    printf("ERROR: mapped streaming needs ES3, using orphaning\n");
+    strategy = STREAM_ORPHAN;
+  }
+  stream->strategy = strategy;
+
+  int num_buffers = strategy == STREAM_SUBDATA ? STREAM_BUFFER_FRAMES : 1;
+  size_t buffer_size = strategy == STREAM_MAP
+    ? STREAM_BUFFER_FRAMES * stream->frame_size : stream->frame_size;
+
+  glGenBuffers(num_buffers, stream->buffers);
+  for (int i = 0; i < num_buffers; i++) {
+    glBindBuffer(target, stream->buffers[i]);
+    glBufferData(target, buffer_size, NULL, GL_STREAM_DRAW);
+  }
+  glBindBuffer(target, 0);
+}
+
+void stream_buffer_destroy(StreamBuffer *stream) {
+  for (int i = 0; i < STREAM_BUFFER_FRAMES; i++) {
+    if (stream->fences[i] != NULL) {
+      gl_caps.DeleteSync(stream->fences[i]);
+      stream->fences[i] = NULL;
+    }
+  }
+  int num_buffers = stream->strategy == STREAM_SUBDATA ? STREAM_BUFFER_FRAMES : 1;
+  glDeleteBuffers(num_buffers, stream->buffers);
+}
+
+/* First write of a frame: make sure its region is free to overwrite */
+static void begin_frame(StreamBuffer *stream) {
+
+  stream->frame_started = true;
+  stream->head = 0;
+
+  if (stream->strategy == STREAM_ORPHAN) {
+    glBindBuffer(stream->target, stream->buffers[0]);
+    glBufferData(stream->target, stream->frame_size, NULL, GL_STREAM_DRAW);
+  } else if (stream->strategy == STREAM_MAP) {
+    GLsync fence = stream->fences[stream->region];
+    if (fence != NULL) {
+      GLenum result = gl_caps.ClientWaitSync(fence, 0, 0);
+      if (result == GL_TIMEOUT_EXPIRED) {
+	/* The GPU is a whole ring behind */
+	stream->stalls += 1;
+	gl_caps.ClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+      }
+      gl_caps.DeleteSync(fence);
+      stream->fences[stream->region] = NULL;
+    }
+  }
+}
+
+bool stream_buffer_write(StreamBuffer *stream, const void *data, size_t bytes,
+			 GLuint *buffer, size_t *offset) {
+
+  Uint64 start = SDL_GetPerformanceCounter();
+  if (!stream->frame_started) {
+    begin_frame(stream);
+  }
+
+  if (stream->head + bytes > stream->frame_size) {
+    stream->overflows += 1;
+    return false;
+  }
+
+  GLuint target_buffer;
+  size_t target_offset;
+  if (stream->strategy == STREAM_MAP) {
+    target_buffer = stream->buffers[0];
+    target_offset = stream->region * stream->frame_size + stream->head;
+  } else if (stream->strategy == STREAM_SUBDATA) {
+    target_buffer = stream->buffers[stream->region];
+    target_offset = stream->head;
+  } else {
+    target_buffer = stream->buffers[0];
+    target_offset = stream->head;
+  }
+
+  glBindBuffer(stream->target, target_buffer);
+  if (stream->strategy == STREAM_MAP) {
+    void *mapped = gl_caps.MapBufferRange(stream->target, target_offset, bytes,
+					  GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT
+					  | GL_MAP_INVALIDATE_RANGE_BIT);
+    if (mapped == NULL) {
+      printf("ERROR: could not map stream buffer\n");
+      return false;
+    }
+    memcpy(mapped, data, bytes);
+    gl_caps.UnmapBuffer(stream->target);
+  } else {
+    glBufferSubData(stream->target, target_offset, bytes, data);
+  }
+
+  stream->head = (stream->head + bytes + STREAM_ALIGN - 1) & ~(size_t) (STREAM_ALIGN - 1);
+  stream->bytes += bytes;
+
+  double elapsed = ms_since(start);
+  stream->upload_ms += elapsed;
+  if (stream->strategy != STREAM_MAP && elapsed > STREAM_STALL_MS) {
+    stream->stalls += 1;
+  }
+
+  *buffer = target_buffer;
+  *offset = target_offset;
+  return true;
+}
+
+void stream_buffer_end_frame(StreamBuffer *stream) {
+
+  if (stream->frame_started && stream->strategy == STREAM_MAP) {
+    stream->fences[stream->region] = gl_caps.FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  }
+  if (stream->strategy != STREAM_ORPHAN) {
+    stream->region = (stream->region + 1) % STREAM_BUFFER_FRAMES;
+  }
+  stream->frame_started = false;
+  stream->frames += 1;
+}
+
+/* ---- Startup benchmark ---- */
+
+static const char *pick_vertex_source =
+  "#version 100\n"
+  "attribute vec4 position;\n"
+  "void main() {\n"
+  "  gl_Position = vec4(position.xy, 2.0, 1.0);\n"  /* clipped, but fetched */
+  "  gl_PointSize = 1.0;\n"
+  "}\n";
+
+static const char *pick_fragment_source =
+  "#version 100\n"
+  "precision mediump float;\n"
+  "void main() {\n"
+  "  gl_FragColor = vec4(1.0);\n"
+  "}\n";
+
+static GLuint compile_pick_shader(GLenum type, const char *source) {
+  GLuint shader = glCreateShader(type);
+  glShaderSource(shader, 1, &source, NULL);
+  glCompileShader(shader);
+  GLint compiled = 0;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+  if (!compiled) {
+    printf("ERROR: stream benchmark shader did not compile\n");
+  }
+  return shader;
+}
+
+static double time_strategy(StreamStrategy strategy, GLenum target, size_t frame_size,
+			    GLint position_attr, const unsigned char *data) {
+
+  StreamBuffer stream;
+  stream_buffer_init(&stream, target, frame_size, strategy);
+  size_t piece = (frame_size / PICK_WRITES) & ~(size_t) (STREAM_ALIGN - 1);
+  GLsizei points = (GLsizei) (piece / (4 * sizeof(GLfloat)));
+
+  glFinish();
+  Uint64 start = SDL_GetPerformanceCounter();
+  for (int f = 0; f < PICK_FRAMES; f++) {
+    for (int w = 0; w < PICK_WRITES; w++) {
+      GLuint buffer;
+      size_t offset;
+      if (stream_buffer_write(&stream, data, piece, &buffer, &offset)) {
+	glVertexAttribPointer(position_attr, 4, GL_FLOAT, GL_FALSE, 0, (void *) offset);
+	glDrawArrays(GL_POINTS, 0, points);
+      }
+    }
+    stream_buffer_end_frame(&stream);
+    glFlush();
+  }
+  glFinish();
+  double ms = ms_since(start);
+
+  stream_buffer_destroy(&stream);
+  return ms;
+}
+
+StreamStrategy stream_buffer_pick_strategy(GLenum target, size_t frame_size) {
+
+  GLuint program = glCreateProgram();
+  GLuint vertex = compile_pick_shader(GL_VERTEX_SHADER, pick_vertex_source);
+  GLuint fragment = compile_pick_shader(GL_FRAGMENT_SHADER, pick_fragment_source);
+  glAttachShader(program, vertex);
+  glAttachShader(program, fragment);
+  glLinkProgram(program);
+  glUseProgram(program);
+  GLint position_attr = glGetAttribLocation(program, "position");
+  glEnableVertexAttribArray(position_attr);
+
+  unsigned char *data = calloc(frame_size, 1);
+  StreamStrategy candidates[3] = { STREAM_SUBDATA, STREAM_ORPHAN, STREAM_MAP };
+  int num_candidates = can_map() ? 3 : 2;
+  StreamStrategy best = STREAM_SUBDATA;
+  double best_ms = 0.0;
+
+  printf("Stream buffer strategies, %d frames of %.1f KB:\n",
+	 PICK_FRAMES, frame_size / 1024.0);
+  for (int i = 0; i < num_candidates; i++) {
+    double ms = time_strategy(candidates[i], target, frame_size, position_attr, data);
+    printf("\t%-8s %7.3f ms/frame, %8.1f MB/s\n", stream_strategy_name(candidates[i]),
+	   ms / PICK_FRAMES, (double) frame_size * PICK_FRAMES / ms / 1000.0);
+    if (i == 0 || ms < best_ms) {
+      best = candidates[i];
+      best_ms = ms;
+    }
+  }
+  printf("\tusing %s\n", stream_strategy_name(best));
+
+  free(data);
+  glDisableVertexAttribArray(position_attr);
+  glBindBuffer(target, 0);
+  glUseProgram(0);
+  glDeleteShader(vertex);
+  glDeleteShader(fragment);
+  glDeleteProgram(program);
+  return best;
+}
+
+void stream_buffer_report(StreamBuffer *stream, const char *name) {
+
+  if (stream->frames < stream->report_frames) {
+    return;
+  }
+
+  int frames = stream->frames;
+  printf("stream %s: %s, %.1f KB/frame, upload %.3f ms/frame at %.1f MB/s, "
+	 "%d stalls, %d overflows\n",
+	 name, stream_strategy_name(stream->strategy),
+	 stream->bytes / 1024.0 / frames, stream->upload_ms / frames,
+	 stream->upload_ms > 0.0 ? stream->bytes / stream->upload_ms / 1000.0 : 0.0,
+	 stream->stalls, stream->overflows);
+
+  stream->frames = 0;
+  stream->bytes = 0;
+  stream->upload_ms = 0.0;
+  stream->stalls = 0;
+  stream->overflows = 0;
+}
@@ -0,0 +1,91 @@
+#ifndef STREAM_BUFFER_H_
+#define STREAM_BUFFER_H_
+
+/* Streaming per-frame geometry: debug lines, HUD quads, instance data.
+
+   Writing into a buffer the GPU may still be reading from makes Mali
+   and VideoCore drivers wait for the GPU. A StreamBuffer keeps
+   STREAM_BUFFER_FRAMES frames worth of space so the CPU writes one
+   region while the GPU reads the previous ones, using one of:
+   - SUBDATA: a ring of buffers, one per frame, glBufferSubData. Works
+     everywhere; whether it stalls is up to the driver.
+   - ORPHAN: one buffer, glBufferData(NULL) at the start of each frame so
+     the driver can hand out fresh storage while the GPU keeps the old.
+   - MAP: ES3 only. One buffer split into per-frame regions, written
+     with glMapBufferRange(GL_MAP_UNSYNCHRONIZED_BIT). A fence per
+     region says when the GPU is done with it, so the only waits are
+     the ones we choose to make, and those are counted exactly.
+
+   STREAM_AUTO times each available strategy at startup and keeps the
+   fastest on this driver.
+
+   Writes within a frame are appended and 16 byte aligned; a frame that
+   writes more than the per-frame size gets its extra writes refused
+   and counted as overflows.
+*/
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <SDL2/SDL.h>
+
+#include "gl_caps.h"
+
+#define STREAM_BUFFER_FRAMES 3
+
+/* An ES2 upload call that blocks longer than this counts as a stall */
+#define STREAM_STALL_MS 1.0
+
+typedef enum {
+  STREAM_SUBDATA,
+  STREAM_ORPHAN,
+  STREAM_MAP,
+  STREAM_AUTO
+} StreamStrategy;
+
+typedef struct {
+  StreamStrategy strategy;
+  GLenum target;
+  size_t frame_size;  /* bytes writable per frame */
+
+  GLuint buffers[STREAM_BUFFER_FRAMES];  /* SUBDATA uses all, others one */
+  GLsync fences[STREAM_BUFFER_FRAMES];   /* MAP only */
+  int region;         /* frame slot being written */
+  size_t head;        /* bytes written into it */
+  bool frame_started;
+
+  /* Counters, reset by stream_buffer_report */
+  int frames;
+  size_t bytes;
+  double upload_ms;
+  int stalls;
+  int overflows;
+  int report_frames;
+} StreamBuffer;
+
+const char *stream_strategy_name(StreamStrategy strategy);
+
+/* --stream subdata|orphan|map|auto, auto if not given */
+StreamStrategy stream_parse_args(int argc, char *argv[]);
+
+/* Needs a current context and load_gl_caps(). STREAM_AUTO runs the
+   startup benchmark; MAP falls back to ORPHAN on ES2. */
+void stream_buffer_init(StreamBuffer *stream, GLenum target, size_t frame_size,
+			StreamStrategy strategy);
+void stream_buffer_destroy(StreamBuffer *stream);
+
+/* Copy bytes into this frame's region. On success the buffer is bound
+   to the stream's target and *offset is where the data starts in it. */
+bool stream_buffer_write(StreamBuffer *stream, const void *data, size_t bytes,
+			 GLuint *buffer, size_t *offset);
+
+/* Call once the frame's draws using the stream have been issued. */
+void stream_buffer_end_frame(StreamBuffer *stream);
+
+/* Time each strategy available on this context and return the fastest. */
+StreamStrategy stream_buffer_pick_strategy(GLenum target, size_t frame_size);
+
+/* Prints every stream->report_frames frames and resets. */
+void stream_buffer_report(StreamBuffer *stream, const char *name);
+
+#endif // STREAM_BUFFER_H_
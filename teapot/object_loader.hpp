@@ -1,9 +1,11 @@
 // C++ header file containing functions to load up QUAD and TRIANGLE based OBJ files.
+// out_bounds, if given, gets the mesh's bounding box and sphere.
 bool loadTriangleOBJ(
 	     const char* path,
 	     std::vector < glm::vec3 > & out_vertices,
 	     std::vector < glm::vec2 > & out_uvs,
-	     std::vector < glm::vec3 > & out_normals
+	     std::vector < glm::vec3 > & out_normals,
+	     Bounds * out_bounds = NULL
 	     ) {
 
   // set up temporary variables
@@ -90,6 +92,11 @@ bool loadTriangleOBJ(
     out_normals.push_back(normal);
     
   }
+
+  // Bounding volumes for culling
+  if (out_bounds != NULL && !out_vertices.empty()) {
+    bounds_from_vertices(out_bounds, &out_vertices[0][0], out_vertices.size());
+  }
   
   return true;
 };
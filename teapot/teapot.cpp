@@ -4,6 +4,7 @@
 #include <iostream>
 #include <vector>
 #include <cstring>
+#include <cmath>
 
 #include <SDL2/SDL.h>
 
@@ -14,6 +15,10 @@
 
 extern "C" {
   #include "../shader_loader/shader_loader.h"
+  #include "../frustum_cull/frustum_cull.h"
+  #include "../mesh_lod/mesh_lod.h"
+  #include "../resource_manager/resource_manager.h"
+  #include "../startup/startup.h"
 }
 #include "object_loader.hpp"
 
@@ -27,29 +32,149 @@ const unsigned int sizeY = 1080;
 const char* fragmentShaderPath = "shaders/shader.frag";
 const char* vertexShaderPath = "shaders/shader.vert";
 
+// A loaded OBJ file, shared through the resource manager
+struct ObjMesh {
+  std::vector< glm::vec3 > vertices;
+  std::vector< glm::vec2 > uvs;
+  std::vector< glm::vec3 > normals;
+  Bounds bounds;
+};
+
+static size_t obj_mesh_bytes(const ObjMesh *mesh) {
+  return sizeof(ObjMesh)
+    + mesh->vertices.size() * sizeof(glm::vec3)
+    + mesh->uvs.size() * sizeof(glm::vec2)
+    + mesh->normals.size() * sizeof(glm::vec3);
+}
 
-int main(int argc, char* argv[]) {
+// The mesh was already parsed on a startup thread; user is the ObjMesh.
+static bool adopt_obj_mesh(const char *path, const char *options, void *user,
+			   ResourceData *out) {
+  ObjMesh *mesh = (ObjMesh *) user;
+  out->data = mesh;
+  out->cpu_bytes = obj_mesh_bytes(mesh);
+  return true;
+}
 
-  // array variables to store the data
-  // TB TODO: Do this in a class.
-  std::vector< glm::vec3 > cube_1_vertices;
-  std::vector< glm::vec2 > cube_1_uvs;
-  std::vector< glm::vec3 > cube_1_normals;
+static void free_obj_mesh(ResourceData *resource) {
+  delete (ObjMesh *) resource->data;
+}
 
-  std::vector< glm::vec3 > cube_2_vertices;
-  std::vector< glm::vec2 > cube_2_uvs;
-  std::vector< glm::vec3 > cube_2_normals;
-  
-  if( loadTriangleOBJ(teapotPath, cube_1_vertices, cube_1_uvs, cube_1_normals) ) {
-    std::cout << "cube 1 done" << std::endl;
-  } else {
-    std::cout << "no cube 1 :(" << std::endl;
+// A mesh loaded at startup: parsed (and simplified, for the teapot) on
+// a background thread while the window and context come up, then handed
+// to the resource manager and put in VBOs on the main thread.
+struct MeshAsset {
+  const char* path;
+  ResourceManager* resources;
+  bool build_lods;
+
+  ObjMesh* parsed;
+  MeshLODChain lods;
+  MeshHandle handle;
+  int num_VBOs;
+  GLuint VBOs[MESH_LOD_MAX_LEVELS];
+};
+
+static bool load_mesh_asset(void *data) {
+  MeshAsset *asset = (MeshAsset *) data;
+  ObjMesh *mesh = new ObjMesh();
+  if (!loadTriangleOBJ(asset->path, mesh->vertices, mesh->uvs, mesh->normals,
+		       &mesh->bounds)) {
+    delete mesh;
+    return false;
+  }
+  asset->parsed = mesh;
+
+  // Simplified copies of the teapot at 50, 25 and 12% of its triangles,
+  // for when it is small on screen.
+  if (asset->build_lods) {
+    const float lod_ratios[] = { 0.5f, 0.25f, 0.125f };
+    mesh_lod_build(&asset->lods, &mesh->vertices[0][0], mesh->vertices.size() / 3,
+		   lod_ratios, 3);
   }
+  return true;
+}
 
-  if( loadTriangleOBJ(cubePath, cube_2_vertices, cube_2_uvs, cube_2_normals) ) {
-    std::cout << "cube 2 done" << std::endl;
+static void upload_mesh_asset(void *data) {
+  MeshAsset *asset = (MeshAsset *) data;
+  asset->handle = resource_load_mesh(asset->resources, asset->path, "",
+				     adopt_obj_mesh, free_obj_mesh, asset->parsed);
+  const ObjMesh *mesh = (const ObjMesh *) resource_mesh(asset->resources, asset->handle);
+  if (mesh != asset->parsed) {
+    // Somebody had loaded it already
+    delete asset->parsed;
+  }
+  asset->parsed = NULL;
+
+  // A VBO for each level of the teapot, or just the one (also when
+  // simplifying it came up with no levels).
+  if (asset->build_lods && asset->lods.num_levels > 0) {
+    asset->num_VBOs = asset->lods.num_levels;
+    glGenBuffers(asset->num_VBOs, asset->VBOs);
+    for (int i = 0; i < asset->num_VBOs; i++) {
+      glBindBuffer(GL_ARRAY_BUFFER, asset->VBOs[i]);
+      glBufferData(GL_ARRAY_BUFFER,
+		   asset->lods.levels[i].num_triangles * 9 * sizeof(GLfloat),
+		   asset->lods.levels[i].vertices, GL_STATIC_DRAW);
+    }
   } else {
-    std::cout << "no cube 2 :(" << std::endl;
+    asset->num_VBOs = 1;
+    glGenBuffers(1, asset->VBOs);
+    glBindBuffer(GL_ARRAY_BUFFER, asset->VBOs[0]);
+    glBufferData(GL_ARRAY_BUFFER, mesh->vertices.size() * sizeof(glm::vec3),
+		 &mesh->vertices[0], GL_STATIC_DRAW);
+  }
+}
+
+struct ShaderAsset {
+  char* vertexSource;
+  char* fragmentSource;
+};
+
+static bool load_shader_asset(void *data) {
+  ShaderAsset *asset = (ShaderAsset *) data;
+  asset->vertexSource = read_shader_source(vertexShaderPath);
+  asset->fragmentSource = read_shader_source(fragmentShaderPath);
+  return asset->vertexSource != NULL && asset->fragmentSource != NULL;
+}
+
+
+int main(int argc, char* argv[]) {
+
+  // The meshes live in the resource manager; we only keep handles.
+  ResourceManager resources;
+  resource_manager_init(&resources);
+
+  // --serial-startup loads everything before SDL_Init, as this used to.
+  int startup_threads = 3;
+  bool serial_startup = false;
+  startup_parse_args(argc, argv, &startup_threads, &serial_startup);
+  StartupPipeline startup;
+  startup_init(&startup, startup_threads, serial_startup);
+
+  MeshAsset teapot_asset = {};
+  teapot_asset.path = teapotPath;
+  teapot_asset.resources = &resources;
+  teapot_asset.build_lods = true;
+  MeshAsset cube_asset = {};
+  cube_asset.path = cubePath;
+  cube_asset.resources = &resources;
+  ShaderAsset shader_asset = {};
+
+  int teapot_task = startup_add(&startup, "teapot", load_mesh_asset,
+				upload_mesh_asset, &teapot_asset);
+  int cube_task = startup_add(&startup, "cube", load_mesh_asset,
+			      upload_mesh_asset, &cube_asset);
+  startup_add(&startup, "shaders", load_shader_asset, NULL, &shader_asset);
+  startup_start(&startup);
+
+  // --dolly moves the teapot towards and away from the camera, to see
+  // the LODs change.
+  bool dolly = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--dolly") == 0) {
+      dolly = true;
+    }
   }
 
   //printf("output vertices has %d elements\n", vertices.size());
@@ -57,8 +182,8 @@ int main(int argc, char* argv[]) {
   //   printf("%f %f %f\n", vertices[i][0], vertices[i][1], vertices[i][2]);
   // }
 
-  // We have now loaded up the teapot! Time to render it up
-  // using the same techniques as the previous tutorial.
+  // The teapot is loading in the background. Time to get ready to render
+  // it up using the same techniques as the previous tutorial.
 
   SDL_Init(SDL_INIT_VIDEO);
   SDL_ShowCursor(SDL_DISABLE);
@@ -81,25 +206,49 @@ int main(int argc, char* argv[]) {
   } else {
     std::cout << "Error: Could not create window: " << SDL_GetError() << std::endl;
   }
+  startup_mark(&startup, "window");
 
   // Open GL context
   SDL_GLContext glcontext = SDL_GL_CreateContext(window);
+  startup_mark(&startup, "context");
 
-  // Create a VBO for the object vertex data.
-  GLuint vertexVBO_cube_1;
-  glGenBuffers(1, &vertexVBO_cube_1);
-  glBindBuffer(GL_ARRAY_BUFFER, vertexVBO_cube_1);
-  glBufferData(GL_ARRAY_BUFFER, cube_1_vertices.size() * sizeof(glm::vec3),
-	       &cube_1_vertices[0], GL_STATIC_DRAW);
-
-  GLuint vertexVBO_cube_2;
-  glGenBuffers(1, &vertexVBO_cube_2);
-  glBindBuffer(GL_ARRAY_BUFFER, vertexVBO_cube_2);
-  glBufferData(GL_ARRAY_BUFFER, cube_2_vertices.size() * sizeof(glm::vec3),
-	       &cube_2_vertices[0], GL_STATIC_DRAW);
+  // The VBOs are made as each mesh finishes loading.
+  if (startup_wait(&startup, teapot_task)) {
+    std::cout << "cube 1 done" << std::endl;
+  } else {
+    std::cout << "no cube 1 :(" << std::endl;
+  }
+  if (startup_wait(&startup, cube_task)) {
+    std::cout << "cube 2 done" << std::endl;
+  } else {
+    std::cout << "no cube 2 :(" << std::endl;
+  }
+  if (!startup_finish(&startup)) {
+    startup_destroy(&startup);
+    mesh_lod_free(&teapot_asset.lods);
+    glDeleteBuffers(teapot_asset.num_VBOs, teapot_asset.VBOs);
+    glDeleteBuffers(cube_asset.num_VBOs, cube_asset.VBOs);
+    resource_release_mesh(&resources, teapot_asset.handle);
+    resource_release_mesh(&resources, cube_asset.handle);
+    resource_manager_destroy(&resources);
+    free(shader_asset.vertexSource);
+    free(shader_asset.fragmentSource);
+    SDL_GL_DeleteContext(glcontext);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+    return EXIT_FAILURE;
+  }
+  MeshHandle cube_1_mesh = teapot_asset.handle;
+  MeshHandle cube_2_mesh = cube_asset.handle;
+  const ObjMesh *cube_1 = (const ObjMesh *) resource_mesh(&resources, cube_1_mesh);
+  MeshLODChain &teapot_lods = teapot_asset.lods;
+  GLuint *lod_VBOs = teapot_asset.VBOs;
+  // Without levels the one VBO holds the whole teapot
+  int teapot_triangles = cube_1->vertices.size() / 3;
 
   // MVP matrix for the scene.
   glm::mat4 Model = glm::mat4(1.0f);
+  glm::mat4 Rotation = glm::mat4(1.0f);
   glm::mat4 View = glm::lookAt(glm::vec3(0.0f, 0.0f, 10.0f), // camera location
 			       glm::vec3(0.0f, 0.0f, 0.0f), // looking at origin
 			       glm::vec3(0.0f, 1.0f, 0.0f)  // setting up direction
@@ -110,7 +259,14 @@ int main(int argc, char* argv[]) {
 					  0.1f, 100.0f);
 
   // Set up the shader programs
-  GLuint programID = load_shaders(vertexShaderPath, fragmentShaderPath);
+  ProgramHandle program = resource_load_program_source(&resources, vertexShaderPath,
+						       fragmentShaderPath,
+						       shader_asset.vertexSource,
+						       shader_asset.fragmentSource);
+  free(shader_asset.vertexSource);
+  free(shader_asset.fragmentSource);
+  GLuint programID = resource_program(&resources, program);
+  resource_manager_report(&resources);
   glUseProgram(programID);
 
   // Get uniform and attribute locations
@@ -123,10 +279,28 @@ int main(int argc, char* argv[]) {
   glEnable(GL_DEPTH_TEST);
   glDepthFunc(GL_LESS);
 
+  // The camera is fixed, so the frustum is too. Only the teapot moves.
+  Frustum frustum;
+  glm::mat4 view_projection = Projection * View;
+  frustum_from_matrix(&frustum, &view_projection[0][0]);
+
+  CullSet cull_set;
+  cull_set_init(&cull_set, 1);
+  CullStats cull_stats;
+  cull_stats_init(&cull_stats);
+
+  // LOD stats
+  int lod = 0;
+  int lod_frames = 0;
+  long lod_triangles = 0;
+  float lod_max_error_px = 0.0f;
+
   // Here is our render loop!
   SDL_Event event;
+  unsigned long int frame = 0;
   bool shouldExit = false;
   glm::mat4 mvp;
+  bool first_frame = true;
   while( !shouldExit ) {
 
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -139,23 +313,73 @@ int main(int argc, char* argv[]) {
     }
 
     // Insert the MVP and do some rotations if necessary.
-    Model = glm::rotate(Model, 0.01f, glm::vec3(0.0, 1.0, 0.1));
+    Rotation = glm::rotate(Rotation, 0.01f, glm::vec3(0.0, 1.0, 0.1));
+    Model = Rotation;
+    if (dolly) {
+      // 8 to 60 units from the camera
+      float distance = 34.0f - 26.0f * cosf(frame * 0.005f);
+      Model = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, 10.0f - distance))
+	* Rotation;
+    }
+    frame += 1;
     mvp = Projection * View * Model;
-    glUniformMatrix4fv(MVP_id, 1, GL_FALSE, &mvp[0][0]);
+
+    // Skip the draw altogether when the teapot is off screen
+    cull_set_update(&cull_set, 0, &cube_1->bounds, &Model[0][0]);
+    frustum_cull(&frustum, &cull_set, &cull_stats);
+
+    if (cull_set.visible[0]) {
+      // Pick the level from how big the teapot is on screen
+      glm::vec4 centre = View * Model * glm::vec4(cube_1->bounds.center[0],
+						  cube_1->bounds.center[1],
+						  cube_1->bounds.center[2], 1.0f);
+      float pixels_per_unit = mesh_lod_screen_radius(1.0f, -centre.z,
+						     Projection[1][1], sizeY);
+      int num_triangles = teapot_triangles;
+      if (teapot_lods.num_levels > 0) {
+	lod = mesh_lod_select(&teapot_lods, lod, cull_set.radius[0] * pixels_per_unit);
+	num_triangles = teapot_lods.levels[lod].num_triangles;
+	float error_px = teapot_lods.levels[lod].error * pixels_per_unit;
+	if (error_px > lod_max_error_px) {
+	  lod_max_error_px = error_px;
+	}
+      }
+      lod_triangles += num_triangles;
+
+      glUniformMatrix4fv(MVP_id, 1, GL_FALSE, &mvp[0][0]);
     
-    // Bind the vertex buffer
-    glBindBuffer(GL_ARRAY_BUFFER, vertexVBO_cube_1);
-    glVertexAttribPointer(position_attr_i,
-			  3,
-			  GL_FLOAT,
-			  GL_FALSE,
-			  0,
-			  (void*) (0*sizeof(GLfloat)));
-    glEnableVertexAttribArray(position_attr_i);
+      // Bind the vertex buffer
+      glBindBuffer(GL_ARRAY_BUFFER, lod_VBOs[lod]);
+      glVertexAttribPointer(position_attr_i,
+			    3,
+			    GL_FLOAT,
+			    GL_FALSE,
+			    0,
+			    (void*) (0*sizeof(GLfloat)));
+      glEnableVertexAttribArray(position_attr_i);
     
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, cube_1_vertices.size());
+      glDrawArrays(GL_TRIANGLES, 0, 3 * num_triangles);
+    }
 
     SDL_GL_SwapWindow(window);
+    cull_stats_report(&cull_stats, "teapot");
+
+    if (first_frame) {
+      startup_mark(&startup, "first frame");
+      startup_report(&startup);
+      first_frame = false;
+    }
+
+    lod_frames += 1;
+    if (lod_frames == 5 * 60) {
+      std::cout << "teapot LOD: " << lod_triangles / lod_frames
+		<< " triangles/frame of " << teapot_triangles
+		<< ", now LOD " << lod << ", error bound "
+		<< lod_max_error_px << " px" << std::endl;
+      lod_frames = 0;
+      lod_triangles = 0;
+      lod_max_error_px = 0.0f;
+    }
 
     //glDisableVertexAttribArray(position_attr_i);
 
@@ -163,6 +387,15 @@ int main(int argc, char* argv[]) {
 
 
   // Clean up
+  cull_set_destroy(&cull_set);
+  startup_destroy(&startup);
+  glDeleteBuffers(teapot_asset.num_VBOs, teapot_asset.VBOs);
+  glDeleteBuffers(cube_asset.num_VBOs, cube_asset.VBOs);
+  mesh_lod_free(&teapot_lods);
+  resource_release_program(&resources, program);
+  resource_release_mesh(&resources, cube_1_mesh);
+  resource_release_mesh(&resources, cube_2_mesh);
+  resource_manager_destroy(&resources);
   SDL_GL_DeleteContext(glcontext);
   SDL_DestroyWindow(window);
   SDL_Quit();
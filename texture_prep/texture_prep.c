@@ -0,0 +1,485 @@
+/* SIMD format conversion and gamma-correct mip baking, cached as KTX. */
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <SDL2/SDL_image.h>
+
+#include "texture_prep.h"
+#include "job_system.h"
+#include "simd.h"
+
+#define PREP_GRAIN_ROWS 16
+#define KAISER_TAPS 8
+#define KAISER_BETA 4.0
+#define LINEAR_TO_SRGB_SIZE 4096
+#define CACHE_KEY "texture_prep"
+
+typedef struct {
+  float srgb_to_linear[256];
+  unsigned char linear_to_srgb[LINEAR_TO_SRGB_SIZE];
+  float kaiser[KAISER_TAPS];
+} PrepTables;
+
+static double ms_since(Uint64 start) {
+  return (double) (SDL_GetPerformanceCounter() - start) * 1000.0
+    / (double) SDL_GetPerformanceFrequency();
+}
+
+const char *mip_filter_name(MipFilter filter) {
+  return filter == MIP_FILTER_KAISER ? "kaiser" : "box";
+}
+
+MipFilter mip_filter_parse_args(int argc, char *argv[]) {
+  MipFilter filter = MIP_FILTER_BOX;
+  for (int i = 1; i < argc - 1; i++) {
+    if (strcmp(argv[i], "--mip-filter") != 0) {
+      continue;
+    }
+    if (strcmp(argv[i + 1], "kaiser") == 0) {
+      filter = MIP_FILTER_KAISER;
+    } else if (strcmp(argv[i + 1], "box") == 0) {
+      filter = MIP_FILTER_BOX;
+    } else {
+      printf("ERROR: unknown mip filter %s, using box\n", argv[i + 1]);
+    }
+  }
+  return filter;
+}
+
+/* Zeroth order modified Bessel function, for the Kaiser window */
+static double bessel_i0(double x) {
+  double sum = 1.0;
+  double term = 1.0;
+  for (int k = 1; k < 32; k++) {
+    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+static void build_tables(PrepTables *tables) {
+  for (int i = 0; i < 256; i++) {
+    double c = i / 255.0;
+    tables->srgb_to_linear[i] = (float) (c <= 0.04045 ? c / 12.92
+					 : pow((c + 0.055) / 1.055, 2.4));
+  }
+  for (int i = 0; i < LINEAR_TO_SRGB_SIZE; i++) {
+    double l = i / (double) (LINEAR_TO_SRGB_SIZE - 1);
+    double c = l <= 0.0031308 ? l * 12.92 : 1.055 * pow(l, 1.0 / 2.4) - 0.055;
+    tables->linear_to_srgb[i] = (unsigned char) (c * 255.0 + 0.5);
+  }
+
+  /* Halving: taps sit 0.5, 1.5 .. 3.5 source texels either side of the
+     output texel's centre, and the sinc cuts off at half the source rate */
+  double sum = 0.0;
+  double weights[KAISER_TAPS];
+  for (int k = 0; k < KAISER_TAPS; k++) {
+    double d = k - (KAISER_TAPS - 1) / 2.0;
+    double x = M_PI * d / 2.0;
+    double sinc = sin(x) / x;
+    double t = d / (KAISER_TAPS / 2.0);
+    double window = bessel_i0(KAISER_BETA * sqrt(1.0 - t * t)) / bessel_i0(KAISER_BETA);
+    weights[k] = sinc * window;
+    sum += weights[k];
+  }
+  for (int k = 0; k < KAISER_TAPS; k++) {
+    tables->kaiser[k] = (float) (weights[k] / sum);
+  }
+}
+
+/* ---- Convert ---- */
+
+/* Three byte RGB, as PNGs without alpha load, to opaque RGBA. Pixel i
+   of a 16 byte load starts at byte 3i and moves up i bytes to 4i. */
+static void expand_rgb_row(const unsigned char *row, uint32_t *out, int width) {
+  static const int32_t lane_masks[4][4] = {
+    { 0xFFFFFF, 0, 0, 0 }, { 0, 0xFFFFFF, 0, 0 },
+    { 0, 0, 0xFFFFFF, 0 }, { 0, 0, 0, 0xFFFFFF }
+  };
+  i32x4 masks[4];
+  for (int i = 0; i < 4; i++) {
+    masks[i] = i32x4_load(lane_masks[i]);
+  }
+  i32x4 opaque = i32x4_set1((int32_t) 0xFF000000u);
+
+  int x = 0;
+  /* Four pixels are 12 bytes, so stop while the load stays in the row */
+  for (; x + 6 <= width; x += 4) {
+    i32x4 pixels = i32x4_load((const int32_t *) (row + 3 * x));
+    i32x4 packed = i32x4_or(opaque, i32x4_and(pixels, masks[0]));
+    packed = i32x4_or(packed, i32x4_and(i32x4_shift_bytes(pixels, 1), masks[1]));
+    packed = i32x4_or(packed, i32x4_and(i32x4_shift_bytes(pixels, 2), masks[2]));
+    packed = i32x4_or(packed, i32x4_and(i32x4_shift_bytes(pixels, 3), masks[3]));
+    i32x4_store((int32_t *) (out + x), packed);
+  }
+  for (; x < width; x++) {
+    const unsigned char *pixel = row + 3 * x;
+    out[x] = 0xFF000000u | pixel[0] | (uint32_t) pixel[1] << 8 | (uint32_t) pixel[2] << 16;
+  }
+}
+
+/* Any surface to tightly packed RGBA8. The repacking assumes a little
+   endian CPU, as the pi and x86 are. */
+static unsigned char *convert_surface(SDL_Surface *surface, bool *has_alpha) {
+  Uint32 colour_key;
+  *has_alpha = surface->format->Amask != 0 || SDL_GetColorKey(surface, &colour_key) == 0;
+
+  SDL_Surface *source = surface;
+  const SDL_PixelFormat *format = surface->format;
+  bool eight_bit = format->BytesPerPixel == 4 && format->Rloss == 0
+    && format->Gloss == 0 && format->Bloss == 0
+    && (format->Amask == 0 || format->Aloss == 0);
+  bool rgb = format->BytesPerPixel == 3 && format->Rmask == 0x0000FF
+    && format->Gmask == 0x00FF00 && format->Bmask == 0xFF0000;
+  if ((!eight_bit && !rgb) || (*has_alpha && format->Amask == 0)) {
+    /* Also turns a colour key into alpha */
+    source = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_RGBA32, 0);
+    if (source == NULL) {
+      printf("ERROR: could not convert the image: %s\n", SDL_GetError());
+      return NULL;
+    }
+    format = source->format;
+    rgb = false;
+  }
+
+  int width = source->w;
+  int height = source->h;
+  unsigned char *rgba = malloc((size_t) width * height * 4);
+
+  i32x4 masks[4] = {
+    i32x4_set1((int32_t) format->Rmask), i32x4_set1((int32_t) format->Gmask),
+    i32x4_set1((int32_t) format->Bmask), i32x4_set1((int32_t) format->Amask)
+  };
+  int shifts[4] = { format->Rshift, format->Gshift, format->Bshift, format->Ashift };
+  i32x4 opaque = i32x4_set1(format->Amask == 0 ? (int32_t) 0xFF000000u : 0);
+
+  if (SDL_MUSTLOCK(source)) {
+    SDL_LockSurface(source);
+  }
+  for (int y = 0; y < height; y++) {
+    const uint32_t *row = (const uint32_t *) ((const unsigned char *) source->pixels
+					      + (size_t) y * source->pitch);
+    uint32_t *out = (uint32_t *) (rgba + (size_t) y * width * 4);
+    if (rgb) {
+      expand_rgb_row((const unsigned char *) row, out, width);
+      continue;
+    }
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+      i32x4 pixels = i32x4_load((const int32_t *) (row + x));
+      i32x4 packed = opaque;
+      for (int c = 0; c < 4; c++) {
+	i32x4 channel = i32x4_srl(i32x4_and(pixels, masks[c]), shifts[c]);
+	packed = i32x4_or(packed, i32x4_sll(channel, 8 * c));
+      }
+      i32x4_store((int32_t *) (out + x), packed);
+    }
+    for (; x < width; x++) {
+      uint32_t pixel = row[x];
+      uint32_t packed = format->Amask == 0 ? 0xFF000000u : 0;
+      packed |= ((pixel & format->Rmask) >> format->Rshift)
+	| ((pixel & format->Gmask) >> format->Gshift) << 8
+	| ((pixel & format->Bmask) >> format->Bshift) << 16
+	| ((pixel & format->Amask) >> format->Ashift) << 24;
+      out[x] = packed;
+    }
+  }
+  if (SDL_MUSTLOCK(source)) {
+    SDL_UnlockSurface(source);
+  }
+
+  if (source != surface) {
+    SDL_FreeSurface(source);
+  }
+  return rgba;
+}
+
+/* ---- Mips ---- */
+
+typedef struct {
+  const PrepTables *tables;
+  const unsigned char *rgba;
+  const float *src;   /* 4 floats per texel */
+  int src_w;
+  int src_h;
+  float *dst;
+  int dst_w;
+  int dst_h;
+  float *tmp;         /* Kaiser: dst_w x src_h after the horizontal pass */
+  unsigned char *packed;
+  int row_bytes;
+  int bytes_per_pixel;
+} PrepJob;
+
+static void linearize_job(void *data, int begin, int end) {
+  PrepJob *job = (PrepJob *) data;
+  const float *lut = job->tables->srgb_to_linear;
+  for (int y = begin; y < end; y++) {
+    const unsigned char *in = job->rgba + (size_t) y * job->dst_w * 4;
+    float *out = job->dst + (size_t) y * job->dst_w * 4;
+    for (int x = 0; x < job->dst_w; x++, in += 4) {
+      f32x4_store(out + 4 * x, f32x4_set(lut[in[0]], lut[in[1]], lut[in[2]],
+					 in[3] * (1.0f / 255.0f)));
+    }
+  }
+}
+
+static inline int clamp_index(int i, int size) {
+  return i < 0 ? 0 : (i >= size ? size - 1 : i);
+}
+
+static void box_job(void *data, int begin, int end) {
+  PrepJob *job = (PrepJob *) data;
+  f32x4 quarter = f32x4_set1(0.25f);
+  for (int y = begin; y < end; y++) {
+    const float *row0 = job->src + (size_t) clamp_index(2 * y, job->src_h) * job->src_w * 4;
+    const float *row1 = job->src + (size_t) clamp_index(2 * y + 1, job->src_h) * job->src_w * 4;
+    float *out = job->dst + (size_t) y * job->dst_w * 4;
+    for (int x = 0; x < job->dst_w; x++) {
+      int x0 = 4 * clamp_index(2 * x, job->src_w);
+      int x1 = 4 * clamp_index(2 * x + 1, job->src_w);
+      f32x4 sum = f32x4_add(f32x4_add(f32x4_load(row0 + x0), f32x4_load(row0 + x1)),
+			    f32x4_add(f32x4_load(row1 + x0), f32x4_load(row1 + x1)));
+      f32x4_store(out + 4 * x, f32x4_mul(sum, quarter));
+    }
+  }
+}
+
+/* Over source rows: halve the width into tmp */
+static void kaiser_horizontal_job(void *data, int begin, int end) {
+  PrepJob *job = (PrepJob *) data;
+  const float *weights = job->tables->kaiser;
+  for (int y = begin; y < end; y++) {
+    const float *in = job->src + (size_t) y * job->src_w * 4;
+    float *out = job->tmp + (size_t) y * job->dst_w * 4;
+    for (int x = 0; x < job->dst_w; x++) {
+      f32x4 sum = f32x4_zero();
+      for (int k = 0; k < KAISER_TAPS; k++) {
+	int sx = clamp_index(2 * x - KAISER_TAPS / 2 + 1 + k, job->src_w);
+	sum = f32x4_madd(f32x4_load(in + 4 * sx), f32x4_set1(weights[k]), sum);
+      }
+      f32x4_store(out + 4 * x, sum);
+    }
+  }
+}
+
+/* Over destination rows: halve the height of tmp into dst */
+static void kaiser_vertical_job(void *data, int begin, int end) {
+  PrepJob *job = (PrepJob *) data;
+  const float *weights = job->tables->kaiser;
+  for (int y = begin; y < end; y++) {
+    float *out = job->dst + (size_t) y * job->dst_w * 4;
+    const float *rows[KAISER_TAPS];
+    for (int k = 0; k < KAISER_TAPS; k++) {
+      int sy = clamp_index(2 * y - KAISER_TAPS / 2 + 1 + k, job->src_h);
+      rows[k] = job->tmp + (size_t) sy * job->dst_w * 4;
+    }
+    for (int x = 0; x < job->dst_w; x++) {
+      f32x4 sum = f32x4_zero();
+      for (int k = 0; k < KAISER_TAPS; k++) {
+	sum = f32x4_madd(f32x4_load(rows[k] + 4 * x), f32x4_set1(weights[k]), sum);
+      }
+      f32x4_store(out + 4 * x, sum);
+    }
+  }
+}
+
+/* ---- Pack ---- */
+
+static void pack_job(void *data, int begin, int end) {
+  PrepJob *job = (PrepJob *) data;
+  const unsigned char *lut = job->tables->linear_to_srgb;
+  f32x4 zero = f32x4_zero();
+  f32x4 one = f32x4_set1(1.0f);
+  f32x4 scale = f32x4_set((float) (LINEAR_TO_SRGB_SIZE - 1), (float) (LINEAR_TO_SRGB_SIZE - 1),
+			  (float) (LINEAR_TO_SRGB_SIZE - 1), 255.0f);
+  f32x4 half = f32x4_set1(0.5f);
+
+  for (int y = begin; y < end; y++) {
+    const float *in = job->dst + (size_t) y * job->dst_w * 4;
+    unsigned char *out = job->packed + (size_t) y * job->row_bytes;
+    for (int x = 0; x < job->dst_w; x++, out += job->bytes_per_pixel) {
+      /* Kaiser can ring past 0 and 1 */
+      f32x4 v = f32x4_min(f32x4_max(f32x4_load(in + 4 * x), zero), one);
+      int32_t index[4];
+      i32x4_store(index, f32x4_to_i32x4(f32x4_madd(v, scale, half)));
+      out[0] = lut[index[0]];
+      out[1] = lut[index[1]];
+      out[2] = lut[index[2]];
+      if (job->bytes_per_pixel == 4) {
+	out[3] = (unsigned char) index[3];
+      }
+    }
+  }
+}
+
+bool texture_prep_surface(SDL_Surface *surface, MipFilter filter,
+			  struct JobSystem *jobs, KtxTexture *out,
+			  TexturePrepStats *stats) {
+  memset(out, 0, sizeof(*out));
+
+  Uint64 start = SDL_GetPerformanceCounter();
+  bool has_alpha;
+  unsigned char *rgba = convert_surface(surface, &has_alpha);
+  if (rgba == NULL) {
+    return false;
+  }
+  stats->convert_ms = ms_since(start);
+
+  PrepTables tables;
+  build_tables(&tables);
+
+  int width = surface->w;
+  int height = surface->h;
+  GLenum format = has_alpha ? GL_RGBA : GL_RGB;
+
+  /* Every level down to 1x1, packed into one allocation */
+  out->internal_format = format;
+  out->type = GL_UNSIGNED_BYTE;
+  out->width = width;
+  out->height = height;
+  size_t total = 0;
+  for (int w = width, h = height; out->num_levels < KTX_MAX_LEVELS; ) {
+    KtxLevel *level = &out->levels[out->num_levels++];
+    level->width = w;
+    level->height = h;
+    level->size = ktx_level_size(format, w, h);
+    total += level->size;
+    if (w == 1 && h == 1) {
+      break;
+    }
+    w = w > 1 ? w / 2 : 1;
+    h = h > 1 ? h / 2 : 1;
+  }
+  out->file = malloc(total);
+  total = 0;
+  for (int i = 0; i < out->num_levels; i++) {
+    out->levels[i].data = out->file + total;
+    total += out->levels[i].size;
+  }
+
+  float *current = malloc((size_t) width * height * 4 * sizeof(float));
+  float *next = malloc((size_t) (width / 2 + 1) * (height / 2 + 1) * 4 * sizeof(float));
+  float *tmp = NULL;
+  if (filter == MIP_FILTER_KAISER) {
+    tmp = malloc((size_t) (width / 2 + 1) * height * 4 * sizeof(float));
+  }
+
+  PrepJob job = { &tables, rgba, NULL, 0, 0, current, width, height, tmp,
+		  NULL, 0, format == GL_RGBA ? 4 : 3 };
+  start = SDL_GetPerformanceCounter();
+  parallel_for(jobs, height, PREP_GRAIN_ROWS, linearize_job, &job);
+  stats->mip_ms = ms_since(start);
+  free(rgba);
+
+  stats->pack_ms = 0.0;
+  for (int i = 0; i < out->num_levels; i++) {
+    const KtxLevel *level = &out->levels[i];
+    if (i > 0) {
+      start = SDL_GetPerformanceCounter();
+      job.src = job.dst;
+      job.src_w = job.dst_w;
+      job.src_h = job.dst_h;
+      job.dst = job.src == current ? next : current;
+      job.dst_w = level->width;
+      job.dst_h = level->height;
+      if (filter == MIP_FILTER_KAISER) {
+	parallel_for(jobs, job.src_h, PREP_GRAIN_ROWS, kaiser_horizontal_job, &job);
+	parallel_for(jobs, job.dst_h, PREP_GRAIN_ROWS, kaiser_vertical_job, &job);
+      } else {
+	parallel_for(jobs, job.dst_h, PREP_GRAIN_ROWS, box_job, &job);
+      }
+      stats->mip_ms += ms_since(start);
+    }
+
+    start = SDL_GetPerformanceCounter();
+    job.packed = (unsigned char *) level->data;
+    job.row_bytes = (int) (level->size / level->height);
+    parallel_for(jobs, level->height, PREP_GRAIN_ROWS, pack_job, &job);
+    stats->pack_ms += ms_since(start);
+  }
+
+  free(current);
+  free(next);
+  free(tmp);
+  return true;
+}
+
+/* ---- Cache ---- */
+
+bool texture_prep_load(const char *path, const char *cache_path, MipFilter filter,
+		       struct JobSystem *jobs, KtxTexture *out,
+		       TexturePrepStats *stats) {
+  memset(stats, 0, sizeof(*stats));
+
+  struct stat source;
+  if (stat(path, &source) != 0) {
+    printf("ERROR: could not find %s\n", path);
+    return false;
+  }
+  char key[512];
+  snprintf(key, sizeof(key), "%s %lld bytes, modified %lld, %s filter", path,
+	   (long long) source.st_size, (long long) source.st_mtime,
+	   mip_filter_name(filter));
+
+  Uint64 start = SDL_GetPerformanceCounter();
+  struct stat cache;
+  if (cache_path != NULL && stat(cache_path, &cache) == 0 && ktx_load(out, cache_path)) {
+    const char *value = ktx_value(out, CACHE_KEY);
+    if (value != NULL && strcmp(value, key) == 0 && out->type != 0) {
+      stats->cache_hit = true;
+      stats->load_ms = ms_since(start);
+      return true;
+    }
+    stats->cache_stale = true;
+    ktx_free(out);
+  }
+
+  start = SDL_GetPerformanceCounter();
+  SDL_Surface *surface = IMG_Load(path);
+  if (surface == NULL) {
+    printf("ERROR: could not load %s: %s\n", path, IMG_GetError());
+    return false;
+  }
+  stats->load_ms = ms_since(start);
+
+  JobSystem own_jobs;
+  if (jobs == NULL) {
+    job_system_init(&own_jobs, 0);
+  }
+  bool ok = texture_prep_surface(surface, filter, jobs != NULL ? jobs : &own_jobs,
+				 out, stats);
+  if (jobs == NULL) {
+    job_system_destroy(&own_jobs);
+  }
+  SDL_FreeSurface(surface);
+  if (!ok || cache_path == NULL) {
+    return ok;
+  }
+
+  /* A cache that cannot be written only costs the next start */
+  start = SDL_GetPerformanceCounter();
+  out->key = CACHE_KEY;
+  out->value = key;
+  ktx_write(out, cache_path, false);
+  out->key = NULL;
+  out->value = NULL;
+  stats->write_ms = ms_since(start);
+  return true;
+}
+
+void texture_prep_report(const TexturePrepStats *stats, const char *path) {
+  if (stats->cache_hit) {
+    printf("%s: baked mips from the cache, read in %.2f ms\n", path, stats->load_ms);
+    return;
+  }
+  printf("%s: baked mips%s, decode %.2f ms, convert %.2f ms, mips %.2f ms, "
+	 "pack %.2f ms, cache write %.2f ms\n", path,
+	 stats->cache_stale ? " (cache was stale)" : "",
+	 stats->load_ms, stats->convert_ms, stats->mip_ms, stats->pack_ms,
+	 stats->write_ms);
+}
@@ -0,0 +1,73 @@
+#ifndef TEXTURE_PREP_H_
+#define TEXTURE_PREP_H_
+
+/* Baking an image into ready to upload mip levels, ahead of time.
+
+   Three stages, each timed:
+
+   convert  any SDL surface format and pitch to RGBA8, four pixels at a
+            time with i32x4 masks and shifts. 24 bit RGB, as PNGs
+            without alpha load, is widened the same way with byte
+            shifts. Anything else that is not 32 bit with 8 bit
+            channels (16 bit, paletted, BGR, colour keyed) goes through
+            SDL first.
+   mips     every level from the one above, in linear light: sRGB is
+            decoded, filtered one pixel per f32x4 and re-encoded, so
+            dark and bright texels average as they should. Rows are
+            split across the job system. Box is a 2x2 average; Kaiser
+            is a Kaiser windowed sinc over 8 taps each way, which keeps
+            the smaller levels sharper.
+   pack     back to 8 bit sRGB in the GL upload format, GL_RGB or
+            GL_RGBA if the image has alpha, with KTX's row padding.
+
+   The result is an uncompressed KtxTexture, so it is cached as a KTX
+   file next to the image and uploaded with ktx_upload: one plain
+   glTexImage2D per level and no glGenerateMipmap.
+*/
+
+#include <stdbool.h>
+
+#include <SDL2/SDL.h>
+
+#include "ktx.h"
+
+struct JobSystem;
+
+typedef enum {
+  MIP_FILTER_BOX,
+  MIP_FILTER_KAISER
+} MipFilter;
+
+typedef struct {
+  bool cache_hit;
+  bool cache_stale;    /* there was a cache, but for another image or filter */
+  double load_ms;      /* decoding the image, or reading the cache */
+  double convert_ms;
+  double mip_ms;
+  double pack_ms;
+  double write_ms;     /* writing the cache */
+} TexturePrepStats;
+
+const char *mip_filter_name(MipFilter filter);
+
+/* --mip-filter box|kaiser, box by default. */
+MipFilter mip_filter_parse_args(int argc, char *argv[]);
+
+/* The whole chain for surface. out is freed with ktx_free. jobs may be
+   NULL to do it all on this thread. */
+bool texture_prep_surface(SDL_Surface *surface, MipFilter filter,
+			  struct JobSystem *jobs, KtxTexture *out,
+			  TexturePrepStats *stats);
+
+/* Reads cache_path if it was baked from this image (same size and
+   modification time) with this filter, otherwise bakes the image and
+   writes cache_path; a NULL cache_path always bakes. No GL calls, so
+   any thread can do it. With jobs NULL a job system is started just
+   for the bake. */
+bool texture_prep_load(const char *path, const char *cache_path, MipFilter filter,
+		       struct JobSystem *jobs, KtxTexture *out,
+		       TexturePrepStats *stats);
+
+void texture_prep_report(const TexturePrepStats *stats, const char *path);
+
+#endif // TEXTURE_PREP_H_
@@ -0,0 +1,404 @@
+/* Budgeted, LRU mip streaming of KTX textures from a reader thread. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "texture_stream.h"
+#include "gl_caps.h"
+
+static double ms_since(Uint64 start) {
+  return (double) (SDL_GetPerformanceCounter() - start) * 1000.0
+    / (double) SDL_GetPerformanceFrequency();
+}
+
+/* ---- Reader thread ---- */
+
+static int reader_main(void *data) {
+  TextureStream *stream = (TextureStream *) data;
+
+  SDL_LockMutex(stream->lock);
+  while (!stream->quit) {
+    StreamRequest *next = NULL;
+    for (int i = 0; i < TEXTURE_STREAM_QUEUE; i++) {
+      StreamRequest *request = &stream->requests[i];
+      if (request->state == STREAM_REQUEST_QUEUED
+	  && (next == NULL || request->sequence - next->sequence > 0x80000000u)) {
+	next = request;
+      }
+    }
+    if (next == NULL) {
+      SDL_CondWait(stream->wake, stream->lock);
+      continue;
+    }
+    next->state = STREAM_REQUEST_READING;
+
+    /* The path and level offsets never change once added */
+    const StreamTexture *texture = &stream->textures[next->texture];
+    int level = next->level;
+    SDL_UnlockMutex(stream->lock);
+
+    unsigned char *bytes = malloc(texture->info.levels[level].size);
+    if (!ktx_read_level(&texture->info, texture->path, level, bytes)) {
+      free(bytes);
+      bytes = NULL;
+    }
+
+    SDL_LockMutex(stream->lock);
+    next->data = bytes;
+    next->state = STREAM_REQUEST_DONE;
+  }
+  SDL_UnlockMutex(stream->lock);
+  return 0;
+}
+
+void texture_stream_init(TextureStream *stream, size_t budget, bool allow_compressed) {
+  memset(stream, 0, sizeof(*stream));
+  stream->budget = budget;
+  stream->base_level = gl_caps.es3;
+  stream->allow_compressed = allow_compressed;
+  stream->frame = 1;
+
+  stream->lock = SDL_CreateMutex();
+  stream->wake = SDL_CreateCond();
+  stream->thread = SDL_CreateThread(reader_main, "texture stream", stream);
+}
+
+void texture_stream_destroy(TextureStream *stream) {
+  SDL_LockMutex(stream->lock);
+  stream->quit = true;
+  SDL_CondSignal(stream->wake);
+  SDL_UnlockMutex(stream->lock);
+  SDL_WaitThread(stream->thread, NULL);
+
+  for (int i = 0; i < TEXTURE_STREAM_QUEUE; i++) {
+    free(stream->requests[i].data);
+  }
+  for (int i = 0; i < stream->num_textures; i++) {
+    StreamTexture *texture = &stream->textures[i];
+    glDeleteTextures(1, &texture->id);
+    for (int level = 0; level < KTX_MAX_LEVELS; level++) {
+      free(texture->levels[level]);
+    }
+    ktx_free(&texture->info);
+    free(texture->path);
+  }
+  SDL_DestroyCond(stream->wake);
+  SDL_DestroyMutex(stream->lock);
+  memset(stream, 0, sizeof(*stream));
+}
+
+/* ---- GL side ---- */
+
+/* What a level will take once uploaded, as ktx_upload_level decides */
+static size_t level_gpu_bytes(const TextureStream *stream, const StreamTexture *texture,
+			      int level) {
+  const KtxLevel *info = &texture->info.levels[level];
+  size_t texels = (size_t) info->width * info->height;
+  if (texture->info.type != 0) {
+    return texels * (texture->info.internal_format == GL_RGBA ? 4 : 3);
+  }
+  bool direct = stream->allow_compressed
+    && ((texture->info.internal_format == GL_ETC1_RGB8_OES && gl_caps.etc1) || gl_caps.etc2);
+  return direct ? info->size : texels * 3;
+}
+
+static void set_sampling(int width, int height, int levels) {
+  int full_chain = 1;
+  while ((width >> (full_chain - 1)) > 1 || (height >> (full_chain - 1)) > 1) {
+    full_chain += 1;
+  }
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+		  levels >= full_chain ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+}
+
+/* ES2: a new GL texture whose level 0 is the finest resident level */
+static void reallocate(TextureStream *stream, StreamTexture *texture) {
+  glDeleteTextures(1, &texture->id);
+  glGenTextures(1, &texture->id);
+  glBindTexture(GL_TEXTURE_2D, texture->id);
+  int first = texture->resident_level;
+  for (int level = first; level < texture->info.num_levels; level++) {
+    stream->resident_bytes -= texture->level_bytes[level];
+    texture->level_bytes[level] = ktx_upload_level(&texture->info, level, level - first,
+						   texture->levels[level],
+						   stream->allow_compressed);
+    stream->resident_bytes += texture->level_bytes[level];
+  }
+  set_sampling(texture->info.levels[first].width, texture->info.levels[first].height,
+	       texture->info.num_levels - first);
+}
+
+/* level is the one after the finest resident level; takes data */
+static void upload_level(TextureStream *stream, StreamTexture *texture, int level,
+			 unsigned char *data) {
+  texture->resident_level = level;
+  if (!stream->base_level) {
+    texture->levels[level] = data;
+    reallocate(stream, texture);
+    return;
+  }
+  glBindTexture(GL_TEXTURE_2D, texture->id);
+  texture->level_bytes[level] = ktx_upload_level(&texture->info, level, level, data,
+						 stream->allow_compressed);
+  stream->resident_bytes += texture->level_bytes[level];
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+  free(data);
+}
+
+/* Drops the finest resident level */
+static void evict_level(TextureStream *stream, StreamTexture *texture) {
+  int level = texture->resident_level;
+  texture->resident_level = level + 1;
+  stream->evictions += 1;
+  if (!stream->base_level) {
+    free(texture->levels[level]);
+    texture->levels[level] = NULL;
+    stream->resident_bytes -= texture->level_bytes[level];
+    texture->level_bytes[level] = 0;
+    reallocate(stream, texture);
+    return;
+  }
+  glBindTexture(GL_TEXTURE_2D, texture->id);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level + 1);
+  /* An empty image gives the memory back; below the base level it is
+     never sampled */
+  glTexImage2D(GL_TEXTURE_2D, level, GL_RGB, 0, 0, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+  stream->resident_bytes -= texture->level_bytes[level];
+  texture->level_bytes[level] = 0;
+}
+
+/* Evicts until bytes more fit alongside what is resident and on its way */
+static bool make_room(TextureStream *stream, size_t bytes, size_t pending, int requester) {
+  while (stream->resident_bytes + pending + bytes > stream->budget) {
+    StreamTexture *victim = NULL;
+    for (int i = 0; i < stream->num_textures; i++) {
+      StreamTexture *texture = &stream->textures[i];
+      /* One being streamed into has to keep its finest level, or the
+	 level on its way would leave a gap */
+      if (i == requester || texture->loading
+	  || texture->resident_level >= texture->tail_level) {
+	continue;
+      }
+      bool idle = texture->last_used != stream->frame;
+      if (!idle && texture->resident_level >= texture->wanted_level) {
+	continue;
+      }
+      /* Idle before in use, then least recently used, then finest */
+      if (victim == NULL) {
+	victim = texture;
+      } else {
+	bool victim_idle = victim->last_used != stream->frame;
+	if ((idle && !victim_idle)
+	    || (idle == victim_idle && texture->last_used < victim->last_used)
+	    || (idle == victim_idle && texture->last_used == victim->last_used
+		&& texture->resident_level < victim->resident_level)) {
+	  victim = texture;
+	}
+      }
+    }
+    if (victim == NULL) {
+      return false;
+    }
+    evict_level(stream, victim);
+  }
+  return true;
+}
+
+int texture_stream_add(TextureStream *stream, const char *path) {
+  if (stream->num_textures == TEXTURE_STREAM_MAX) {
+    printf("ERROR: can only stream %d textures\n", TEXTURE_STREAM_MAX);
+    return -1;
+  }
+  StreamTexture *texture = &stream->textures[stream->num_textures];
+  memset(texture, 0, sizeof(*texture));
+  if (!ktx_open(&texture->info, path)) {
+    return -1;
+  }
+  size_t length = strlen(path) + 1;
+  texture->path = malloc(length);
+  memcpy(texture->path, path, length);
+
+  int num_levels = texture->info.num_levels;
+  texture->tail_level = num_levels - 1;
+  for (int level = 0; level < num_levels; level++) {
+    const KtxLevel *info = &texture->info.levels[level];
+    if (info->width <= TEXTURE_STREAM_TAIL && info->height <= TEXTURE_STREAM_TAIL) {
+      texture->tail_level = level;
+      break;
+    }
+  }
+  texture->resident_level = num_levels;
+  texture->wanted_level = texture->tail_level;
+
+  glGenTextures(1, &texture->id);
+  if (stream->base_level) {
+    glBindTexture(GL_TEXTURE_2D, texture->id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, num_levels - 1);
+    set_sampling(texture->info.width, texture->info.height, num_levels);
+  }
+
+  /* The tail is read here and now, coarsest first */
+  for (int level = num_levels - 1; level >= texture->tail_level; level--) {
+    unsigned char *data = malloc(texture->info.levels[level].size);
+    if (!ktx_read_level(&texture->info, path, level, data)) {
+      free(data);
+      break;
+    }
+    upload_level(stream, texture, level, data);
+  }
+  if (texture->resident_level != texture->tail_level) {
+    glDeleteTextures(1, &texture->id);
+    for (int level = 0; level < KTX_MAX_LEVELS; level++) {
+      free(texture->levels[level]);
+      stream->resident_bytes -= texture->level_bytes[level];
+    }
+    ktx_free(&texture->info);
+    free(texture->path);
+    memset(texture, 0, sizeof(*texture));
+    return -1;
+  }
+  return stream->num_textures++;
+}
+
+void texture_stream_use(TextureStream *stream, int texture_index, float screen_pixels) {
+  StreamTexture *texture = &stream->textures[texture_index];
+  if (texture->last_used != stream->frame) {
+    texture->last_used = stream->frame;
+    texture->wanted_level = texture->tail_level;
+  }
+  /* The smallest level still at least as big as it is on screen */
+  int size = texture->info.width > texture->info.height
+    ? texture->info.width : texture->info.height;
+  int level = 0;
+  while (level < texture->tail_level && (float) (size >> (level + 1)) >= screen_pixels) {
+    level += 1;
+  }
+  if (level < texture->wanted_level) {
+    texture->wanted_level = level;
+  }
+}
+
+void texture_stream_update(TextureStream *stream) {
+
+  /* Take whatever the reader has finished */
+  StreamRequest done[TEXTURE_STREAM_QUEUE];
+  int num_done = 0;
+  size_t pending = 0;
+  SDL_LockMutex(stream->lock);
+  for (int i = 0; i < TEXTURE_STREAM_QUEUE; i++) {
+    StreamRequest *request = &stream->requests[i];
+    if (request->state == STREAM_REQUEST_DONE) {
+      done[num_done++] = *request;
+      memset(request, 0, sizeof(*request));
+    } else if (request->state != STREAM_REQUEST_FREE) {
+      pending += level_gpu_bytes(stream, &stream->textures[request->texture], request->level);
+    }
+  }
+  SDL_UnlockMutex(stream->lock);
+
+  /* Room was made for these when they were queued */
+  for (int i = 0; i < num_done; i++) {
+    StreamTexture *texture = &stream->textures[done[i].texture];
+    texture->loading = false;
+    if (done[i].data == NULL) {
+      continue;
+    }
+    if (done[i].level != texture->resident_level - 1) {
+      free(done[i].data);
+      continue;
+    }
+    upload_level(stream, texture, done[i].level, done[i].data);
+    double latency = ms_since(done[i].queued);
+    stream->stream_ins += 1;
+    stream->bytes_streamed += texture->info.levels[done[i].level].size;
+    stream->latency_ms += latency;
+    if (latency > stream->max_latency_ms) {
+      stream->max_latency_ms = latency;
+    }
+  }
+
+  /* Queue the next level for whatever is furthest from what it wants */
+  bool queued = false;
+  bool skipped[TEXTURE_STREAM_MAX] = { false };
+  for (;;) {
+    int best = -1;
+    int best_gap = 0;
+    for (int i = 0; i < stream->num_textures; i++) {
+      const StreamTexture *texture = &stream->textures[i];
+      int gap = texture->resident_level - texture->wanted_level;
+      if (texture->last_used == stream->frame && !texture->loading && !skipped[i]
+	  && gap > best_gap) {
+	best = i;
+	best_gap = gap;
+      }
+    }
+    if (best < 0) {
+      break;
+    }
+
+    StreamRequest *slot = NULL;
+    for (int i = 0; i < TEXTURE_STREAM_QUEUE && slot == NULL; i++) {
+      if (stream->requests[i].state == STREAM_REQUEST_FREE) {
+	slot = &stream->requests[i];
+      }
+    }
+    if (slot == NULL) {
+      break;
+    }
+
+    StreamTexture *texture = &stream->textures[best];
+    int level = texture->resident_level - 1;
+    size_t bytes = level_gpu_bytes(stream, texture, level);
+    if (!make_room(stream, bytes, pending, best)) {
+      stream->budget_waits += 1;
+      skipped[best] = true;
+      continue;
+    }
+    pending += bytes;
+    texture->loading = true;
+
+    SDL_LockMutex(stream->lock);
+    slot->texture = best;
+    slot->level = level;
+    slot->sequence = stream->next_sequence++;
+    slot->data = NULL;
+    slot->queued = SDL_GetPerformanceCounter();
+    slot->state = STREAM_REQUEST_QUEUED;
+    SDL_UnlockMutex(stream->lock);
+    queued = true;
+  }
+  if (queued) {
+    SDL_LockMutex(stream->lock);
+    SDL_CondSignal(stream->wake);
+    SDL_UnlockMutex(stream->lock);
+  }
+
+  stream->frame += 1;
+}
+
+GLuint texture_stream_id(const TextureStream *stream, int texture) {
+  return stream->textures[texture].id;
+}
+
+void texture_stream_report(const TextureStream *stream) {
+  printf("Texture streaming (%s): %d textures, %.1f of %.1f KB resident, "
+	 "%d stream-ins (%.1f KB), latency %.2f ms average, %.2f ms worst, "
+	 "%d evictions, %d waits for room\n",
+	 stream->base_level ? "base level" : "reallocating", stream->num_textures,
+	 stream->resident_bytes / 1024.0, stream->budget / 1024.0, stream->stream_ins,
+	 stream->bytes_streamed / 1024.0,
+	 stream->stream_ins > 0 ? stream->latency_ms / stream->stream_ins : 0.0,
+	 stream->max_latency_ms, stream->evictions, stream->budget_waits);
+  for (int i = 0; i < stream->num_textures; i++) {
+    const StreamTexture *texture = &stream->textures[i];
+    size_t bytes = 0;
+    for (int level = 0; level < texture->info.num_levels; level++) {
+      bytes += texture->level_bytes[level];
+    }
+    const KtxLevel *finest = &texture->info.levels[texture->resident_level];
+    printf("\t%s: level %d (%d by %d), wants %d, %.1f KB\n", texture->path,
+	   texture->resident_level, finest->width, finest->height,
+	   texture->wanted_level, bytes / 1024.0);
+  }
+}
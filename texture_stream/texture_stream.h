@@ -0,0 +1,120 @@
+#ifndef TEXTURE_STREAM_H_
+#define TEXTURE_STREAM_H_
+
+/* Mip streaming of KTX textures under a GPU memory budget.
+
+   Adding a texture only reads its header and its small tail (levels of
+   TEXTURE_STREAM_TAIL texels and under), which stays resident. Each
+   frame the program says which textures it drew and how many pixels
+   across they came out on screen; that picks the finest level worth
+   having. texture_stream_update then queues reads of the next finer
+   level for textures that want one, and a reader thread pulls just
+   that level out of the file. Levels come in one at a time, coarse to
+   fine, so a texture sharpens as it gets closer.
+
+   When the next level would go over the budget, levels are evicted
+   finest first from the least recently drawn textures, and from ones
+   drawn this frame only if they hold more than they now want. If that
+   is not enough the stream-in waits.
+
+   On ES3 all of a texture's levels live in one GL texture and
+   GL_TEXTURE_BASE_LEVEL moves to the finest resident one; evicted
+   levels are redefined as 0x0 to give the memory back. ES2 has no base
+   level, so the GL level 0 has to be the finest resident level: the
+   texture is reallocated whenever that changes, from CPU copies of the
+   resident levels. So on ES2 texture_stream_id can change from frame
+   to frame.
+
+   Reading happens on the thread; everything else, GL included, is for
+   the thread with the context.
+*/
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <SDL2/SDL.h>
+#include <GLES2/gl2.h>
+
+#include "ktx.h"
+
+#define TEXTURE_STREAM_MAX 64
+#define TEXTURE_STREAM_TAIL 32    /* always resident at or under this size */
+#define TEXTURE_STREAM_QUEUE 8    /* reads queued or in flight */
+
+typedef struct {
+  char *path;
+  KtxTexture info;          /* header and level offsets only */
+  GLuint id;
+  int tail_level;
+  int resident_level;       /* finest level on the GPU */
+  int wanted_level;         /* finest level worth having when last drawn */
+  bool loading;             /* resident_level - 1 is queued or being read */
+  unsigned int last_used;   /* frame */
+  size_t level_bytes[KTX_MAX_LEVELS];   /* on the GPU, 0 if not resident */
+  unsigned char *levels[KTX_MAX_LEVELS];  /* ES2: CPU copies to reallocate from */
+} StreamTexture;
+
+typedef enum {
+  STREAM_REQUEST_FREE,
+  STREAM_REQUEST_QUEUED,
+  STREAM_REQUEST_READING,
+  STREAM_REQUEST_DONE
+} StreamRequestState;
+
+typedef struct {
+  StreamRequestState state;
+  int texture;
+  int level;
+  unsigned int sequence;    /* queue order */
+  unsigned char *data;      /* NULL if the read failed */
+  Uint64 queued;
+} StreamRequest;
+
+typedef struct {
+  size_t budget;            /* bytes */
+  bool base_level;          /* ES3: GL_TEXTURE_BASE_LEVEL, ES2: reallocate */
+  bool allow_compressed;
+
+  int num_textures;
+  StreamTexture textures[TEXTURE_STREAM_MAX];
+  size_t resident_bytes;
+  unsigned int frame;
+
+  /* Shared with the reader thread */
+  SDL_Thread *thread;
+  SDL_mutex *lock;
+  SDL_cond *wake;
+  bool quit;
+  unsigned int next_sequence;
+  StreamRequest requests[TEXTURE_STREAM_QUEUE];
+
+  /* Since init */
+  int stream_ins;
+  int evictions;
+  int budget_waits;         /* frames a wanted level waited for room */
+  size_t bytes_streamed;
+  double latency_ms;        /* from queueing to upload, summed */
+  double max_latency_ms;
+} TextureStream;
+
+/* budget is in bytes. Needs load_gl_caps() first. */
+void texture_stream_init(TextureStream *stream, size_t budget, bool allow_compressed);
+void texture_stream_destroy(TextureStream *stream);
+
+/* Opens path and uploads its tail. Returns the texture's index, or -1. */
+int texture_stream_add(TextureStream *stream, const char *path);
+
+/* The texture was drawn this frame, screen_pixels across. */
+void texture_stream_use(TextureStream *stream, int texture, float screen_pixels);
+
+/* Once a frame, after the uses: uploads what has been read, evicts
+   and queues reads. */
+void texture_stream_update(TextureStream *stream);
+
+/* The GL texture to bind this frame. */
+GLuint texture_stream_id(const TextureStream *stream, int texture);
+
+/* Resident bytes, per texture levels, evictions and stream-in latency. */
+void texture_stream_report(const TextureStream *stream);
+
+#endif // TEXTURE_STREAM_H_
@@ -0,0 +1,169 @@
+// Offline texture compressor: turns a PNG (or anything SDL_image reads)
+// into an ETC1 or ETC2 KTX file with a full mip chain, e.g.
+//
+//   ./texture_tool ../image/texture.png ../image/texture.ktx
+//   ./texture_tool --etc2 --ktx2 ../image/texture.png ../image/texture.ktx2
+//
+// ETC cannot be mipmapped by the driver, so the levels are made here
+// by texture_prep (gamma correct, --mip-filter box|kaiser) and each is
+// compressed on its own. --uncompressed writes texture_prep's RGB8 or
+// RGBA8 chain as it is, KTX1 only.
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+
+#include "etc.h"
+#include "job_system.h"
+#include "ktx.h"
+#include "texture_prep.h"
+
+/* A texture_prep level (rows padded, maybe RGBA) to tight RGB8 */
+static unsigned char *level_to_rgb(const KtxTexture *baked, const KtxLevel *level) {
+  int bytes_per_pixel = baked->internal_format == GL_RGBA ? 4 : 3;
+  size_t row = level->size / level->height;
+  unsigned char *rgb = malloc((size_t) level->width * level->height * 3);
+  for (int y = 0; y < level->height; y++) {
+    const unsigned char *in = level->data + y * row;
+    unsigned char *out = rgb + (size_t) y * level->width * 3;
+    for (int x = 0; x < level->width; x++) {
+      memcpy(out + 3 * x, in + bytes_per_pixel * x, 3);
+    }
+  }
+  return rgb;
+}
+
+static void usage(void) {
+  printf("usage: texture_tool [--etc2] [--ktx2] [--uncompressed] [--no-mips] "
+	 "[--mip-filter box|kaiser] input output\n");
+}
+
+int main(int argc, char *argv[]) {
+
+  GLenum format = GL_ETC1_RGB8_OES;
+  bool ktx2 = false;
+  bool mips = true;
+  bool uncompressed = false;
+  MipFilter filter = mip_filter_parse_args(argc, argv);
+  const char *input = NULL;
+  const char *output = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--etc2") == 0) {
+      format = GL_COMPRESSED_RGB8_ETC2;
+    } else if (strcmp(argv[i], "--ktx2") == 0) {
+      ktx2 = true;
+    } else if (strcmp(argv[i], "--uncompressed") == 0) {
+      uncompressed = true;
+    } else if (strcmp(argv[i], "--no-mips") == 0) {
+      mips = false;
+    } else if (strcmp(argv[i], "--mip-filter") == 0) {
+      i++;
+    } else if (input == NULL) {
+      input = argv[i];
+    } else if (output == NULL) {
+      output = argv[i];
+    } else {
+      usage();
+      return EXIT_FAILURE;
+    }
+  }
+  if (input == NULL || output == NULL) {
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  if (uncompressed && ktx2) {
+    printf("ERROR: --uncompressed only writes KTX1\n");
+    return EXIT_FAILURE;
+  }
+
+  IMG_Init(IMG_INIT_PNG | IMG_INIT_JPG);
+  SDL_Surface *surface = IMG_Load(input);
+  if (surface == NULL) {
+    printf("ERROR: could not load %s: %s\n", input, IMG_GetError());
+    return EXIT_FAILURE;
+  }
+
+  JobSystem jobs;
+  job_system_init(&jobs, 0);
+  KtxTexture baked;
+  TexturePrepStats stats;
+  memset(&stats, 0, sizeof(stats));
+  bool prepared = texture_prep_surface(surface, filter, &jobs, &baked, &stats);
+  job_system_destroy(&jobs);
+  SDL_FreeSurface(surface);
+  IMG_Quit();
+  if (!prepared) {
+    return EXIT_FAILURE;
+  }
+  if (!mips) {
+    baked.num_levels = 1;
+  }
+  printf("%s: %d by %d, %s mips in %.2f ms (convert %.2f ms, pack %.2f ms)\n",
+	 input, baked.width, baked.height, mip_filter_name(filter), stats.mip_ms,
+	 stats.convert_ms, stats.pack_ms);
+
+  if (uncompressed) {
+    bool ok = ktx_write(&baked, output, false);
+    if (ok) {
+      printf("Wrote %s, %s, %d levels\n", output, ktx_format_name(baked.internal_format),
+	     baked.num_levels);
+    }
+    ktx_free(&baked);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  KtxTexture texture;
+  memset(&texture, 0, sizeof(texture));
+  texture.internal_format = format;
+  texture.width = baked.width;
+  texture.height = baked.height;
+
+  printf("%s: %d by %d, %s%s\n", input, texture.width, texture.height,
+	 ktx_format_name(format), ktx2 ? " in KTX2" : "");
+
+  size_t rgb_bytes = 0;
+  size_t etc_bytes = 0;
+  for (int level = 0; level < baked.num_levels; level++) {
+    int level_width = baked.levels[level].width;
+    int level_height = baked.levels[level].height;
+    unsigned char *level_rgb = level_to_rgb(&baked, &baked.levels[level]);
+    size_t size = etc_image_size(level_width, level_height);
+    unsigned char *blocks = malloc(size);
+    double error = etc_encode_image(level_rgb, level_width, level_height, blocks);
+    double mse = error / ((double) level_width * level_height * 3);
+    double psnr = mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / mse) : INFINITY;
+    free(level_rgb);
+
+    texture.levels[level].width = level_width;
+    texture.levels[level].height = level_height;
+    texture.levels[level].size = size;
+    texture.levels[level].data = blocks;
+    texture.num_levels = level + 1;
+
+    rgb_bytes += (size_t) level_width * level_height * 3;
+    etc_bytes += size;
+    printf("\tlevel %2d: %4d by %4d, %7zu bytes, PSNR %.2f dB\n",
+	   level, level_width, level_height, size, psnr);
+  }
+  ktx_free(&baked);
+
+  printf("\t%.1f KB as GL_RGB, %.1f KB compressed (%.0f%% smaller)\n",
+	 rgb_bytes / 1024.0, etc_bytes / 1024.0,
+	 100.0 * (1.0 - (double) etc_bytes / (double) rgb_bytes));
+
+  bool ok = ktx_write(&texture, output, ktx2);
+  for (int level = 0; level < texture.num_levels; level++) {
+    free((void *) texture.levels[level].data);
+  }
+  if (!ok) {
+    return EXIT_FAILURE;
+  }
+  printf("Wrote %s\n", output);
+  return EXIT_SUCCESS;
+}